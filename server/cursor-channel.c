@@ -278,10 +278,16 @@ void cursor_channel_process_cmd(CursorChannel *cursor, RedCursorCmd *cursor_cmd)
         (cursor->mouse_mode == SPICE_MOUSE_MODE_SERVER
          || cursor_cmd->type != QXL_CURSOR_MOVE
          || cursor_show)) {
-        red_channel_pipes_add(RED_CHANNEL(cursor), &cursor_pipe_item->base);
-    } else {
-        red_pipe_item_unref(&cursor_pipe_item->base);
+        RedChannelClient *rcc;
+
+        FOREACH_CLIENT(cursor, rcc) {
+            if (!red_channel_client_is_parked(rcc)) {
+                red_pipe_item_ref(&cursor_pipe_item->base);
+                red_channel_client_pipe_add(rcc, &cursor_pipe_item->base);
+            }
+        }
     }
+    red_pipe_item_unref(&cursor_pipe_item->base);
 }
 
 void cursor_channel_reset(CursorChannel *cursor)
@@ -333,6 +339,17 @@ void cursor_channel_set_mouse_mode(CursorChannel *cursor, uint32_t mode)
     cursor->mouse_mode = mode;
 }
 
+void cursor_channel_park_client(CursorChannel *cursor, RedChannelClient *rcc)
+{
+    red_channel_client_set_parked(rcc, TRUE);
+}
+
+void cursor_channel_resume_client(CursorChannel *cursor, RedChannelClient *rcc)
+{
+    red_channel_client_set_parked(rcc, FALSE);
+    cursor_channel_init_client(cursor, CURSOR_CHANNEL_CLIENT(rcc));
+}
+
 /**
  * Connect a new client to CursorChannel.
  */
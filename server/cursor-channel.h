@@ -59,6 +59,10 @@ void                 cursor_channel_reset       (CursorChannel *cursor);
 void                 cursor_channel_do_init     (CursorChannel *cursor);
 void                 cursor_channel_process_cmd (CursorChannel *cursor, RedCursorCmd *cursor_cmd);
 void                 cursor_channel_set_mouse_mode(CursorChannel *cursor, uint32_t mode);
+/* The cursor updates are not queued to a parked client, it gets the current
+ * cursor state when it resumes */
+void                 cursor_channel_park_client  (CursorChannel *cursor, RedChannelClient *rcc);
+void                 cursor_channel_resume_client(CursorChannel *cursor, RedChannelClient *rcc);
 
 G_END_DECLS
 
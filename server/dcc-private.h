@@ -49,6 +49,8 @@ struct DisplayChannelClientPrivate
         FreeList free_list;
         uint64_t pixmap_cache_items[MAX_DRAWABLE_PIXMAP_CACHE_ITEMS];
         int num_pixmap_cache_items;
+        /* image compressed ahead of time for the item being sent */
+        ImageEncoderJob *encoder_job;
     } send_data;
 
     /* Host preferred video-codec order sorted with client preferred */
@@ -59,6 +61,10 @@ struct DisplayChannelClientPrivate
 
     uint8_t surface_client_created[NUM_SURFACES];
     QRegion surface_client_lossy_region[NUM_SURFACES];
+    /* drawing items alive drawing to each surface, and number of the ones
+     * using it as a source, see dcc_clear_surface_drawables_from_pipe() */
+    Ring surface_pipe_items[NUM_SURFACES];
+    uint32_t surface_pipe_deps[NUM_SURFACES];
 
     VideoStreamAgent stream_agents[NUM_STREAMS];
     uint32_t streams_max_latency;
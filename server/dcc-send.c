@@ -327,19 +327,37 @@ static void marshaller_compress_buf_free(uint8_t *data, void *opaque)
     compress_buf_free(opaque);
 }
 
-static void marshaller_add_compressed(SpiceMarshaller *m,
-                                      RedCompressBuf *comp_buf, size_t size)
+static void marshaller_unref_compress_cache_entry(uint8_t *data, void *opaque)
 {
-    size_t max = size;
+    image_compress_cache_entry_unref(opaque);
+}
+
+/* Add the compressed buffers of @comp_data, releasing them once sent */
+static void marshaller_add_compressed(SpiceMarshaller *m, compress_send_data_t *comp_data)
+{
+    RedCompressBuf *comp_buf = comp_data->comp_buf;
+    size_t max = comp_data->comp_buf_size;
     size_t now;
     do {
         spice_return_if_fail(comp_buf);
         now = MIN(sizeof(comp_buf->buf), max);
         max -= now;
-        spice_marshaller_add_by_ref_full(m, comp_buf->buf.bytes, now,
-                                         marshaller_compress_buf_free, comp_buf);
+        if (comp_data->cache_entry) {
+            /* the buffers are shared with the other clients */
+            spice_marshaller_add_by_ref_full(m, comp_buf->buf.bytes, now,
+                                             marshaller_unref_compress_cache_entry,
+                                             image_compress_cache_entry_ref(comp_data->cache_entry));
+        } else {
+            spice_marshaller_add_by_ref_full(m, comp_buf->buf.bytes, now,
+                                             marshaller_compress_buf_free, comp_buf);
+        }
         comp_buf = comp_buf->send_next;
     } while (max);
+
+    if (comp_data->cache_entry) {
+        image_compress_cache_entry_unref(comp_data->cache_entry);
+        comp_data->cache_entry = NULL;
+    }
 }
 
 static void marshaller_unref_drawable(uint8_t *data, void *opaque)
@@ -475,8 +493,7 @@ static FillBitsType fill_bits(DisplayChannelClient *dcc, SpiceMarshaller *m,
                                  &bitmap_palette_out, &lzplt_palette_out);
             spice_assert(bitmap_palette_out == NULL);
 
-            marshaller_add_compressed(m, comp_send_data.comp_buf,
-                                      comp_send_data.comp_buf_size);
+            marshaller_add_compressed(m, &comp_send_data);
 
             if (lzplt_palette_out && comp_send_data.lzplt_palette) {
                 spice_marshall_Palette(lzplt_palette_out, comp_send_data.lzplt_palette);
@@ -708,18 +725,22 @@ static void red_pipe_replace_rendered_drawables_with_images(DisplayChannelClient
                                                             int first_surface_id,
                                                             SpiceRect *first_area)
 {
-    int resent_surface_ids[MAX_PIPE_SIZE];
-    SpiceRect resent_areas[MAX_PIPE_SIZE]; // not pointers since drawables may be released
+    int *resent_surface_ids;
+    SpiceRect *resent_areas; // not pointers since drawables may be released
     int num_resent;
     GList *l, *prev;
     GQueue *pipe;
 
+    pipe = red_channel_client_get_pipe(RED_CHANNEL_CLIENT(dcc));
+
+    // the pipe depth depends on the client connection, at most all the
+    // drawables in the pipe are resent
+    resent_surface_ids = g_new(int, g_queue_get_length(pipe) + 1);
+    resent_areas = g_new(SpiceRect, g_queue_get_length(pipe) + 1);
     resent_surface_ids[0] = first_surface_id;
     resent_areas[0] = *first_area;
     num_resent = 1;
 
-    pipe = red_channel_client_get_pipe(RED_CHANNEL_CLIENT(dcc));
-
     // going from the oldest to the newest
     for (l = pipe->tail; l != NULL; l = prev) {
         RedPipeItem *pipe_item = l->data;
@@ -753,6 +774,9 @@ static void red_pipe_replace_rendered_drawables_with_images(DisplayChannelClient
 
         red_channel_client_pipe_remove_and_release_pos(RED_CHANNEL_CLIENT(dcc), l);
     }
+
+    g_free(resent_surface_ids);
+    g_free(resent_areas);
 }
 
 static void red_add_lossless_drawable_dependencies(RedChannelClient *rcc,
@@ -1993,8 +2017,7 @@ static void red_marshall_image(RedChannelClient *rcc,
         spice_marshall_Image(src_bitmap_out, &red_image,
                              &bitmap_palette_out, &lzplt_palette_out);
 
-        marshaller_add_compressed(src_bitmap_out,
-                                  comp_send_data.comp_buf, comp_send_data.comp_buf_size);
+        marshaller_add_compressed(src_bitmap_out, &comp_send_data);
 
         if (lzplt_palette_out && comp_send_data.lzplt_palette) {
             spice_marshall_Palette(lzplt_palette_out, comp_send_data.lzplt_palette);
@@ -2386,10 +2409,13 @@ void dcc_send_item(RedChannelClient *rcc, RedPipeItem *pipe_item)
     DisplayChannelClient *dcc = DISPLAY_CHANNEL_CLIENT(rcc);
     SpiceMarshaller *m = red_channel_client_get_marshaller(rcc);
 
+    dcc_update_bandwidth(dcc);
     reset_send_data(dcc);
     switch (pipe_item->type) {
     case RED_PIPE_ITEM_TYPE_DRAW: {
         RedDrawablePipeItem *dpi = SPICE_UPCAST(RedDrawablePipeItem, pipe_item);
+        dcc->priv->send_data.encoder_job = dpi->encoder_job;
+        dpi->encoder_job = NULL;
         marshall_qxl_drawable(rcc, m, dpi);
         break;
     }
@@ -2415,9 +2441,13 @@ void dcc_send_item(RedChannelClient *rcc, RedPipeItem *pipe_item)
     case RED_PIPE_ITEM_TYPE_MIGRATE_DATA:
         display_channel_marshall_migrate_data(rcc, m);
         break;
-    case RED_PIPE_ITEM_TYPE_IMAGE:
-        red_marshall_image(rcc, m, SPICE_UPCAST(RedImageItem, pipe_item));
+    case RED_PIPE_ITEM_TYPE_IMAGE: {
+        RedImageItem *image_item = SPICE_UPCAST(RedImageItem, pipe_item);
+        dcc->priv->send_data.encoder_job = image_item->encoder_job;
+        image_item->encoder_job = NULL;
+        red_marshall_image(rcc, m, image_item);
         break;
+    }
     case RED_PIPE_ITEM_TYPE_PIXMAP_SYNC:
         display_channel_marshall_pixmap_sync(rcc, m);
         break;
@@ -2459,6 +2489,12 @@ void dcc_send_item(RedChannelClient *rcc, RedPipeItem *pipe_item)
         spice_warn_if_reached();
     }
 
+    // the image was not compressed as expected, for instance it was cached
+    if (dcc->priv->send_data.encoder_job) {
+        image_encoder_job_cancel(dcc->priv->send_data.encoder_job);
+        dcc->priv->send_data.encoder_job = NULL;
+    }
+
     // a message is pending
     if (red_channel_client_send_message_pending(rcc)) {
         begin_send_message(rcc);
@@ -23,6 +23,7 @@
 #include "display-channel-private.h"
 #include "red-client.h"
 #include "main-channel-client.h"
+#include "reds.h"
 #include <spice-server-enums.h>
 #include "glib-compat.h"
 
@@ -31,6 +32,22 @@ G_DEFINE_TYPE(DisplayChannelClient, display_channel_client, TYPE_COMMON_GRAPHICS
 #define DISPLAY_CLIENT_SHORT_TIMEOUT 15000000000ULL //nano
 #define DISPLAY_FREE_LIST_DEFAULT_SIZE 128
 
+/* Rough compression ratios used to estimate the size of the messages
+ * queued to the clients */
+#define IMAGE_COMPRESSION_RATIO_ESTIMATE 4
+#define VIDEO_COMPRESSION_RATIO_ESTIMATE 20
+
+/* A client is a low bandwidth one below the first rate, as decided by the
+ * main channel network test. The measured rate must go above the second one
+ * before the client is considered fast again */
+#define LOW_BANDWIDTH_BYTES_PER_SEC (10 * 1024 * 1024 / 8)
+#define HIGH_BANDWIDTH_BYTES_PER_SEC (LOW_BANDWIDTH_BYTES_PER_SEC * 3 / 2)
+
+/* Messages from this size are written without copy (MSG_ZEROCOPY) if
+ * enabled with spice_server_set_zerocopy(). Below this size pinning the
+ * pages costs more than the copy */
+#define ZEROCOPY_THRESHOLD (64 * 1024)
+
 enum
 {
     PROP0,
@@ -42,6 +59,11 @@ enum
 static void on_display_video_codecs_update(GObject *gobject, GParamSpec *pspec, gpointer user_data);
 static bool dcc_config_socket(RedChannelClient *rcc);
 static void dcc_on_disconnect(RedChannelClient *rcc);
+static ImageEncoderJob *dcc_compress_image_ahead(DisplayChannelClient *dcc, SpiceBitmap *src,
+                                                 Drawable *drawable, int can_lossy);
+static ImageEncoderJob *dcc_compress_drawable_image_ahead(DisplayChannelClient *dcc,
+                                                          Drawable *drawable,
+                                                          SpiceImage *image);
 
 static void
 display_channel_client_get_property(GObject *object,
@@ -168,12 +190,17 @@ display_channel_client_class_init(DisplayChannelClientClass *klass)
 
 static void display_channel_client_init(DisplayChannelClient *self)
 {
+    int i;
+
     /* we need to allocate the private data manually here since
      * g_type_class_add_private() doesn't support private structs larger than
      * 64k */
     self->priv = g_new0(DisplayChannelClientPrivate, 1);
 
     ring_init(&self->priv->palette_cache_lru);
+    for (i = 0; i < NUM_SURFACES; i++) {
+        ring_init(&self->priv->surface_pipe_items[i]);
+    }
     self->priv->palette_cache_available = CLIENT_PALETTE_CACHE_SIZE;
     // todo: tune quality according to bandwidth
     self->priv->encoders.jpeg_quality = 85;
@@ -205,6 +232,39 @@ static RedSurfaceCreateItem *red_surface_create_item_new(RedChannel* channel,
     return create;
 }
 
+static bool drawable_depends_on_surface(Drawable *drawable, int x)
+{
+    return drawable->surface_deps[x] != -1 && drawable->surface_deps[x] != drawable->surface_id;
+}
+
+void dcc_surface_pipe_drawable_added(DisplayChannelClient *dcc, Drawable *drawable,
+                                     DccSurfacePipeLink *link, RedPipeItem *item)
+{
+    int x;
+
+    link->item = item;
+    ring_item_init(&link->link);
+    ring_add(&dcc->priv->surface_pipe_items[drawable->surface_id], &link->link);
+    for (x = 0; x < 3; ++x) {
+        if (drawable_depends_on_surface(drawable, x)) {
+            dcc->priv->surface_pipe_deps[drawable->surface_deps[x]]++;
+        }
+    }
+}
+
+void dcc_surface_pipe_drawable_released(DisplayChannelClient *dcc, Drawable *drawable,
+                                        DccSurfacePipeLink *link)
+{
+    int x;
+
+    ring_remove(&link->link);
+    for (x = 0; x < 3; ++x) {
+        if (drawable_depends_on_surface(drawable, x)) {
+            dcc->priv->surface_pipe_deps[drawable->surface_deps[x]]--;
+        }
+    }
+}
+
 bool dcc_drawable_is_in_pipe(DisplayChannelClient *dcc, Drawable *drawable)
 {
     RedDrawablePipeItem *dpi;
@@ -236,7 +296,25 @@ bool dcc_clear_surface_drawables_from_pipe(DisplayChannelClient *dcc, int surfac
        no other drawable depends on them */
 
     rcc = RED_CHANNEL_CLIENT(dcc);
-    for (l = red_channel_client_get_pipe(rcc)->head; l != NULL; ) {
+    if (dcc->priv->surface_pipe_deps[surface_id] == 0) {
+        // no drawing uses the surface, the ones drawing to it are all removed
+        // without looking at the others
+        RingItem *link, *next;
+
+        RING_FOREACH_SAFE(link, next, &dcc->priv->surface_pipe_items[surface_id]) {
+            RedPipeItem *item = SPICE_CONTAINEROF(link, DccSurfacePipeLink, link)->item;
+
+            // the items being sent are not in the pipe anymore
+            if (red_channel_client_pipe_item_is_linked(rcc, item)) {
+                red_channel_client_pipe_remove_and_release(rcc, item);
+            }
+        }
+        l = NULL;
+    } else {
+        // the drawings queued after the last one using the surface are removed
+        l = red_channel_client_get_pipe(rcc)->head;
+    }
+    while (l != NULL) {
         Drawable *drawable;
         RedDrawablePipeItem *dpi = NULL;
         int depend_found = FALSE;
@@ -314,6 +392,42 @@ void dcc_create_surface(DisplayChannelClient *dcc, int surface_id)
     red_channel_client_pipe_add(RED_CHANNEL_CLIENT(dcc), &create->base);
 }
 
+static void red_image_item_free(RedPipeItem *base)
+{
+    RedImageItem *item = SPICE_UPCAST(RedImageItem, base);
+
+    if (item->encoder_job) {
+        image_encoder_job_cancel(item->encoder_job);
+    }
+    g_free(item);
+}
+
+/* Start compressing the image of @item in the image encoder pool,
+ * the same way red_marshall_image() would compress it */
+static ImageEncoderJob *dcc_compress_image_item_ahead(DisplayChannelClient *dcc,
+                                                      RedImageItem *item)
+{
+    ImageEncoderJob *job;
+    SpiceBitmap bitmap;
+
+    bitmap.format = item->image_format;
+    bitmap.flags = 0;
+    if (item->top_down) {
+        bitmap.flags |= SPICE_BITMAP_FLAGS_TOP_DOWN;
+    }
+    bitmap.x = item->width;
+    bitmap.y = item->height;
+    bitmap.stride = item->stride;
+    bitmap.palette = NULL;
+    bitmap.palette_id = 0;
+    bitmap.data = spice_chunks_new_linear(item->data, bitmap.stride * bitmap.y);
+
+    job = dcc_compress_image_ahead(dcc, &bitmap, NULL, item->can_lossy);
+
+    spice_chunks_destroy(bitmap.data);
+    return job;
+}
+
 // adding the pipe item after pos. If pos == NULL, adding to head.
 RedImageItem *dcc_add_surface_area_image(DisplayChannelClient *dcc,
                                          int surface_id,
@@ -340,7 +454,7 @@ RedImageItem *dcc_add_surface_area_image(DisplayChannelClient *dcc,
 
     item = (RedImageItem *)g_malloc(height * stride + sizeof(RedImageItem));
 
-    red_pipe_item_init(&item->base, RED_PIPE_ITEM_TYPE_IMAGE);
+    red_pipe_item_init_full(&item->base, RED_PIPE_ITEM_TYPE_IMAGE, red_image_item_free);
 
     item->surface_id = surface_id;
     item->image_format =
@@ -368,6 +482,9 @@ RedImageItem *dcc_add_surface_area_image(DisplayChannelClient *dcc,
         }
     }
 
+    item->encoder_job = dcc_compress_image_item_ahead(dcc, item);
+    item->base.size_hint = height * stride / IMAGE_COMPRESSION_RATIO_ESTIMATE;
+
     if (pipe_item_pos) {
         red_channel_client_pipe_add_after_pos(RED_CHANNEL_CLIENT(dcc), &item->base, pipe_item_pos);
     } else {
@@ -401,6 +518,51 @@ void dcc_push_surface_image(DisplayChannelClient *dcc, int surface_id)
     dcc_add_surface_area_image(dcc, surface_id, &area, NULL, FALSE);
 }
 
+/* Park a client which is not able to keep up with the guest: the drawings
+ * queued to it are dropped and no new ones are queued until it resumes */
+void dcc_park(DisplayChannelClient *dcc)
+{
+    RedChannelClient *rcc = RED_CHANNEL_CLIENT(dcc);
+    GList *l;
+
+    red_channel_client_set_parked(rcc, TRUE);
+    for (l = red_channel_client_get_pipe(rcc)->head; l != NULL; ) {
+        RedPipeItem *item = l->data;
+        GList *item_pos = l;
+
+        l = l->next;
+        if (item->type == RED_PIPE_ITEM_TYPE_DRAW ||
+            item->type == RED_PIPE_ITEM_TYPE_UPGRADE ||
+            item->type == RED_PIPE_ITEM_TYPE_IMAGE) {
+            red_channel_client_pipe_remove_and_release_pos(rcc, item_pos);
+        }
+    }
+}
+
+/* Resume a parked client by sending it the current images of its surfaces.
+ * Lossy compression is allowed for the images to let the client catch up,
+ * lossy areas are upgraded later as usual */
+void dcc_resume(DisplayChannelClient *dcc)
+{
+    DisplayChannel *display = DCC_TO_DC(dcc);
+    int surface_id;
+
+    red_channel_client_set_parked(RED_CHANNEL_CLIENT(dcc), FALSE);
+    for (surface_id = 0; surface_id < NUM_SURFACES; surface_id++) {
+        RedSurface *surface = &display->priv->surfaces[surface_id];
+        SpiceRect area;
+
+        if (!dcc->priv->surface_client_created[surface_id] || !surface->context.canvas) {
+            continue;
+        }
+        display_channel_current_flush(display, surface_id);
+        area.top = area.left = 0;
+        area.right = surface->context.width;
+        area.bottom = surface->context.height;
+        dcc_add_surface_area_image(dcc, surface_id, &area, NULL, TRUE);
+    }
+}
+
 static void add_drawable_surface_images(DisplayChannelClient *dcc, Drawable *drawable)
 {
     DisplayChannel *display = DCC_TO_DC(dcc);
@@ -434,15 +596,62 @@ static void red_drawable_pipe_item_free(RedPipeItem *item)
     RedDrawablePipeItem *dpi = SPICE_UPCAST(RedDrawablePipeItem, item);
     spice_assert(item->refcount == 0);
 
+    if (dpi->encoder_job) {
+        image_encoder_job_cancel(dpi->encoder_job);
+    }
+    dcc_surface_pipe_drawable_released(dpi->dcc, dpi->drawable, &dpi->surface_link);
     dpi->drawable->pipes = g_list_remove(dpi->drawable->pipes, dpi);
     drawable_unref(dpi->drawable);
     g_free(dpi);
 }
 
+/* Estimate the size of the message sent for @drawable, only the source
+ * image is considered, other data are small compared to it */
+static uint32_t drawable_size_hint(Drawable *drawable)
+{
+    RedDrawable *red_drawable = drawable->red_drawable;
+    SpiceImage *image;
+    uint64_t size;
+
+    switch (red_drawable->type) {
+    case QXL_DRAW_COPY:
+        image = red_drawable->u.copy.src_bitmap;
+        break;
+    case QXL_DRAW_OPAQUE:
+        image = red_drawable->u.opaque.src_bitmap;
+        break;
+    case QXL_DRAW_BLEND:
+        image = red_drawable->u.blend.src_bitmap;
+        break;
+    case QXL_DRAW_TRANSPARENT:
+        image = red_drawable->u.transparent.src_bitmap;
+        break;
+    case QXL_DRAW_ALPHA_BLEND:
+        image = red_drawable->u.alpha_blend.src_bitmap;
+        break;
+    case QXL_DRAW_ROP3:
+        image = red_drawable->u.rop3.src_bitmap;
+        break;
+    case QXL_DRAW_COMPOSITE:
+        image = red_drawable->u.composite.src_bitmap;
+        break;
+    default:
+        return 0;
+    }
+
+    if (image == NULL || image->descriptor.type != SPICE_IMAGE_TYPE_BITMAP) {
+        return 0;
+    }
+    size = image->u.bitmap.y * (uint64_t) image->u.bitmap.stride;
+    size /= drawable->stream ? VIDEO_COMPRESSION_RATIO_ESTIMATE : IMAGE_COMPRESSION_RATIO_ESTIMATE;
+    return MIN(size, UINT32_MAX);
+}
+
 static RedDrawablePipeItem *red_drawable_pipe_item_new(DisplayChannelClient *dcc,
                                                        Drawable *drawable)
 {
     RedDrawablePipeItem *dpi;
+    RedDrawable *red_drawable;
 
     dpi = g_new0(RedDrawablePipeItem, 1);
     dpi->drawable = drawable;
@@ -450,30 +659,54 @@ static RedDrawablePipeItem *red_drawable_pipe_item_new(DisplayChannelClient *dcc
     drawable->pipes = g_list_prepend(drawable->pipes, dpi);
     red_pipe_item_init_full(&dpi->base, RED_PIPE_ITEM_TYPE_DRAW,
                             red_drawable_pipe_item_free);
+    dpi->base.size_hint = drawable_size_hint(drawable);
     drawable->refs++;
+    dcc_surface_pipe_drawable_added(dcc, drawable, &dpi->surface_link, &dpi->base);
+
+    /* streamed drawables are sent using the video encoder */
+    red_drawable = drawable->red_drawable;
+    if (red_drawable->type == QXL_DRAW_COPY && !drawable->stream) {
+        SpiceImage *image = red_drawable->u.copy.src_bitmap;
+
+        if (image && image->descriptor.type == SPICE_IMAGE_TYPE_BITMAP) {
+            dpi->encoder_job = dcc_compress_drawable_image_ahead(dcc, drawable, image);
+        }
+    }
     return dpi;
 }
 
 void dcc_prepend_drawable(DisplayChannelClient *dcc, Drawable *drawable)
 {
-    RedDrawablePipeItem *dpi = red_drawable_pipe_item_new(dcc, drawable);
+    RedDrawablePipeItem *dpi;
 
+    if (red_channel_client_is_parked(RED_CHANNEL_CLIENT(dcc))) {
+        return;
+    }
+    dpi = red_drawable_pipe_item_new(dcc, drawable);
     add_drawable_surface_images(dcc, drawable);
     red_channel_client_pipe_add(RED_CHANNEL_CLIENT(dcc), &dpi->base);
 }
 
 void dcc_append_drawable(DisplayChannelClient *dcc, Drawable *drawable)
 {
-    RedDrawablePipeItem *dpi = red_drawable_pipe_item_new(dcc, drawable);
+    RedDrawablePipeItem *dpi;
 
+    if (red_channel_client_is_parked(RED_CHANNEL_CLIENT(dcc))) {
+        return;
+    }
+    dpi = red_drawable_pipe_item_new(dcc, drawable);
     add_drawable_surface_images(dcc, drawable);
     red_channel_client_pipe_add_tail(RED_CHANNEL_CLIENT(dcc), &dpi->base);
 }
 
 void dcc_add_drawable_after(DisplayChannelClient *dcc, Drawable *drawable, RedPipeItem *pos)
 {
-    RedDrawablePipeItem *dpi = red_drawable_pipe_item_new(dcc, drawable);
+    RedDrawablePipeItem *dpi;
 
+    if (red_channel_client_is_parked(RED_CHANNEL_CLIENT(dcc))) {
+        return;
+    }
+    dpi = red_drawable_pipe_item_new(dcc, drawable);
     add_drawable_surface_images(dcc, drawable);
     red_channel_client_pipe_add_after(RED_CHANNEL_CLIENT(dcc), &dpi->base, pos);
 }
@@ -832,19 +1065,202 @@ static SpiceImageCompression get_compression_for_bitmap(SpiceBitmap *bitmap,
     return SPICE_IMAGE_COMPRESSION_INVALID;
 }
 
+/* Images smaller than this are compressed quickly enough when sent */
+#define MIN_SIZE_TO_COMPRESS_AHEAD (64 * 1024)
+
+/* Check whether @src can be compressed by the image encoder pool, returning
+ * the compression dcc_compress_image() would use for it */
+static bool dcc_get_compression_ahead(DisplayChannelClient *dcc,
+                                      SpiceBitmap *src, Drawable *drawable, int can_lossy,
+                                      SpiceImageCompression *compression, bool *jpeg)
+{
+    DisplayChannel *display_channel = DCC_TO_DC(dcc);
+
+    if (!bitmap_fmt_is_rgb(src->format) || (src->data->flags & SPICE_CHUNKS_FLAGS_UNSTABLE)) {
+        return FALSE;
+    }
+
+    *compression = get_compression_for_bitmap(src, dcc->priv->image_compression, drawable);
+    *jpeg = FALSE;
+    switch (*compression) {
+    case SPICE_IMAGE_COMPRESSION_QUIC:
+        *jpeg = can_lossy && display_channel->priv->enable_jpeg &&
+                (src->format != SPICE_BITMAP_FMT_RGBA || !bitmap_has_extra_stride(src));
+        return TRUE;
+#ifdef USE_LZ4
+    case SPICE_IMAGE_COMPRESSION_LZ4:
+        if (!red_channel_client_test_remote_cap(RED_CHANNEL_CLIENT(dcc),
+                                                SPICE_DISPLAY_CAP_LZ4_COMPRESSION)) {
+            *compression = SPICE_IMAGE_COMPRESSION_LZ;
+        }
+        return TRUE;
+#endif
+    case SPICE_IMAGE_COMPRESSION_LZ:
+        return TRUE;
+    default:
+        /* GLZ depends on the client dictionary */
+        return FALSE;
+    }
+}
+
+static ImageEncoderJob *dcc_compress_image_ahead(DisplayChannelClient *dcc, SpiceBitmap *src,
+                                                 Drawable *drawable, int can_lossy)
+{
+    RedChannelClient *rcc = RED_CHANNEL_CLIENT(dcc);
+    ImageEncoderPool *pool;
+    SpiceImageCompression compression;
+    bool jpeg;
+
+    pool = reds_get_image_encoder_pool(red_channel_get_server(red_channel_client_get_channel(rcc)));
+    if (pool == NULL ||
+        src->y * (uint64_t) src->stride < MIN_SIZE_TO_COMPRESS_AHEAD ||
+        /* images are not compressed for local clients */
+        red_stream_get_family(red_channel_client_get_stream(rcc)) == AF_UNIX ||
+        !dcc_get_compression_ahead(dcc, src, drawable, can_lossy, &compression, &jpeg)) {
+        return NULL;
+    }
+
+    return image_encoder_pool_submit(pool, src, compression, jpeg,
+                                     dcc->priv->encoders.jpeg_quality);
+}
+
+/* Take the result of the compression started for the item being sent, if
+ * it was started for @src with the same parameters */
+static ImageEncoderJobResult dcc_take_compressed_image(DisplayChannelClient *dcc,
+                                                       SpiceImage *dest, SpiceBitmap *src,
+                                                       Drawable *drawable, int can_lossy,
+                                                       compress_send_data_t *o_comp_data)
+{
+    ImageEncoderJob *job = dcc->priv->send_data.encoder_job;
+    SpiceImageCompression compression;
+    bool jpeg;
+
+    if (job == NULL) {
+        return IMAGE_ENCODER_JOB_NOT_DONE;
+    }
+    dcc->priv->send_data.encoder_job = NULL;
+
+    if (!dcc_get_compression_ahead(dcc, src, drawable, can_lossy, &compression, &jpeg) ||
+        !image_encoder_job_matches(job, src, compression, jpeg,
+                                   dcc->priv->encoders.jpeg_quality)) {
+        image_encoder_job_cancel(job);
+        return IMAGE_ENCODER_JOB_NOT_DONE;
+    }
+    return image_encoder_job_take_result(job, dest, o_comp_data);
+}
+
+/* Check whether the compression of @src can be shared with the other
+ * clients, filling @key if so */
+static bool dcc_get_compress_cache_key(DisplayChannelClient *dcc, SpiceImage *dest,
+                                       SpiceBitmap *src, Drawable *drawable, int can_lossy,
+                                       ImageCompressCacheKey *key)
+{
+    DisplayChannel *display_channel = DCC_TO_DC(dcc);
+
+    /* the images of the other items are not shared between the clients */
+    if (drawable == NULL ||
+        red_channel_get_n_clients(RED_CHANNEL(display_channel)) < 2) {
+        return FALSE;
+    }
+    if (!dcc_get_compression_ahead(dcc, src, drawable, can_lossy,
+                                   &key->compression, &key->jpeg)) {
+        return FALSE;
+    }
+    key->bitmap = src;
+    key->image_id = dest->descriptor.id;
+    key->jpeg_quality = dcc->priv->encoders.jpeg_quality;
+    return TRUE;
+}
+
+/* Find the item of another client whose compression of the drawable image
+ * is still pending and can be shared */
+static RedDrawablePipeItem *drawable_find_encoder_job(Drawable *drawable,
+                                                      const ImageCompressCacheKey *key)
+{
+    GList *l;
+
+    for (l = drawable->pipes; l != NULL; l = l->next) {
+        RedDrawablePipeItem *dpi = l->data;
+
+        if (dpi->encoder_job &&
+            image_encoder_job_matches(dpi->encoder_job, key->bitmap, key->compression,
+                                      key->jpeg, key->jpeg_quality)) {
+            return dpi;
+        }
+    }
+    return NULL;
+}
+
+/* The image of a drawable is compressed once for all the clients sharing
+ * the result: no job is started if the result is already cached or another
+ * client is waiting for the same compression, dcc_compress_image() uses
+ * theirs */
+static ImageEncoderJob *dcc_compress_drawable_image_ahead(DisplayChannelClient *dcc,
+                                                          Drawable *drawable,
+                                                          SpiceImage *image)
+{
+    int can_lossy = DCC_TO_DC(dcc)->priv->enable_jpeg;
+    ImageCompressCacheKey key;
+
+    if (dcc_get_compress_cache_key(dcc, image, &image->u.bitmap, drawable, can_lossy, &key) &&
+        (image_compress_cache_contains(&drawable->compressed_images, &key) ||
+         drawable_find_encoder_job(drawable, &key) != NULL)) {
+        return NULL;
+    }
+    return dcc_compress_image_ahead(dcc, &image->u.bitmap, drawable, can_lossy);
+}
+
 int dcc_compress_image(DisplayChannelClient *dcc,
                        SpiceImage *dest, SpiceBitmap *src, Drawable *drawable,
                        int can_lossy,
                        compress_send_data_t* o_comp_data)
 {
     DisplayChannel *display_channel = DCC_TO_DC(dcc);
+    ImageCompressCache *compress_cache = &display_channel->priv->compress_cache;
+    ImageCompressCacheKey cache_key;
+    bool cacheable;
     SpiceImageCompression image_compression;
     stat_start_time_t start_time;
     int success = FALSE;
 
+    cacheable = dcc_get_compress_cache_key(dcc, dest, src, drawable, can_lossy, &cache_key);
+    if (cacheable &&
+        image_compress_cache_lookup(compress_cache, &drawable->compressed_images, &cache_key,
+                                    dest, o_comp_data)) {
+        if (dcc->priv->send_data.encoder_job) {
+            image_encoder_job_cancel(dcc->priv->send_data.encoder_job);
+            dcc->priv->send_data.encoder_job = NULL;
+        }
+        return TRUE;
+    }
+    /* take over the compression another client is waiting for, the result
+     * is cached for it */
+    if (cacheable && !dcc->priv->send_data.encoder_job) {
+        RedDrawablePipeItem *other = drawable_find_encoder_job(drawable, &cache_key);
+
+        if (other) {
+            dcc->priv->send_data.encoder_job = other->encoder_job;
+            other->encoder_job = NULL;
+        }
+    }
+
     stat_start_time_init(&start_time, &display_channel->priv->encoder_shared_data.off_stat);
 
-    image_compression = get_compression_for_bitmap(src, dcc->priv->image_compression, drawable);
+    switch (dcc_take_compressed_image(dcc, dest, src, drawable, can_lossy, o_comp_data)) {
+    case IMAGE_ENCODER_JOB_COMPRESSED:
+        if (cacheable) {
+            image_compress_cache_add(compress_cache, &drawable->compressed_images, &cache_key,
+                                     dest, o_comp_data);
+        }
+        return TRUE;
+    case IMAGE_ENCODER_JOB_FAILED:
+        image_compression = SPICE_IMAGE_COMPRESSION_OFF;
+        break;
+    default:
+        image_compression = get_compression_for_bitmap(src, dcc->priv->image_compression,
+                                                       drawable);
+    }
+
     switch (image_compression) {
     case SPICE_IMAGE_COMPRESSION_OFF:
         break;
@@ -888,6 +1304,9 @@ lz_compress:
     if (!success) {
         uint64_t image_size = src->stride * (uint64_t)src->y;
         stat_compress_add(&display_channel->priv->encoder_shared_data.off_stat, start_time, image_size, image_size);
+    } else if (cacheable) {
+        image_compress_cache_add(compress_cache, &drawable->compressed_images, &cache_key,
+                                 dest, o_comp_data);
     }
 
     return success;
@@ -1393,6 +1812,12 @@ static bool dcc_config_socket(RedChannelClient *rcc)
 
     DISPLAY_CHANNEL_CLIENT(rcc)->is_low_bandwidth = main_channel_client_is_low_bandwidth(mcc);
 
+    // copying the large uncompressed images to the socket is costly on LAN
+    if (!DISPLAY_CHANNEL_CLIENT(rcc)->is_low_bandwidth &&
+        reds_get_zerocopy(red_channel_get_server(red_channel_client_get_channel(rcc)))) {
+        red_stream_enable_zerocopy(red_channel_client_get_stream(rcc), ZEROCOPY_THRESHOLD);
+    }
+
     return common_channel_client_config_socket(rcc);
 }
 
@@ -1420,3 +1845,27 @@ gboolean dcc_is_low_bandwidth(DisplayChannelClient *dcc)
 {
     return dcc->is_low_bandwidth;
 }
+
+void dcc_update_bandwidth(DisplayChannelClient *dcc)
+{
+    uint64_t bytes_per_sec = red_channel_client_get_bandwidth(RED_CHANNEL_CLIENT(dcc));
+    int is_low_bandwidth = dcc->is_low_bandwidth;
+
+    // till the connection is measured the network test result is kept
+    if (bytes_per_sec == 0) {
+        return;
+    }
+    if (bytes_per_sec < LOW_BANDWIDTH_BYTES_PER_SEC) {
+        is_low_bandwidth = TRUE;
+    } else if (bytes_per_sec > HIGH_BANDWIDTH_BYTES_PER_SEC) {
+        is_low_bandwidth = FALSE;
+    }
+    if (is_low_bandwidth == dcc->is_low_bandwidth) {
+        return;
+    }
+
+    spice_debug("bandwidth %.2f Mbps, %s", bytes_per_sec * 8 / 1024.0 / 1024.0,
+                is_low_bandwidth ? "low bandwidth" : "high bandwidth");
+    dcc->is_low_bandwidth = is_low_bandwidth;
+    display_channel_update_compression(DCC_TO_DC(dcc), dcc);
+}
@@ -22,6 +22,7 @@
 #include <glib-object.h>
 
 #include "image-encoders.h"
+#include "image-encoder-pool.h"
 #include "image-cache.h"
 #include "pixmap-cache.h"
 #include "display-limits.h"
@@ -75,8 +76,6 @@ GType display_channel_client_get_type(void) G_GNUC_CONST;
 #define WIDE_CLIENT_ACK_WINDOW 40
 #define NARROW_CLIENT_ACK_WINDOW 20
 
-#define MAX_PIPE_SIZE 50
-
 typedef struct DisplayChannel DisplayChannel;
 typedef struct VideoStream VideoStream;
 typedef struct VideoStreamAgent VideoStreamAgent;
@@ -120,13 +119,23 @@ typedef struct RedImageItem {
     int image_format;
     uint32_t image_flags;
     int can_lossy;
+    ImageEncoderJob *encoder_job;
     uint8_t data[0];
 } RedImageItem;
 
+/* Link of a drawing or upgrade item in the list of the items of its client
+ * drawing to the same surface */
+typedef struct DccSurfacePipeLink {
+    RingItem link;
+    RedPipeItem *item;
+} DccSurfacePipeLink;
+
 typedef struct RedDrawablePipeItem {
     RedPipeItem base;
     Drawable *drawable;
     DisplayChannelClient *dcc;
+    ImageEncoderJob *encoder_job;
+    DccSurfacePipeLink surface_link;
 } RedDrawablePipeItem;
 
 DisplayChannelClient*      dcc_new                                   (DisplayChannel *display,
@@ -152,6 +161,8 @@ void                       dcc_create_stream                         (DisplayCha
                                                                       VideoStream *stream);
 void                       dcc_create_surface                        (DisplayChannelClient *dcc,
                                                                       int surface_id);
+void                       dcc_park                                  (DisplayChannelClient *dcc);
+void                       dcc_resume                                (DisplayChannelClient *dcc);
 void                       dcc_push_surface_image                    (DisplayChannelClient *dcc,
                                                                       int surface_id);
 RedImageItem *             dcc_add_surface_area_image                (DisplayChannelClient *dcc,
@@ -179,6 +190,13 @@ bool                       dcc_clear_surface_drawables_from_pipe     (DisplayCha
                                                                       int wait_if_used);
 bool                       dcc_drawable_is_in_pipe                   (DisplayChannelClient *dcc,
                                                                       Drawable *drawable);
+void                       dcc_surface_pipe_drawable_added           (DisplayChannelClient *dcc,
+                                                                      Drawable *drawable,
+                                                                      DccSurfacePipeLink *link,
+                                                                      RedPipeItem *item);
+void                       dcc_surface_pipe_drawable_released        (DisplayChannelClient *dcc,
+                                                                      Drawable *drawable,
+                                                                      DccSurfacePipeLink *link);
 RedPipeItem *              dcc_gl_scanout_item_new                   (RedChannelClient *rcc,
                                                                       void *data, int num);
 RedPipeItem *              dcc_gl_draw_item_new                      (RedChannelClient *rcc,
@@ -198,6 +216,9 @@ void dcc_set_max_stream_latency(DisplayChannelClient *dcc, uint32_t latency);
 uint64_t dcc_get_max_stream_bit_rate(DisplayChannelClient *dcc);
 void dcc_set_max_stream_bit_rate(DisplayChannelClient *dcc, uint64_t rate);
 gboolean dcc_is_low_bandwidth(DisplayChannelClient *dcc);
+/* Follows the bandwidth measured on the connection, updating the
+ * compression if the client becomes or stops being low bandwidth */
+void dcc_update_bandwidth(DisplayChannelClient *dcc);
 GArray *dcc_get_preferred_video_codecs_for_encoding(DisplayChannelClient *dcc);
 
 G_END_DECLS
@@ -25,6 +25,9 @@
 #ifndef _WIN32
 #include <poll.h>
 #endif
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
 
 #include "dispatcher.h"
 
@@ -38,6 +41,11 @@ static void setup_dummy_signal_handler(void);
 
 #define DISPATCHER_MESSAGE_TYPE_CUSTOM 0x7fffffffu
 
+#ifdef HAVE_SYS_EVENTFD_H
+static bool dispatcher_ring_init(Dispatcher *self);
+static uint32_t dispatcher_ring_skip(Dispatcher *dispatcher, uint32_t pos, bool release);
+#endif
+
 /* structure to store message header information.
  * That structure is sent through a socketpair so it's optimized
  * to be transfered via sockets.
@@ -51,9 +59,44 @@ typedef struct DispatcherMessage {
     uint32_t ack:1;
 } DispatcherMessage;
 
+#ifdef HAVE_SYS_EVENTFD_H
+/* When eventfd is available messages are passed through a shared memory
+ * ring instead of the socketpair. Senders are already serialized by the
+ * dispatcher lock so the ring has a single producer and a single consumer
+ * and does not need any lock itself. The eventfds are only used to wake up
+ * a receiver which is idle and to block a sender waiting for an ACK or for
+ * free space, so a busy receiver does not cost any syscall to the senders.
+ */
+#define DISPATCHER_RING_SIZE (64 * 1024)
+#define DISPATCHER_RING_MASK (DISPATCHER_RING_SIZE - 1)
+/* payloads bigger than this are copied to the heap, only a pointer is queued */
+#define DISPATCHER_RING_MAX_INLINE 1024
+
+typedef struct DispatcherRing {
+    /* free running positions, masked when accessing data */
+    gint head; /* written by the sender */
+    gint tail; /* written by the receiver */
+    gint receiver_idle; /* receiver needs a wakeup on the recv eventfd */
+    gint sender_waiting; /* sender waits for free space on the send eventfd */
+    uint8_t data[DISPATCHER_RING_SIZE];
+} DispatcherRing;
+
+typedef struct DispatcherRingRecord {
+    DispatcherMessage msg;
+    void *heap_payload; /* NULL if payload follows the record */
+} DispatcherRingRecord;
+
+#define DISPATCHER_RING_ALIGN(size) (((size) + 7) & ~7u)
+#endif
+
 struct DispatcherPrivate {
+    /* with the ring recv_fd and send_fd are the eventfds used to signal
+     * respectively the receiver and the sender */
     int recv_fd;
     int send_fd;
+#ifdef HAVE_SYS_EVENTFD_H
+    DispatcherRing *ring;
+#endif
     pthread_t thread_id;
     pthread_mutex_t lock;
     DispatcherMessage *messages;
@@ -113,8 +156,22 @@ dispatcher_finalize(GObject *object)
 {
     Dispatcher *self = DISPATCHER(object);
     g_free(self->priv->messages);
-    socket_close(self->priv->send_fd);
-    socket_close(self->priv->recv_fd);
+#ifdef HAVE_SYS_EVENTFD_H
+    if (self->priv->ring) {
+        DispatcherRing *ring = self->priv->ring;
+        /* release payloads of messages never received */
+        while ((uint32_t) ring->tail != (uint32_t) ring->head) {
+            ring->tail = dispatcher_ring_skip(self, ring->tail, true);
+        }
+        g_free(ring);
+        close(self->priv->send_fd);
+        close(self->priv->recv_fd);
+    } else
+#endif
+    {
+        socket_close(self->priv->send_fd);
+        socket_close(self->priv->recv_fd);
+    }
     pthread_mutex_destroy(&self->priv->lock);
     g_free(self->priv->payload);
     G_OBJECT_CLASS(dispatcher_parent_class)->finalize(object);
@@ -129,18 +186,24 @@ static void dispatcher_constructed(GObject *object)
 
 #ifdef DEBUG_DISPATCHER
     setup_dummy_signal_handler();
+#endif
+    pthread_mutex_init(&self->priv->lock, NULL);
+    self->priv->thread_id = pthread_self();
+    self->priv->messages = g_new0(DispatcherMessage,
+                                  self->priv->max_message_type);
+
+#ifdef HAVE_SYS_EVENTFD_H
+    if (dispatcher_ring_init(self)) {
+        return;
+    }
+    spice_debug("failed to create dispatcher ring, using socketpair");
 #endif
     if (socketpair(AF_LOCAL, SOCK_STREAM, 0, channels) == -1) {
         spice_error("socketpair failed %s", strerror(errno));
         return;
     }
-    pthread_mutex_init(&self->priv->lock, NULL);
     self->priv->recv_fd = channels[0];
     self->priv->send_fd = channels[1];
-    self->priv->thread_id = pthread_self();
-
-    self->priv->messages = g_new0(DispatcherMessage,
-                                  self->priv->max_message_type);
 }
 
 static void
@@ -273,6 +336,27 @@ static int write_safe(int fd, uint8_t *buf, size_t size)
     return written_size;
 }
 
+static void dispatcher_call_handlers(Dispatcher *dispatcher,
+                                     const DispatcherMessage *msg, void *payload)
+{
+    if (dispatcher->priv->any_handler && msg->type != DISPATCHER_MESSAGE_TYPE_CUSTOM) {
+        dispatcher->priv->any_handler(dispatcher->priv->opaque, msg->type, payload);
+    }
+    if (msg->handler) {
+        msg->handler(dispatcher->priv->opaque, payload);
+    } else {
+        g_warning("error: no handler for message type %d", msg->type);
+    }
+}
+
+static void dispatcher_ensure_payload_size(Dispatcher *dispatcher, size_t size)
+{
+    if (G_UNLIKELY(size > dispatcher->priv->payload_size)) {
+        dispatcher->priv->payload = g_realloc(dispatcher->priv->payload, size);
+        dispatcher->priv->payload_size = size;
+    }
+}
+
 static int dispatcher_handle_single_read(Dispatcher *dispatcher)
 {
     int ret;
@@ -288,24 +372,14 @@ static int dispatcher_handle_single_read(Dispatcher *dispatcher)
         /* no message */
         return 0;
     }
-    if (G_UNLIKELY(msg->size > dispatcher->priv->payload_size)) {
-        dispatcher->priv->payload = g_realloc(dispatcher->priv->payload, msg->size);
-        dispatcher->priv->payload_size = msg->size;
-    }
+    dispatcher_ensure_payload_size(dispatcher, msg->size);
     payload = dispatcher->priv->payload;
     if (read_safe(dispatcher->priv->recv_fd, payload, msg->size, 1) == -1) {
         g_warning("error reading from dispatcher: %d", errno);
         /* TODO: close socketpair? */
         return 0;
     }
-    if (dispatcher->priv->any_handler && msg->type != DISPATCHER_MESSAGE_TYPE_CUSTOM) {
-        dispatcher->priv->any_handler(dispatcher->priv->opaque, msg->type, payload);
-    }
-    if (msg->handler) {
-        msg->handler(dispatcher->priv->opaque, payload);
-    } else {
-        g_warning("error: no handler for message type %d", msg->type);
-    }
+    dispatcher_call_handlers(dispatcher, msg, payload);
     if (msg->ack) {
         if (write_safe(dispatcher->priv->recv_fd,
                        (uint8_t*)&ack, sizeof(ack)) == -1) {
@@ -316,6 +390,201 @@ static int dispatcher_handle_single_read(Dispatcher *dispatcher)
     return 1;
 }
 
+#ifdef HAVE_SYS_EVENTFD_H
+static bool dispatcher_ring_init(Dispatcher *self)
+{
+    int recv_fd, send_fd;
+
+    /* the receiver only polls its eventfd, the sender blocks on its one */
+    recv_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (recv_fd == -1) {
+        return false;
+    }
+    send_fd = eventfd(0, EFD_CLOEXEC);
+    if (send_fd == -1) {
+        close(recv_fd);
+        return false;
+    }
+    self->priv->ring = g_new0(DispatcherRing, 1);
+    self->priv->ring->receiver_idle = 1;
+    self->priv->recv_fd = recv_fd;
+    self->priv->send_fd = send_fd;
+    return true;
+}
+
+static void dispatcher_ring_copy_in(DispatcherRing *ring, uint32_t pos,
+                                    const void *src, size_t size)
+{
+    uint32_t offset = pos & DISPATCHER_RING_MASK;
+    size_t first = MIN(size, DISPATCHER_RING_SIZE - offset);
+
+    memcpy(&ring->data[offset], src, first);
+    memcpy(ring->data, (const uint8_t *) src + first, size - first);
+}
+
+static void dispatcher_ring_copy_out(DispatcherRing *ring, uint32_t pos,
+                                     void *dst, size_t size)
+{
+    uint32_t offset = pos & DISPATCHER_RING_MASK;
+    size_t first = MIN(size, DISPATCHER_RING_SIZE - offset);
+
+    memcpy(dst, &ring->data[offset], first);
+    memcpy((uint8_t *) dst + first, ring->data, size - first);
+}
+
+/* skip the record at @pos, returns the position of the next record */
+static uint32_t dispatcher_ring_skip(Dispatcher *dispatcher, uint32_t pos, bool release)
+{
+    DispatcherRingRecord record;
+
+    dispatcher_ring_copy_out(dispatcher->priv->ring, pos, &record, sizeof(record));
+    pos += sizeof(record);
+    if (record.heap_payload) {
+        if (release) {
+            g_free(record.heap_payload);
+        }
+    } else {
+        pos += DISPATCHER_RING_ALIGN(record.msg.size);
+    }
+    return pos;
+}
+
+static void dispatcher_ring_signal(int fd)
+{
+    while (eventfd_write(fd, 1) == -1) {
+        if (errno != EINTR) {
+            g_warning("error signalling dispatcher: %d", errno);
+            return;
+        }
+    }
+}
+
+/*
+ * dispatcher_ring_wait
+ * consumes a signal from the eventfd, blocking if the eventfd is blocking.
+ * @return false if no signal was pending or on error
+ */
+static bool dispatcher_ring_wait(int fd)
+{
+    eventfd_t value;
+
+    while (eventfd_read(fd, &value) == -1) {
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno != EAGAIN) {
+            g_warning("error waiting dispatcher: %d", errno);
+        }
+        return false;
+    }
+    return true;
+}
+
+static uint32_t dispatcher_ring_free_space(DispatcherRing *ring, uint32_t head)
+{
+    return DISPATCHER_RING_SIZE - (head - (uint32_t) g_atomic_int_get(&ring->tail));
+}
+
+/* Wait for the receiver to release enough space to write @needed bytes at
+ * @head. Called with the dispatcher lock held so only a single sender can
+ * be waiting at a time. */
+static void dispatcher_ring_wait_space(Dispatcher *dispatcher, uint32_t head, uint32_t needed)
+{
+    DispatcherRing *ring = dispatcher->priv->ring;
+
+    while (dispatcher_ring_free_space(ring, head) < needed) {
+        g_atomic_int_set(&ring->sender_waiting, 1);
+        if (dispatcher_ring_free_space(ring, head) >= needed) {
+            if (!g_atomic_int_compare_and_exchange(&ring->sender_waiting, 1, 0)) {
+                /* the receiver is signalling us, consume the signal so
+                 * it won't be taken for an ACK */
+                dispatcher_ring_wait(dispatcher->priv->send_fd);
+            }
+            break;
+        }
+        dispatcher_ring_wait(dispatcher->priv->send_fd);
+    }
+}
+
+static void dispatcher_ring_send(Dispatcher *dispatcher, const DispatcherMessage *msg,
+                                 void *payload)
+{
+    DispatcherRing *ring = dispatcher->priv->ring;
+    DispatcherRingRecord record = { .msg = *msg, .heap_payload = NULL };
+    uint32_t head = g_atomic_int_get(&ring->head);
+    uint32_t needed = sizeof(record);
+
+    if (msg->size > DISPATCHER_RING_MAX_INLINE) {
+        record.heap_payload = g_malloc(msg->size);
+        memcpy(record.heap_payload, payload, msg->size);
+    } else {
+        needed += DISPATCHER_RING_ALIGN(msg->size);
+    }
+    dispatcher_ring_wait_space(dispatcher, head, needed);
+
+    dispatcher_ring_copy_in(ring, head, &record, sizeof(record));
+    if (!record.heap_payload) {
+        dispatcher_ring_copy_in(ring, head + sizeof(record), payload, msg->size);
+    }
+    g_atomic_int_set(&ring->head, head + needed);
+
+    /* wake up the receiver only if it's not already processing messages */
+    if (g_atomic_int_compare_and_exchange(&ring->receiver_idle, 1, 0)) {
+        dispatcher_ring_signal(dispatcher->priv->recv_fd);
+    }
+    if (msg->ack) {
+        dispatcher_ring_wait(dispatcher->priv->send_fd);
+    }
+}
+
+static bool dispatcher_ring_handle_single_read(Dispatcher *dispatcher)
+{
+    DispatcherRing *ring = dispatcher->priv->ring;
+    DispatcherRingRecord record;
+    uint32_t tail = ring->tail;
+    void *payload;
+
+    if (tail == (uint32_t) g_atomic_int_get(&ring->head)) {
+        return false;
+    }
+    dispatcher_ring_copy_out(ring, tail, &record, sizeof(record));
+    payload = record.heap_payload;
+    if (!payload) {
+        dispatcher_ensure_payload_size(dispatcher, record.msg.size);
+        payload = dispatcher->priv->payload;
+        dispatcher_ring_copy_out(ring, tail + sizeof(record), payload, record.msg.size);
+    }
+    /* release the space before calling the handler, the message is copied */
+    g_atomic_int_set(&ring->tail, dispatcher_ring_skip(dispatcher, tail, false));
+    if (g_atomic_int_compare_and_exchange(&ring->sender_waiting, 1, 0)) {
+        dispatcher_ring_signal(dispatcher->priv->send_fd);
+    }
+
+    dispatcher_call_handlers(dispatcher, &record.msg, payload);
+    g_free(record.heap_payload);
+    if (record.msg.ack) {
+        dispatcher_ring_signal(dispatcher->priv->send_fd);
+    }
+    return true;
+}
+
+static void dispatcher_ring_handle_event(Dispatcher *dispatcher)
+{
+    DispatcherRing *ring = dispatcher->priv->ring;
+
+    /* reset the eventfd counter, the ring content is what matters */
+    dispatcher_ring_wait(dispatcher->priv->recv_fd);
+    do {
+        while (dispatcher_ring_handle_single_read(dispatcher)) {
+        }
+        g_atomic_int_set(&ring->receiver_idle, 1);
+        /* a sender could have queued a message before seeing the flag,
+         * if it already saw the flag we will get a new event instead */
+    } while ((uint32_t) ring->tail != (uint32_t) g_atomic_int_get(&ring->head) &&
+             g_atomic_int_compare_and_exchange(&ring->receiver_idle, 1, 0));
+}
+#endif
+
 /*
  * dispatcher_handle_event
  * doesn't handle being in the middle of a message. all reads are blocking.
@@ -324,6 +593,12 @@ static void dispatcher_handle_event(int fd, int event, void *opaque)
 {
     Dispatcher *dispatcher = opaque;
 
+#ifdef HAVE_SYS_EVENTFD_H
+    if (dispatcher->priv->ring) {
+        dispatcher_ring_handle_event(dispatcher);
+        return;
+    }
+#endif
     while (dispatcher_handle_single_read(dispatcher)) {
     }
 }
@@ -336,6 +611,12 @@ dispatcher_send_message_internal(Dispatcher *dispatcher, const DispatcherMessage
     int send_fd = dispatcher->priv->send_fd;
 
     pthread_mutex_lock(&dispatcher->priv->lock);
+#ifdef HAVE_SYS_EVENTFD_H
+    if (dispatcher->priv->ring) {
+        dispatcher_ring_send(dispatcher, msg, payload);
+        goto unlock;
+    }
+#endif
     if (write_safe(send_fd, (uint8_t*)msg, sizeof(*msg)) == -1) {
         g_warning("error: failed to send message header for message %d",
                   msg->type);
@@ -395,10 +676,7 @@ void dispatcher_register_handler(Dispatcher *dispatcher, uint32_t message_type,
     msg->size = size;
     msg->type = message_type;
     msg->ack = ack;
-    if (msg->size > dispatcher->priv->payload_size) {
-        dispatcher->priv->payload = g_realloc(dispatcher->priv->payload, msg->size);
-        dispatcher->priv->payload_size = msg->size;
-    }
+    dispatcher_ensure_payload_size(dispatcher, msg->size);
 }
 
 void dispatcher_register_universal_handler(
@@ -37,16 +37,16 @@ typedef struct DispatcherClass DispatcherClass;
 typedef struct DispatcherPrivate DispatcherPrivate;
 
 /* A Dispatcher provides inter-thread communication by serializing messages.
- * Currently the Dispatcher uses a unix socket (socketpair) for dispatching the
- * messages.
+ * Where eventfd is available the Dispatcher queues the messages in a lock-free
+ * shared memory ring and uses eventfds only to wake up an idle receiver or a
+ * sender waiting for an ACK. Otherwise it falls back to a unix socket
+ * (socketpair) for dispatching the messages.
  *
  * Message types are identified by a unique integer value and must first be
  * registered with the class (see dispatcher_register_handler()) before they
  * can be sent. Sending threads can send a message using the
- * dispatcher_send_message() function. The receiving thread can monitor the
- * dispatcher's 'receive' file descriptor (see dispatcher_get_recv_fd()) for
- * activity and should call dispatcher_handle_recv_read() to process incoming
- * messages.
+ * dispatcher_send_message() function. The receiving thread should create a
+ * watch (see dispatcher_create_watch()) which processes incoming messages.
  */
 struct Dispatcher
 {
@@ -19,6 +19,7 @@
 #define DISPLAY_CHANNEL_PRIVATE_H_
 
 #include "display-channel.h"
+#include "image-compress-cache.h"
 
 #define TRACE_ITEMS_SHIFT 3
 #define NUM_TRACE_ITEMS (1 << TRACE_ITEMS_SHIFT)
@@ -42,10 +43,13 @@ typedef struct RedSurface {
      * which drawables overlap, and to exclude regions of drawables that are
      * obscured by other drawables */
     Ring current;
+    /* Spatial index of the top level items of 'current' */
+    RingIndex current_index;
     /* A ring of pending Drawables associated with this surface. This ring is
      * actually used for drawing. The ring is maintained in order of age, the
      * tail being the oldest drawable. */
     Ring current_list;
+    RingIndex current_list_index;
     DrawContext context;
 
     Ring depend_on_me;
@@ -67,15 +71,60 @@ typedef struct MonitorsConfig {
     QXLHead heads[0];
 } MonitorsConfig;
 
+/* Drawables are allocated from slabs. Slabs are added when all the
+ * drawables are used, as long as the memory budget allows it, and released
+ * when they are no longer used, keeping at least NUM_DRAWABLES drawables */
 #define NUM_DRAWABLES 1000
+#define DRAWABLES_PER_SLAB 128
+#define DRAWABLES_MIN_SLABS ((NUM_DRAWABLES + DRAWABLES_PER_SLAB - 1) / DRAWABLES_PER_SLAB)
+/* Default memory budget for the drawables, enough for 8 times
+ * NUM_DRAWABLES drawables so the pool can grow during bursts. It can be
+ * changed with spice_server_set_drawables_memory() */
+#define DRAWABLES_MEMORY_BUDGET (8 * DRAWABLES_MIN_SLABS * sizeof(DrawableSlab))
+
+/* Default size of the cache of the images compressed for the clients, can
+ * be changed with spice_server_set_compress_cache_memory() */
+#define COMPRESS_CACHE_MEMORY_BUDGET (16 * 1024 * 1024)
+
+typedef struct DrawableSlab DrawableSlab;
 typedef struct _Drawable _Drawable;
 struct _Drawable {
     union {
         Drawable drawable;
         _Drawable *next;
     } u;
+    DrawableSlab *slab;
 };
 
+struct DrawableSlab {
+    /* in DrawablePool::free_slabs while some drawables are free */
+    RingItem link;
+    /* in DrawablePool::slabs */
+    RingItem pool_link;
+    _Drawable *free_drawables;
+    uint32_t num_used;
+    _Drawable drawables[DRAWABLES_PER_SLAB];
+};
+
+typedef struct DrawablePool {
+    /* Slabs with free drawables. Drawables are taken from the head, slabs
+     * getting empty are moved to the tail so they can be released */
+    Ring free_slabs;
+    /* all the slabs */
+    Ring slabs;
+    uint32_t num_slabs;
+    uint32_t num_empty_slabs;
+    uint32_t min_slabs;
+    uint32_t max_slabs;
+    /* highest number of drawables used at the same time */
+    uint32_t peak_count;
+
+    RedStatCounter slabs_allocated_counter;
+    RedStatCounter slabs_released_counter;
+    /* allocations which had to render and release an older drawable */
+    RedStatCounter exhausted_counter;
+} DrawablePool;
+
 struct DisplayChannelPrivate
 {
     DisplayChannel *pub;
@@ -98,8 +147,7 @@ struct DisplayChannelPrivate
     Ring current_list;
 
     uint32_t drawable_count;
-    _Drawable drawables[NUM_DRAWABLES];
-    _Drawable *free_drawables;
+    DrawablePool drawable_pool;
 
     int stream_video;
     GArray *video_codecs;
@@ -116,9 +164,14 @@ struct DisplayChannelPrivate
     SpiceImageSurfaces image_surfaces;
 
     ImageCache image_cache;
+    /* images compressed once and sent to all the clients */
+    ImageCompressCache compress_cache;
 
     int gl_draw_async_count;
 
+    /* whether walks of the tree use the surface indexes to skip items */
+    bool tree_index;
+
 /* TODO: some day unify this, make it more runtime.. */
     stat_info_t add_stat;
     stat_info_t exclude_stat;
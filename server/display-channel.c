@@ -85,6 +85,8 @@ display_channel_set_property(GObject *object,
     }
 }
 
+static void drawables_destroy(DisplayChannel *display);
+
 static void
 display_channel_finalize(GObject *object)
 {
@@ -95,14 +97,9 @@ display_channel_finalize(GObject *object)
 
     if (spice_extra_checks) {
         unsigned int count;
-        _Drawable *drawable;
         VideoStream *stream;
 
-        count = 0;
-        for (drawable = self->priv->free_drawables; drawable; drawable = drawable->u.next) {
-            ++count;
-        }
-        spice_assert(count == NUM_DRAWABLES);
+        spice_assert(self->priv->drawable_count == 0);
 
         count = 0;
         for (stream = self->priv->free_streams; stream; stream = stream->next) {
@@ -116,6 +113,8 @@ display_channel_finalize(GObject *object)
         }
     }
 
+    drawables_destroy(self);
+    image_compress_cache_clear(&self->priv->compress_cache);
     monitors_config_unref(self->priv->monitors_config);
     g_array_unref(self->priv->video_codecs);
     g_free(self->priv);
@@ -428,8 +427,12 @@ static void current_add_drawable(DisplayChannel *display,
 
     surface = &display->priv->surfaces[surface_id];
     ring_add_after(&drawable->tree_item.base.siblings_link, pos);
+    if (!drawable->tree_item.base.container) {
+        ring_index_add(&surface->current_index, &drawable->tree_item.base.siblings_link);
+    }
     ring_add(&display->priv->current_list, &drawable->list_link);
     ring_add(&surface->current_list, &drawable->surface_list_link);
+    ring_index_add(&surface->current_list_index, &drawable->surface_list_link);
     drawable->refs++;
 }
 
@@ -440,8 +443,10 @@ static void current_remove_drawable(DisplayChannel *display, Drawable *item)
     /* todo: move all to unref? */
     video_stream_trace_add_drawable(display, item);
     draw_item_remove_shadow(&item->tree_item);
+    ring_index_remove(&item->tree_item.base.siblings_link, &item->tree_item.base.index_entry);
     ring_remove(&item->tree_item.base.siblings_link);
     ring_remove(&item->list_link);
+    ring_index_remove(&item->surface_list_link, &item->surface_list_entry);
     ring_remove(&item->surface_list_link);
     drawable_unref(item);
 }
@@ -764,6 +769,23 @@ static void __exclude_region(DisplayChannel *display, Ring *ring, TreeItem *item
     stat_add(&display->priv->__exclude_stat, start_time);
 }
 
+/* Return the first item of the tree from @ring_item, included, which may
+ * intersect @area, skipping the items of the surface index which cannot.
+ * Only the top level items are indexed, children of containers are never
+ * skipped. @stop is never skipped */
+static RingItem *current_skip(DisplayChannel *display, RingItem *ring_item,
+                              const pixman_box32_t *area, TreeItem *stop)
+{
+    TreeItem *item;
+
+    if (!ring_item || !display->priv->tree_index) {
+        return ring_item;
+    }
+    item = SPICE_CONTAINEROF(ring_item, TreeItem, siblings_link);
+    return ring_index_skip(ring_item, &item->index_entry, area,
+                           stop ? &stop->siblings_link : NULL);
+}
+
 /* This function iterates through the given @ring starting at @ring_item and
  * continuing until reaching @last. and calls __exclude_region() on each item.
  * Any items that have an empty region as a result of the __exclude_region()
@@ -848,7 +870,8 @@ static void exclude_region(DisplayChannel *display, Ring *ring, RingItem *ring_i
         /* if this is the last item to check, or if the current ring is
          * completed, don't go any further */
         while ((last && *last == (TreeItem *)ring_item) ||
-               !(ring_item = ring_next(ring, ring_item))) {
+               !(ring_item = current_skip(display, ring_next(ring, ring_item), &rgn->extents,
+                                          last ? *last : NULL))) {
             /* we're currently iterating the top ring, so we're done */
             if (ring == top_ring) {
                 stat_add(&display->priv->exclude_stat, start_time);
@@ -893,6 +916,8 @@ static bool current_add_with_shadow(DisplayChannel *display, Ring *ring, Drawabl
 
     /* Prepend the shadow to the beginning of the current ring */
     ring_add(ring, &shadow->base.siblings_link);
+    ring_index_add(&display->priv->surfaces[item->surface_id].current_index,
+                   &shadow->base.siblings_link);
     /* Prepend the draw item to the beginning of the current ring. NOTE: this
      * means that the drawable is placed *before* its associated shadow in the
      * tree. Changing this order will violate several unstated assumptions */
@@ -928,7 +953,7 @@ static bool current_add(DisplayChannel *display, Ring *ring, Drawable *drawable)
 
     spice_assert(!region_is_empty(&item->base.rgn));
     region_init(&exclude_rgn);
-    now = ring_next(ring, ring);
+    now = current_skip(display, ring_next(ring, ring), &item->base.rgn.extents, NULL);
 
     /* check whether the new drawable region intersects any of the items
      * already in the 'current' ring */
@@ -939,7 +964,7 @@ static bool current_add(DisplayChannel *display, Ring *ring, Drawable *drawable)
         if (!region_bounds_intersects(&item->base.rgn, &sibling->rgn)) {
             /* the bounds of the two items are totally disjoint, so no need to
              * check further. check the next item */
-            now = ring_next(ring, now);
+            now = current_skip(display, ring_next(ring, now), &item->base.rgn.extents, NULL);
             continue;
         }
         /* bounds overlap, but check whether the regions actually overlap */
@@ -947,7 +972,7 @@ static bool current_add(DisplayChannel *display, Ring *ring, Drawable *drawable)
         if (!(test_res & REGION_TEST_SHARED)) {
             /* there's no overlap of the regions between these two items. Move
              * on to the next one. */
-            now = ring_next(ring, now);
+            now = current_skip(display, ring_next(ring, now), &item->base.rgn.extents, NULL);
             continue;
         } else if (sibling->type != TREE_ITEM_TYPE_SHADOW) {
             /* there is an overlap between the two regions */
@@ -1590,34 +1615,135 @@ void display_channel_free_some(DisplayChannel *display)
     }
 }
 
+static DrawableSlab *drawable_slab_new(DrawablePool *pool)
+{
+    DrawableSlab *slab;
+    int i;
+
+    if (pool->num_slabs >= pool->max_slabs) {
+        return NULL;
+    }
+
+    slab = g_new(DrawableSlab, 1);
+    slab->free_drawables = NULL;
+    slab->num_used = 0;
+    for (i = DRAWABLES_PER_SLAB - 1; i >= 0; i--) {
+        slab->drawables[i].slab = slab;
+        slab->drawables[i].u.next = slab->free_drawables;
+        slab->free_drawables = &slab->drawables[i];
+    }
+    ring_item_init(&slab->link);
+    ring_add(&pool->free_slabs, &slab->link);
+    ring_item_init(&slab->pool_link);
+    ring_add(&pool->slabs, &slab->pool_link);
+    pool->num_slabs++;
+    pool->num_empty_slabs++;
+    stat_inc_counter(pool->slabs_allocated_counter, 1);
+    return slab;
+}
+
+static void drawable_slab_free(DrawablePool *pool, DrawableSlab *slab)
+{
+    spice_assert(slab->num_used == 0);
+
+    ring_remove(&slab->link);
+    ring_remove(&slab->pool_link);
+    pool->num_slabs--;
+    pool->num_empty_slabs--;
+    stat_inc_counter(pool->slabs_released_counter, 1);
+    g_free(slab);
+}
+
 static Drawable* drawable_try_new(DisplayChannel *display)
 {
-    Drawable *drawable;
+    DrawablePool *pool = &display->priv->drawable_pool;
+    RingItem *link = ring_get_head(&pool->free_slabs);
+    DrawableSlab *slab;
+    _Drawable *drawable;
 
-    if (!display->priv->free_drawables)
+    if (link) {
+        slab = SPICE_CONTAINEROF(link, DrawableSlab, link);
+    } else if (!(slab = drawable_slab_new(pool))) {
         return NULL;
+    }
 
-    drawable = &display->priv->free_drawables->u.drawable;
-    display->priv->free_drawables = display->priv->free_drawables->u.next;
+    drawable = slab->free_drawables;
+    slab->free_drawables = drawable->u.next;
+    if (slab->num_used++ == 0) {
+        pool->num_empty_slabs--;
+    }
+    if (!slab->free_drawables) {
+        ring_remove(&slab->link);
+    }
     display->priv->drawable_count++;
+    pool->peak_count = MAX(pool->peak_count, display->priv->drawable_count);
 
-    return drawable;
+    return &drawable->u.drawable;
 }
 
 static void drawable_free(DisplayChannel *display, Drawable *drawable)
 {
-    ((_Drawable *)drawable)->u.next = display->priv->free_drawables;
-    display->priv->free_drawables = (_Drawable *)drawable;
+    DrawablePool *pool = &display->priv->drawable_pool;
+    _Drawable *item = SPICE_CONTAINEROF(drawable, _Drawable, u.drawable);
+    DrawableSlab *slab = item->slab;
+
+    if (!slab->free_drawables) {
+        /* the slab was full, allocate from it first to keep the others
+         * getting empty */
+        ring_add(&pool->free_slabs, &slab->link);
+    }
+    item->u.next = slab->free_drawables;
+    slab->free_drawables = item;
+    display->priv->drawable_count--;
+
+    if (--slab->num_used != 0) {
+        return;
+    }
+    pool->num_empty_slabs++;
+    /* release the slabs beyond the minimum, keeping a spare one to not
+     * allocate it again with the next drawable */
+    if (pool->num_slabs > pool->max_slabs ||
+        (pool->num_slabs > pool->min_slabs && pool->num_empty_slabs > 1)) {
+        drawable_slab_free(pool, slab);
+        return;
+    }
+    ring_remove(&slab->link);
+    ring_add_before(&slab->link, &pool->free_slabs);
+}
+
+static void drawables_set_memory_budget(DisplayChannel *display, uint64_t budget)
+{
+    DrawablePool *pool = &display->priv->drawable_pool;
+
+    pool->max_slabs = MAX(budget / sizeof(DrawableSlab), 1);
+    pool->min_slabs = MIN(DRAWABLES_MIN_SLABS, pool->max_slabs);
 }
 
 static void drawables_init(DisplayChannel *display)
 {
-    int i;
+    ring_init(&display->priv->drawable_pool.free_slabs);
+    ring_init(&display->priv->drawable_pool.slabs);
+    drawables_set_memory_budget(display, DRAWABLES_MEMORY_BUDGET);
+}
+
+static void drawables_destroy(DisplayChannel *display)
+{
+    DrawablePool *pool = &display->priv->drawable_pool;
+    RingItem *link;
+
+    if (display->priv->drawable_count != 0) {
+        spice_warning("%u drawables still used", display->priv->drawable_count);
+    }
+    while ((link = ring_get_head(&pool->slabs))) {
+        DrawableSlab *slab = SPICE_CONTAINEROF(link, DrawableSlab, pool_link);
 
-    display->priv->free_drawables = NULL;
-    for (i = 0; i < NUM_DRAWABLES; i++) {
-        drawable_free(display, &display->priv->drawables[i].u.drawable);
+        ring_remove(&slab->pool_link);
+        if (ring_item_is_linked(&slab->link)) {
+            ring_remove(&slab->link);
+        }
+        g_free(slab);
     }
+    pool->num_slabs = pool->num_empty_slabs = 0;
 }
 
 /**
@@ -1630,9 +1756,12 @@ static Drawable *display_channel_drawable_try_new(DisplayChannel *display,
 {
     Drawable *drawable;
 
-    while (!(drawable = drawable_try_new(display))) {
-        if (!free_one_drawable(display, FALSE))
-            return NULL;
+    if (!(drawable = drawable_try_new(display))) {
+        stat_inc_counter(display->priv->drawable_pool.exhausted_counter, 1);
+        do {
+            if (!free_one_drawable(display, FALSE))
+                return NULL;
+        } while (!(drawable = drawable_try_new(display)));
     }
 
     memset(drawable, 0, sizeof(Drawable));
@@ -1648,6 +1777,7 @@ static Drawable *display_channel_drawable_try_new(DisplayChannel *display,
     drawable->tree_item.base.type = TREE_ITEM_TYPE_DRAWABLE;
     region_init(&drawable->tree_item.base.rgn);
     glz_retention_init(&drawable->glz_retention);
+    ring_init(&drawable->compressed_images);
     drawable->process_commands_generation = process_commands_generation;
 
     return drawable;
@@ -1709,12 +1839,13 @@ void drawable_unref(Drawable *drawable)
     display_channel_surface_unref(display, drawable->surface_id);
 
     glz_retention_detach_drawables(&drawable->glz_retention);
+    image_compress_cache_drop_owner(&display->priv->compress_cache,
+                                    &drawable->compressed_images);
 
     if (drawable->red_drawable) {
         red_drawable_unref(drawable->red_drawable);
     }
     drawable_free(display, drawable);
-    display->priv->drawable_count--;
 }
 
 static void drawable_deps_draw(DisplayChannel *display, Drawable *drawable)
@@ -1916,22 +2047,41 @@ static void draw_until(DisplayChannel *display, RedSurface *surface, Drawable *l
     } while (now != last);
 }
 
+/* Skip the drawables of Surface::current_list from @ring_item, included,
+ * which cannot intersect @area */
+static RingItem *current_list_skip(DisplayChannel *display, RingItem *ring_item,
+                                   const pixman_box32_t *area)
+{
+    Drawable *drawable;
+
+    if (!ring_item || !display->priv->tree_index) {
+        return ring_item;
+    }
+    drawable = SPICE_CONTAINEROF(ring_item, Drawable, surface_list_link);
+    return ring_index_skip(ring_item, &drawable->surface_list_entry, area, NULL);
+}
+
 /* Find the first Drawable in the @current ring that intersects the given
  * @area, starting at item @from (or the head of the ring if @from is NULL).
  *
  * NOTE: this function expects @current to be a ring of Drawables, and more
  * specifically an instance of Surface::current_list (not Surface::current) */
-static Drawable* current_find_intersects_rect(Ring *current, RingItem *from,
+static Drawable* current_find_intersects_rect(DisplayChannel *display,
+                                              Ring *current, RingItem *from,
                                               const SpiceRect *area)
 {
     RingItem *it;
     QRegion rgn;
     Drawable *last = NULL;
+    const pixman_box32_t *box;
 
     region_init(&rgn);
     region_add(&rgn, area);
+    box = &rgn.extents;
 
-    for (it = from ? from : ring_next(current, current); it != NULL; it = ring_next(current, it)) {
+    for (it = current_list_skip(display, from ? from : ring_next(current, current), box);
+         it != NULL;
+         it = current_list_skip(display, ring_next(current, it), box)) {
         Drawable *now = SPICE_CONTAINEROF(it, Drawable, surface_list_link);
         if (region_intersects(&rgn, &now->tree_item.base.rgn)) {
             last = now;
@@ -1983,7 +2133,7 @@ void display_channel_draw_until(DisplayChannel *display, const SpiceRect *area,
     if (!surface_last)
         return;
 
-    last = current_find_intersects_rect(&surface->current_list,
+    last = current_find_intersects_rect(display, &surface->current_list,
                                         &surface_last->surface_list_link, area);
     if (!last)
         return;
@@ -2004,7 +2154,7 @@ void display_channel_draw(DisplayChannel *display, const SpiceRect *area, int su
 
     surface = &display->priv->surfaces[surface_id];
 
-    last = current_find_intersects_rect(&surface->current_list, NULL, area);
+    last = current_find_intersects_rect(display, &surface->current_list, NULL, area);
     if (last)
         draw_until(display, surface, last);
 
@@ -2152,6 +2302,16 @@ create_canvas_for_surface(DisplayChannel *display, RedSurface *surface, uint32_t
     return NULL;
 }
 
+static const pixman_box32_t *tree_item_get_bounds(RingItem *link)
+{
+    return &SPICE_CONTAINEROF(link, TreeItem, siblings_link)->rgn.extents;
+}
+
+static const pixman_box32_t *drawable_get_bounds(RingItem *link)
+{
+    return &SPICE_CONTAINEROF(link, Drawable, surface_list_link)->tree_item.base.rgn.extents;
+}
+
 void display_channel_create_surface(DisplayChannel *display, uint32_t surface_id, uint32_t width,
                                     uint32_t height, int32_t stride, uint32_t format,
                                     void *line_0, int data_is_valid, int send_client)
@@ -2176,7 +2336,13 @@ void display_channel_create_surface(DisplayChannel *display, uint32_t surface_id
     g_warn_if_fail(surface->create_cmd == NULL);
     g_warn_if_fail(surface->destroy_cmd == NULL);
     ring_init(&surface->current);
+    ring_index_init(&surface->current_index, &surface->current,
+                    RING_INDEX_ENTRY_OFFSET(TreeItem, siblings_link, index_entry),
+                    tree_item_get_bounds);
     ring_init(&surface->current_list);
+    ring_index_init(&surface->current_list_index, &surface->current_list,
+                    RING_INDEX_ENTRY_OFFSET(Drawable, surface_list_link, surface_list_entry),
+                    drawable_get_bounds);
     ring_init(&surface->depend_on_me);
     region_init(&surface->draw_dirty_region);
     surface->refs = 1;
@@ -2279,6 +2445,7 @@ display_channel_init(DisplayChannel *self)
     self->priv->pub = self;
     self->priv->renderer = RED_RENDERER_INVALID;
     self->priv->stream_video = SPICE_STREAM_VIDEO_OFF;
+    self->priv->tree_index = TRUE;
 
     image_encoder_shared_init(&self->priv->encoder_shared_data);
 
@@ -2287,6 +2454,7 @@ display_channel_init(DisplayChannel *self)
     self->priv->image_surfaces.ops = &image_surfaces_ops;
 
     image_cache_init(&self->priv->image_cache);
+    image_compress_cache_init(&self->priv->compress_cache, COMPRESS_CACHE_MEMORY_BUDGET);
     display_channel_init_video_streams(self);
 }
 
@@ -2311,6 +2479,18 @@ display_channel_constructed(GObject *object)
                       "add_to_cache", TRUE);
     stat_init_counter(&self->priv->non_cache_counter, reds, stat,
                       "non_cache", TRUE);
+    stat_init_counter(&self->priv->drawable_pool.slabs_allocated_counter, reds, stat,
+                      "drawable_slabs_allocated", TRUE);
+    stat_init_counter(&self->priv->drawable_pool.slabs_released_counter, reds, stat,
+                      "drawable_slabs_released", TRUE);
+    stat_init_counter(&self->priv->drawable_pool.exhausted_counter, reds, stat,
+                      "drawable_pool_exhausted", TRUE);
+    stat_init_counter(&self->priv->compress_cache.hits_counter, reds, stat,
+                      "compress_cache_hits", TRUE);
+    stat_init_counter(&self->priv->compress_cache.misses_counter, reds, stat,
+                      "compress_cache_misses", TRUE);
+    stat_init_counter(&self->priv->compress_cache.evictions_counter, reds, stat,
+                      "compress_cache_evictions", TRUE);
 
     red_channel_set_cap(channel, SPICE_DISPLAY_CAP_MONITORS_CONFIG);
     red_channel_set_cap(channel, SPICE_DISPLAY_CAP_PREF_COMPRESSION);
@@ -2547,9 +2727,12 @@ void display_channel_debug_oom(DisplayChannel *display, const char *msg)
 {
     RedChannel *channel = RED_CHANNEL(display);
 
-    spice_debug("%s #draw=%u, #glz_draw=%u current %u pipes %u",
+    spice_debug("%s #draw=%u (peak %u, %u/%u slabs), #glz_draw=%u current %u pipes %u",
                 msg,
                 display->priv->drawable_count,
+                display->priv->drawable_pool.peak_count,
+                display->priv->drawable_pool.num_slabs,
+                display->priv->drawable_pool.max_slabs,
                 display->priv->encoder_shared_data.glz_drawable_count,
                 ring_get_length(&display->priv->current_list),
                 red_channel_sum_pipes_size(channel));
@@ -2660,3 +2843,25 @@ void display_channel_set_image_compression(DisplayChannel *display,
 {
     display->priv->image_compression = image_compression;
 }
+
+void display_channel_set_drawables_memory(DisplayChannel *display, uint64_t budget)
+{
+    drawables_set_memory_budget(display, budget);
+}
+
+void display_channel_get_drawables_count(DisplayChannel *display,
+                                         uint32_t *count, uint32_t *peak)
+{
+    *count = display->priv->drawable_count;
+    *peak = display->priv->drawable_pool.peak_count;
+}
+
+void display_channel_set_compress_cache_memory(DisplayChannel *display, uint64_t max_size)
+{
+    image_compress_cache_set_max_size(&display->priv->compress_cache, max_size);
+}
+
+void display_channel_set_tree_index(DisplayChannel *display, bool enable)
+{
+    display->priv->tree_index = enable;
+}
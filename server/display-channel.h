@@ -72,12 +72,16 @@ typedef struct DependItem {
 struct Drawable {
     uint32_t refs;
     RingItem surface_list_link;
+    RingIndexEntry surface_list_entry;
     RingItem list_link;
     DrawItem tree_item;
     GList *pipes;
     RedDrawable *red_drawable;
 
     GlzImageRetention glz_retention;
+    /* entries of DisplayChannelPrivate::compress_cache for the images of
+     * the drawable */
+    Ring compressed_images;
 
     red_time_t creation_time;
     red_time_t first_frame_time;
@@ -161,6 +165,19 @@ void display_channel_debug_oom(DisplayChannel *display, const char *msg);
 void display_channel_update_qxl_running(DisplayChannel *display, bool running);
 void display_channel_set_image_compression(DisplayChannel *display,
                                            SpiceImageCompression image_compression);
+/* Set the maximum memory, in bytes, used for the drawables. Beyond that
+ * older drawables are rendered to make room for new ones */
+void display_channel_set_drawables_memory(DisplayChannel *display, uint64_t budget);
+/* Return the number of drawables used and the highest number used at the
+ * same time, for testing purposes */
+void display_channel_get_drawables_count(DisplayChannel *display,
+                                         uint32_t *count, uint32_t *peak);
+/* Set the maximum memory, in bytes, used to keep the images compressed for
+ * a client so the other clients can send them without compressing again */
+void display_channel_set_compress_cache_memory(DisplayChannel *display, uint64_t max_size);
+/* Enable or disable the use of the surface indexes to skip the items of
+ * the tree not intersecting an area, for testing purposes */
+void display_channel_set_tree_index(DisplayChannel *display, bool enable);
 
 G_END_DECLS
 
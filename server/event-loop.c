@@ -89,8 +89,10 @@ static GIOCondition spice_event_to_giocondition(int event_mask)
 {
     GIOCondition condition = 0;
 
+    /* errors are reported as read events, the read returning the error.
+     * The completions of the zerocopy writes are signalled this way too */
     if (event_mask & SPICE_WATCH_EVENT_READ)
-        condition |= G_IO_IN;
+        condition |= G_IO_IN | G_IO_ERR;
     if (event_mask & SPICE_WATCH_EVENT_WRITE)
         condition |= G_IO_OUT;
 
@@ -101,7 +103,7 @@ static int giocondition_to_spice_event(GIOCondition condition)
 {
     int event = 0;
 
-    if (condition & G_IO_IN)
+    if (condition & (G_IO_IN | G_IO_ERR))
         event |= SPICE_WATCH_EVENT_READ;
     if (condition & G_IO_OUT)
         event |= SPICE_WATCH_EVENT_WRITE;
@@ -0,0 +1,201 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 agent <agent@local>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include <config.h>
+
+#include <pthread.h>
+#include <signal.h>
+// compatibility for FreeBSD
+#ifdef HAVE_PTHREAD_NP_H
+#include <pthread_np.h>
+#define pthread_setname_np pthread_set_name_np
+#endif
+
+#include "handshake-pool.h"
+
+typedef struct HandshakePoolThread {
+    pthread_t thread;
+    SpiceCoreInterfaceInternal core;
+    GMainLoop *loop;
+} HandshakePoolThread;
+
+struct HandshakePool {
+    unsigned int num_threads;
+    /* thread to use for the next handshake */
+    unsigned int next_thread;
+    HandshakePoolThread *threads;
+
+    pthread_mutex_t lock;
+    /* handshakes in progress and their destroy functions */
+    GHashTable *handshakes;
+};
+
+typedef struct HandshakeJob {
+    HandshakeFunc func;
+    void *opaque;
+    SpiceCoreInterfaceInternal *core;
+} HandshakeJob;
+
+static void *handshake_pool_thread_main(void *opaque)
+{
+    HandshakePoolThread *thread = opaque;
+
+    g_main_context_push_thread_default(thread->core.main_context);
+    g_main_loop_run(thread->loop);
+    g_main_context_pop_thread_default(thread->core.main_context);
+
+    return NULL;
+}
+
+static void handshake_pool_thread_free(HandshakePoolThread *thread)
+{
+    g_main_loop_unref(thread->loop);
+    g_main_context_unref(thread->core.main_context);
+}
+
+HandshakePool *handshake_pool_new(unsigned int num_threads)
+{
+    HandshakePool *pool;
+    unsigned int i;
+#ifndef _WIN32
+    sigset_t thread_sig_mask;
+    sigset_t curr_sig_mask;
+#endif
+
+    spice_return_val_if_fail(num_threads > 0, NULL);
+
+    pool = g_new0(HandshakePool, 1);
+    pool->threads = g_new0(HandshakePoolThread, num_threads);
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->handshakes = g_hash_table_new(NULL, NULL);
+
+#ifndef _WIN32
+    sigfillset(&thread_sig_mask);
+    sigdelset(&thread_sig_mask, SIGILL);
+    sigdelset(&thread_sig_mask, SIGFPE);
+    sigdelset(&thread_sig_mask, SIGSEGV);
+    pthread_sigmask(SIG_SETMASK, &thread_sig_mask, &curr_sig_mask);
+#endif
+    for (i = 0; i < num_threads; i++) {
+        HandshakePoolThread *thread = &pool->threads[i];
+        int r;
+
+        thread->core = event_loop_core;
+        thread->core.main_context = g_main_context_new();
+        thread->loop = g_main_loop_new(thread->core.main_context, FALSE);
+        if ((r = pthread_create(&thread->thread, NULL, handshake_pool_thread_main, thread))) {
+            spice_warning("create handshake thread failed %d", r);
+            handshake_pool_thread_free(thread);
+            break;
+        }
+        pthread_setname_np(thread->thread, "SPICE Handshake");
+    }
+#ifndef _WIN32
+    pthread_sigmask(SIG_SETMASK, &curr_sig_mask, NULL);
+#endif
+    pool->num_threads = i;
+
+    if (pool->num_threads == 0) {
+        handshake_pool_free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+static gboolean handshake_pool_thread_quit(gpointer opaque)
+{
+    g_main_loop_quit(opaque);
+    return G_SOURCE_REMOVE;
+}
+
+void handshake_pool_free(HandshakePool *pool)
+{
+    GHashTableIter iter;
+    gpointer opaque, destroy;
+    unsigned int i;
+
+    if (!pool) {
+        return;
+    }
+
+    for (i = 0; i < pool->num_threads; i++) {
+        HandshakePoolThread *thread = &pool->threads[i];
+
+        GSource *source = g_idle_source_new();
+
+        /* not g_main_context_invoke(), the quit would be lost if the
+         * thread did not start running its loop yet */
+        g_source_set_callback(source, handshake_pool_thread_quit, thread->loop, NULL);
+        g_source_attach(source, thread->core.main_context);
+        g_source_unref(source);
+        pthread_join(thread->thread, NULL);
+    }
+
+    /* the threads are stopped, the handshakes are destroyed while their
+     * main contexts are still there for their watches to be removed */
+    g_hash_table_iter_init(&iter, pool->handshakes);
+    while (g_hash_table_iter_next(&iter, &opaque, &destroy)) {
+        g_hash_table_iter_steal(&iter);
+        ((GDestroyNotify) destroy)(opaque);
+    }
+    g_hash_table_unref(pool->handshakes);
+    pthread_mutex_destroy(&pool->lock);
+
+    for (i = 0; i < pool->num_threads; i++) {
+        handshake_pool_thread_free(&pool->threads[i]);
+    }
+    g_free(pool->threads);
+    g_free(pool);
+}
+
+static gboolean handshake_job_run(gpointer opaque)
+{
+    HandshakeJob *job = opaque;
+
+    job->func(job->core, job->opaque);
+    return G_SOURCE_REMOVE;
+}
+
+void handshake_pool_run(HandshakePool *pool, HandshakeFunc func,
+                        GDestroyNotify destroy, void *opaque)
+{
+    HandshakePoolThread *thread = &pool->threads[pool->next_thread];
+    HandshakeJob *job = g_new(HandshakeJob, 1);
+    GSource *source;
+
+    /* the handshakes are short, spreading them is enough */
+    pool->next_thread = (pool->next_thread + 1) % pool->num_threads;
+
+    pthread_mutex_lock(&pool->lock);
+    g_hash_table_insert(pool->handshakes, opaque, destroy);
+    pthread_mutex_unlock(&pool->lock);
+
+    job->func = func;
+    job->opaque = opaque;
+    job->core = &thread->core;
+    source = g_idle_source_new();
+    g_source_set_callback(source, handshake_job_run, job, g_free);
+    g_source_attach(source, thread->core.main_context);
+    g_source_unref(source);
+}
+
+void handshake_pool_release(HandshakePool *pool, void *opaque)
+{
+    pthread_mutex_lock(&pool->lock);
+    g_hash_table_remove(pool->handshakes, opaque);
+    pthread_mutex_unlock(&pool->lock);
+}
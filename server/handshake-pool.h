@@ -0,0 +1,50 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 agent <agent@local>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef HANDSHAKE_POOL_H_
+#define HANDSHAKE_POOL_H_
+
+#include "red-common.h"
+
+/* A pool of threads running the handshakes of the new connections.
+ *
+ * Each thread runs its own main loop. A connection handed to a thread
+ * switches its stream to the core interface of the thread so the TLS
+ * handshake, the link messages and the authentication are processed there
+ * instead of in the main loop. Once authenticated the connection is given
+ * back to the main thread.
+ */
+typedef struct HandshakePool HandshakePool;
+
+typedef void (*HandshakeFunc)(SpiceCoreInterfaceInternal *core, void *opaque);
+
+HandshakePool *handshake_pool_new(unsigned int num_threads);
+/* Stop the threads, the handshakes still in progress are destroyed */
+void handshake_pool_free(HandshakePool *pool);
+
+/* Call @func from one of the threads, passing the core interface to use
+ * for the watches and timers of the handshake.
+ * The handshake is in progress till handshake_pool_release() is called,
+ * @destroy is called for @opaque if the pool is freed before */
+void handshake_pool_run(HandshakePool *pool, HandshakeFunc func,
+                        GDestroyNotify destroy, void *opaque);
+/* The handshake of @opaque is done or aborted, can be called from any
+ * thread */
+void handshake_pool_release(HandshakePool *pool, void *opaque);
+
+#endif /* HANDSHAKE_POOL_H_ */
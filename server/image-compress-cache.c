@@ -0,0 +1,199 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 agent <agent@local>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include <config.h>
+
+#include "image-compress-cache.h"
+
+struct ImageCompressCacheEntry {
+    RingItem link;       /* in ImageCompressCache::entries */
+    RingItem owner_link; /* in the entries of the owner */
+    /* NULL once the entry has been dropped from the cache */
+    ImageCompressCache *cache;
+    uint32_t refs;
+    /* memory used by the compressed buffers */
+    uint64_t size;
+
+    ImageCompressCacheKey key;
+    SpiceImage image;
+    compress_send_data_t comp_data;
+};
+
+static bool key_equal(const ImageCompressCacheKey *a, const ImageCompressCacheKey *b)
+{
+    return a->bitmap == b->bitmap &&
+           a->image_id == b->image_id &&
+           a->compression == b->compression &&
+           a->jpeg == b->jpeg &&
+           (!a->jpeg || a->jpeg_quality == b->jpeg_quality);
+}
+
+ImageCompressCacheEntry *image_compress_cache_entry_ref(ImageCompressCacheEntry *entry)
+{
+    entry->refs++;
+    return entry;
+}
+
+void image_compress_cache_entry_unref(ImageCompressCacheEntry *entry)
+{
+    RedCompressBuf *buf;
+
+    if (--entry->refs != 0) {
+        return;
+    }
+    spice_assert(entry->cache == NULL);
+
+    buf = entry->comp_data.comp_buf;
+    while (buf) {
+        RedCompressBuf *next = buf->send_next;
+        compress_buf_free(buf);
+        buf = next;
+    }
+    g_free(entry);
+}
+
+static void cache_drop_entry(ImageCompressCache *cache, ImageCompressCacheEntry *entry)
+{
+    ring_remove(&entry->link);
+    ring_remove(&entry->owner_link);
+    cache->size -= entry->size;
+    entry->cache = NULL;
+    image_compress_cache_entry_unref(entry);
+}
+
+/* Evict the least recently used entries till @size bytes can be added */
+static void cache_make_room(ImageCompressCache *cache, uint64_t size)
+{
+    RingItem *link;
+
+    while (cache->size + size > cache->max_size &&
+           (link = ring_get_tail(&cache->entries))) {
+        cache_drop_entry(cache, SPICE_CONTAINEROF(link, ImageCompressCacheEntry, link));
+        stat_inc_counter(cache->evictions_counter, 1);
+    }
+}
+
+void image_compress_cache_init(ImageCompressCache *cache, uint64_t max_size)
+{
+    ring_init(&cache->entries);
+    cache->size = 0;
+    cache->max_size = max_size;
+}
+
+void image_compress_cache_clear(ImageCompressCache *cache)
+{
+    RingItem *link;
+
+    while ((link = ring_get_head(&cache->entries))) {
+        cache_drop_entry(cache, SPICE_CONTAINEROF(link, ImageCompressCacheEntry, link));
+    }
+}
+
+void image_compress_cache_set_max_size(ImageCompressCache *cache, uint64_t max_size)
+{
+    cache->max_size = max_size;
+    cache_make_room(cache, 0);
+}
+
+static void entry_fill(ImageCompressCacheEntry *entry,
+                       SpiceImage *dest, compress_send_data_t *o_comp_data)
+{
+    dest->descriptor.type = entry->image.descriptor.type;
+    dest->u = entry->image.u;
+    *o_comp_data = entry->comp_data;
+    o_comp_data->cache_entry = image_compress_cache_entry_ref(entry);
+}
+
+static ImageCompressCacheEntry *cache_find(Ring *owner_entries, const ImageCompressCacheKey *key)
+{
+    RingItem *link;
+
+    RING_FOREACH(link, owner_entries) {
+        ImageCompressCacheEntry *entry =
+            SPICE_CONTAINEROF(link, ImageCompressCacheEntry, owner_link);
+
+        if (key_equal(&entry->key, key)) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+bool image_compress_cache_lookup(ImageCompressCache *cache, Ring *owner_entries,
+                                 const ImageCompressCacheKey *key,
+                                 SpiceImage *dest, compress_send_data_t *o_comp_data)
+{
+    ImageCompressCacheEntry *entry = cache_find(owner_entries, key);
+
+    if (!entry) {
+        stat_inc_counter(cache->misses_counter, 1);
+        return FALSE;
+    }
+    ring_remove(&entry->link);
+    ring_add(&cache->entries, &entry->link);
+    entry_fill(entry, dest, o_comp_data);
+    stat_inc_counter(cache->hits_counter, 1);
+    return TRUE;
+}
+
+bool image_compress_cache_contains(Ring *owner_entries, const ImageCompressCacheKey *key)
+{
+    return cache_find(owner_entries, key) != NULL;
+}
+
+bool image_compress_cache_add(ImageCompressCache *cache, Ring *owner_entries,
+                              const ImageCompressCacheKey *key,
+                              const SpiceImage *dest, compress_send_data_t *o_comp_data)
+{
+    ImageCompressCacheEntry *entry;
+    RedCompressBuf *buf;
+    uint64_t size = 0;
+
+    spice_return_val_if_fail(o_comp_data->cache_entry == NULL, FALSE);
+
+    for (buf = o_comp_data->comp_buf; buf; buf = buf->send_next) {
+        size += sizeof(*buf);
+    }
+    if (size > cache->max_size) {
+        return FALSE;
+    }
+    cache_make_room(cache, size);
+
+    entry = g_new0(ImageCompressCacheEntry, 1);
+    entry->cache = cache;
+    entry->refs = 1;
+    entry->size = size;
+    entry->key = *key;
+    entry->image.descriptor.type = dest->descriptor.type;
+    entry->image.u = dest->u;
+    entry->comp_data = *o_comp_data;
+    ring_add(&cache->entries, &entry->link);
+    ring_add(owner_entries, &entry->owner_link);
+    cache->size += size;
+
+    o_comp_data->cache_entry = image_compress_cache_entry_ref(entry);
+    return TRUE;
+}
+
+void image_compress_cache_drop_owner(ImageCompressCache *cache, Ring *owner_entries)
+{
+    RingItem *link;
+
+    while ((link = ring_get_head(owner_entries))) {
+        cache_drop_entry(cache, SPICE_CONTAINEROF(link, ImageCompressCacheEntry, owner_link));
+    }
+}
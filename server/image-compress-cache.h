@@ -0,0 +1,95 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 agent <agent@local>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAGE_COMPRESS_CACHE_H_
+#define IMAGE_COMPRESS_CACHE_H_
+
+#include <common/ring.h>
+
+#include "image-encoders.h"
+#include "stat.h"
+
+/* Cache of compressed images shared by the clients of a display channel.
+ *
+ * When several clients are connected the same image is sent to each of
+ * them. The result of the first compression is kept so the other clients
+ * with the same settings send the same bytes instead of compressing again.
+ *
+ * The entries are attached to the owner of the image data, usually a
+ * Drawable, and must be dropped with image_compress_cache_drop_owner()
+ * before the data is released. Within an owner the images are identified
+ * by their id and bitmap as the guests can use the same id for different
+ * images. The cache is bounded in size, the least recently used entries are
+ * evicted first. Marshalled entries are refcounted so they can be evicted
+ * while being sent.
+ *
+ * Only compressions not depending on the client state can be cached, GLZ
+ * output depends on the client dictionary.
+ */
+typedef struct ImageCompressCache ImageCompressCache;
+
+typedef struct ImageCompressCacheKey {
+    const SpiceBitmap *bitmap;
+    uint64_t image_id;
+    SpiceImageCompression compression;
+    bool jpeg;
+    int jpeg_quality;
+} ImageCompressCacheKey;
+
+struct ImageCompressCache {
+    /* all the entries, the most recently used first */
+    Ring entries;
+    uint64_t size;
+    uint64_t max_size;
+
+    RedStatCounter hits_counter;
+    RedStatCounter misses_counter;
+    RedStatCounter evictions_counter;
+};
+
+void image_compress_cache_init(ImageCompressCache *cache, uint64_t max_size);
+/* Drop all the entries, the ones being marshalled are released once sent */
+void image_compress_cache_clear(ImageCompressCache *cache);
+void image_compress_cache_set_max_size(ImageCompressCache *cache, uint64_t max_size);
+
+/* Look for the image identified by @key in @owner_entries. On a hit @dest
+ * and @o_comp_data are filled like image_encoders_compress_*() would do,
+ * o_comp_data->cache_entry holding a reference released by
+ * image_compress_cache_entry_unref() */
+bool image_compress_cache_lookup(ImageCompressCache *cache, Ring *owner_entries,
+                                 const ImageCompressCacheKey *key,
+                                 SpiceImage *dest, compress_send_data_t *o_comp_data);
+
+/* Check whether the image identified by @key is in @owner_entries, without
+ * counting it as a use */
+bool image_compress_cache_contains(Ring *owner_entries, const ImageCompressCacheKey *key);
+
+/* Add the result of a compression to the cache. On success the cache takes
+ * the compressed buffers and o_comp_data->cache_entry is set like
+ * image_compress_cache_lookup() does, otherwise @o_comp_data is left as is */
+bool image_compress_cache_add(ImageCompressCache *cache, Ring *owner_entries,
+                              const ImageCompressCacheKey *key,
+                              const SpiceImage *dest, compress_send_data_t *o_comp_data);
+
+/* Drop the entries attached to an owner, its image data being released */
+void image_compress_cache_drop_owner(ImageCompressCache *cache, Ring *owner_entries);
+
+ImageCompressCacheEntry *image_compress_cache_entry_ref(ImageCompressCacheEntry *entry);
+void image_compress_cache_entry_unref(ImageCompressCacheEntry *entry);
+
+#endif /* IMAGE_COMPRESS_CACHE_H_ */
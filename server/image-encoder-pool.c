@@ -0,0 +1,326 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 agent <agent@local>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include <config.h>
+
+#include <pthread.h>
+#include <signal.h>
+// compatibility for FreeBSD
+#ifdef HAVE_PTHREAD_NP_H
+#include <pthread_np.h>
+#define pthread_setname_np pthread_set_name_np
+#endif
+
+#include "image-encoder-pool.h"
+#include "spice-bitmap-utils.h"
+
+typedef enum {
+    JOB_STATE_QUEUED,
+    JOB_STATE_RUNNING,
+    JOB_STATE_DONE,
+} ImageEncoderJobState;
+
+struct ImageEncoderJob {
+    ImageEncoderPool *pool;
+    GList *link; /* link in pool->jobs while queued */
+    ImageEncoderJobState state;
+
+    /* input, the chunks are a copy not owning the pixel data */
+    SpiceBitmap bitmap;
+    SpiceImageCompression compression;
+    bool jpeg;
+    int jpeg_quality;
+
+    /* output */
+    bool compressed;
+    SpiceImage image;
+    compress_send_data_t comp_data;
+};
+
+typedef struct ImageEncoderPoolThread {
+    ImageEncoderPool *pool;
+    pthread_t thread;
+    ImageEncoderSharedData shared_data;
+    ImageEncoders encoders;
+} ImageEncoderPoolThread;
+
+struct ImageEncoderPool {
+    pthread_mutex_t lock;
+    pthread_cond_t job_cond;  /* signalled when a job is queued */
+    pthread_cond_t done_cond; /* signalled when a job is completed */
+    GQueue jobs;
+    bool quit;
+
+    unsigned int num_threads;
+    ImageEncoderPoolThread *threads;
+};
+
+static void image_encoder_job_run(ImageEncoderPoolThread *thread, ImageEncoderJob *job)
+{
+    ImageEncoders *enc = &thread->encoders;
+
+    if (job->jpeg) {
+        enc->jpeg_quality = job->jpeg_quality;
+        job->compressed = image_encoders_compress_jpeg(enc, &job->image, &job->bitmap,
+                                                       &job->comp_data);
+        return;
+    }
+
+    switch (job->compression) {
+    case SPICE_IMAGE_COMPRESSION_QUIC:
+        job->compressed = image_encoders_compress_quic(enc, &job->image, &job->bitmap,
+                                                       &job->comp_data);
+        break;
+    case SPICE_IMAGE_COMPRESSION_LZ:
+        job->compressed = image_encoders_compress_lz(enc, &job->image, &job->bitmap,
+                                                     &job->comp_data);
+        break;
+#ifdef USE_LZ4
+    case SPICE_IMAGE_COMPRESSION_LZ4:
+        job->compressed = image_encoders_compress_lz4(enc, &job->image, &job->bitmap,
+                                                      &job->comp_data);
+        break;
+#endif
+    default:
+        spice_warn_if_reached();
+        job->compressed = FALSE;
+    }
+}
+
+static void *image_encoder_pool_thread_main(void *opaque)
+{
+    ImageEncoderPoolThread *thread = opaque;
+    ImageEncoderPool *pool = thread->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        ImageEncoderJob *job;
+
+        while (!pool->quit && g_queue_is_empty(&pool->jobs)) {
+            pthread_cond_wait(&pool->job_cond, &pool->lock);
+        }
+        if (pool->quit) {
+            break;
+        }
+        job = g_queue_pop_head(&pool->jobs);
+        job->link = NULL;
+        job->state = JOB_STATE_RUNNING;
+        pthread_mutex_unlock(&pool->lock);
+
+        image_encoder_job_run(thread, job);
+
+        pthread_mutex_lock(&pool->lock);
+        job->state = JOB_STATE_DONE;
+        pthread_cond_broadcast(&pool->done_cond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+ImageEncoderPool *image_encoder_pool_new(unsigned int num_threads)
+{
+    ImageEncoderPool *pool;
+    unsigned int i;
+#ifndef _WIN32
+    sigset_t thread_sig_mask;
+    sigset_t curr_sig_mask;
+#endif
+
+    spice_return_val_if_fail(num_threads > 0, NULL);
+
+    pool = g_new0(ImageEncoderPool, 1);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->job_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+    g_queue_init(&pool->jobs);
+    pool->threads = g_new0(ImageEncoderPoolThread, num_threads);
+
+#ifndef _WIN32
+    sigfillset(&thread_sig_mask);
+    sigdelset(&thread_sig_mask, SIGILL);
+    sigdelset(&thread_sig_mask, SIGFPE);
+    sigdelset(&thread_sig_mask, SIGSEGV);
+    pthread_sigmask(SIG_SETMASK, &thread_sig_mask, &curr_sig_mask);
+#endif
+    for (i = 0; i < num_threads; i++) {
+        ImageEncoderPoolThread *thread = &pool->threads[i];
+        int r;
+
+        thread->pool = pool;
+        image_encoder_shared_init(&thread->shared_data);
+        image_encoders_init(&thread->encoders, &thread->shared_data);
+        if ((r = pthread_create(&thread->thread, NULL, image_encoder_pool_thread_main, thread))) {
+            spice_warning("create encoder thread failed %d", r);
+            image_encoders_free(&thread->encoders);
+            break;
+        }
+        pthread_setname_np(thread->thread, "SPICE Encoder");
+    }
+#ifndef _WIN32
+    pthread_sigmask(SIG_SETMASK, &curr_sig_mask, NULL);
+#endif
+    pool->num_threads = i;
+
+    if (pool->num_threads == 0) {
+        image_encoder_pool_free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void image_encoder_pool_free(ImageEncoderPool *pool)
+{
+    unsigned int i;
+
+    if (!pool) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    /* all jobs should be released by their owners at this point */
+    spice_warn_if_fail(g_queue_is_empty(&pool->jobs));
+    pool->quit = TRUE;
+    pthread_cond_broadcast(&pool->job_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->num_threads; i++) {
+        pthread_join(pool->threads[i].thread, NULL);
+        image_encoders_free(&pool->threads[i].encoders);
+    }
+    g_free(pool->threads);
+    g_queue_clear(&pool->jobs);
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_cond_destroy(&pool->job_cond);
+    pthread_mutex_destroy(&pool->lock);
+    g_free(pool);
+}
+
+ImageEncoderJob *image_encoder_pool_submit(ImageEncoderPool *pool,
+                                           const SpiceBitmap *bitmap,
+                                           SpiceImageCompression compression,
+                                           bool jpeg, int jpeg_quality)
+{
+    ImageEncoderJob *job;
+    SpiceChunks *chunks;
+
+    /* the encoders would linearize the chunks in place */
+    spice_return_val_if_fail(!(bitmap->data->flags & SPICE_CHUNKS_FLAGS_UNSTABLE), NULL);
+
+    chunks = spice_chunks_new(bitmap->data->num_chunks);
+    chunks->data_size = bitmap->data->data_size;
+    memcpy(chunks->chunk, bitmap->data->chunk, sizeof(SpiceChunk) * chunks->num_chunks);
+
+    job = g_new0(ImageEncoderJob, 1);
+    job->pool = pool;
+    job->bitmap = *bitmap;
+    job->bitmap.data = chunks;
+    job->compression = compression;
+    job->jpeg = jpeg;
+    job->jpeg_quality = jpeg_quality;
+
+    pthread_mutex_lock(&pool->lock);
+    job->state = JOB_STATE_QUEUED;
+    g_queue_push_tail(&pool->jobs, job);
+    job->link = pool->jobs.tail;
+    pthread_cond_signal(&pool->job_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    return job;
+}
+
+bool image_encoder_job_matches(const ImageEncoderJob *job,
+                               const SpiceBitmap *bitmap,
+                               SpiceImageCompression compression,
+                               bool jpeg, int jpeg_quality)
+{
+    const SpiceBitmap *job_bitmap = &job->bitmap;
+
+    if (job->jpeg != jpeg || (!jpeg && job->compression != compression) ||
+        (jpeg && job->jpeg_quality != jpeg_quality)) {
+        return FALSE;
+    }
+    return job_bitmap->format == bitmap->format &&
+           job_bitmap->flags == bitmap->flags &&
+           job_bitmap->x == bitmap->x &&
+           job_bitmap->y == bitmap->y &&
+           job_bitmap->stride == bitmap->stride &&
+           job_bitmap->data->num_chunks == bitmap->data->num_chunks &&
+           job_bitmap->data->chunk[0].data == bitmap->data->chunk[0].data;
+}
+
+/* Detach the job from the pool, waiting for a running compression.
+ * Returns whether the job was done */
+static bool image_encoder_job_detach(ImageEncoderJob *job)
+{
+    ImageEncoderPool *pool = job->pool;
+    bool done = TRUE;
+
+    pthread_mutex_lock(&pool->lock);
+    if (job->state == JOB_STATE_QUEUED) {
+        g_queue_delete_link(&pool->jobs, job->link);
+        job->link = NULL;
+        done = FALSE;
+    }
+    while (job->state == JOB_STATE_RUNNING) {
+        pthread_cond_wait(&pool->done_cond, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return done;
+}
+
+static void image_encoder_job_free(ImageEncoderJob *job)
+{
+    spice_chunks_destroy(job->bitmap.data);
+    g_free(job);
+}
+
+ImageEncoderJobResult image_encoder_job_take_result(ImageEncoderJob *job,
+                                                    SpiceImage *dest,
+                                                    compress_send_data_t *o_comp_data)
+{
+    ImageEncoderJobResult result;
+
+    if (!image_encoder_job_detach(job)) {
+        result = IMAGE_ENCODER_JOB_NOT_DONE;
+    } else if (!job->compressed) {
+        result = IMAGE_ENCODER_JOB_FAILED;
+    } else {
+        dest->descriptor.type = job->image.descriptor.type;
+        dest->u = job->image.u;
+        *o_comp_data = job->comp_data;
+        result = IMAGE_ENCODER_JOB_COMPRESSED;
+    }
+    image_encoder_job_free(job);
+
+    return result;
+}
+
+void image_encoder_job_cancel(ImageEncoderJob *job)
+{
+    if (image_encoder_job_detach(job) && job->compressed) {
+        RedCompressBuf *buf = job->comp_data.comp_buf;
+
+        while (buf) {
+            RedCompressBuf *next = buf->send_next;
+            compress_buf_free(buf);
+            buf = next;
+        }
+    }
+    image_encoder_job_free(job);
+}
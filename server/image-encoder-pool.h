@@ -0,0 +1,76 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 agent <agent@local>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAGE_ENCODER_POOL_H_
+#define IMAGE_ENCODER_POOL_H_
+
+#include "image-encoders.h"
+
+/* A pool of threads compressing images ahead of time.
+ *
+ * The display worker submits the images of the items it queues to the
+ * client pipes. When an item is marshalled the worker takes the result,
+ * waiting for the compression if it is in progress, or compressing the image
+ * itself if no thread picked the job yet. As items are still marshalled one
+ * after the other the pipe order is preserved.
+ *
+ * Only encoders not depending on the client state can be used: QUIC, JPEG,
+ * LZ and LZ4 for RGB formats. GLZ depends on the client dictionary.
+ */
+typedef struct ImageEncoderPool ImageEncoderPool;
+typedef struct ImageEncoderJob ImageEncoderJob;
+
+typedef enum {
+    /* no thread compressed the image, the caller should compress it */
+    IMAGE_ENCODER_JOB_NOT_DONE,
+    /* the image could not be compressed */
+    IMAGE_ENCODER_JOB_FAILED,
+    IMAGE_ENCODER_JOB_COMPRESSED,
+} ImageEncoderJobResult;
+
+ImageEncoderPool *image_encoder_pool_new(unsigned int num_threads);
+void image_encoder_pool_free(ImageEncoderPool *pool);
+
+/* Queue the compression of @bitmap.
+ * The pixel data of @bitmap must be kept alive till the job is released
+ * with image_encoder_job_take_result() or image_encoder_job_cancel().
+ * If @jpeg is set the image is compressed with JPEG using @jpeg_quality
+ * otherwise @compression is used.
+ */
+ImageEncoderJob *image_encoder_pool_submit(ImageEncoderPool *pool,
+                                           const SpiceBitmap *bitmap,
+                                           SpiceImageCompression compression,
+                                           bool jpeg, int jpeg_quality);
+
+/* Check whether @job is compressing @bitmap the way specified, @jpeg_quality
+ * is only compared for the JPEG jobs */
+bool image_encoder_job_matches(const ImageEncoderJob *job,
+                               const SpiceBitmap *bitmap,
+                               SpiceImageCompression compression,
+                               bool jpeg, int jpeg_quality);
+
+/* Release @job returning its result. If the image was compressed @dest
+ * and @o_comp_data are filled like image_encoders_compress_*() would do */
+ImageEncoderJobResult image_encoder_job_take_result(ImageEncoderJob *job,
+                                                    SpiceImage *dest,
+                                                    compress_send_data_t *o_comp_data);
+
+/* Release @job discarding its result */
+void image_encoder_job_cancel(ImageEncoderJob *job);
+
+#endif /* IMAGE_ENCODER_POOL_H_ */
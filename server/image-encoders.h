@@ -40,6 +40,7 @@ typedef struct ImageEncoders ImageEncoders;
 typedef struct ImageEncoderSharedData ImageEncoderSharedData;
 typedef struct GlzSharedDictionary GlzSharedDictionary;
 typedef struct GlzImageRetention GlzImageRetention;
+typedef struct ImageCompressCacheEntry ImageCompressCacheEntry;
 
 void image_encoder_shared_init(ImageEncoderSharedData *shared_data);
 void image_encoder_shared_stat_reset(ImageEncoderSharedData *shared_data);
@@ -196,6 +197,8 @@ typedef struct compress_send_data_t {
     uint32_t comp_buf_size;
     SpicePalette *lzplt_palette;
     gboolean is_lossy;
+    /* if set the buffers are owned by this shared entry */
+    ImageCompressCacheEntry *cache_entry;
 } compress_send_data_t;
 
 bool image_encoders_compress_quic(ImageEncoders *enc, SpiceImage *dest,
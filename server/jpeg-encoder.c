@@ -22,6 +22,12 @@
 #include "red-common.h"
 #include "jpeg-encoder.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define JPEG_ROW_SIMD
+#include <immintrin.h>
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#endif
+
 struct JpegEncoderContext {
     JpegEncoderUsrContext *usr;
 
@@ -35,7 +41,8 @@ struct JpegEncoderContext {
         int height;
         int stride;
         unsigned int out_size;
-        void (*convert_line_to_RGB24) (void *line, int width, uint8_t **out_line);
+        /* NULL if libjpeg reads the lines as they are */
+        JpegRowConverter convert_line_to_RGB24;
     } cur_image;
 };
 
@@ -106,61 +113,205 @@ void jpeg_encoder_destroy(JpegEncoderContext* encoder)
     g_free(encoder);
 }
 
-static void convert_RGB16_to_RGB24(void *line, int width, uint8_t **out_line)
+/* Line conversions to the RGB24 read by libjpeg. They are only needed for
+ * RGB16, and without the libjpeg-turbo extended color spaces for the others */
+
+static void convert_RGB16_to_RGB24(const uint8_t *src, uint8_t *dest, unsigned int width)
 {
-    uint16_t *src_line = line;
-    uint8_t *out_pix;
-    int x;
+    const uint16_t *src_line = (const uint16_t *) src;
+    unsigned int x;
 
-    spice_assert(out_line && *out_line);
+    for (x = 0; x < width; x++) {
+        uint16_t pixel = GUINT16_FROM_LE(src_line[x]);
 
-    out_pix = *out_line;
+        *dest++ = ((pixel >> 7) & 0xf8) | ((pixel >> 12) & 0x7);
+        *dest++ = ((pixel >> 2) & 0xf8) | ((pixel >> 7) & 0x7);
+        *dest++ = ((pixel << 3) & 0xf8) | ((pixel >> 2) & 0x7);
+    }
+}
+
+static void convert_BGR24_to_RGB24(const uint8_t *src, uint8_t *dest, unsigned int width)
+{
+    unsigned int x;
 
     for (x = 0; x < width; x++) {
-       uint16_t pixel = *src_line++;
-       pixel = GUINT16_FROM_LE(pixel);
-       *out_pix++ = ((pixel >> 7) & 0xf8) | ((pixel >> 12) & 0x7);
-       *out_pix++ = ((pixel >> 2) & 0xf8) | ((pixel >> 7) & 0x7);
-       *out_pix++ = ((pixel << 3) & 0xf8) | ((pixel >> 2) & 0x7);
-   }
+        *dest++ = src[2];
+        *dest++ = src[1];
+        *dest++ = src[0];
+        src += 3;
+    }
 }
 
-static void convert_BGR24_to_RGB24(void *in_line, int width, uint8_t **out_line)
+static void convert_BGRX32_to_RGB24(const uint8_t *src, uint8_t *dest, unsigned int width)
 {
-    int x;
-    uint8_t *out_pix;
-    uint8_t *line = in_line;
-    spice_assert(out_line && *out_line);
-
-    out_pix = *out_line;
+    unsigned int x;
 
     for (x = 0; x < width; x++) {
-        *out_pix++ = line[2];
-        *out_pix++ = line[1];
-        *out_pix++ = line[0];
-        line += 3;
+        *dest++ = src[2];
+        *dest++ = src[1];
+        *dest++ = src[0];
+        src += 4;
     }
 }
 
-static void convert_BGRX32_to_RGB24(void *line, int width, uint8_t **out_line)
+#ifdef JPEG_ROW_SIMD
+/* The kernels below store 16 bytes at once, the bytes past the converted
+ * pixels are rewritten by the next iteration or by the scalar code of the
+ * end of the line. They stop early enough to not write past @dest */
+
+static TARGET_SSSE3 void convert_RGB16_to_RGB24_ssse3(const uint8_t *src, uint8_t *dest,
+                                                      unsigned int width)
 {
-    uint32_t *src_line = line;
-    uint8_t *out_pix;
-    int x;
+    // r0 g0 _ r1 g1 _ ... from r and g packed together, then the blues
+    const __m128i rg_lo = _mm_setr_epi8(0, 8, -1, 1, 9, -1, 2, 10, -1, 3, 11, -1, 4, 12, -1, 5);
+    const __m128i b_lo = _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1);
+    const __m128i rg_hi = _mm_setr_epi8(13, -1, 6, 14, -1, 7, 15, -1,
+                                        -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i b_hi = _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7,
+                                       -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i mask_f8 = _mm_set1_epi16(0xf8);
+    const __m128i mask_7 = _mm_set1_epi16(0x7);
+    unsigned int x;
+
+    for (x = 0; x + 8 <= width; x += 8, src += 16, dest += 24) {
+        __m128i pixels = _mm_loadu_si128((const __m128i *) src);
+        __m128i r = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(pixels, 7), mask_f8),
+                                 _mm_and_si128(_mm_srli_epi16(pixels, 12), mask_7));
+        __m128i g = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(pixels, 2), mask_f8),
+                                 _mm_and_si128(_mm_srli_epi16(pixels, 7), mask_7));
+        __m128i b = _mm_or_si128(_mm_and_si128(_mm_slli_epi16(pixels, 3), mask_f8),
+                                 _mm_and_si128(_mm_srli_epi16(pixels, 2), mask_7));
+        __m128i rg = _mm_packus_epi16(r, g);
+
+        b = _mm_packus_epi16(b, b);
+        _mm_storeu_si128((__m128i *) dest, _mm_or_si128(_mm_shuffle_epi8(rg, rg_lo),
+                                                        _mm_shuffle_epi8(b, b_lo)));
+        _mm_storel_epi64((__m128i *) (dest + 16), _mm_or_si128(_mm_shuffle_epi8(rg, rg_hi),
+                                                               _mm_shuffle_epi8(b, b_hi)));
+    }
+    convert_RGB16_to_RGB24(src, dest, width - x);
+}
 
-    spice_assert(out_line && *out_line);
+static TARGET_SSSE3 void convert_BGR24_to_RGB24_ssse3(const uint8_t *src, uint8_t *dest,
+                                                      unsigned int width)
+{
+    const __m128i swap = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, -1);
+    unsigned int x;
 
-    out_pix = *out_line;
+    // 5 pixels per 16 bytes, the loads also need a 6th pixel
+    for (x = 0; x + 6 <= width; x += 5, src += 15, dest += 15) {
+        __m128i pixels = _mm_loadu_si128((const __m128i *) src);
 
-    for (x = 0; x < width; x++) {
-        uint32_t pixel = *src_line++;
-        pixel = GUINT32_FROM_LE(pixel);
-        *out_pix++ = (pixel >> 16) & 0xff;
-        *out_pix++ = (pixel >> 8) & 0xff;
-        *out_pix++ = pixel & 0xff;
+        _mm_storeu_si128((__m128i *) dest, _mm_shuffle_epi8(pixels, swap));
     }
+    convert_BGR24_to_RGB24(src, dest, width - x);
 }
 
+static TARGET_SSSE3 void convert_BGRX32_to_RGB24_ssse3(const uint8_t *src, uint8_t *dest,
+                                                       unsigned int width)
+{
+    const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    unsigned int x;
+
+    // 4 pixels give 12 bytes, the stores also need a 6th pixel
+    for (x = 0; x + 6 <= width; x += 4, src += 16, dest += 12) {
+        __m128i pixels = _mm_loadu_si128((const __m128i *) src);
+
+        _mm_storeu_si128((__m128i *) dest, _mm_shuffle_epi8(pixels, pack));
+    }
+    convert_BGRX32_to_RGB24(src, dest, width - x);
+}
+#endif /* JPEG_ROW_SIMD */
+
+static bool jpeg_row_convert_impl_supported(JpegRowConvertImpl impl)
+{
+    switch (impl) {
+    case JPEG_ROW_CONVERT_IMPL_AUTO:
+    case JPEG_ROW_CONVERT_IMPL_SCALAR:
+        return true;
+#ifdef JPEG_ROW_SIMD
+    case JPEG_ROW_CONVERT_IMPL_SSSE3:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("ssse3");
+#endif
+    default:
+        return false;
+    }
+}
+
+static JpegRowConvertImpl jpeg_row_convert_get_best_impl(void)
+{
+    static gsize best_impl = 0;
+
+    if (g_once_init_enter(&best_impl)) {
+        JpegRowConvertImpl impl = JPEG_ROW_CONVERT_IMPL_SCALAR;
+
+        if (jpeg_row_convert_impl_supported(JPEG_ROW_CONVERT_IMPL_SSSE3)) {
+            impl = JPEG_ROW_CONVERT_IMPL_SSSE3;
+        }
+        g_once_init_leave(&best_impl, impl);
+    }
+    return best_impl;
+}
+
+JpegRowConverter jpeg_row_converter_get(JpegEncoderImageType type, JpegRowConvertImpl impl)
+{
+    if (impl == JPEG_ROW_CONVERT_IMPL_AUTO) {
+        impl = jpeg_row_convert_get_best_impl();
+    } else if (!jpeg_row_convert_impl_supported(impl)) {
+        return NULL;
+    }
+
+    switch (type) {
+    case JPEG_IMAGE_TYPE_RGB16:
+#ifdef JPEG_ROW_SIMD
+        if (impl == JPEG_ROW_CONVERT_IMPL_SSSE3) {
+            return convert_RGB16_to_RGB24_ssse3;
+        }
+#endif
+        return convert_RGB16_to_RGB24;
+    case JPEG_IMAGE_TYPE_BGR24:
+#ifdef JPEG_ROW_SIMD
+        if (impl == JPEG_ROW_CONVERT_IMPL_SSSE3) {
+            return convert_BGR24_to_RGB24_ssse3;
+        }
+#endif
+        return convert_BGR24_to_RGB24;
+    case JPEG_IMAGE_TYPE_BGRX32:
+#ifdef JPEG_ROW_SIMD
+        if (impl == JPEG_ROW_CONVERT_IMPL_SSSE3) {
+            return convert_BGRX32_to_RGB24_ssse3;
+        }
+#endif
+        return convert_BGRX32_to_RGB24;
+    default:
+        return NULL;
+    }
+}
+
+JpegRowConverter jpeg_encoder_set_input_type(struct jpeg_compress_struct *cinfo,
+                                             JpegEncoderImageType type)
+{
+    cinfo->in_color_space = JCS_RGB;
+    cinfo->input_components = 3;
+
+#ifdef JCS_EXTENSIONS
+    /* the libjpeg-turbo formats give the order of the bytes in memory, which
+     * is the same for our images whatever the endianness */
+    switch (type) {
+    case JPEG_IMAGE_TYPE_BGR24:
+        cinfo->in_color_space = JCS_EXT_BGR;
+        return NULL;
+    case JPEG_IMAGE_TYPE_BGRX32:
+        cinfo->in_color_space = JCS_EXT_BGRX;
+        cinfo->input_components = 4;
+        return NULL;
+    default:
+        break;
+    }
+#endif
+    return jpeg_row_converter_get(type, JPEG_ROW_CONVERT_IMPL_AUTO);
+}
 
 #define FILL_LINES() {                                                  \
     if (lines == lines_end) {                                           \
@@ -175,20 +326,26 @@ static void convert_BGRX32_to_RGB24(void *line, int width, uint8_t **out_line)
 static void do_jpeg_encode(JpegEncoder *jpeg, uint8_t *lines, unsigned int num_lines)
 {
     uint8_t *lines_end;
-    uint8_t *RGB24_line;
+    uint8_t *RGB24_line = NULL;
     int stride, width;
     JSAMPROW row_pointer[1];
     width = jpeg->cur_image.width;
     stride = jpeg->cur_image.stride;
 
-    RGB24_line = g_new(uint8_t, width*3);
+    if (jpeg->cur_image.convert_line_to_RGB24) {
+        RGB24_line = g_new(uint8_t, width*3);
+    }
 
     lines_end = lines + (stride * num_lines);
 
     for (;jpeg->cinfo.next_scanline < jpeg->cinfo.image_height; lines += stride) {
         FILL_LINES();
-        jpeg->cur_image.convert_line_to_RGB24(lines, width, &RGB24_line);
-        row_pointer[0] = RGB24_line;
+        if (RGB24_line) {
+            jpeg->cur_image.convert_line_to_RGB24(lines, RGB24_line, width);
+            row_pointer[0] = RGB24_line;
+        } else {
+            row_pointer[0] = lines;
+        }
         jpeg_write_scanlines(&jpeg->cinfo, row_pointer, 1);
     }
 
@@ -205,24 +362,14 @@ int jpeg_encode(JpegEncoderContext *enc, int quality, JpegEncoderImageType type,
     enc->cur_image.stride = stride;
     enc->cur_image.out_size = 0;
 
-    switch (type) {
-    case JPEG_IMAGE_TYPE_RGB16:
-        enc->cur_image.convert_line_to_RGB24 = convert_RGB16_to_RGB24;
-        break;
-    case JPEG_IMAGE_TYPE_BGR24:
-        enc->cur_image.convert_line_to_RGB24 = convert_BGR24_to_RGB24;
-        break;
-    case JPEG_IMAGE_TYPE_BGRX32:
-        enc->cur_image.convert_line_to_RGB24 = convert_BGRX32_to_RGB24;
-        break;
-    default:
+    if (type != JPEG_IMAGE_TYPE_RGB16 && type != JPEG_IMAGE_TYPE_BGR24 &&
+        type != JPEG_IMAGE_TYPE_BGRX32) {
         spice_error("bad image type");
     }
+    enc->cur_image.convert_line_to_RGB24 = jpeg_encoder_set_input_type(&enc->cinfo, type);
 
     enc->cinfo.image_width = width;
     enc->cinfo.image_height = height;
-    enc->cinfo.input_components = 3;
-    enc->cinfo.in_color_space = JCS_RGB;
     jpeg_set_defaults(&enc->cinfo);
     jpeg_set_quality(&enc->cinfo, quality, TRUE);
 
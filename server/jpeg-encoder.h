@@ -42,6 +42,19 @@ typedef enum {
     JPEG_IMAGE_TYPE_BGRX32,
 } JpegEncoderImageType;
 
+/* Implementations of the line conversions, AUTO selects the fastest one
+ * supported by the CPU */
+typedef enum {
+    JPEG_ROW_CONVERT_IMPL_AUTO,
+    JPEG_ROW_CONVERT_IMPL_SCALAR,
+    JPEG_ROW_CONVERT_IMPL_SSSE3,
+} JpegRowConvertImpl;
+
+/* Converts @width pixels of @src to the RGB24 lines read by libjpeg */
+typedef void (*JpegRowConverter)(const uint8_t *src, uint8_t *dest, unsigned int width);
+
+struct jpeg_compress_struct;
+
 typedef struct JpegEncoderContext JpegEncoderContext;
 typedef struct JpegEncoderUsrContext JpegEncoderUsrContext;
 
@@ -59,4 +72,14 @@ int jpeg_encode(JpegEncoderContext *jpeg, int quality, JpegEncoderImageType type
                 int width, int height, uint8_t *lines, unsigned int num_lines, int stride,
                 uint8_t *io_ptr, unsigned int num_io_bytes);
 
+/* Sets the input color space of @cinfo for lines of the given type, before
+ * jpeg_set_defaults(). Returns the converter to apply to the lines, or NULL if
+ * libjpeg reads them as they are (libjpeg-turbo extended color spaces) */
+JpegRowConverter jpeg_encoder_set_input_type(struct jpeg_compress_struct *cinfo,
+                                             JpegEncoderImageType type);
+
+/* Returns the converter of the lines of the given type to RGB24 using the
+ * given implementation, NULL if the implementation is not supported */
+JpegRowConverter jpeg_row_converter_get(JpegEncoderImageType type, JpegRowConvertImpl impl);
+
 #endif /* JPEG_ENCODER_H_ */
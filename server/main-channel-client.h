@@ -93,6 +93,9 @@ void main_channel_client_handle_pong(MainChannelClient *mcc, SpiceMsgPing *ping,
 /*
  * return TRUE if network test had been completed successfully.
  * If FALSE, bitrate_per_sec is set to MAX_UINT64 and the roundtrip is set to 0
+ *
+ * The test is done once when connecting, the channels then follow their own
+ * connection, see red_channel_client_get_bandwidth()
  */
 int main_channel_client_is_network_info_initialized(MainChannelClient *mcc);
 int main_channel_client_is_low_bandwidth(MainChannelClient *mcc);
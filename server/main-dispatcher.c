@@ -126,6 +126,7 @@ enum {
     MAIN_DISPATCHER_MIGRATE_SEAMLESS_DST_COMPLETE,
     MAIN_DISPATCHER_SET_MM_TIME_LATENCY,
     MAIN_DISPATCHER_CLIENT_DISCONNECT,
+    MAIN_DISPATCHER_LINK_AUTHENTICATED,
 
     MAIN_DISPATCHER_NUM_MESSAGES
 };
@@ -148,6 +149,10 @@ typedef struct MainDispatcherClientDisconnectMessage {
     RedClient *client;
 } MainDispatcherClientDisconnectMessage;
 
+typedef struct MainDispatcherLinkAuthenticatedMessage {
+    RedLinkInfo *link;
+} MainDispatcherLinkAuthenticatedMessage;
+
 /* channel_event - calls core->channel_event, must be done in main thread */
 static void main_dispatcher_handle_channel_event(void *opaque,
                                                  void *payload)
@@ -203,6 +208,15 @@ static void main_dispatcher_handle_client_disconnect(void *opaque,
     g_object_unref(msg->client);
 }
 
+static void main_dispatcher_handle_link_authenticated(void *opaque,
+                                                      void *payload)
+{
+    RedsState *reds = opaque;
+    MainDispatcherLinkAuthenticatedMessage *msg = payload;
+
+    reds_handle_authenticated_link(reds, msg->link);
+}
+
 void main_dispatcher_seamless_migrate_dst_complete(MainDispatcher *self,
                                                    RedClient *client)
 {
@@ -247,6 +261,20 @@ void main_dispatcher_client_disconnect(MainDispatcher *self, RedClient *client)
     }
 }
 
+void main_dispatcher_link_authenticated(MainDispatcher *self, RedLinkInfo *link)
+{
+    MainDispatcherLinkAuthenticatedMessage msg;
+
+    if (pthread_self() == dispatcher_get_thread_id(DISPATCHER(self))) {
+        reds_handle_authenticated_link(self->priv->reds, link);
+        return;
+    }
+
+    msg.link = link;
+    dispatcher_send_message(DISPATCHER(self), MAIN_DISPATCHER_LINK_AUTHENTICATED,
+                            &msg);
+}
+
 /*
  * FIXME:
  * Reds routines shouldn't be exposed. Instead reds.c should register the callbacks,
@@ -282,6 +310,9 @@ void main_dispatcher_constructed(GObject *object)
     dispatcher_register_handler(DISPATCHER(self), MAIN_DISPATCHER_CLIENT_DISCONNECT,
                                 main_dispatcher_handle_client_disconnect,
                                 sizeof(MainDispatcherClientDisconnectMessage), false);
+    dispatcher_register_handler(DISPATCHER(self), MAIN_DISPATCHER_LINK_AUTHENTICATED,
+                                main_dispatcher_handle_link_authenticated,
+                                sizeof(MainDispatcherLinkAuthenticatedMessage), false);
 }
 
 static void main_dispatcher_finalize(GObject *object)
@@ -34,6 +34,7 @@
 typedef struct MainDispatcher MainDispatcher;
 typedef struct MainDispatcherClass MainDispatcherClass;
 typedef struct MainDispatcherPrivate MainDispatcherPrivate;
+typedef struct RedLinkInfo RedLinkInfo;
 
 struct MainDispatcher
 {
@@ -58,6 +59,8 @@ void main_dispatcher_set_mm_time_latency(MainDispatcher *self, RedClient *client
  * that triggered the client destruction.
  */
 void main_dispatcher_client_disconnect(MainDispatcher *self, RedClient *client);
+/* Continue the processing of a link authenticated by a handshake thread */
+void main_dispatcher_link_authenticated(MainDispatcher *self, RedLinkInfo *link);
 
 MainDispatcher* main_dispatcher_new(RedsState *reds);
 
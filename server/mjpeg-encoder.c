@@ -25,6 +25,8 @@
 #include "red-common.h"
 #include "video-encoder.h"
 #include "utils.h"
+#include "jpeg-encoder.h"
+#include "video-rate-control.h"
 
 #define MJPEG_MAX_FPS 25
 #define MJPEG_MIN_FPS 1
@@ -37,19 +39,6 @@ static const int mjpeg_quality_samples[MJPEG_QUALITY_SAMPLE_NUM] = {20, 30, 40,
 
 #define MJPEG_AVERAGE_SIZE_WINDOW 3
 
-#define MJPEG_BIT_RATE_EVAL_MIN_NUM_FRAMES 3
-
-#define MJPEG_SERVER_STATUS_EVAL_FPS_INTERVAL 1
-#define MJPEG_SERVER_STATUS_DOWNGRADE_DROP_FACTOR_TH 0.1
-
-/*
- * acting on positive client reports only if enough frame mm time
- * has passed since the last bit rate change and the report.
- * time
- */
-#define MJPEG_CLIENT_POSITIVE_REPORT_TIMEOUT 2000
-#define MJPEG_CLIENT_POSITIVE_REPORT_STRICT_TIMEOUT 3000
-
 #define MJPEG_ADJUST_FPS_TIMEOUT 500
 
 /*
@@ -58,28 +47,9 @@ static const int mjpeg_quality_samples[MJPEG_QUALITY_SAMPLE_NUM] = {20, 30, 40,
  */
 #define MJPEG_MAX_CLIENT_PLAYBACK_DELAY (MSEC_PER_SEC * 5)
 
-/*
- * The stream starts after lossless frames were sent to the client,
- * and without rate control (except for pipe congestion). Thus, on the beginning
- * of the stream, we might observe frame drops on the client and server side which
- * are not necessarily related to mis-estimation of the bit rate, and we would
- * like to wait till the stream stabilizes.
- */
-#define MJPEG_WARMUP_TIME (NSEC_PER_SEC * 3)
-
 /* The compressed buffer initial size. */
 #define MJPEG_INITIAL_BUFFER_SIZE (32 * 1024)
 
-#ifdef JCS_EXTENSIONS
-#  ifndef WORDS_BIGENDIAN
-#    define JCS_EXT_LE_BGRX JCS_EXT_BGRX
-#    define JCS_EXT_LE_BGR JCS_EXT_BGR
-#  else
-#    define JCS_EXT_LE_BGRX JCS_EXT_XRGB
-#    define JCS_EXT_LE_BGR JCS_EXT_RGB
-#  endif
-#endif
-
 enum {
     MJPEG_QUALITY_EVAL_TYPE_SET,
     MJPEG_QUALITY_EVAL_TYPE_UPGRADE,
@@ -107,28 +77,6 @@ typedef struct MJpegEncoderQualityEval {
     int max_sampled_fps_quality_id;
 } MJpegEncoderQualityEval;
 
-typedef struct MJpegEncoderClientState {
-    int max_video_latency;
-    uint32_t max_audio_latency;
-} MJpegEncoderClientState;
-
-typedef struct MJpegEncoderServerState {
-    uint32_t num_frames_encoded;
-    uint32_t num_frames_dropped;
-} MJpegEncoderServerState;
-
-typedef struct MJpegEncoderBitRateInfo {
-    uint64_t change_start_time;
-    uint64_t last_frame_time;
-    uint32_t change_start_mm_time;
-    int was_upgraded;
-
-    /* gathering data about the frames that
-     * were encoded since the last bit rate change*/
-    uint32_t num_enc_frames;
-    uint64_t sum_enc_size;
-} MJpegEncoderBitRateInfo;
-
 /*
  * Adjusting the stream jpeg quality and frame rate (fps):
  * When during_quality_eval=TRUE, we compress different frames with different
@@ -138,13 +86,12 @@ typedef struct MJpegEncoderBitRateInfo {
  * during_quality_eval is set for new streams and can also be set any time we want
  * to re-evaluate the stream parameters (e.g., when the bit rate and/or
  * compressed frame size significantly change).
+ * The byte rate itself follows the network rate control, see
+ * mjpeg_encoder_follow_bit_rate.
  */
 typedef struct MJpegEncoderRateControl {
     int during_quality_eval;
     MJpegEncoderQualityEval quality_eval_data;
-    MJpegEncoderBitRateInfo bit_rate_info;
-    MJpegEncoderClientState client_state;
-    MJpegEncoderServerState server_state;
 
     uint64_t byte_rate;
     int quality_id;
@@ -161,7 +108,7 @@ typedef struct MJpegEncoderRateControl {
     uint64_t sum_recent_enc_size;
     uint32_t num_recent_enc_frames;
 
-    uint64_t warmup_start_time;
+    uint64_t last_frame_time;
 } MJpegEncoderRateControl;
 
 typedef struct MJpegVideoBuffer {
@@ -179,10 +126,11 @@ typedef struct MJpegEncoder {
     struct jpeg_error_mgr jerr;
 
     unsigned int bytes_per_pixel; /* bytes per pixel of the input buffer */
-    void (*pixel_converter)(void *src, uint8_t *dest);
+    JpegRowConverter row_converter;
 
     MJpegEncoderRateControl rate_control;
     VideoEncoderRateControlCbs cbs;
+    VideoRateControl *bit_rate_control;
 
     /* stats */
     uint64_t starting_bit_rate;
@@ -190,7 +138,6 @@ typedef struct MJpegEncoder {
     uint32_t num_frames;
 } MJpegEncoder;
 
-static void mjpeg_encoder_process_server_drops(MJpegEncoder *encoder);
 static uint32_t get_min_required_playback_delay(const MJpegEncoder *encoder,
                                                 uint64_t frame_enc_size);
 
@@ -217,6 +164,8 @@ static MJpegVideoBuffer* create_mjpeg_video_buffer(void)
 static void mjpeg_encoder_destroy(VideoEncoder *video_encoder)
 {
     MJpegEncoder *encoder = SPICE_CONTAINEROF(video_encoder, MJpegEncoder, base);
+
+    video_rate_control_free(encoder->bit_rate_control);
     g_free(encoder->cinfo.dest);
     jpeg_destroy_compress(&encoder->cinfo);
     g_free(encoder->row);
@@ -228,37 +177,6 @@ static uint8_t mjpeg_encoder_get_bytes_per_pixel(MJpegEncoder *encoder)
     return encoder->bytes_per_pixel;
 }
 
-#ifndef JCS_EXTENSIONS
-/* Pixel conversion routines */
-static void pixel_rgb24bpp_to_24(void *src_ptr, uint8_t *dest)
-{
-    uint8_t *src = src_ptr;
-    /* libjpegs stores rgb, spice/win32 stores bgr */
-    *dest++ = src[2]; /* red */
-    *dest++ = src[1]; /* green */
-    *dest++ = src[0]; /* blue */
-}
-
-static void pixel_rgb32bpp_to_24(void *src, uint8_t *dest)
-{
-    uint32_t pixel = *(uint32_t *)src;
-    pixel = GUINT32_FROM_LE(pixel);
-    *dest++ = (pixel >> 16) & 0xff;
-    *dest++ = (pixel >>  8) & 0xff;
-    *dest++ = (pixel >>  0) & 0xff;
-}
-#endif
-
-static void pixel_rgb16bpp_to_24(void *src, uint8_t *dest)
-{
-    uint16_t pixel = *(uint16_t *)src;
-    pixel = GUINT16_FROM_LE(pixel);
-    *dest++ = ((pixel >> 7) & 0xf8) | ((pixel >> 12) & 0x7);
-    *dest++ = ((pixel >> 2) & 0xf8) | ((pixel >> 7) & 0x7);
-    *dest++ = ((pixel << 3) & 0xf8) | ((pixel >> 2) & 0x7);
-}
-
-
 /* code from libjpeg 8 to handle compression to a memory buffer
  *
  * Copyright (C) 1994-1996, Thomas G. Lane.
@@ -377,9 +295,6 @@ static inline void mjpeg_encoder_reset_quality(MJpegEncoder *encoder,
         rate_control->last_enc_size = 0;
     }
 
-    if (rate_control->quality_eval_data.reason == MJPEG_QUALITY_EVAL_REASON_RATE_CHANGE) {
-        memset(&rate_control->server_state, 0, sizeof(MJpegEncoderServerState));
-    }
     rate_control->quality_id = quality_id;
     memset(&rate_control->quality_eval_data, 0, sizeof(MJpegEncoderQualityEval));
     rate_control->quality_eval_data.max_quality_id = MJPEG_QUALITY_SAMPLE_NUM - 1;
@@ -655,9 +570,69 @@ end:
     if (rate_control->during_quality_eval) {
         quality_eval->encoded_size_by_quality[rate_control->quality_id] = new_avg_enc_size;
         mjpeg_encoder_eval_quality(encoder);
+    }
+}
+
+static void mjpeg_encoder_quality_eval_stop(MJpegEncoder *encoder)
+{
+    MJpegEncoderRateControl *rate_control = &encoder->rate_control;
+    uint32_t quality_id;
+    uint32_t fps;
+
+    if (!rate_control->during_quality_eval) {
+        return;
+    }
+    switch (rate_control->quality_eval_data.type) {
+    case MJPEG_QUALITY_EVAL_TYPE_UPGRADE:
+        quality_id = rate_control->quality_eval_data.min_quality_id;
+        fps = rate_control->quality_eval_data.min_quality_fps;
+        break;
+    case MJPEG_QUALITY_EVAL_TYPE_DOWNGRADE:
+        quality_id = rate_control->quality_eval_data.max_quality_id;
+        fps = rate_control->quality_eval_data.max_quality_fps;
+        break;
+    case MJPEG_QUALITY_EVAL_TYPE_SET:
+        quality_id = MJPEG_QUALITY_SAMPLE_NUM / 2;
+        fps = MJPEG_MAX_FPS / 2;
+        break;
+    default:
+        spice_warning("unexpected");
+        return;
+    }
+    mjpeg_encoder_reset_quality(encoder, quality_id, fps, 0);
+    spice_debug("during quality evaluation: canceling."
+                "reset quality to %d fps %d",
+                mjpeg_quality_samples[rate_control->quality_id], rate_control->fps);
+}
+
+/*
+ * Adopts the bit rate of the network rate control. The quality and frame
+ * rate are re-evaluated for the new bit rate.
+ */
+static void mjpeg_encoder_follow_bit_rate(MJpegEncoder *encoder)
+{
+    MJpegEncoderRateControl *rate_control = &encoder->rate_control;
+    uint64_t byte_rate = video_rate_control_get_bit_rate(encoder->bit_rate_control) / 8;
+
+    if (byte_rate == rate_control->byte_rate) {
+        return;
+    }
+    mjpeg_encoder_quality_eval_stop(encoder);
+    if (byte_rate < rate_control->byte_rate) {
+        spice_debug("decrease bit rate %.2f (Mbps)", byte_rate * 8 / 1024.0 / 1024.0);
+        mjpeg_encoder_quality_eval_set_downgrade(encoder,
+                                                 MJPEG_QUALITY_EVAL_REASON_RATE_CHANGE,
+                                                 rate_control->quality_id,
+                                                 rate_control->fps);
     } else {
-        mjpeg_encoder_process_server_drops(encoder);
+        spice_debug("increase bit rate %.2f (Mbps)", byte_rate * 8 / 1024.0 / 1024.0);
+        mjpeg_encoder_quality_eval_set_upgrade(encoder,
+                                               MJPEG_QUALITY_EVAL_REASON_RATE_CHANGE,
+                                               rate_control->quality_id,
+                                               rate_control->fps);
     }
+    rate_control->byte_rate = byte_rate;
+    rate_control->last_frame_time = 0;
 }
 
 /*
@@ -724,6 +699,7 @@ static int mjpeg_encoder_start_frame(MJpegEncoder *encoder,
                                      uint32_t frame_mm_time)
 {
     uint32_t quality;
+    JpegEncoderImageType image_type;
 
     MJpegEncoderRateControl *rate_control = &encoder->rate_control;
     uint64_t now;
@@ -734,8 +710,9 @@ static int mjpeg_encoder_start_frame(MJpegEncoder *encoder,
     if (!rate_control->adjusted_fps_start_time) {
         rate_control->adjusted_fps_start_time = now;
     }
+    mjpeg_encoder_follow_bit_rate(encoder);
     mjpeg_encoder_adjust_fps(encoder, now);
-    interval = (now - rate_control->bit_rate_info.last_frame_time);
+    interval = (now - rate_control->last_frame_time);
 
     if (interval < NSEC_PER_SEC / rate_control->adjusted_fps) {
         return VIDEO_ENCODER_FRAME_DROP;
@@ -745,52 +722,32 @@ static int mjpeg_encoder_start_frame(MJpegEncoder *encoder,
 
     if (!rate_control->during_quality_eval ||
         rate_control->quality_eval_data.reason == MJPEG_QUALITY_EVAL_REASON_SIZE_CHANGE) {
-        MJpegEncoderBitRateInfo *bit_rate_info;
-
-        bit_rate_info = &encoder->rate_control.bit_rate_info;
-
-        if (!bit_rate_info->change_start_time) {
-            bit_rate_info->change_start_time = now;
-            bit_rate_info->change_start_mm_time = frame_mm_time;
-        }
-        bit_rate_info->last_frame_time = now;
+        rate_control->last_frame_time = now;
     }
 
-    encoder->cinfo.in_color_space   = JCS_RGB;
-    encoder->cinfo.input_components = 3;
-    encoder->pixel_converter = NULL;
-
     switch (format) {
     case SPICE_BITMAP_FMT_32BIT:
     case SPICE_BITMAP_FMT_RGBA:
         encoder->bytes_per_pixel = 4;
-#ifdef JCS_EXTENSIONS
-        encoder->cinfo.in_color_space   = JCS_EXT_LE_BGRX;
-        encoder->cinfo.input_components = 4;
-#else
-        encoder->pixel_converter = pixel_rgb32bpp_to_24;
-#endif
+        image_type = JPEG_IMAGE_TYPE_BGRX32;
         break;
     case SPICE_BITMAP_FMT_16BIT:
         encoder->bytes_per_pixel = 2;
-        encoder->pixel_converter = pixel_rgb16bpp_to_24;
+        image_type = JPEG_IMAGE_TYPE_RGB16;
         break;
     case SPICE_BITMAP_FMT_24BIT:
         encoder->bytes_per_pixel = 3;
-#ifdef JCS_EXTENSIONS
-        encoder->cinfo.in_color_space = JCS_EXT_LE_BGR;
-#else
-        encoder->pixel_converter = pixel_rgb24bpp_to_24;
-#endif
+        image_type = JPEG_IMAGE_TYPE_BGR24;
         break;
     default:
         spice_debug("unsupported format %d", format);
         return VIDEO_ENCODER_FRAME_UNSUPPORTED;
     }
+    encoder->row_converter = jpeg_encoder_set_input_type(&encoder->cinfo, image_type);
 
     encoder->cinfo.image_width = src->right - src->left;
     encoder->cinfo.image_height = src->bottom - src->top;
-    if (encoder->pixel_converter != NULL) {
+    if (encoder->row_converter != NULL) {
         JDIMENSION stride = encoder->cinfo.image_width * 3;
         /* check for integer overflow */
         if (stride < encoder->cinfo.image_width) {
@@ -820,17 +777,9 @@ static int mjpeg_encoder_encode_scanline(MJpegEncoder *encoder,
                                          size_t image_width)
 {
     unsigned int scanlines_written;
-    uint8_t *row;
 
-    row = encoder->row;
-    if (encoder->pixel_converter) {
-        unsigned int x;
-        for (x = 0; x < image_width; x++) {
-            /* src_pixels is expected to be 4 bytes aligned */
-            encoder->pixel_converter(src_pixels, row);
-            row += 3;
-            src_pixels += encoder->bytes_per_pixel;
-        }
+    if (encoder->row_converter) {
+        encoder->row_converter(src_pixels, encoder->row, image_width);
         scanlines_written = jpeg_write_scanlines(&encoder->cinfo, &encoder->row, 1);
     } else {
         scanlines_written = jpeg_write_scanlines(&encoder->cinfo, &src_pixels, 1);
@@ -853,22 +802,15 @@ static size_t mjpeg_encoder_end_frame(MJpegEncoder *encoder)
 
     encoder->first_frame = FALSE;
     rate_control->last_enc_size = dest->pub.next_output_byte - dest->buffer;
-    rate_control->server_state.num_frames_encoded++;
-
-    if (!rate_control->during_quality_eval ||
-        rate_control->quality_eval_data.reason == MJPEG_QUALITY_EVAL_REASON_SIZE_CHANGE) {
 
-        if (!rate_control->during_quality_eval) {
-            if (rate_control->num_recent_enc_frames >= MJPEG_AVERAGE_SIZE_WINDOW) {
-                rate_control->num_recent_enc_frames = 0;
-                rate_control->sum_recent_enc_size = 0;
-            }
-            rate_control->sum_recent_enc_size += rate_control->last_enc_size;
-            rate_control->num_recent_enc_frames++;
-            rate_control->adjusted_fps_num_frames++;
+    if (!rate_control->during_quality_eval) {
+        if (rate_control->num_recent_enc_frames >= MJPEG_AVERAGE_SIZE_WINDOW) {
+            rate_control->num_recent_enc_frames = 0;
+            rate_control->sum_recent_enc_size = 0;
         }
-        rate_control->bit_rate_info.sum_enc_size += encoder->rate_control.last_enc_size;
-        rate_control->bit_rate_info.num_enc_frames++;
+        rate_control->sum_recent_enc_size += rate_control->last_enc_size;
+        rate_control->num_recent_enc_frames++;
+        rate_control->adjusted_fps_num_frames++;
     }
     return encoder->rate_control.last_enc_size;
 }
@@ -954,6 +896,8 @@ static int mjpeg_encoder_encode_frame(VideoEncoder *video_encoder,
     if (ret == VIDEO_ENCODER_FRAME_ENCODE_DONE) {
         if (encode_frame(encoder, src, bitmap, top_down)) {
             buffer->base.size = mjpeg_encoder_end_frame(encoder);
+            video_rate_control_frame_encoded(encoder->bit_rate_control, frame_mm_time,
+                                             buffer->base.size);
             *outbuf = (VideoBuffer*)buffer;
         } else {
             ret = VIDEO_ENCODER_FRAME_UNSUPPORTED;
@@ -967,209 +911,6 @@ static int mjpeg_encoder_encode_frame(VideoEncoder *video_encoder,
 }
 
 
-static void mjpeg_encoder_quality_eval_stop(MJpegEncoder *encoder)
-{
-    MJpegEncoderRateControl *rate_control = &encoder->rate_control;
-    uint32_t quality_id;
-    uint32_t fps;
-
-    if (!rate_control->during_quality_eval) {
-        return;
-    }
-    switch (rate_control->quality_eval_data.type) {
-    case MJPEG_QUALITY_EVAL_TYPE_UPGRADE:
-        quality_id = rate_control->quality_eval_data.min_quality_id;
-        fps = rate_control->quality_eval_data.min_quality_fps;
-        break;
-    case MJPEG_QUALITY_EVAL_TYPE_DOWNGRADE:
-        quality_id = rate_control->quality_eval_data.max_quality_id;
-        fps = rate_control->quality_eval_data.max_quality_fps;
-        break;
-    case MJPEG_QUALITY_EVAL_TYPE_SET:
-        quality_id = MJPEG_QUALITY_SAMPLE_NUM / 2;
-        fps = MJPEG_MAX_FPS / 2;
-        break;
-    default:
-        spice_warning("unexpected");
-        return;
-    }
-    mjpeg_encoder_reset_quality(encoder, quality_id, fps, 0);
-    spice_debug("during quality evaluation: canceling."
-                "reset quality to %d fps %d",
-                mjpeg_quality_samples[rate_control->quality_id], rate_control->fps);
-}
-
-static void mjpeg_encoder_decrease_bit_rate(MJpegEncoder *encoder)
-{
-    MJpegEncoderRateControl *rate_control = &encoder->rate_control;
-    MJpegEncoderBitRateInfo *bit_rate_info = &rate_control->bit_rate_info;
-    uint64_t measured_byte_rate;
-    uint32_t measured_fps;
-    uint64_t decrease_size;
-
-    mjpeg_encoder_quality_eval_stop(encoder);
-
-    rate_control->client_state.max_video_latency = 0;
-    rate_control->client_state.max_audio_latency = 0;
-    if (rate_control->warmup_start_time) {
-        uint64_t now;
-
-        now = spice_get_monotonic_time_ns();
-        if (now - rate_control->warmup_start_time < MJPEG_WARMUP_TIME) {
-            spice_debug("during warmup. ignoring");
-            return;
-        } else {
-            rate_control->warmup_start_time = 0;
-        }
-    }
-
-    if (bit_rate_info->num_enc_frames > MJPEG_BIT_RATE_EVAL_MIN_NUM_FRAMES ||
-        bit_rate_info->num_enc_frames > rate_control->fps) {
-        double duration_sec;
-
-        duration_sec = (bit_rate_info->last_frame_time - bit_rate_info->change_start_time);
-        duration_sec /= NSEC_PER_SEC;
-        measured_byte_rate = bit_rate_info->sum_enc_size / duration_sec;
-        measured_fps = bit_rate_info->num_enc_frames / duration_sec;
-        decrease_size = bit_rate_info->sum_enc_size / bit_rate_info->num_enc_frames;
-        spice_debug("bit rate estimation %.2f (Mbps) fps %u",
-                    measured_byte_rate*8/1024.0/1024,
-                    measured_fps);
-    } else {
-        measured_byte_rate = rate_control->byte_rate;
-        measured_fps = rate_control->fps;
-        decrease_size = measured_byte_rate/measured_fps;
-        spice_debug("bit rate not re-estimated %.2f (Mbps) fps %u",
-                    measured_byte_rate*8/1024.0/1024,
-                    measured_fps);
-    }
-
-    measured_byte_rate = MIN(rate_control->byte_rate, measured_byte_rate);
-
-    if (decrease_size >=  measured_byte_rate) {
-        decrease_size = measured_byte_rate / 2;
-    }
-
-    rate_control->byte_rate = measured_byte_rate - decrease_size;
-    bit_rate_info->change_start_time = 0;
-    bit_rate_info->change_start_mm_time = 0;
-    bit_rate_info->last_frame_time = 0;
-    bit_rate_info->num_enc_frames = 0;
-    bit_rate_info->sum_enc_size = 0;
-    bit_rate_info->was_upgraded = FALSE;
-
-    spice_debug("decrease bit rate %.2f (Mbps)", rate_control->byte_rate * 8 / 1024.0/1024.0);
-    mjpeg_encoder_quality_eval_set_downgrade(encoder,
-                                             MJPEG_QUALITY_EVAL_REASON_RATE_CHANGE,
-                                             rate_control->quality_id,
-                                             rate_control->fps);
-}
-
-static void mjpeg_encoder_handle_negative_client_stream_report(MJpegEncoder *encoder,
-                                                               uint32_t report_end_frame_mm_time)
-{
-    MJpegEncoderRateControl *rate_control = &encoder->rate_control;
-
-    spice_debug("trace");
-
-    if ((rate_control->bit_rate_info.change_start_mm_time > report_end_frame_mm_time ||
-        !rate_control->bit_rate_info.change_start_mm_time) &&
-         !rate_control->bit_rate_info.was_upgraded) {
-        spice_debug("ignoring, a downgrade has already occurred later to the report time");
-        return;
-    }
-
-    mjpeg_encoder_decrease_bit_rate(encoder);
-}
-
-static void mjpeg_encoder_increase_bit_rate(MJpegEncoder *encoder)
-{
-    MJpegEncoderRateControl *rate_control = &encoder->rate_control;
-    MJpegEncoderBitRateInfo *bit_rate_info = &rate_control->bit_rate_info;
-    uint64_t measured_byte_rate;
-    uint32_t measured_fps;
-    uint64_t increase_size;
-
-
-    if (bit_rate_info->num_enc_frames > MJPEG_BIT_RATE_EVAL_MIN_NUM_FRAMES ||
-        bit_rate_info->num_enc_frames > rate_control->fps) {
-        uint64_t avg_frame_size;
-        double duration_sec;
-
-        duration_sec = (bit_rate_info->last_frame_time - bit_rate_info->change_start_time);
-        duration_sec /= NSEC_PER_SEC;
-        measured_byte_rate = bit_rate_info->sum_enc_size / duration_sec;
-        measured_fps = bit_rate_info->num_enc_frames / duration_sec;
-        avg_frame_size = bit_rate_info->sum_enc_size / bit_rate_info->num_enc_frames;
-        spice_debug("bit rate estimation %.2f (Mbps) defined %.2f"
-                    " fps %u avg-frame-size=%.2f (KB)",
-                    measured_byte_rate*8/1024.0/1024,
-                    rate_control->byte_rate*8/1024.0/1024,
-                    measured_fps,
-                    avg_frame_size/1024.0);
-        increase_size = avg_frame_size;
-    } else {
-        spice_debug("not enough samples for measuring the bit rate. no change");
-        return;
-    }
-
-
-    mjpeg_encoder_quality_eval_stop(encoder);
-
-    if (measured_byte_rate + increase_size < rate_control->byte_rate) {
-        spice_debug("measured byte rate is small: not upgrading, just re-evaluating");
-    } else {
-        rate_control->byte_rate = MIN(measured_byte_rate, rate_control->byte_rate) + increase_size;
-    }
-
-    bit_rate_info->change_start_time = 0;
-    bit_rate_info->change_start_mm_time = 0;
-    bit_rate_info->last_frame_time = 0;
-    bit_rate_info->num_enc_frames = 0;
-    bit_rate_info->sum_enc_size = 0;
-    bit_rate_info->was_upgraded = TRUE;
-
-    spice_debug("increase bit rate %.2f (Mbps)", rate_control->byte_rate * 8 / 1024.0/1024.0);
-    mjpeg_encoder_quality_eval_set_upgrade(encoder,
-                                           MJPEG_QUALITY_EVAL_REASON_RATE_CHANGE,
-                                           rate_control->quality_id,
-                                           rate_control->fps);
-}
-
-static void mjpeg_encoder_handle_positive_client_stream_report(MJpegEncoder *encoder,
-                                                               uint32_t report_start_frame_mm_time)
-{
-    MJpegEncoderRateControl *rate_control = &encoder->rate_control;
-    MJpegEncoderBitRateInfo *bit_rate_info = &rate_control->bit_rate_info;
-    int stable_client_mm_time;
-    int timeout;
-
-    if (rate_control->during_quality_eval &&
-        rate_control->quality_eval_data.reason == MJPEG_QUALITY_EVAL_REASON_RATE_CHANGE) {
-        spice_debug("during quality evaluation (rate change). ignoring report");
-        return;
-    }
-
-    if ((rate_control->fps > MJPEG_IMPROVE_QUALITY_FPS_STRICT_TH ||
-         rate_control->fps >= mjpeg_encoder_get_source_fps(encoder)) &&
-         rate_control->quality_id > MJPEG_QUALITY_SAMPLE_NUM / 2) {
-        timeout = MJPEG_CLIENT_POSITIVE_REPORT_STRICT_TIMEOUT;
-    } else {
-        timeout = MJPEG_CLIENT_POSITIVE_REPORT_TIMEOUT;
-    }
-
-    stable_client_mm_time = (int)report_start_frame_mm_time - bit_rate_info->change_start_mm_time;
-
-    if (!bit_rate_info->change_start_mm_time || stable_client_mm_time < timeout) {
-        /* assessing the stability of the current setting and only then
-         * respond to the report */
-        spice_debug("no drops, but not enough time has passed for assessing "
-                    "the playback stability since the last bit rate change");
-        return;
-    }
-    mjpeg_encoder_increase_bit_rate(encoder);
-}
-
 /*
  * the video playback jitter buffer should be at least (send_time*2 + net_latency) for
  * preventing underflow
@@ -1191,37 +932,12 @@ static uint32_t get_min_required_playback_delay(const MJpegEncoder *encoder,
     return min_delay;
 }
 
-#define MJPEG_PLAYBACK_LATENCY_DECREASE_FACTOR 0.5
-#define MJPEG_VIDEO_VS_AUDIO_LATENCY_FACTOR 1.25
-#define MJPEG_VIDEO_DELAY_TH -15
-
-static void mjpeg_encoder_client_stream_report(VideoEncoder *video_encoder,
-                                               uint32_t num_frames,
-                                               uint32_t num_drops,
-                                               uint32_t start_frame_mm_time,
-                                               uint32_t end_frame_mm_time,
-                                               int32_t end_frame_delay,
-                                               uint32_t audio_delay)
+static void mjpeg_encoder_update_client_playback_delay(MJpegEncoder *encoder,
+                                                       int32_t end_frame_delay)
 {
-    MJpegEncoder *encoder = SPICE_CONTAINEROF(video_encoder, MJpegEncoder, base);
     MJpegEncoderRateControl *rate_control = &encoder->rate_control;
-    MJpegEncoderClientState *client_state = &rate_control->client_state;
     uint64_t avg_enc_size = 0;
     uint32_t min_playback_delay;
-    int is_video_delay_small = FALSE;
-
-    spice_debug("client report: #frames %u, #drops %d, duration %u video-delay %d audio-delay %u",
-                num_frames, num_drops,
-                end_frame_mm_time - start_frame_mm_time,
-                end_frame_delay, audio_delay);
-
-    if (rate_control->during_quality_eval) {
-        if (rate_control->quality_eval_data.type == MJPEG_QUALITY_EVAL_TYPE_DOWNGRADE &&
-            rate_control->quality_eval_data.reason == MJPEG_QUALITY_EVAL_REASON_RATE_CHANGE) {
-            spice_debug("during rate downgrade evaluation");
-            return;
-        }
-    }
 
     if (rate_control->num_recent_enc_frames) {
         avg_enc_size = rate_control->sum_recent_enc_size /
@@ -1239,103 +955,42 @@ static void mjpeg_encoder_client_stream_report(VideoEncoder *video_encoder,
         */
         if (rate_control->quality_id != MJPEG_QUALITY_SAMPLE_NUM - 1 ||
             rate_control->fps < MIN(src_fps, MJPEG_MAX_FPS) || end_frame_delay < 0) {
-            is_video_delay_small = TRUE;
             if (encoder->cbs.update_client_playback_delay) {
                 encoder->cbs.update_client_playback_delay(encoder->cbs.opaque,
                                                           min_playback_delay);
             }
         }
     }
+}
 
+static void mjpeg_encoder_client_stream_report(VideoEncoder *video_encoder,
+                                               uint32_t num_frames,
+                                               uint32_t num_drops,
+                                               uint32_t start_frame_mm_time,
+                                               uint32_t end_frame_mm_time,
+                                               int32_t end_frame_delay,
+                                               uint32_t audio_delay)
+{
+    MJpegEncoder *encoder = SPICE_CONTAINEROF(video_encoder, MJpegEncoder, base);
+    MJpegEncoderRateControl *rate_control = &encoder->rate_control;
 
-    /*
-     * If the audio latency has decreased (since the start of the current
-     * sequence of positive reports), and the video latency is bigger, slow down
-     * the video rate
-     */
-    if (end_frame_delay > 0 &&
-        audio_delay < MJPEG_PLAYBACK_LATENCY_DECREASE_FACTOR*client_state->max_audio_latency &&
-        end_frame_delay > MJPEG_VIDEO_VS_AUDIO_LATENCY_FACTOR*audio_delay) {
-        spice_debug("video_latency >> audio_latency && audio_latency << max (%u)",
-                    client_state->max_audio_latency);
-        mjpeg_encoder_handle_negative_client_stream_report(encoder,
-                                                           end_frame_mm_time);
-        return;
-    }
-
-    if (end_frame_delay < MJPEG_VIDEO_DELAY_TH) {
-        mjpeg_encoder_handle_negative_client_stream_report(encoder,
-                                                           end_frame_mm_time);
+    if (rate_control->during_quality_eval &&
+        rate_control->quality_eval_data.type == MJPEG_QUALITY_EVAL_TYPE_DOWNGRADE &&
+        rate_control->quality_eval_data.reason == MJPEG_QUALITY_EVAL_REASON_RATE_CHANGE) {
+        spice_debug("during rate downgrade evaluation");
     } else {
-        double major_delay_decrease_thresh;
-        double medium_delay_decrease_thresh;
-
-        client_state->max_video_latency = MAX(end_frame_delay, client_state->max_video_latency);
-        client_state->max_audio_latency = MAX(audio_delay, client_state->max_audio_latency);
-
-        medium_delay_decrease_thresh = client_state->max_video_latency;
-        medium_delay_decrease_thresh *= MJPEG_PLAYBACK_LATENCY_DECREASE_FACTOR;
-
-        major_delay_decrease_thresh = medium_delay_decrease_thresh;
-        major_delay_decrease_thresh *= MJPEG_PLAYBACK_LATENCY_DECREASE_FACTOR;
-        /*
-         * since the bit rate and the required latency are only evaluation based on the
-         * reports we got till now, we assume that the latency is too low only if it
-         * was higher during the time that passed since the last report that resulted
-         * in a bit rate decrement. If we find that the latency has decreased, it might
-         * suggest that the stream bit rate is too high.
-         */
-        if ((end_frame_delay < medium_delay_decrease_thresh &&
-            is_video_delay_small) || end_frame_delay < major_delay_decrease_thresh) {
-            spice_debug("downgrade due to short video delay (last=%u, past-max=%u",
-                end_frame_delay, client_state->max_video_latency);
-            mjpeg_encoder_handle_negative_client_stream_report(encoder,
-                                                               end_frame_mm_time);
-        } else if (!num_drops) {
-            mjpeg_encoder_handle_positive_client_stream_report(encoder,
-                                                               start_frame_mm_time);
-
-        }
+        mjpeg_encoder_update_client_playback_delay(encoder, end_frame_delay);
     }
+    video_rate_control_client_report(encoder->bit_rate_control,
+                                     num_frames, num_drops,
+                                     start_frame_mm_time, end_frame_mm_time,
+                                     end_frame_delay, audio_delay);
 }
 
 static void mjpeg_encoder_notify_server_frame_drop(VideoEncoder *video_encoder)
 {
     MJpegEncoder *encoder = SPICE_CONTAINEROF(video_encoder, MJpegEncoder, base);
-    encoder->rate_control.server_state.num_frames_dropped++;
-    mjpeg_encoder_process_server_drops(encoder);
-}
-
-/*
- * decrease the bit rate if the drop rate on the sever side exceeds a pre defined
- * threshold.
- */
-static void mjpeg_encoder_process_server_drops(MJpegEncoder *encoder)
-{
-    MJpegEncoderServerState *server_state = &encoder->rate_control.server_state;
-    uint32_t num_frames_total;
-    double drop_factor;
-    uint32_t fps;
-
-    fps = MIN(encoder->rate_control.fps, mjpeg_encoder_get_source_fps(encoder));
-    if (server_state->num_frames_encoded < fps * MJPEG_SERVER_STATUS_EVAL_FPS_INTERVAL) {
-        return;
-    }
-
-    num_frames_total = server_state->num_frames_dropped + server_state->num_frames_encoded;
-    drop_factor = ((double)server_state->num_frames_dropped) / num_frames_total;
-
-    spice_debug("#drops %u total %u fps %u src-fps %u",
-                server_state->num_frames_dropped,
-                num_frames_total,
-                encoder->rate_control.fps,
-                mjpeg_encoder_get_source_fps(encoder));
-
-    if (drop_factor > MJPEG_SERVER_STATUS_DOWNGRADE_DROP_FACTOR_TH) {
-        mjpeg_encoder_decrease_bit_rate(encoder);
-    }
-    server_state->num_frames_encoded = 0;
-    server_state->num_frames_dropped = 0;
+    video_rate_control_server_frame_drop(encoder->bit_rate_control);
 }
 
 static uint64_t mjpeg_encoder_get_bit_rate(VideoEncoder *video_encoder)
@@ -1373,15 +1028,16 @@ VideoEncoder *mjpeg_encoder_new(SpiceVideoCodecType codec_type,
     encoder->base.get_stats = mjpeg_encoder_get_stats;
     encoder->base.codec_type = codec_type;
     encoder->first_frame = TRUE;
-    encoder->rate_control.byte_rate = starting_bit_rate / 8;
     encoder->starting_bit_rate = starting_bit_rate;
 
     encoder->cbs = *cbs;
+    encoder->bit_rate_control = video_rate_control_new(starting_bit_rate, cbs);
+    encoder->rate_control.byte_rate =
+        video_rate_control_get_bit_rate(encoder->bit_rate_control) / 8;
     mjpeg_encoder_reset_quality(encoder, MJPEG_QUALITY_SAMPLE_NUM / 2, 5, 0);
     encoder->rate_control.during_quality_eval = TRUE;
     encoder->rate_control.quality_eval_data.type = MJPEG_QUALITY_EVAL_TYPE_SET;
     encoder->rate_control.quality_eval_data.reason = MJPEG_QUALITY_EVAL_REASON_RATE_CHANGE;
-    encoder->rate_control.warmup_start_time = spice_get_monotonic_time_ns();
 
     encoder->cinfo.err = jpeg_std_error(&encoder->jerr);
     jpeg_create_compress(&encoder->cinfo);
@@ -43,6 +43,19 @@ void red_channel_capabilities_reset(RedChannelCapabilities *caps)
     memset(caps, 0, sizeof(*caps));
 }
 
+void red_channel_capabilities_set_common_cap(RedChannelCapabilities *caps, uint32_t cap)
+{
+    int n = cap / 32;
+
+    if (n >= caps->num_common_caps) {
+        caps->common_caps = g_renew(uint32_t, caps->common_caps, n + 1);
+        memset(caps->common_caps + caps->num_common_caps, 0,
+               (n + 1 - caps->num_common_caps) * sizeof(uint32_t));
+        caps->num_common_caps = n + 1;
+    }
+    caps->common_caps[n] |= 1U << (cap % 32);
+}
+
 static RedChannelCapabilities *red_channel_capabilities_dup(const RedChannelCapabilities *caps)
 {
     RedChannelCapabilities *res = g_new(RedChannelCapabilities, 1);
@@ -42,6 +42,9 @@ void red_channel_capabilities_init(RedChannelCapabilities *dest,
  * All resources are freed by this function. */
 void red_channel_capabilities_reset(RedChannelCapabilities *caps);
 
+/* Add a common capability, growing the array if needed */
+void red_channel_capabilities_set_common_cap(RedChannelCapabilities *caps, uint32_t cap);
+
 /* GObject type that can be used to box RedChannelCapabilities */
 extern GType red_channel_capabilities_type;
 #define RED_TYPE_CHANNEL_CAPABILITIES red_channel_capabilities_type
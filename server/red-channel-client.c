@@ -39,6 +39,27 @@
 
 #define CLIENT_ACK_WINDOW 20
 
+/* Pipe flow control. The estimated bytes queued are limited to what the
+ * connection can send in a roundtrip plus PIPE_TARGET_DELAY, so fast
+ * clients get deeper pipes while slow ones are not flooded */
+#define PIPE_ITEM_MIN_SIZE 64
+#define PIPE_BYTES_MIN (256 * 1024)
+#define PIPE_BYTES_MAX (64 * 1024 * 1024)
+#define PIPE_BYTES_DEFAULT (4 * 1024 * 1024)
+#define PIPE_TARGET_DELAY (NSEC_PER_SEC / 10)
+#define BANDWIDTH_SAMPLE_INTERVAL (NSEC_PER_SEC / 10)
+
+/* Maximum number of windows sent but not acked yet whose send time is kept
+ * to measure the roundtrip, see red_channel_client_waiting_for_ack() */
+#define ACK_TIMES_MAX 4
+
+/* While pushing the pipe small messages are kept and written together with
+ * the following ones, saving syscalls and TLS records. The batch is written
+ * when one of these limits is reached or when the pipe is drained */
+#define BATCH_MAX_BYTES (64 * 1024)
+#define BATCH_MAX_MESSAGES 64
+#define BATCH_MAX_DELAY NSEC_PER_MILLISEC
+
 #define MAX_HEADER_SIZE sizeof(SpiceDataHeader)
 
 #ifndef IOV_MAX
@@ -82,7 +103,9 @@ typedef struct RedChannelClientLatencyMonitor {
     bool tcp_nodelay;
     bool warmup_was_sent;
 
-    int64_t roundtrip;
+    int64_t roundtrip; /* minimum measured by the pings */
+    /* average of the pings and acks roundtrips, -1 if not measured yet */
+    int64_t smoothed_roundtrip;
 } RedChannelClientLatencyMonitor;
 
 typedef enum {
@@ -100,11 +123,38 @@ typedef struct RedChannelClientConnectivityMonitor {
     SpiceTimer *timer;
 } RedChannelClientConnectivityMonitor;
 
+/* Estimates the sending rate when the connection is saturated */
+typedef struct RedChannelClientBandwidthMonitor {
+    uint64_t sample_start;
+    uint64_t sample_bytes;
+    bool sample_blocked;
+    bool sample_delayed; /* the send scheduler limited the rate */
+    uint64_t bytes_per_sec; /* 0 if there is no estimation yet */
+    bool measured; /* the connection was saturated at least once */
+} RedChannelClientBandwidthMonitor;
+
 typedef struct OutgoingMessageBuffer {
     int pos;
     int size;
+    uint32_t zerocopy_sent; /* red_stream_zerocopy_sent() before the writes */
 } OutgoingMessageBuffer;
 
+/* Messages marshalled but not written yet, they precede the current one */
+typedef struct OutgoingMessageBatch {
+    GQueue marshallers;
+    GSList *free_marshallers; /* reset marshallers ready to be reused */
+    uint32_t size;
+    uint64_t start_time; /* when the first message was added */
+    bool writing; /* the batch is part of the data being written */
+} OutgoingMessageBatch;
+
+/* Marshallers of messages written with MSG_ZEROCOPY, their data must be
+ * kept till the kernel does not read it anymore */
+typedef struct ZeroCopyHold {
+    uint32_t sent; /* red_stream_zerocopy_sent() after the writes */
+    GSList *marshallers;
+} ZeroCopyHold;
+
 typedef struct IncomingMessageBuffer {
     uint8_t header_buf[MAX_HEADER_SIZE];
     SpiceDataHeaderOpaque header;
@@ -125,6 +175,16 @@ struct RedChannelClientPrivate
         uint32_t client_generation;
         uint32_t messages_window;
         uint32_t client_window;
+        /* bytes of the messages begun and written to the stream */
+        uint64_t bytes_queued;
+        uint64_t bytes_written;
+        /* the messages ending the windows to be acked, the position of
+         * their end in the stream and the time their last byte was written,
+         * 0 till written */
+        uint32_t num_times;
+        uint32_t times_window[ACK_TIMES_MAX];
+        uint64_t times_end[ACK_TIMES_MAX];
+        uint64_t times[ACK_TIMES_MAX];
     } ack_data;
 
     struct {
@@ -134,6 +194,8 @@ struct RedChannelClientPrivate
         uint32_t size;
         int blocked;
         uint64_t last_sent_serial;
+        bool has_fd;
+        int fd;
 
         struct {
             SpiceMarshaller *marshaller;
@@ -146,8 +208,17 @@ struct RedChannelClientPrivate
     } send_data;
 
     bool block_read;
+    /* last mask set for the watch of the stream */
+    int watch_mask;
     bool during_send;
     GQueue pipe;
+    uint64_t pipe_bytes; /* estimated size of the items in pipe */
+    /* unused links for the items shared with other pipes */
+    RedPipeItemLink *free_pipe_links;
+    uint64_t parked_time;
+    /* monotonic time the pipe was seen full at by red_channel_client_is_slow,
+     * 0 once it is not full anymore */
+    uint64_t pipe_full_time;
 
     RedChannelCapabilities remote_caps;
     bool is_mini_header;
@@ -158,20 +229,35 @@ struct RedChannelClientPrivate
 
     RedChannelClientLatencyMonitor latency_monitor;
     RedChannelClientConnectivityMonitor connectivity_monitor;
+    RedChannelClientBandwidthMonitor bandwidth_monitor;
+
+    /* share of the client bandwidth, see send-scheduler.h */
+    SendScheduler *send_scheduler;
+    SendSchedulerEntry *send_scheduler_entry;
+    SpiceTimer *send_scheduler_timer;
+    bool send_delayed;
 
     IncomingMessageBuffer incoming;
     OutgoingMessageBuffer outgoing;
+    OutgoingMessageBatch batch;
+    GQueue zerocopy_holds;
 
     RedStatCounter out_messages;
     RedStatCounter out_bytes;
+    RedStatCounter bytes_per_sec;
+    RedStatCounter roundtrip_us;
 };
 
 static const SpiceDataHeaderOpaque full_header_wrapper;
 static const SpiceDataHeaderOpaque mini_header_wrapper;
 static void red_channel_client_clear_sent_item(RedChannelClient *rcc);
+static void red_channel_client_batch_clear(RedChannelClient *rcc);
+static void red_channel_client_zerocopy_hold(RedChannelClient *rcc);
+static void red_channel_client_zerocopy_release(RedChannelClient *rcc, bool all);
 static void red_channel_client_initable_interface_init(GInitableIface *iface);
 static void red_channel_client_set_message_serial(RedChannelClient *channel, uint64_t);
 static bool red_channel_client_config_socket(RedChannelClient *rcc);
+static void red_channel_client_send_scheduler_remove(RedChannelClient *rcc);
 
 /*
  * When an error occurs over a channel, we treat it as a warning
@@ -341,6 +427,7 @@ red_channel_client_finalize(GObject *object)
         core->timer_remove(core, self->priv->connectivity_monitor.timer);
         self->priv->connectivity_monitor.timer = NULL;
     }
+    red_channel_client_send_scheduler_remove(self);
 
     red_stream_free(self->priv->stream);
     self->priv->stream = NULL;
@@ -353,6 +440,17 @@ red_channel_client_finalize(GObject *object)
         spice_marshaller_destroy(self->priv->send_data.urgent.marshaller);
     }
 
+    red_channel_client_batch_clear(self);
+    red_channel_client_zerocopy_release(self, true);
+    g_slist_free_full(self->priv->batch.free_marshallers,
+                      (GDestroyNotify) spice_marshaller_destroy);
+    while (self->priv->free_pipe_links) {
+        RedPipeItemLink *link = self->priv->free_pipe_links;
+
+        self->priv->free_pipe_links = link->next;
+        g_free(link);
+    }
+
     red_channel_capabilities_reset(&self->priv->remote_caps);
     if (self->priv->channel) {
         g_object_unref(self->priv->channel);
@@ -392,6 +490,8 @@ static void red_channel_client_constructed(GObject *object)
     const RedStatNode *node = red_channel_get_stat_node(channel);
     stat_init_counter(&self->priv->out_messages, reds, node, "out_messages", TRUE);
     stat_init_counter(&self->priv->out_bytes, reds, node, "out_bytes", TRUE);
+    stat_init_counter(&self->priv->bytes_per_sec, reds, node, "bytes_per_sec", TRUE);
+    stat_init_counter(&self->priv->roundtrip_us, reds, node, "roundtrip_us", TRUE);
 }
 
 static void red_channel_client_class_init(RedChannelClientClass *klass)
@@ -454,12 +554,15 @@ red_channel_client_init(RedChannelClient *self)
     self->priv->ack_data.messages_window = ~0;
     self->priv->ack_data.client_generation = ~0;
     self->priv->ack_data.client_window = CLIENT_ACK_WINDOW;
+    self->priv->latency_monitor.smoothed_roundtrip = -1;
     self->priv->send_data.main.marshaller = spice_marshaller_new();
     self->priv->send_data.urgent.marshaller = spice_marshaller_new();
 
     self->priv->send_data.marshaller = self->priv->send_data.main.marshaller;
 
     g_queue_init(&self->priv->pipe);
+    g_queue_init(&self->priv->batch.marshallers);
+    g_queue_init(&self->priv->zerocopy_holds);
 }
 
 RedChannel* red_channel_client_get_channel(RedChannelClient *rcc)
@@ -467,11 +570,135 @@ RedChannel* red_channel_client_get_channel(RedChannelClient *rcc)
     return rcc->priv->channel;
 }
 
+static void red_channel_client_bandwidth_update(RedChannelClient *rcc, int n)
+{
+    RedChannelClientBandwidthMonitor *monitor = &rcc->priv->bandwidth_monitor;
+    uint64_t now = spice_get_monotonic_time_ns();
+    uint64_t elapsed, rate;
+
+    if (monitor->sample_start == 0) {
+        monitor->sample_start = now;
+    }
+    monitor->sample_bytes += n;
+    elapsed = now - monitor->sample_start;
+    if (elapsed < BANDWIDTH_SAMPLE_INTERVAL) {
+        return;
+    }
+
+    rate = monitor->sample_bytes * NSEC_PER_SEC / elapsed;
+    if (monitor->sample_blocked && !monitor->sample_delayed) {
+        /* the connection was saturated, the sample is a good measurement,
+         * which the bandwidth cannot be below */
+        monitor->bytes_per_sec = monitor->bytes_per_sec ?
+            MAX((monitor->bytes_per_sec * 7 + rate) / 8, rate) : rate;
+        monitor->measured = true;
+    } else {
+        /* we were not sending enough to fill the connection, or the send
+         * scheduler limited the rate to the estimation itself, which would
+         * otherwise only go down, only a lower bound of the bandwidth */
+        monitor->bytes_per_sec = MAX(monitor->bytes_per_sec, rate);
+    }
+    monitor->sample_start = now;
+    monitor->sample_bytes = 0;
+    monitor->sample_blocked = false;
+    monitor->sample_delayed = false;
+    stat_set_counter(rcc->priv->bytes_per_sec, monitor->bytes_per_sec);
+    if (rcc->priv->send_scheduler_entry) {
+        send_scheduler_set_bandwidth(rcc->priv->send_scheduler, rcc->priv->send_scheduler_entry,
+                                     red_channel_client_get_bandwidth(rcc));
+    }
+}
+
+/* Average the roundtrips like TCP does (RFC 6298), unlike the minimum used
+ * for the pipe limit it follows the delays added by the network queues */
+static void red_channel_client_roundtrip_sample(RedChannelClient *rcc, int64_t roundtrip)
+{
+    RedChannelClientLatencyMonitor *monitor = &rcc->priv->latency_monitor;
+
+    if (monitor->smoothed_roundtrip < 0) {
+        monitor->smoothed_roundtrip = roundtrip;
+    } else {
+        monitor->smoothed_roundtrip = (monitor->smoothed_roundtrip * 7 + roundtrip) / 8;
+    }
+    stat_set_counter(rcc->priv->roundtrip_us, monitor->smoothed_roundtrip / NSEC_PER_MICROSEC);
+}
+
+/* Called when a message is begun, keeps the position of the end of the
+ * last message of a window, the client acks once it received it */
+static void red_channel_client_ack_window_sent(RedChannelClient *rcc)
+{
+    uint32_t messages_window = rcc->priv->ack_data.messages_window;
+    uint32_t client_window = rcc->priv->ack_data.client_window;
+    uint32_t n = rcc->priv->ack_data.num_times;
+
+    if (client_window == 0 || messages_window % client_window != 0 || n == ACK_TIMES_MAX) {
+        return;
+    }
+    rcc->priv->ack_data.times_window[n] = messages_window;
+    rcc->priv->ack_data.times_end[n] = rcc->priv->ack_data.bytes_queued;
+    rcc->priv->ack_data.times[n] = 0;
+    rcc->priv->ack_data.num_times++;
+}
+
+/* Called when @n bytes are written to the stream, the roundtrip of a window
+ * starts when the last byte of its last message is written, not when the
+ * message is marshalled, the messages can wait in the pipe or in a batch */
+static void red_channel_client_ack_window_written(RedChannelClient *rcc, int n)
+{
+    uint64_t now = 0;
+    uint32_t i;
+
+    rcc->priv->ack_data.bytes_written += n;
+    for (i = 0; i < rcc->priv->ack_data.num_times; i++) {
+        if (rcc->priv->ack_data.times[i] != 0) {
+            continue;
+        }
+        if (rcc->priv->ack_data.times_end[i] > rcc->priv->ack_data.bytes_written) {
+            break;
+        }
+        if (now == 0) {
+            now = spice_get_monotonic_time_ns();
+        }
+        rcc->priv->ack_data.times[i] = now;
+    }
+}
+
+/* The client acked the first window, the ack is sent after the processing
+ * of the messages, so the roundtrip includes the client load too */
+static void red_channel_client_ack_window_received(RedChannelClient *rcc)
+{
+    uint32_t client_window = rcc->priv->ack_data.client_window;
+    uint32_t i, n = 0;
+
+    for (i = 0; i < rcc->priv->ack_data.num_times; i++) {
+        uint32_t window = rcc->priv->ack_data.times_window[i];
+
+        if (window == client_window && rcc->priv->ack_data.times[i] != 0) {
+            red_channel_client_roundtrip_sample(rcc, spice_get_monotonic_time_ns() -
+                                                     rcc->priv->ack_data.times[i]);
+        }
+        if (window <= client_window) {
+            continue;
+        }
+        rcc->priv->ack_data.times_window[n] = window - client_window;
+        rcc->priv->ack_data.times_end[n] = rcc->priv->ack_data.times_end[i];
+        rcc->priv->ack_data.times[n] = rcc->priv->ack_data.times[i];
+        n++;
+    }
+    rcc->priv->ack_data.num_times = n;
+}
+
 static void red_channel_client_data_sent(RedChannelClient *rcc, int n)
 {
     if (rcc->priv->connectivity_monitor.timer) {
         rcc->priv->connectivity_monitor.sent_bytes = true;
     }
+    red_channel_client_bandwidth_update(rcc, n);
+    red_channel_client_ack_window_written(rcc, n);
+    if (rcc->priv->send_scheduler_entry) {
+        send_scheduler_sent(rcc->priv->send_scheduler, rcc->priv->send_scheduler_entry,
+                            n, spice_get_monotonic_time_ns());
+    }
     stat_inc_counter(rcc->priv->out_bytes, n);
 }
 
@@ -484,20 +711,38 @@ static void red_channel_client_data_read(RedChannelClient *rcc, int n)
 
 static int red_channel_client_get_out_msg_size(RedChannelClient *rcc)
 {
-    return rcc->priv->send_data.size;
+    return rcc->priv->batch.size + rcc->priv->send_data.size;
 }
 
 static int red_channel_client_prepare_out_msg(RedChannelClient *rcc,
                                               struct iovec *vec, int vec_size,
                                               int pos)
 {
-    return spice_marshaller_fill_iovec(rcc->priv->send_data.marshaller,
-                                       vec, vec_size, pos);
+    GList *l;
+    int n = 0;
+
+    for (l = rcc->priv->batch.marshallers.head; l != NULL && n < vec_size; l = l->next) {
+        SpiceMarshaller *m = l->data;
+        size_t size = spice_marshaller_get_total_size(m);
+
+        if ((size_t) pos >= size) { // already written
+            pos -= size;
+            continue;
+        }
+        n += spice_marshaller_fill_iovec(m, vec + n, vec_size - n, pos);
+        pos = 0;
+    }
+    if (n < vec_size && rcc->priv->send_data.size != 0) {
+        n += spice_marshaller_fill_iovec(rcc->priv->send_data.marshaller,
+                                         vec + n, vec_size - n, pos);
+    }
+    return n;
 }
 
 static void red_channel_client_set_blocked(RedChannelClient *rcc)
 {
     rcc->priv->send_data.blocked = TRUE;
+    rcc->priv->bandwidth_monitor.sample_blocked = true;
 }
 
 static inline int red_channel_client_urgent_marshaller_is_active(RedChannelClient *rcc)
@@ -529,6 +774,7 @@ static void red_channel_client_send_set_ack(RedChannelClient *rcc)
     ack.generation = ++rcc->priv->ack_data.generation;
     ack.window = rcc->priv->ack_data.client_window;
     rcc->priv->ack_data.messages_window = 0;
+    rcc->priv->ack_data.num_times = 0;
 
     spice_marshall_msg_set_ack(rcc->priv->send_data.marshaller, &ack);
 
@@ -623,9 +869,10 @@ static void red_channel_client_restore_main_sender(RedChannelClient *rcc)
 static void red_channel_client_msg_sent(RedChannelClient *rcc)
 {
 #ifndef _WIN32
-    int fd;
+    if (rcc->priv->send_data.has_fd) {
+        int fd = rcc->priv->send_data.fd;
 
-    if (spice_marshaller_get_fd(rcc->priv->send_data.marshaller, &fd)) {
+        rcc->priv->send_data.has_fd = false;
         if (red_stream_send_msgfd(rcc->priv->stream, fd) < 0) {
             perror("sendfd");
             red_channel_client_disconnect(rcc);
@@ -653,9 +900,104 @@ static void red_channel_client_msg_sent(RedChannelClient *rcc)
 
 }
 
+static inline uint32_t pipe_item_size(RedPipeItem *item)
+{
+    return MAX(item->size_hint, PIPE_ITEM_MIN_SIZE);
+}
+
+/* Return a link to queue @item in the pipe, the embedded one if unused */
+static GList *red_channel_client_pipe_link_new(RedChannelClient *rcc, RedPipeItem *item)
+{
+    RedPipeItemLink *link = &item->pipe_link;
+
+    if (link->pipe != NULL) {
+        link = rcc->priv->free_pipe_links;
+        if (link) {
+            rcc->priv->free_pipe_links = link->next;
+        } else {
+            link = g_new(RedPipeItemLink, 1);
+        }
+        link->link.data = item;
+        link->link.prev = link->link.next = NULL;
+        link->next = item->pipe_link.next;
+        item->pipe_link.next = link;
+    }
+    link->pipe = &rcc->priv->pipe;
+    rcc->priv->pipe_bytes += pipe_item_size(item);
+    return &link->link;
+}
+
+/* Remove @l from the pipe. Returns the item, the reference owned by the
+ * pipe is transferred to the caller */
+static RedPipeItem *red_channel_client_pipe_unlink(RedChannelClient *rcc, GList *l)
+{
+    RedPipeItemLink *link = SPICE_CONTAINEROF(l, RedPipeItemLink, link);
+    RedPipeItem *item = l->data;
+
+    g_queue_unlink(&rcc->priv->pipe, l);
+    link->pipe = NULL;
+    if (link != &item->pipe_link) {
+        RedPipeItemLink **prev = &item->pipe_link.next;
+
+        while (*prev != link) {
+            prev = &(*prev)->next;
+        }
+        *prev = link->next;
+        link->next = rcc->priv->free_pipe_links;
+        rcc->priv->free_pipe_links = link;
+    }
+    rcc->priv->pipe_bytes -= pipe_item_size(item);
+    if (rcc->priv->pipe_full_time && !red_channel_client_pipe_is_full(rcc)) {
+        rcc->priv->pipe_full_time = 0;
+    }
+    return item;
+}
+
+/* The positions of an item are as many as the pipes it is queued in, the
+ * pipe is never walked */
+static GList *red_channel_client_pipe_find(RedChannelClient *rcc, RedPipeItem *item)
+{
+    RedPipeItemLink *link;
+
+    for (link = &item->pipe_link; link != NULL; link = link->next) {
+        if (link->pipe == &rcc->priv->pipe) {
+            return &link->link;
+        }
+    }
+    return NULL;
+}
+
+static void pipe_insert_link_after(GQueue *pipe, GList *sibling, GList *link)
+{
+    if (sibling == pipe->tail) {
+        g_queue_push_tail_link(pipe, link);
+        return;
+    }
+    link->prev = sibling;
+    link->next = sibling->next;
+    sibling->next->prev = link;
+    sibling->next = link;
+    pipe->length++;
+}
+
+static void pipe_insert_link_before(GQueue *pipe, GList *sibling, GList *link)
+{
+    if (sibling == pipe->head) {
+        g_queue_push_head_link(pipe, link);
+        return;
+    }
+    pipe_insert_link_after(pipe, sibling->prev, link);
+}
+
 static gboolean red_channel_client_pipe_remove(RedChannelClient *rcc, RedPipeItem *item)
 {
-    return g_queue_remove(&rcc->priv->pipe, item);
+    GList *link = red_channel_client_pipe_find(rcc, item);
+
+    if (!link) {
+        return FALSE;
+    }
+    red_channel_client_pipe_unlink(rcc, link);
+    return TRUE;
 }
 
 bool red_channel_client_test_remote_common_cap(RedChannelClient *rcc, uint32_t cap)
@@ -817,6 +1159,8 @@ static void red_channel_client_event(int fd, int event, void *data)
     RedChannelClient *rcc = RED_CHANNEL_CLIENT(data);
 
     g_object_ref(rcc);
+    // the completions of the zerocopy writes are signalled as socket errors
+    red_channel_client_zerocopy_release(rcc, false);
     if (event & SPICE_WATCH_EVENT_READ) {
         red_channel_client_receive(rcc);
     }
@@ -909,6 +1253,7 @@ static gboolean red_channel_client_initable_init(GInitable *initable,
     GError *local_error = NULL;
     SpiceCoreInterfaceInternal *core;
     RedChannelClient *self = RED_CHANNEL_CLIENT(initable);
+    uint32_t type;
 
     if (!self->priv->stream) {
         g_set_error_literal(&local_error,
@@ -933,6 +1278,7 @@ static gboolean red_channel_client_initable_init(GInitable *initable,
                         SPICE_WATCH_EVENT_READ,
                         red_channel_client_event,
                         self);
+    self->priv->watch_mask = SPICE_WATCH_EVENT_READ;
 
     if (self->priv->monitor_latency
         && red_stream_get_family(self->priv->stream) != AF_UNIX) {
@@ -949,8 +1295,14 @@ static gboolean red_channel_client_initable_init(GInitable *initable,
     red_channel_add_client(self->priv->channel, self);
     if (!red_client_add_channel(self->priv->client, self, &local_error)) {
         red_channel_remove_client(self->priv->channel, self);
+        goto cleanup;
     }
 
+    g_object_get(self->priv->channel, "channel-type", &type, NULL);
+    self->priv->send_scheduler =
+        send_scheduler_ref(red_client_get_send_scheduler(self->priv->client));
+    self->priv->send_scheduler_entry = send_scheduler_add(self->priv->send_scheduler, type);
+
 cleanup:
     if (local_error) {
         red_channel_warning(red_channel_client_get_channel(self),
@@ -974,6 +1326,12 @@ red_channel_client_watch_update_mask(RedChannelClient *rcc, int event_mask)
         event_mask &= ~SPICE_WATCH_EVENT_READ;
     }
 
+    // the mask is set again at each push, avoid the useless updates
+    if (event_mask == rcc->priv->watch_mask) {
+        return;
+    }
+    rcc->priv->watch_mask = event_mask;
+
     core = red_channel_get_core_interface(rcc->priv->channel);
     core->watch_update_mask(core, rcc->priv->stream->watch, event_mask);
 }
@@ -1096,6 +1454,9 @@ static void red_channel_client_handle_outgoing(RedChannelClient *rcc)
         if (!buffer->size) {  // nothing to be sent
             return;
         }
+        rcc->priv->batch.writing = !g_queue_is_empty(&rcc->priv->batch.marshallers);
+        buffer->zerocopy_sent = red_stream_zerocopy_sent(stream);
+        red_channel_client_zerocopy_release(rcc, false);
     }
 
     for (;;) {
@@ -1128,7 +1489,19 @@ static void red_channel_client_handle_outgoing(RedChannelClient *rcc)
                  * switching from the urgent marshaller to the main one */
                 buffer->pos = 0;
                 buffer->size = 0;
-                red_channel_client_msg_sent(rcc);
+                if (red_stream_zerocopy_sent(stream) != buffer->zerocopy_sent) {
+                    red_channel_client_zerocopy_hold(rcc);
+                }
+                red_channel_client_batch_clear(rcc);
+                if (rcc->priv->send_data.size != 0) {
+                    red_channel_client_msg_sent(rcc);
+                } else {
+                    // only batched messages were written
+                    rcc->priv->send_data.blocked = FALSE;
+                    if (g_queue_is_empty(&rcc->priv->pipe)) {
+                        red_channel_client_restart_ping_timer(rcc);
+                    }
+                }
                 return;
             }
         }
@@ -1311,13 +1684,68 @@ void red_channel_client_send(RedChannelClient *rcc)
     g_object_unref(rcc);
 }
 
+static void red_channel_client_send_scheduler_timer(void *opaque)
+{
+    RedChannelClient *rcc = opaque;
+
+    rcc->priv->send_delayed = false;
+    red_channel_client_push(rcc);
+}
+
+static void red_channel_client_send_scheduler_remove(RedChannelClient *rcc)
+{
+    SpiceCoreInterfaceInternal *core = red_channel_get_core_interface(rcc->priv->channel);
+
+    if (rcc->priv->send_scheduler_timer) {
+        core->timer_remove(core, rcc->priv->send_scheduler_timer);
+        rcc->priv->send_scheduler_timer = NULL;
+    }
+    if (rcc->priv->send_scheduler_entry) {
+        send_scheduler_remove(rcc->priv->send_scheduler, rcc->priv->send_scheduler_entry);
+        rcc->priv->send_scheduler_entry = NULL;
+    }
+    g_clear_pointer(&rcc->priv->send_scheduler, send_scheduler_unref);
+    rcc->priv->send_delayed = false;
+}
+
+/* Whether the client scheduler delays the next message, the push is
+ * retried by a timer when the channel can send again */
+static bool red_channel_client_send_is_delayed(RedChannelClient *rcc)
+{
+    SpiceCoreInterfaceInternal *core;
+    uint64_t delay;
+
+    if (!rcc->priv->send_scheduler_entry) {
+        return false;
+    }
+    delay = send_scheduler_get_delay(rcc->priv->send_scheduler, rcc->priv->send_scheduler_entry,
+                                     spice_get_monotonic_time_ns());
+    rcc->priv->send_delayed = delay != 0;
+    if (!rcc->priv->send_delayed) {
+        return false;
+    }
+    rcc->priv->bandwidth_monitor.sample_delayed = true;
+
+    core = red_channel_get_core_interface(rcc->priv->channel);
+    if (!rcc->priv->send_scheduler_timer) {
+        rcc->priv->send_scheduler_timer =
+            core->timer_add(core, red_channel_client_send_scheduler_timer, rcc);
+    }
+    core->timer_start(core, rcc->priv->send_scheduler_timer,
+                      (delay + NSEC_PER_MILLISEC - 1) / NSEC_PER_MILLISEC);
+    return true;
+}
+
 static inline RedPipeItem *red_channel_client_pipe_item_get(RedChannelClient *rcc)
 {
     if (!rcc || red_channel_client_is_blocked(rcc)
              || red_channel_client_waiting_for_ack(rcc)) {
         return NULL;
     }
-    return g_queue_pop_tail(&rcc->priv->pipe);
+    if (g_queue_is_empty(&rcc->priv->pipe) || red_channel_client_send_is_delayed(rcc)) {
+        return NULL;
+    }
+    return red_channel_client_pipe_unlink(rcc, rcc->priv->pipe.tail);
 }
 
 void red_channel_client_push(RedChannelClient *rcc)
@@ -1343,6 +1771,9 @@ void red_channel_client_push(RedChannelClient *rcc)
     while ((pipe_item = red_channel_client_pipe_item_get(rcc))) {
         red_channel_client_send_item(rcc, pipe_item);
     }
+    if (!g_queue_is_empty(&rcc->priv->batch.marshallers) && !rcc->priv->batch.writing) {
+        red_channel_client_send(rcc);
+    }
     /* prepare_pipe_add() will reenable WRITE events when the rcc->priv->pipe is empty
      * red_channel_client_ack_zero_messages_window() will reenable WRITE events
      * if we were waiting for acks to be received
@@ -1350,7 +1781,9 @@ void red_channel_client_push(RedChannelClient *rcc)
      * notified that we can write and we then exit (see pipe_item_get) as we
      * are waiting for the ack consuming CPU in a tight loop
      */
-    if ((red_channel_client_no_item_being_sent(rcc) && g_queue_is_empty(&rcc->priv->pipe)) ||
+    /* Same when the scheduler delays the sending, the timer will push */
+    if ((red_channel_client_no_item_being_sent(rcc) &&
+         (g_queue_is_empty(&rcc->priv->pipe) || rcc->priv->send_delayed)) ||
         red_channel_client_waiting_for_ack(rcc)) {
         red_channel_client_watch_update_mask(rcc, SPICE_WATCH_EVENT_READ);
         /* channel has no pending data to send so now we can flush data in
@@ -1368,15 +1801,24 @@ void red_channel_client_push(RedChannelClient *rcc)
 
 int red_channel_client_get_roundtrip_ms(RedChannelClient *rcc)
 {
-    if (rcc->priv->latency_monitor.roundtrip < 0) {
-        return rcc->priv->latency_monitor.roundtrip;
+    if (rcc->priv->latency_monitor.smoothed_roundtrip < 0) {
+        return -1;
     }
-    return rcc->priv->latency_monitor.roundtrip / NSEC_PER_MILLISEC;
+    return rcc->priv->latency_monitor.smoothed_roundtrip / NSEC_PER_MILLISEC;
+}
+
+uint64_t red_channel_client_get_bandwidth(RedChannelClient *rcc)
+{
+    if (!rcc->priv->bandwidth_monitor.measured) {
+        return 0;
+    }
+    return rcc->priv->bandwidth_monitor.bytes_per_sec;
 }
 
 void red_channel_client_init_outgoing_messages_window(RedChannelClient *rcc)
 {
     rcc->priv->ack_data.messages_window = 0;
+    rcc->priv->ack_data.num_times = 0;
     red_channel_client_push(rcc);
 }
 
@@ -1418,6 +1860,7 @@ static void red_channel_client_handle_pong(RedChannelClient *rcc, SpiceMsgPing *
         rcc->priv->latency_monitor.roundtrip = now - ping->timestamp;
         spice_debug("update roundtrip %.2f(ms)", ((double)rcc->priv->latency_monitor.roundtrip)/NSEC_PER_MILLISEC);
     }
+    red_channel_client_roundtrip_sample(rcc, now - ping->timestamp);
 
     rcc->priv->latency_monitor.last_pong_time = now;
     rcc->priv->latency_monitor.state = PING_STATE_NONE;
@@ -1481,6 +1924,7 @@ bool red_channel_client_handle_message(RedChannelClient *rcc, uint16_t type,
         break;
     case SPICE_MSGC_ACK:
         if (rcc->priv->ack_data.client_generation == rcc->priv->ack_data.generation) {
+            red_channel_client_ack_window_received(rcc);
             rcc->priv->ack_data.messages_window -= rcc->priv->ack_data.client_window;
             red_channel_client_watch_update_mask(rcc,
                                                  SPICE_WATCH_EVENT_READ|SPICE_WATCH_EVENT_WRITE);
@@ -1517,6 +1961,129 @@ void red_channel_client_init_send_data(RedChannelClient *rcc, uint16_t msg_type)
     rcc->priv->send_data.header.set_msg_type(&rcc->priv->send_data.header, msg_type);
 }
 
+static SpiceMarshaller *red_channel_client_get_free_marshaller(RedChannelClient *rcc)
+{
+    OutgoingMessageBatch *batch = &rcc->priv->batch;
+    SpiceMarshaller *m;
+
+    if (!batch->free_marshallers) {
+        return spice_marshaller_new();
+    }
+    m = batch->free_marshallers->data;
+    batch->free_marshallers = g_slist_delete_link(batch->free_marshallers,
+                                                  batch->free_marshallers);
+    return m;
+}
+
+/* Move the message just marshalled to the batch if more items are going to
+ * be sent right after it. Messages carrying a file descriptor are never
+ * batched as the descriptor must follow its message */
+static bool red_channel_client_batch_message(RedChannelClient *rcc)
+{
+    OutgoingMessageBatch *batch = &rcc->priv->batch;
+    uint32_t size = rcc->priv->send_data.size;
+    SpiceMarshaller *m;
+    uint64_t now;
+
+    if (!rcc->priv->during_send || batch->writing ||
+        red_channel_client_urgent_marshaller_is_active(rcc) ||
+        rcc->priv->send_data.has_fd ||
+        red_channel_client_is_blocked(rcc) ||
+        red_channel_client_waiting_for_ack(rcc) ||
+        g_queue_is_empty(&rcc->priv->pipe)) {
+        return false;
+    }
+    if (batch->size + size > BATCH_MAX_BYTES ||
+        g_queue_get_length(&batch->marshallers) >= BATCH_MAX_MESSAGES) {
+        return false;
+    }
+    now = spice_get_monotonic_time_ns();
+    if (batch->size == 0) {
+        batch->start_time = now;
+    } else if (now - batch->start_time >= BATCH_MAX_DELAY) {
+        return false;
+    }
+
+    g_queue_push_tail(&batch->marshallers, rcc->priv->send_data.main.marshaller);
+    batch->size += size;
+
+    m = red_channel_client_get_free_marshaller(rcc);
+    rcc->priv->send_data.main.marshaller = m;
+    rcc->priv->send_data.marshaller = m;
+    rcc->priv->send_data.size = 0;
+    return true;
+}
+
+/* Keep the marshallers of the data just written, replacing them with new
+ * ones, till the kernel completed the zerocopy writes */
+static void red_channel_client_zerocopy_hold(RedChannelClient *rcc)
+{
+    ZeroCopyHold *hold = g_new0(ZeroCopyHold, 1);
+    SpiceMarshaller *m;
+
+    hold->sent = red_stream_zerocopy_sent(rcc->priv->stream);
+    while ((m = g_queue_pop_head(&rcc->priv->batch.marshallers)) != NULL) {
+        hold->marshallers = g_slist_prepend(hold->marshallers, m);
+    }
+    if (rcc->priv->send_data.size != 0) {
+        hold->marshallers = g_slist_prepend(hold->marshallers, rcc->priv->send_data.marshaller);
+        m = red_channel_client_get_free_marshaller(rcc);
+        if (red_channel_client_urgent_marshaller_is_active(rcc)) {
+            rcc->priv->send_data.urgent.marshaller = m;
+        } else {
+            rcc->priv->send_data.main.marshaller = m;
+        }
+        rcc->priv->send_data.marshaller = m;
+    }
+    g_queue_push_tail(&rcc->priv->zerocopy_holds, hold);
+}
+
+/* Release the data of the completed zerocopy writes, or of all of them if
+ * @all, the connection being closed */
+static void red_channel_client_zerocopy_release(RedChannelClient *rcc, bool all)
+{
+    OutgoingMessageBatch *batch = &rcc->priv->batch;
+    ZeroCopyHold *hold;
+    uint32_t completed = 0;
+
+    /* the notifications must be read even without data held, a write
+     * blocked in the middle of the data completes before being held and
+     * the error queue would keep the socket signalled */
+    if (!all && rcc->priv->stream) {
+        completed = red_stream_zerocopy_completed(rcc->priv->stream);
+    }
+    if (g_queue_is_empty(&rcc->priv->zerocopy_holds)) {
+        return;
+    }
+    while ((hold = g_queue_peek_head(&rcc->priv->zerocopy_holds)) != NULL) {
+        GSList *l;
+
+        if (!all && (int32_t) (completed - hold->sent) < 0) {
+            break;
+        }
+        g_queue_pop_head(&rcc->priv->zerocopy_holds);
+        // this releases the references to the pipe items sent
+        for (l = hold->marshallers; l != NULL; l = l->next) {
+            spice_marshaller_reset(l->data);
+        }
+        batch->free_marshallers = g_slist_concat(hold->marshallers, batch->free_marshallers);
+        g_free(hold);
+    }
+}
+
+static void red_channel_client_batch_clear(RedChannelClient *rcc)
+{
+    OutgoingMessageBatch *batch = &rcc->priv->batch;
+    SpiceMarshaller *m;
+
+    while ((m = g_queue_pop_head(&batch->marshallers)) != NULL) {
+        spice_marshaller_reset(m);
+        batch->free_marshallers = g_slist_prepend(batch->free_marshallers, m);
+    }
+    batch->size = 0;
+    batch->writing = false;
+}
+
 void red_channel_client_begin_send_message(RedChannelClient *rcc)
 {
     SpiceMarshaller *m = rcc->priv->send_data.marshaller;
@@ -1539,8 +2106,16 @@ void red_channel_client_begin_send_message(RedChannelClient *rcc)
                                              rcc->priv->send_data.header.header_size);
     rcc->priv->send_data.header.set_msg_serial(&rcc->priv->send_data.header,
                                                ++rcc->priv->send_data.last_sent_serial);
+    rcc->priv->ack_data.bytes_queued += rcc->priv->send_data.size;
     rcc->priv->ack_data.messages_window++;
+    red_channel_client_ack_window_sent(rcc);
     rcc->priv->send_data.header.data = NULL; /* avoid writing to this until we have a new message */
+#ifndef _WIN32
+    rcc->priv->send_data.has_fd = spice_marshaller_get_fd(m, &rcc->priv->send_data.fd);
+#endif
+    if (red_channel_client_batch_message(rcc)) {
+        return;
+    }
     red_channel_client_send(rcc);
 }
 
@@ -1586,7 +2161,7 @@ void red_channel_client_pipe_add(RedChannelClient *rcc, RedPipeItem *item)
     if (!prepare_pipe_add(rcc, item)) {
         return;
     }
-    g_queue_push_head(&rcc->priv->pipe, item);
+    g_queue_push_head_link(&rcc->priv->pipe, red_channel_client_pipe_link_new(rcc, item));
 }
 
 void red_channel_client_pipe_add_push(RedChannelClient *rcc, RedPipeItem *item)
@@ -1604,7 +2179,8 @@ void red_channel_client_pipe_add_after_pos(RedChannelClient *rcc,
         return;
     }
 
-    g_queue_insert_after(&rcc->priv->pipe, pipe_item_pos, item);
+    pipe_insert_link_after(&rcc->priv->pipe, pipe_item_pos,
+                           red_channel_client_pipe_link_new(rcc, item));
 }
 
 static void
@@ -1617,7 +2193,8 @@ red_channel_client_pipe_add_before_pos(RedChannelClient *rcc,
         return;
     }
 
-    g_queue_insert_before(&rcc->priv->pipe, pipe_item_pos, item);
+    pipe_insert_link_before(&rcc->priv->pipe, pipe_item_pos,
+                            red_channel_client_pipe_link_new(rcc, item));
 }
 
 void red_channel_client_pipe_add_after(RedChannelClient *rcc,
@@ -1627,7 +2204,7 @@ void red_channel_client_pipe_add_after(RedChannelClient *rcc,
     GList *prev;
 
     spice_assert(pos);
-    prev = g_queue_find(&rcc->priv->pipe, pos);
+    prev = red_channel_client_pipe_find(rcc, pos);
     g_return_if_fail(prev != NULL);
 
     red_channel_client_pipe_add_after_pos(rcc, item, prev);
@@ -1636,7 +2213,7 @@ void red_channel_client_pipe_add_after(RedChannelClient *rcc,
 int red_channel_client_pipe_item_is_linked(RedChannelClient *rcc,
                                            RedPipeItem *item)
 {
-    return g_queue_find(&rcc->priv->pipe, item) != NULL;
+    return red_channel_client_pipe_find(rcc, item) != NULL;
 }
 
 void red_channel_client_pipe_add_tail(RedChannelClient *rcc,
@@ -1645,7 +2222,7 @@ void red_channel_client_pipe_add_tail(RedChannelClient *rcc,
     if (!prepare_pipe_add(rcc, item)) {
         return;
     }
-    g_queue_push_tail(&rcc->priv->pipe, item);
+    g_queue_push_tail_link(&rcc->priv->pipe, red_channel_client_pipe_link_new(rcc, item));
 }
 
 void red_channel_client_pipe_add_type(RedChannelClient *rcc, int pipe_item_type)
@@ -1681,6 +2258,70 @@ uint32_t red_channel_client_get_pipe_size(RedChannelClient *rcc)
     return g_queue_get_length(&rcc->priv->pipe);
 }
 
+uint64_t red_channel_client_get_pipe_bytes(RedChannelClient *rcc)
+{
+    return rcc->priv->pipe_bytes;
+}
+
+uint64_t red_channel_client_get_pipe_bytes_limit(RedChannelClient *rcc)
+{
+    uint64_t bytes_per_sec = rcc->priv->bandwidth_monitor.bytes_per_sec;
+    int64_t roundtrip = rcc->priv->latency_monitor.roundtrip;
+    uint64_t limit;
+
+    if (bytes_per_sec == 0) {
+        return PIPE_BYTES_DEFAULT;
+    }
+    if (roundtrip < 0) {
+        roundtrip = 0;
+    }
+    /* enough data to fill the connection for a roundtrip and the
+     * target queueing delay */
+    limit = bytes_per_sec * (roundtrip + PIPE_TARGET_DELAY) / NSEC_PER_SEC;
+    return CLAMP(limit, PIPE_BYTES_MIN, PIPE_BYTES_MAX);
+}
+
+bool red_channel_client_pipe_is_full(RedChannelClient *rcc)
+{
+    return g_queue_get_length(&rcc->priv->pipe) > MAX_PIPE_SIZE ||
+           rcc->priv->pipe_bytes > red_channel_client_get_pipe_bytes_limit(rcc);
+}
+
+bool red_channel_client_is_slow(RedChannelClient *rcc, uint64_t grace_time)
+{
+    uint64_t now;
+
+    /* a pipe held back by the send scheduler is not the client's fault */
+    if (!red_channel_client_pipe_is_full(rcc) || rcc->priv->send_delayed) {
+        rcc->priv->pipe_full_time = 0;
+        return FALSE;
+    }
+    now = spice_get_monotonic_time_ns();
+    if (!rcc->priv->pipe_full_time) {
+        rcc->priv->pipe_full_time = now;
+    }
+    return now - rcc->priv->pipe_full_time >= grace_time;
+}
+
+void red_channel_client_set_parked(RedChannelClient *rcc, bool parked)
+{
+    if (!parked) {
+        rcc->priv->parked_time = 0;
+    } else if (!rcc->priv->parked_time) {
+        rcc->priv->parked_time = spice_get_monotonic_time_ns();
+    }
+}
+
+bool red_channel_client_is_parked(RedChannelClient *rcc)
+{
+    return rcc->priv->parked_time != 0;
+}
+
+uint64_t red_channel_client_get_parked_time(RedChannelClient *rcc)
+{
+    return rcc->priv->parked_time;
+}
+
 GQueue* red_channel_client_get_pipe(RedChannelClient *rcc)
 {
     return &rcc->priv->pipe;
@@ -1709,11 +2350,17 @@ static void red_channel_client_clear_sent_item(RedChannelClient *rcc)
 // are we reading from an fd here? arghh
 static void red_channel_client_pipe_clear(RedChannelClient *rcc)
 {
-    RedPipeItem *item;
-
     red_channel_client_clear_sent_item(rcc);
-    while ((item = g_queue_pop_head(&rcc->priv->pipe)) != NULL) {
-        red_pipe_item_unref(item);
+    red_channel_client_batch_clear(rcc);
+    red_channel_client_zerocopy_release(rcc, true);
+#ifndef _WIN32
+    if (rcc->priv->send_data.has_fd && rcc->priv->send_data.fd != -1) {
+        close(rcc->priv->send_data.fd);
+    }
+    rcc->priv->send_data.has_fd = false;
+#endif
+    while (!g_queue_is_empty(&rcc->priv->pipe)) {
+        red_pipe_item_unref(red_channel_client_pipe_unlink(rcc, rcc->priv->pipe.head));
     }
 }
 
@@ -1722,6 +2369,7 @@ void red_channel_client_ack_zero_messages_window(RedChannelClient *rcc)
     red_channel_client_watch_update_mask(rcc,
                                          SPICE_WATCH_EVENT_READ|SPICE_WATCH_EVENT_WRITE);
     rcc->priv->ack_data.messages_window = 0;
+    rcc->priv->ack_data.num_times = 0;
 }
 
 void red_channel_client_ack_set_client_window(RedChannelClient *rcc, int client_window)
@@ -1764,6 +2412,7 @@ void red_channel_client_disconnect(RedChannelClient *rcc)
         core->timer_remove(core, rcc->priv->connectivity_monitor.timer);
         rcc->priv->connectivity_monitor.timer = NULL;
     }
+    red_channel_client_send_scheduler_remove(rcc);
     red_channel_remove_client(channel, rcc);
     red_channel_client_on_disconnect(rcc);
 }
@@ -1876,7 +2525,7 @@ bool red_channel_client_wait_outgoing_item(RedChannelClient *rcc,
 
 gboolean red_channel_client_no_item_being_sent(RedChannelClient *rcc)
 {
-    return !rcc || (rcc->priv->send_data.size == 0);
+    return !rcc || (rcc->priv->send_data.size == 0 && !rcc->priv->batch.writing);
 }
 
 void red_channel_client_pipe_remove_and_release(RedChannelClient *rcc,
@@ -1890,10 +2539,7 @@ void red_channel_client_pipe_remove_and_release(RedChannelClient *rcc,
 void red_channel_client_pipe_remove_and_release_pos(RedChannelClient *rcc,
                                                     GList *item_pos)
 {
-    RedPipeItem *item = item_pos->data;
-
-    g_queue_delete_link(&rcc->priv->pipe, item_pos);
-    red_pipe_item_unref(item);
+    red_pipe_item_unref(red_channel_client_pipe_unlink(rcc, item_pos));
 }
 
 /* client mutex should be locked before this call */
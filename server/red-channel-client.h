@@ -30,6 +30,9 @@ G_BEGIN_DECLS
 
 #define RED_TYPE_CHANNEL_CLIENT red_channel_client_get_type()
 
+/* Maximum number of items in a pipe regardless of their size */
+#define MAX_PIPE_SIZE 200
+
 SPICE_DECLARE_TYPE(RedChannelClient, red_channel_client, CHANNEL_CLIENT);
 
 gboolean red_channel_client_is_connected(RedChannelClient *rcc);
@@ -67,8 +70,12 @@ void red_channel_client_begin_send_message(RedChannelClient *rcc);
  */
 SpiceMarshaller *red_channel_client_switch_to_urgent_sender(RedChannelClient *rcc);
 
-/* returns -1 if we don't have an estimation */
+/* returns -1 if we don't have an estimation. This is an average updated
+ * along the connection, so it includes the delays of the loaded network */
 int red_channel_client_get_roundtrip_ms(RedChannelClient *rcc);
+/* Returns the bytes per second the connection can send, updated along the
+ * connection. 0 if the connection was never saturated to measure it */
+uint64_t red_channel_client_get_bandwidth(RedChannelClient *rcc);
 
 /* Checks periodically if the connection is still alive */
 void red_channel_client_start_connectivity_monitoring(RedChannelClient *rcc, uint32_t timeout_ms);
@@ -87,6 +94,22 @@ RedPipeItem *red_channel_client_new_empty_msg(int msg_type);
 void red_channel_client_pipe_add_empty_msg(RedChannelClient *rcc, int msg_type);
 gboolean red_channel_client_pipe_is_empty(RedChannelClient *rcc);
 uint32_t red_channel_client_get_pipe_size(RedChannelClient *rcc);
+/* estimated size of the queued items, see RedPipeItem::size_hint */
+uint64_t red_channel_client_get_pipe_bytes(RedChannelClient *rcc);
+/* bytes that can be queued, based on the client bandwidth and roundtrip */
+uint64_t red_channel_client_get_pipe_bytes_limit(RedChannelClient *rcc);
+/* whether producers should stop adding items to the pipe */
+bool red_channel_client_pipe_is_full(RedChannelClient *rcc);
+/* Whether the client cannot keep up with its producer: its pipe stayed full
+ * for @grace_time nanoseconds without the send scheduler delaying it */
+bool red_channel_client_is_slow(RedChannelClient *rcc, uint64_t grace_time);
+/* A parked client could not keep up with its producer and is skipped when
+ * checking whether the producer must stop, its channel resynchronizes it
+ * once its pipe has drained */
+void red_channel_client_set_parked(RedChannelClient *rcc, bool parked);
+bool red_channel_client_is_parked(RedChannelClient *rcc);
+/* monotonic time the client was parked at, 0 if it is not parked */
+uint64_t red_channel_client_get_parked_time(RedChannelClient *rcc);
 GQueue* red_channel_client_get_pipe(RedChannelClient *rcc);
 bool red_channel_client_is_mini_header(RedChannelClient *rcc);
 
@@ -639,6 +639,18 @@ uint32_t red_channel_max_pipe_size(RedChannel *channel)
     return pipe_size;
 }
 
+bool red_channel_any_pipe_full(RedChannel *channel)
+{
+    RedChannelClient *rcc;
+
+    FOREACH_CLIENT(channel, rcc) {
+        if (!red_channel_client_is_parked(rcc) && red_channel_client_pipe_is_full(rcc)) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
 uint32_t red_channel_sum_pipes_size(RedChannel *channel)
 {
     RedChannelClient *rcc;
@@ -182,6 +182,8 @@ void red_channel_connect(RedChannel *channel, RedClient *client,
 
 /* return the sum of all the rcc pipe size */
 uint32_t red_channel_max_pipe_size(RedChannel *channel);
+/* return whether the pipe of any client which is not parked is full */
+bool red_channel_any_pipe_full(RedChannel *channel);
 /* return the max size of all the rcc pipe */
 uint32_t red_channel_sum_pipes_size(RedChannel *channel);
 
@@ -20,6 +20,7 @@
 #include "red-channel.h"
 #include "red-client.h"
 #include "reds.h"
+#include "send-scheduler.h"
 
 #define FOREACH_CHANNEL_CLIENT(_client, _data) \
     GLIST_FOREACH((_client ? (_client)->channels : NULL), RedChannelClient, _data)
@@ -44,6 +45,8 @@ struct RedClient {
     int during_target_migrate;
     int seamless_migrate;
     int num_migrated_channels; /* for seamless - number of channels that wait for migrate data*/
+
+    SendScheduler *send_scheduler;
 };
 
 struct RedClientClass
@@ -107,6 +110,7 @@ red_client_finalize (GObject *object)
     RedClient *self = RED_CLIENT(object);
 
     spice_debug("release client=%p", self);
+    send_scheduler_unref(self->send_scheduler);
     pthread_mutex_destroy(&self->lock);
 
     G_OBJECT_CLASS (red_client_parent_class)->finalize (object);
@@ -141,14 +145,22 @@ red_client_init(RedClient *self)
 {
     pthread_mutex_init(&self->lock, NULL);
     self->thread_id = pthread_self();
+    self->send_scheduler = send_scheduler_new();
 }
 
 RedClient *red_client_new(RedsState *reds, int migrated)
 {
-    return g_object_new(RED_TYPE_CLIENT,
-                        "spice-server", reds,
-                        "migrated", migrated,
-                        NULL);
+    RedClient *client = g_object_new(RED_TYPE_CLIENT,
+                                     "spice-server", reds,
+                                     "migrated", migrated,
+                                     NULL);
+    uint32_t type;
+
+    for (type = 0; type < SPICE_END_CHANNEL; type++) {
+        send_scheduler_set_max_rate(client->send_scheduler, type,
+                                    reds_get_channel_max_rate(reds, type));
+    }
+    return client;
 }
 
 void red_client_set_migration_seamless(RedClient *client) // dest
@@ -374,3 +386,8 @@ RedsState *red_client_get_server(RedClient *client)
 {
     return client->reds;
 }
+
+SendScheduler *red_client_get_send_scheduler(RedClient *client)
+{
+    return client->send_scheduler;
+}
@@ -22,6 +22,7 @@
 #include <glib-object.h>
 
 #include "main-channel-client.h"
+#include "send-scheduler.h"
 
 G_BEGIN_DECLS
 
@@ -58,6 +59,8 @@ void red_client_migrate(RedClient *client);
 gboolean red_client_is_disconnecting(RedClient *client);
 void red_client_set_disconnecting(RedClient *client);
 RedsState* red_client_get_server(RedClient *client);
+/* shares the bandwidth between the channels of the client */
+SendScheduler *red_client_get_send_scheduler(RedClient *client);
 
 G_END_DECLS
 
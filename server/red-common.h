@@ -68,6 +68,9 @@ struct SpiceCoreInterfaceInternal {
         GMainContext *main_context;
         SpiceCoreInterface *public_interface;
     };
+    /* ring polling the watches of the glib implementation, see
+     * uring-event-loop.h, NULL if not used */
+    struct UringEventLoop *uring_loop;
 };
 
 extern const SpiceCoreInterfaceInternal event_loop_core;
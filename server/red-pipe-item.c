@@ -43,7 +43,12 @@ void red_pipe_item_init_full(RedPipeItem *item,
                              red_pipe_item_free_t *free_func)
 {
     item->type = type;
+    item->size_hint = 0;
     item->refcount = 1;
+    item->pipe_link.link.data = item;
+    item->pipe_link.link.prev = item->pipe_link.link.next = NULL;
+    item->pipe_link.pipe = NULL;
+    item->pipe_link.next = NULL;
     item->free_func = free_func ? free_func : (red_pipe_item_free_t *)g_free;
 }
 
@@ -21,17 +21,35 @@
 
 #include <stddef.h>
 #include <inttypes.h>
+#include <glib.h>
 
 typedef struct RedPipeItem RedPipeItem;
+typedef struct RedPipeItemLink RedPipeItemLink;
 
 typedef void red_pipe_item_free_t(RedPipeItem *item);
 
+/* Position of an item in a client pipe */
+struct RedPipeItemLink {
+    GList link; /* link in the pipe, link.data is the item */
+    GQueue *pipe; /* pipe the link is in, NULL if unused */
+    RedPipeItemLink *next; /* next position of the same item */
+};
+
 struct RedPipeItem {
     int type;
+    /* estimated size in bytes of the message(s) sent for this item,
+     * used for pipe flow control. Must not change while the item is queued */
+    uint32_t size_hint;
 
     /* private */
     int refcount;
 
+    /* Positions of the item in the client pipes, so that finding them
+     * does not walk the pipes. The first pipe uses the embedded link, the
+     * items shared between clients are linked in the other pipes by links
+     * recycled by the clients, so queuing does not allocate either */
+    RedPipeItemLink pipe_link;
+
     red_pipe_item_free_t *free_func;
 };
 
@@ -27,6 +27,10 @@
 #else
 #include <ws2tcpip.h>
 #endif
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+#include <linux/errqueue.h>
+#define HAVE_ZEROCOPY 1
+#endif
 
 #include <glib.h>
 
@@ -80,6 +84,15 @@ typedef struct RedSASL {
 
 struct RedStreamPrivate {
     SSL *ssl;
+    /* the kernel encrypts the records written to the socket */
+    bool ktls_send;
+
+    /* the writes of at least this size use MSG_ZEROCOPY, 0 if disabled */
+    size_t zerocopy_threshold;
+    /* number of writes done with MSG_ZEROCOPY */
+    uint32_t zerocopy_sent;
+    /* number of these writes the kernel reported as completed */
+    uint32_t zerocopy_completed;
 
 #if HAVE_SASL
     RedSASL sasl;
@@ -127,6 +140,26 @@ static ssize_t stream_write_cb(RedStream *s, const void *buf, size_t size)
     return socket_write(s->socket, buf, size);
 }
 
+#ifdef HAVE_ZEROCOPY
+static ssize_t stream_zerocopy_writev(RedStream *s, const struct iovec *iov, int iovcnt)
+{
+    struct msghdr msg = {
+        .msg_iov = (struct iovec *) iov,
+        .msg_iovlen = iovcnt,
+    };
+    ssize_t n;
+
+    n = sendmsg(s->socket, &msg, MSG_ZEROCOPY);
+    if (n > 0) {
+        s->priv->zerocopy_sent++;
+    } else if (n < 0 && errno == ENOBUFS) {
+        // too much memory pinned by the socket, copy this time
+        n = socket_writev(s->socket, iov, iovcnt);
+    }
+    return n;
+}
+#endif
+
 static ssize_t stream_writev_cb(RedStream *s, const struct iovec *iov, int iovcnt)
 {
     ssize_t ret = 0;
@@ -142,7 +175,15 @@ static ssize_t stream_writev_cb(RedStream *s, const struct iovec *iov, int iovcn
         for (i = 0; i < tosend; i++) {
             expected += iov[i].iov_len;
         }
+#ifdef HAVE_ZEROCOPY
+        if (s->priv->zerocopy_threshold && expected >= s->priv->zerocopy_threshold) {
+            n = stream_zerocopy_writev(s, iov, tosend);
+        } else {
+            n = socket_writev(s->socket, iov, tosend);
+        }
+#else
         n = socket_writev(s->socket, iov, tosend);
+#endif
         if (n <= expected) {
             if (n > 0)
                 ret += n;
@@ -218,6 +259,17 @@ void red_stream_remove_watch(RedStream* s)
     }
 }
 
+void red_stream_watch(RedStream *s, int event_mask, SpiceWatchFunc func, void *opaque)
+{
+    SpiceCoreInterfaceInternal *core = s->priv->core;
+
+    if (s->watch) {
+        core->watch_update_mask(core, s->watch, event_mask);
+    } else {
+        s->watch = core->watch_add(core, s->socket, event_mask, func, opaque);
+    }
+}
+
 #if HAVE_SASL
 static ssize_t red_stream_sasl_read(RedStream *s, uint8_t *buf, size_t nbyte);
 #endif
@@ -394,21 +446,44 @@ int red_stream_send_msgfd(RedStream *stream, int fd)
 }
 #endif
 
+/* Without writev every write produces a TLS record, SASL packet or
+ * WebSocket frame so small consecutive buffers are merged, up to the
+ * maximum TLS record payload */
+#define STREAM_COALESCE_SIZE (16 * 1024)
+
 ssize_t red_stream_writev(RedStream *s, const struct iovec *iov, int iovcnt)
 {
-    int i;
-    int n;
+    uint8_t buf[STREAM_COALESCE_SIZE];
+    int i = 0;
+    ssize_t n;
     ssize_t ret = 0;
 
     if (s->priv->writev != NULL && iovcnt > 1) {
         return s->priv->writev(s, iov, iovcnt);
     }
 
-    for (i = 0; i < iovcnt; ++i) {
-        n = red_stream_write(s, iov[i].iov_base, iov[i].iov_len);
+    while (i < iovcnt) {
+        const void *data = iov[i].iov_base;
+        size_t len = iov[i].iov_len;
+
+        if (i + 1 < iovcnt && len + iov[i + 1].iov_len <= sizeof(buf)) {
+            len = 0;
+            while (i < iovcnt && len + iov[i].iov_len <= sizeof(buf)) {
+                memcpy(buf + len, iov[i].iov_base, iov[i].iov_len);
+                len += iov[i].iov_len;
+                i++;
+            }
+            data = buf;
+        } else {
+            i++;
+        }
+        n = red_stream_write(s, data, len);
         if (n <= 0)
             return ret == 0 ? n : ret;
         ret += n;
+        if ((size_t) n < len) {
+            break;
+        }
     }
 
     return ret;
@@ -515,6 +590,105 @@ static void red_stream_disable_writev(RedStream *stream)
     stream->priv->writev = NULL;
 }
 
+bool red_stream_is_ktls(RedStream *stream)
+{
+    return stream->priv->ktls_send;
+}
+
+bool red_stream_enable_zerocopy(RedStream *stream, size_t threshold)
+{
+#ifdef HAVE_ZEROCOPY
+    int enable = 1;
+
+    // the data written must be the data of the caller
+    if (stream->priv->ssl || stream->priv->writev != stream_writev_cb) {
+        return false;
+    }
+    if (setsockopt(stream->socket, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) != 0) {
+        return false;
+    }
+    stream->priv->zerocopy_threshold = threshold;
+    return true;
+#else
+    return false;
+#endif
+}
+
+uint32_t red_stream_zerocopy_sent(RedStream *stream)
+{
+    return stream->priv->zerocopy_sent;
+}
+
+#ifdef HAVE_ZEROCOPY
+/* Read the notifications of the completed zerocopy writes from the error
+ * queue of the socket */
+static void red_stream_read_zerocopy_notifications(RedStream *stream)
+{
+    for (;;) {
+        char control[128];
+        struct msghdr msg = {
+            .msg_control = control,
+            .msg_controllen = sizeof(control),
+        };
+        struct cmsghdr *cmsg;
+
+        if (recvmsg(stream->socket, &msg, MSG_ERRQUEUE) < 0) {
+            return;
+        }
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            struct sock_extended_err serr;
+
+            if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+                !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+                continue;
+            }
+            memcpy(&serr, CMSG_DATA(cmsg), sizeof(serr));
+            if (serr.ee_errno != 0 || serr.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            // the notifications cover the range of writes [ee_info, ee_data]
+            stream->priv->zerocopy_completed = serr.ee_data + 1;
+            if (serr.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                /* the kernel had to copy the data (for instance on the
+                 * loopback), pinning the pages is only an overhead */
+                stream->priv->zerocopy_threshold = 0;
+            }
+        }
+    }
+}
+#endif
+
+uint32_t red_stream_zerocopy_completed(RedStream *stream)
+{
+#ifdef HAVE_ZEROCOPY
+    if (stream->priv->zerocopy_completed != stream->priv->zerocopy_sent) {
+        red_stream_read_zerocopy_notifications(stream);
+    }
+#endif
+    return stream->priv->zerocopy_completed;
+}
+
+bool red_stream_ssl_session_reused(RedStream *stream)
+{
+    return stream->priv->ssl && SSL_session_reused(stream->priv->ssl);
+}
+
+/* If OpenSSL moved the session keys to the kernel (SSL_OP_ENABLE_KTLS) the
+ * application data can be written to the socket as for plain connections,
+ * writev and corking included, the kernel producing the records. The
+ * reads and the control records stay handled by OpenSSL */
+static void red_stream_ssl_established(RedStream *stream)
+{
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+    if (BIO_get_ktls_send(SSL_get_wbio(stream->priv->ssl))) {
+        spice_debug("using kernel TLS to send on socket %d", stream->socket);
+        stream->priv->ktls_send = true;
+        stream->priv->write = stream_write_cb;
+        stream->priv->writev = stream_writev_cb;
+    }
+#endif
+}
+
 RedStreamSslStatus red_stream_ssl_accept(RedStream *stream)
 {
     int ssl_error;
@@ -522,6 +696,7 @@ RedStreamSslStatus red_stream_ssl_accept(RedStream *stream)
 
     return_code = SSL_accept(stream->priv->ssl);
     if (return_code == 1) {
+        red_stream_ssl_established(stream);
         return RED_STREAM_SSL_STATUS_OK;
     }
 
@@ -561,6 +736,8 @@ RedStreamSslStatus red_stream_enable_ssl(RedStream *stream, SSL_CTX *ctx)
     }
 
     SSL_set_bio(stream->priv->ssl, sbio, sbio);
+    /* red_stream_writev() can retry a write from a different buffer */
+    SSL_set_mode(stream->priv->ssl, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
 
     stream->priv->write = stream_ssl_write_cb;
     stream->priv->read = stream_ssl_read_cb;
@@ -1188,13 +1365,13 @@ static ssize_t stream_websocket_writev(RedStream *s, const struct iovec *iov, in
     that will speak WebSocket to the client, but allow the server
     to continue to use normal stream read/write/writev semantics.
 */
-bool red_stream_is_websocket(RedStream *stream, const void *buf, size_t len)
+bool red_stream_is_websocket(RedStream *stream, const void *buf, size_t len, int compression)
 {
     if (stream->priv->ws) {
         return false;
     }
 
-    stream->priv->ws = websocket_new(buf, len, stream,
+    stream->priv->ws = websocket_new(buf, len, stream, compression,
                                      (websocket_read_cb_t) stream->priv->read,
                                      (websocket_write_cb_t) stream->priv->write,
                                      (websocket_writev_cb_t) stream->priv->writev);
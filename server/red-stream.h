@@ -56,11 +56,29 @@ void red_stream_free(RedStream *s);
 
 void red_stream_push_channel_event(RedStream *s, int event);
 void red_stream_remove_watch(RedStream* s);
+/* Wait for the socket to be ready for @event_mask in the core interface
+ * of the stream. @func is kept if the stream is already watched */
+void red_stream_watch(RedStream *s, int event_mask, SpiceWatchFunc func, void *opaque);
 void red_stream_set_channel(RedStream *stream, int connection_id,
                             int channel_type, int channel_id);
 RedStream *red_stream_new(RedsState *reds, int socket);
 void red_stream_set_core_interface(RedStream *stream, SpiceCoreInterfaceInternal *core);
 bool red_stream_is_ssl(RedStream *stream);
+/* Whether the records of the SSL stream are produced by the kernel */
+bool red_stream_is_ktls(RedStream *stream);
+/* Whether the TLS handshake resumed a previous session */
+bool red_stream_ssl_session_reused(RedStream *stream);
+/* Send the writes of at least @threshold bytes with MSG_ZEROCOPY, the kernel
+ * reading the data from the memory of the caller instead of copying it.
+ * The memory must be kept unchanged till red_stream_zerocopy_completed()
+ * reaches the value of red_stream_zerocopy_sent() after the write.
+ * Only available for plain TCP sockets, return whether it was enabled */
+bool red_stream_enable_zerocopy(RedStream *stream, size_t threshold);
+/* Number of writes sent with MSG_ZEROCOPY */
+uint32_t red_stream_zerocopy_sent(RedStream *stream);
+/* Number of writes sent with MSG_ZEROCOPY the kernel does not read anymore,
+ * the completions are signalled by an error condition on the socket */
+uint32_t red_stream_zerocopy_completed(RedStream *stream);
 RedStreamSslStatus red_stream_ssl_accept(RedStream *stream);
 RedStreamSslStatus red_stream_enable_ssl(RedStream *stream, SSL_CTX *ctx);
 int red_stream_get_family(const RedStream *stream);
@@ -91,7 +109,7 @@ bool red_stream_set_auto_flush(RedStream *stream, bool auto_flush);
  */
 void red_stream_flush(RedStream *stream);
 
-bool red_stream_is_websocket(RedStream *stream, const void *buf, size_t len);
+bool red_stream_is_websocket(RedStream *stream, const void *buf, size_t len, int compression);
 
 typedef enum {
     RED_SASL_ERROR_OK,
@@ -47,6 +47,9 @@
 #include "cursor-channel.h"
 #include "tree.h"
 #include "red-record-qxl.h"
+#ifdef HAVE_LIBURING
+#include "uring-event-loop.h"
+#endif
 
 // compatibility for FreeBSD
 #ifdef HAVE_PTHREAD_NP_H
@@ -57,6 +60,9 @@
 #define CMD_RING_POLL_TIMEOUT 10 //milli
 #define CMD_RING_POLL_RETRIES 1
 
+/* How long the pipe of a client must stay full before it is parked */
+#define SLOW_CLIENT_GRACE_TIME (NSEC_PER_SEC / 2)
+
 #define INF_EVENT_WAIT ~0
 
 struct RedWorker {
@@ -116,7 +122,7 @@ static int red_process_cursor(RedWorker *worker, int *ring_is_empty)
     }
 
     *ring_is_empty = FALSE;
-    while (red_channel_max_pipe_size(RED_CHANNEL(worker->cursor_channel)) <= MAX_PIPE_SIZE) {
+    while (!red_channel_any_pipe_full(RED_CHANNEL(worker->cursor_channel))) {
         if (!red_qxl_get_cursor_command(worker->qxl, &ext_cmd)) {
             *ring_is_empty = TRUE;
             if (worker->cursor_poll_tries < CMD_RING_POLL_RETRIES) {
@@ -177,7 +183,7 @@ static int red_process_display(RedWorker *worker, int *ring_is_empty)
 
     worker->process_display_generation++;
     *ring_is_empty = FALSE;
-    while (red_channel_max_pipe_size(RED_CHANNEL(worker->display_channel)) <= MAX_PIPE_SIZE) {
+    while (!red_channel_any_pipe_full(RED_CHANNEL(worker->display_channel))) {
         if (!red_qxl_get_command(worker->qxl, &ext_cmd)) {
             *ring_is_empty = TRUE;
             if (worker->display_poll_tries < CMD_RING_POLL_RETRIES) {
@@ -262,23 +268,74 @@ static int red_process_display(RedWorker *worker, int *ring_is_empty)
 
 static bool red_process_is_blocked(RedWorker *worker)
 {
-    return red_channel_max_pipe_size(RED_CHANNEL(worker->cursor_channel)) > MAX_PIPE_SIZE ||
-           red_channel_max_pipe_size(RED_CHANNEL(worker->display_channel)) > MAX_PIPE_SIZE;
+    return red_channel_any_pipe_full(RED_CHANNEL(worker->cursor_channel)) ||
+           red_channel_any_pipe_full(RED_CHANNEL(worker->display_channel));
 }
 
 typedef int (*red_process_t)(RedWorker *worker, int *ring_is_empty);
+typedef void (*red_client_func_t)(RedChannel *channel, RedChannelClient *rcc);
+
+/* Park the clients which are not able to keep up so that the guest and the
+ * other clients are not stalled by them. A client whose pipe is only full
+ * for a moment is waited for, parking it drops its queued drawings and
+ * resends its surfaces. Returns whether a client was parked */
+static bool park_slow_clients(RedChannel *red_channel, red_client_func_t park)
+{
+    RedChannelClient *rcc;
+    bool parked = FALSE;
+
+    FOREACH_CLIENT(red_channel, rcc) {
+        if (red_channel_client_is_parked(rcc) ||
+            !red_channel_client_is_slow(rcc, SLOW_CLIENT_GRACE_TIME)) {
+            continue;
+        }
+        spice_debug("parking slow client %p of channel %s", rcc,
+                    red_channel_get_name(red_channel));
+        park(red_channel, rcc);
+        parked = TRUE;
+    }
+    return parked;
+}
+
+/* Resume the parked clients whose pipe has drained and disconnect the ones
+ * which did not manage to in time. Returns whether clients are still parked */
+static bool check_parked_clients(RedChannel *red_channel, red_client_func_t resume)
+{
+    uint64_t now = spice_get_monotonic_time_ns();
+    bool parked = FALSE;
+    GList *l, *next;
+
+    for (l = red_channel_get_clients(red_channel); l != NULL; l = next) {
+        RedChannelClient *rcc = l->data;
+
+        next = l->next;
+        if (!red_channel_client_is_parked(rcc)) {
+            continue;
+        }
+        if (!red_channel_client_pipe_is_full(rcc)) {
+            spice_debug("resuming client %p of channel %s", rcc,
+                        red_channel_get_name(red_channel));
+            resume(red_channel, rcc);
+        } else if (now - red_channel_client_get_parked_time(rcc) >= COMMON_CLIENT_TIMEOUT) {
+            spice_warning("timeout, disconnecting slow client %p of channel %s", rcc,
+                          red_channel_get_name(red_channel));
+            red_channel_client_disconnect(rcc);
+        } else {
+            parked = TRUE;
+        }
+    }
+    return parked;
+}
+
+/* Process all the commands of the ring. The clients whose pipe stays full
+ * are parked instead of being waited for, they are resumed or disconnected
+ * later by check_parked_clients */
 static void flush_commands(RedWorker *worker, RedChannel *red_channel,
-                           red_process_t process)
+                           red_process_t process, red_client_func_t park)
 {
     for (;;) {
-        uint64_t end_time;
         int ring_is_empty;
 
-        process(worker, &ring_is_empty);
-        if (ring_is_empty) {
-            break;
-        }
-
         while (process(worker, &ring_is_empty)) {
             red_channel_push(red_channel);
         }
@@ -286,44 +343,47 @@ static void flush_commands(RedWorker *worker, RedChannel *red_channel,
         if (ring_is_empty) {
             break;
         }
-        end_time = spice_get_monotonic_time_ns() + COMMON_CLIENT_TIMEOUT;
-        for (;;) {
-            red_channel_push(red_channel);
-            if (red_channel_max_pipe_size(red_channel) <= MAX_PIPE_SIZE) {
-                break;
-            }
-            red_channel_receive(red_channel);
-            red_channel_send(red_channel);
-            // TODO: MC: the whole timeout will break since it takes lowest timeout, should
-            // do it client by client.
-            if (spice_get_monotonic_time_ns() >= end_time) {
-                // TODO: we need to record the client that actually causes the timeout.
-                // So we need to check the locations of the various pipe heads when counting,
-                // and disconnect only those/that.
-                spice_warning("flush timeout");
-                red_channel_disconnect(red_channel);
-            } else {
-                usleep(DISPLAY_CLIENT_RETRY_INTERVAL);
-            }
+        red_channel_receive(red_channel);
+        red_channel_send(red_channel);
+        red_channel_push(red_channel);
+        if (!park_slow_clients(red_channel, park)) {
+            usleep(DISPLAY_CLIENT_RETRY_INTERVAL);
         }
     }
 }
 
+static void park_display_client(RedChannel *channel, RedChannelClient *rcc)
+{
+    dcc_park(DISPLAY_CHANNEL_CLIENT(rcc));
+}
+
+static void resume_display_client(RedChannel *channel, RedChannelClient *rcc)
+{
+    dcc_resume(DISPLAY_CHANNEL_CLIENT(rcc));
+}
+
+static void park_cursor_client(RedChannel *channel, RedChannelClient *rcc)
+{
+    cursor_channel_park_client(CURSOR_CHANNEL(channel), rcc);
+}
+
+static void resume_cursor_client(RedChannel *channel, RedChannelClient *rcc)
+{
+    cursor_channel_resume_client(CURSOR_CHANNEL(channel), rcc);
+}
+
 static void flush_display_commands(RedWorker *worker)
 {
     flush_commands(worker, RED_CHANNEL(worker->display_channel),
-                   red_process_display);
+                   red_process_display, park_display_client);
 }
 
 static void flush_cursor_commands(RedWorker *worker)
 {
     flush_commands(worker, RED_CHANNEL(worker->cursor_channel),
-                   red_process_cursor);
+                   red_process_cursor, park_cursor_client);
 }
 
-// TODO: on timeout, don't disconnect all channels immediately - try to disconnect the slowest ones
-// first and maybe turn timeouts to several timeouts in order to disconnect channels gradually.
-// Should use disconnect or shutdown?
 static void flush_all_qxl_commands(RedWorker *worker)
 {
     flush_display_commands(worker);
@@ -1020,6 +1080,7 @@ static gboolean worker_source_dispatch(GSource *source, GSourceFunc callback,
     RedWorker *worker = wsource->worker;
     DisplayChannel *display = worker->display_channel;
     int ring_is_empty;
+    bool parked;
 
     /* during migration, in the dest, the display channel can be initialized
        while the global lz data not since migrate data msg hasn't been
@@ -1035,6 +1096,13 @@ static gboolean worker_source_dispatch(GSource *source, GSourceFunc callback,
     red_process_cursor(worker, &ring_is_empty);
     red_process_display(worker, &ring_is_empty);
 
+    parked = check_parked_clients(RED_CHANNEL(worker->cursor_channel), resume_cursor_client);
+    parked = check_parked_clients(RED_CHANNEL(display), resume_display_client) || parked;
+    if (parked) {
+        // check again soon even if the parked clients are stuck
+        worker->event_timeout = MIN(worker->event_timeout, CMD_RING_POLL_TIMEOUT);
+    }
+
     return TRUE;
 }
 
@@ -1058,6 +1126,12 @@ RedWorker* red_worker_new(QXLInstance *qxl)
     worker = g_new0(RedWorker, 1);
     worker->core = event_loop_core;
     worker->core.main_context = g_main_context_new();
+#ifdef HAVE_LIBURING
+    // with many clients polling all the sockets at each iteration is costly
+    if (reds_get_io_uring(reds)) {
+        uring_event_loop_init(&worker->core);
+    }
+#endif
 
     worker->record = reds_get_record(reds);
     dispatcher = red_qxl_get_dispatcher(qxl);
@@ -1111,6 +1185,16 @@ RedWorker* red_worker_new(QXLInstance *qxl)
     red_channel_init_stat_node(channel, &worker->stat, "display_channel");
     display_channel_set_image_compression(worker->display_channel,
                                           spice_server_get_image_compression(reds));
+    if (reds_get_compress_cache_memory(reds) >= 0) {
+        display_channel_set_compress_cache_memory(worker->display_channel,
+                                                  (uint64_t) reds_get_compress_cache_memory(reds)
+                                                  * 1024 * 1024);
+    }
+    if (reds_get_drawables_memory(reds) > 0) {
+        display_channel_set_drawables_memory(worker->display_channel,
+                                             (uint64_t) reds_get_drawables_memory(reds)
+                                             * 1024 * 1024);
+    }
 
     return worker;
 }
@@ -1188,6 +1272,9 @@ void red_worker_free(RedWorker *worker)
         worker->core.watch_remove(&worker->core, worker->dispatch_watch);
     }
 
+#ifdef HAVE_LIBURING
+    uring_event_loop_destroy(&worker->core);
+#endif
     g_main_context_unref(worker->core.main_context);
 
     if (worker->record) {
@@ -27,6 +27,9 @@
 #include "inputs-channel.h"
 #include "stat-file.h"
 #include "red-record-qxl.h"
+#include "image-encoder-pool.h"
+#include "handshake-pool.h"
+#include "tls-session-cache.h"
 
 #define MIGRATE_TIMEOUT (MSEC_PER_SEC * 10)
 #define MM_TIME_DELTA 400 /*ms*/
@@ -134,6 +137,12 @@ struct RedsState {
     GList *qxl_instances;
     MainDispatcher *main_dispatcher;
     RedRecord *record;
+    ImageEncoderPool *image_encoder_pool;
+    HandshakePool *handshake_pool;
+    TlsSessionCache *tls_session_cache;
+    /* protects the state used by the handshake threads, the list of
+     * channels and the ticket */
+    pthread_mutex_t handshake_lock;
 };
 
 #define FOREACH_QXL_INSTANCE(_reds, _qxl) \
@@ -66,6 +66,7 @@
 #include "smartcard.h"
 #endif
 #include "red-stream.h"
+#include "websocket.h"
 #include "red-client.h"
 
 #include "reds-private.h"
@@ -81,6 +82,15 @@
 
 static void reds_client_monitors_config(RedsState *reds, VDAgentMonitorsConfig *monitors_config);
 static gboolean reds_use_client_monitors_config(RedsState *reds);
+SPICE_GNUC_VISIBLE int spice_server_set_websocket_compression(SpiceServer *reds, int level)
+{
+    if (level < 0 || level > 9) {
+        return -1;
+    }
+    reds->config->websocket_compression = level;
+    return 0;
+}
+
 static void reds_set_video_codecs(RedsState *reds, GArray *video_codecs);
 
 static SpiceTimer *adapter_timer_add(const SpiceCoreInterfaceInternal *iface, SpiceTimerFunc func, void *opaque)
@@ -195,10 +205,19 @@ struct RedServerConfig {
     gboolean exit_on_disconnect;
 
     RedSSLParameters ssl_parameters;
+    TlsSessionConfig tls_session;
+    bool ktls;
+    int websocket_compression;
+    bool zerocopy;
+    int compress_cache_memory; /* in MiB, -1 for the display channel default */
+    int drawables_memory; /* in MiB, -1 for the display channel default */
+    bool io_uring;
+    uint64_t channel_max_rates[SPICE_END_CHANNEL]; /* bytes per second, 0 for no limit */
+    bool shared_video_encoders;
 };
 
 
-typedef struct RedLinkInfo {
+struct RedLinkInfo {
     RedsState *reds;
     RedStream *stream;
     SpiceLinkHeader link_header;
@@ -207,7 +226,10 @@ typedef struct RedLinkInfo {
     TicketInfo tiTicketing;
     SpiceLinkAuthMechanism auth_mechanism;
     int skip_auth;
-} RedLinkInfo;
+    /* processed by a thread of the handshake pool */
+    bool in_handshake_thread;
+    red_time_t ssl_start_time;
+};
 
 struct ChannelSecurityOptions {
     uint32_t channel_id;
@@ -326,6 +348,11 @@ void reds_handle_channel_event(RedsState *reds, int event, SpiceChannelEventInfo
 
 static void reds_link_free(RedLinkInfo *link)
 {
+    if (link->in_handshake_thread) {
+        link->in_handshake_thread = false;
+        handshake_pool_release(link->reds->handshake_pool, link);
+    }
+
     red_stream_free(link->stream);
     link->stream = NULL;
 
@@ -389,14 +416,18 @@ void reds_register_channel(RedsState *reds, RedChannel *channel)
     } else {
         g_warn_if_fail(reds_find_channel(reds, this_type, this_id) == NULL);
     }
+    pthread_mutex_lock(&reds->handshake_lock);
     reds->channels = g_list_prepend(reds->channels, channel);
+    pthread_mutex_unlock(&reds->handshake_lock);
     // create new channel in the client if possible
     main_channel_registered_new_channel(reds->main_channel, channel);
 }
 
 void reds_unregister_channel(RedsState *reds, RedChannel *channel)
 {
+    pthread_mutex_lock(&reds->handshake_lock);
     reds->channels = g_list_remove(reds->channels, channel);
+    pthread_mutex_unlock(&reds->handshake_lock);
 }
 
 RedChannel *reds_find_channel(RedsState *reds, uint32_t type, uint32_t id)
@@ -1613,15 +1644,17 @@ bool reds_handle_migrate_data(RedsState *reds, MainChannelClient *mcc,
     return TRUE;
 }
 
-static void reds_channel_init_auth_caps(RedLinkInfo *link, RedChannel *channel)
+/* The authentication capabilities depend on the link, they are added to
+ * the copy of the capabilities of the channel sent to the client */
+static void reds_link_init_auth_caps(RedLinkInfo *link, RedChannelCapabilities *caps)
 {
     RedsState *reds = link->reds;
     if (reds->config->sasl_enabled && !link->skip_auth) {
-        red_channel_set_common_cap(channel, SPICE_COMMON_CAP_AUTH_SASL);
+        red_channel_capabilities_set_common_cap(caps, SPICE_COMMON_CAP_AUTH_SASL);
     } else {
-        red_channel_set_common_cap(channel, SPICE_COMMON_CAP_AUTH_SPICE);
+        red_channel_capabilities_set_common_cap(caps, SPICE_COMMON_CAP_AUTH_SPICE);
     }
-    red_channel_set_common_cap(channel, SPICE_COMMON_CAP_PROTOCOL_AUTH_SELECTION);
+    red_channel_capabilities_set_common_cap(caps, SPICE_COMMON_CAP_PROTOCOL_AUTH_SELECTION);
 }
 
 
@@ -1647,7 +1680,7 @@ static bool reds_send_link_ack(RedsState *reds, RedLinkInfo *link)
         SpiceLinkReply ack;
     } msg;
     RedChannel *channel;
-    const RedChannelCapabilities *channel_caps;
+    RedChannelCapabilities channel_caps;
     BUF_MEM *bmBuf;
     BIO *bio = NULL;
     int ret = FALSE;
@@ -1662,10 +1695,14 @@ static bool reds_send_link_ack(RedsState *reds, RedLinkInfo *link)
 
     msg.ack.error = GUINT32_TO_LE(SPICE_LINK_ERR_OK);
 
+    /* this can run in a handshake thread while the main thread registers
+     * channels, the capabilities are copied to be used out of the lock */
+    pthread_mutex_lock(&reds->handshake_lock);
     channel = reds_find_channel(reds, link->link_mess->channel_type,
                                 link->link_mess->channel_id);
     if (!channel) {
         if (link->link_mess->channel_type != SPICE_CHANNEL_MAIN) {
+            pthread_mutex_unlock(&reds->handshake_lock);
             spice_warning("Received wrong header: channel_type != SPICE_CHANNEL_MAIN");
             return FALSE;
         }
@@ -1673,13 +1710,14 @@ static bool reds_send_link_ack(RedsState *reds, RedLinkInfo *link)
         channel = RED_CHANNEL(reds->main_channel);
     }
 
-    reds_channel_init_auth_caps(link, channel); /* make sure common caps are set */
+    red_channel_capabilities_init(&channel_caps, red_channel_get_local_capabilities(channel));
+    pthread_mutex_unlock(&reds->handshake_lock);
+    reds_link_init_auth_caps(link, &channel_caps);
 
-    channel_caps = red_channel_get_local_capabilities(channel);
-    msg.ack.num_common_caps = GUINT32_TO_LE(channel_caps->num_common_caps);
-    msg.ack.num_channel_caps = GUINT32_TO_LE(channel_caps->num_caps);
-    hdr_size += channel_caps->num_common_caps * sizeof(uint32_t);
-    hdr_size += channel_caps->num_caps * sizeof(uint32_t);
+    msg.ack.num_common_caps = GUINT32_TO_LE(channel_caps.num_common_caps);
+    msg.ack.num_channel_caps = GUINT32_TO_LE(channel_caps.num_caps);
+    hdr_size += channel_caps.num_common_caps * sizeof(uint32_t);
+    hdr_size += channel_caps.num_caps * sizeof(uint32_t);
     msg.header.size = GUINT32_TO_LE(hdr_size);
     msg.ack.caps_offset = GUINT32_TO_LE(sizeof(SpiceLinkReply));
     if (!reds->config->sasl_enabled
@@ -1687,13 +1725,13 @@ static bool reds_send_link_ack(RedsState *reds, RedLinkInfo *link)
         if (!(link->tiTicketing.rsa = RSA_new())) {
             spice_warning("RSA new failed");
             red_dump_openssl_errors();
-            return FALSE;
+            goto end;
         }
 
         if (!(bio = BIO_new(BIO_s_mem()))) {
             spice_warning("BIO new failed");
             red_dump_openssl_errors();
-            return FALSE;
+            goto end;
         }
 
         if (RSA_generate_key_ex(link->tiTicketing.rsa,
@@ -1726,13 +1764,13 @@ static bool reds_send_link_ack(RedsState *reds, RedLinkInfo *link)
 
     if (!red_stream_write_all(link->stream, &msg, sizeof(msg)))
         goto end;
-    for (unsigned int i = 0; i < channel_caps->num_common_caps; i++) {
-        guint32 cap = GUINT32_TO_LE(channel_caps->common_caps[i]);
+    for (unsigned int i = 0; i < channel_caps.num_common_caps; i++) {
+        guint32 cap = GUINT32_TO_LE(channel_caps.common_caps[i]);
         if (!red_stream_write_all(link->stream, &cap, sizeof(cap)))
             goto end;
     }
-    for (unsigned int i = 0; i < channel_caps->num_caps; i++) {
-        guint32 cap = GUINT32_TO_LE(channel_caps->caps[i]);
+    for (unsigned int i = 0; i < channel_caps.num_caps; i++) {
+        guint32 cap = GUINT32_TO_LE(channel_caps.caps[i]);
         if (!red_stream_write_all(link->stream, &cap, sizeof(cap)))
             goto end;
     }
@@ -1742,6 +1780,7 @@ static bool reds_send_link_ack(RedsState *reds, RedLinkInfo *link)
 end:
     if (bio != NULL)
         BIO_free(bio);
+    red_channel_capabilities_reset(&channel_caps);
     return ret;
 }
 
@@ -2174,6 +2213,14 @@ static void reds_handle_link(RedLinkInfo *link)
     RedsState *reds = link->reds;
 
     red_stream_remove_watch(link->stream);
+    if (link->in_handshake_thread) {
+        /* the clients and channels are managed by the main thread */
+        link->in_handshake_thread = false;
+        handshake_pool_release(reds->handshake_pool, link);
+        red_stream_set_core_interface(link->stream, reds_get_core_interface(reds));
+        main_dispatcher_link_authenticated(reds->main_dispatcher, link);
+        return;
+    }
     if (link->link_mess->channel_type == SPICE_CHANNEL_MAIN) {
         reds_handle_main_link(reds, link);
     } else {
@@ -2181,12 +2228,45 @@ static void reds_handle_link(RedLinkInfo *link)
     }
 }
 
+void reds_handle_authenticated_link(RedsState *reds, RedLinkInfo *link)
+{
+    spice_assert(link->reds == reds);
+    reds_handle_link(link);
+}
+
+static bool reds_check_ticket(RedsState *reds, const char *password)
+{
+    time_t ltime;
+    bool expired;
+
+    if (strlen(reds->config->taTicket.password) == 0) {
+        spice_warning("Ticketing is enabled, but no password is set. "
+                      "please set a ticket first");
+        return FALSE;
+    }
+
+    ltime = spice_get_monotonic_time_ns() / NSEC_PER_SEC;
+    expired = (reds->config->taTicket.expiration_time < ltime);
+
+    if (expired) {
+        spice_warning("Ticket has expired");
+        return FALSE;
+    }
+
+    if (strcmp(password, reds->config->taTicket.password) != 0) {
+        spice_warning("Invalid password");
+        return FALSE;
+    }
+    return TRUE;
+}
+
 static void reds_handle_ticket(void *opaque)
 {
     RedLinkInfo *link = (RedLinkInfo *)opaque;
     RedsState *reds = link->reds;
     char *password;
     int password_size;
+    bool ticket_valid;
 
     if (RSA_size(link->tiTicketing.rsa) < SPICE_MAX_PASSWORD_LENGTH) {
         spice_warning("RSA modulus size is smaller than SPICE_MAX_PASSWORD_LENGTH (%d < %d), "
@@ -2207,28 +2287,12 @@ static void reds_handle_ticket(void *opaque)
     }
     password[password_size] = '\0';
 
-    if (reds->config->ticketing_enabled && !link->skip_auth) {
-        time_t ltime;
-        bool expired;
-
-        if (strlen(reds->config->taTicket.password) == 0) {
-            spice_warning("Ticketing is enabled, but no password is set. "
-                          "please set a ticket first");
-            goto error;
-        }
-
-        ltime = spice_get_monotonic_time_ns() / NSEC_PER_SEC;
-        expired = (reds->config->taTicket.expiration_time < ltime);
-
-        if (expired) {
-            spice_warning("Ticket has expired");
-            goto error;
-        }
-
-        if (strcmp(password, reds->config->taTicket.password) != 0) {
-            spice_warning("Invalid password");
-            goto error;
-        }
+    pthread_mutex_lock(&reds->handshake_lock);
+    ticket_valid = !reds->config->ticketing_enabled || link->skip_auth ||
+                   reds_check_ticket(reds, password);
+    pthread_mutex_unlock(&reds->handshake_lock);
+    if (!ticket_valid) {
+        goto error;
     }
 
     reds_handle_link(link);
@@ -2454,7 +2518,8 @@ static void reds_handle_read_magic_done(void *opaque)
            So we may as well read a SpiceLinkHeader's worth of data, and if it's
            clear that a WebSocket connection was requested, we switch
            before proceeding further. */
-        if (red_stream_is_websocket(link->stream, &header->magic, sizeof(header->magic))) {
+        if (red_stream_is_websocket(link->stream, &header->magic, sizeof(header->magic),
+                                    link->reds->config->websocket_compression)) {
             reds_handle_new_link(link);
             return;
         }
@@ -2480,30 +2545,66 @@ static void reds_handle_new_link(RedLinkInfo *link)
                           link);
 }
 
-static void reds_handle_ssl_accept(int fd, int event, void *data)
-{
-    RedLinkInfo *link = (RedLinkInfo *)data;
-    RedsState *reds = link->reds;
-    RedStreamSslStatus return_code = red_stream_ssl_accept(link->stream);
+static void reds_handle_ssl_accept(int fd, int event, void *data);
 
-    switch (return_code) {
+/* Continue the TLS handshake of a link after the last step returned @status */
+static void reds_handle_ssl_status(RedLinkInfo *link, RedStreamSslStatus status)
+{
+    switch (status) {
         case RED_STREAM_SSL_STATUS_ERROR:
             reds_link_free(link);
             return;
         case RED_STREAM_SSL_STATUS_WAIT_FOR_READ:
-            reds_core_watch_update_mask(reds, link->stream->watch,
-                                        SPICE_WATCH_EVENT_READ);
+            red_stream_watch(link->stream, SPICE_WATCH_EVENT_READ,
+                             reds_handle_ssl_accept, link);
             return;
         case RED_STREAM_SSL_STATUS_WAIT_FOR_WRITE:
-            reds_core_watch_update_mask(reds, link->stream->watch,
-                                        SPICE_WATCH_EVENT_WRITE);
+            red_stream_watch(link->stream, SPICE_WATCH_EVENT_WRITE,
+                             reds_handle_ssl_accept, link);
             return;
         case RED_STREAM_SSL_STATUS_OK:
             red_stream_remove_watch(link->stream);
+            if (link->reds->tls_session_cache) {
+                tls_session_cache_handshake_done(link->reds->tls_session_cache,
+                                                 red_stream_ssl_session_reused(link->stream),
+                                                 spice_get_monotonic_time_ns() -
+                                                 link->ssl_start_time);
+            }
             reds_handle_new_link(link);
     }
 }
 
+static void reds_handle_ssl_accept(int fd, int event, void *data)
+{
+    RedLinkInfo *link = (RedLinkInfo *)data;
+
+    reds_handle_ssl_status(link, red_stream_ssl_accept(link->stream));
+}
+
+static void reds_handshake_thread_start(SpiceCoreInterfaceInternal *core, void *opaque)
+{
+    RedLinkInfo *link = opaque;
+
+    red_stream_set_core_interface(link->stream, core);
+    reds_handle_new_link(link);
+}
+
+static void reds_ssl_handshake_thread_start(SpiceCoreInterfaceInternal *core, void *opaque)
+{
+    RedLinkInfo *link = opaque;
+
+    red_stream_set_core_interface(link->stream, core);
+    reds_handle_ssl_status(link, red_stream_enable_ssl(link->stream, link->reds->ctx));
+}
+
+/* Process the link in a handshake thread, it is given back to the main
+ * thread by reds_handle_link() once authenticated */
+static void reds_run_handshake(RedsState *reds, RedLinkInfo *link, HandshakeFunc func)
+{
+    link->in_handshake_thread = true;
+    handshake_pool_run(reds->handshake_pool, func, (GDestroyNotify) reds_link_free, link);
+}
+
 #define KEEPALIVE_TIMEOUT (10*60)
 
 static RedLinkInfo *reds_init_client_connection(RedsState *reds, int socket)
@@ -2537,7 +2638,8 @@ error:
 }
 
 
-static RedLinkInfo *reds_init_client_ssl_connection(RedsState *reds, int socket)
+static RedLinkInfo *reds_init_client_ssl_connection(RedsState *reds, int socket,
+                                                    int skip_auth)
 {
     RedLinkInfo *link;
     RedStreamSslStatus ssl_status;
@@ -2547,24 +2649,18 @@ static RedLinkInfo *reds_init_client_ssl_connection(RedsState *reds, int socket)
         return NULL;
     }
 
+    link->skip_auth = skip_auth;
+    link->ssl_start_time = spice_get_monotonic_time_ns();
+    if (reds->handshake_pool) {
+        reds_run_handshake(reds, link, reds_ssl_handshake_thread_start);
+        return link;
+    }
+
     ssl_status = red_stream_enable_ssl(link->stream, reds->ctx);
-    switch (ssl_status) {
-        case RED_STREAM_SSL_STATUS_OK:
-            reds_handle_new_link(link);
-            return link;
-        case RED_STREAM_SSL_STATUS_ERROR:
-            goto error;
-        case RED_STREAM_SSL_STATUS_WAIT_FOR_READ:
-            link->stream->watch = reds_core_watch_add(reds, link->stream->socket,
-                                                      SPICE_WATCH_EVENT_READ,
-                                                      reds_handle_ssl_accept, link);
-            break;
-        case RED_STREAM_SSL_STATUS_WAIT_FOR_WRITE:
-            link->stream->watch = reds_core_watch_add(reds, link->stream->socket,
-                                                      SPICE_WATCH_EVENT_WRITE,
-                                                      reds_handle_ssl_accept, link);
-            break;
+    if (ssl_status == RED_STREAM_SSL_STATUS_ERROR) {
+        goto error;
     }
+    reds_handle_ssl_status(link, ssl_status);
     return link;
 
 error:
@@ -2586,7 +2682,7 @@ static void reds_accept_ssl_connection(int fd, int event, void *data)
         return;
     }
 
-    if (!(link = reds_init_client_ssl_connection(reds, socket))) {
+    if (!(link = reds_init_client_ssl_connection(reds, socket, 0))) {
         close(socket);
         return;
     }
@@ -2619,7 +2715,11 @@ SPICE_GNUC_VISIBLE int spice_server_add_client(SpiceServer *reds, int socket, in
 
     link->skip_auth = skip_auth;
 
-    reds_handle_new_link(link);
+    if (reds->handshake_pool) {
+        reds_run_handshake(reds, link, reds_handshake_thread_start);
+    } else {
+        reds_handle_new_link(link);
+    }
     return 0;
 }
 
@@ -2628,11 +2728,10 @@ SPICE_GNUC_VISIBLE int spice_server_add_ssl_client(SpiceServer *reds, int socket
 {
     RedLinkInfo *link;
 
-    if (!(link = reds_init_client_ssl_connection(reds, socket))) {
+    if (!(link = reds_init_client_ssl_connection(reds, socket, skip_auth))) {
         return -1;
     }
 
-    link->skip_auth = skip_auth;
     return 0;
 }
 
@@ -2935,6 +3034,14 @@ static int reds_init_ssl(RedsState *reds)
     }
 
     SSL_CTX_set_options(reds->ctx, ssl_options);
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+    /* let the kernel encrypt, the channels can then use writev and
+     * corking as with plain connections. OpenSSL falls back to user space
+     * encryption if the kernel or the cipher is not supported */
+    if (reds->config->ktls) {
+        SSL_CTX_set_options(reds->ctx, SSL_OP_ENABLE_KTLS);
+    }
+#endif
 #if HAVE_DECL_SSL_CTX_SET_ECDH_AUTO || defined(SSL_CTX_set_ecdh_auto)
     SSL_CTX_set_ecdh_auto(reds->ctx, 1);
 #endif
@@ -2978,6 +3085,10 @@ static int reds_init_ssl(RedsState *reds)
     }
 
     SSL_CTX_set_session_id_context(reds->ctx, (const unsigned char *)"SPICE", 5);
+    reds->tls_session_cache = tls_session_cache_new(reds, reds->ctx, &reds->config->tls_session);
+    if (!reds->tls_session_cache) {
+        return -1;
+    }
     if (strlen(reds->config->ssl_parameters.ciphersuite) > 0) {
         if (!SSL_CTX_set_cipher_list(reds->ctx, reds->config->ssl_parameters.ciphersuite)) {
             return -1;
@@ -3620,6 +3731,7 @@ SPICE_GNUC_VISIBLE SpiceServer *spice_server_new(void)
     const char *record_filename;
     RedsState *reds = g_new0(RedsState, 1);
 
+    pthread_mutex_init(&reds->handshake_lock, NULL);
     reds->config = g_new0(RedServerConfig, 1);
     reds->config->default_channel_security =
         SPICE_CHANNEL_SECURITY_NONE | SPICE_CHANNEL_SECURITY_SSL;
@@ -3645,6 +3757,12 @@ SPICE_GNUC_VISIBLE SpiceServer *spice_server_new(void)
     reds->config->agent_copypaste = TRUE;
     reds->config->agent_file_xfer = TRUE;
     reds->config->exit_on_disconnect = FALSE;
+    reds->config->tls_session.cache_size = SSL_SESSION_CACHE_MAX_SIZE_DEFAULT;
+    reds->config->tls_session.timeout = 0;
+    reds->config->tls_session.ticket_key_lifetime = 60 * 60;
+    reds->config->websocket_compression = WEBSOCKET_DEFAULT_COMPRESSION;
+    reds->config->compress_cache_memory = -1;
+    reds->config->drawables_memory = -1;
 #ifdef RED_STATISTICS
     reds->stat_file = stat_file_new(REDS_MAX_STAT_NODES);
     /* Create an initial node. This will be the 0 node making easier
@@ -3900,6 +4018,8 @@ SPICE_GNUC_VISIBLE void spice_server_destroy(SpiceServer *reds)
     pthread_mutex_unlock(&global_reds_lock);
 
     g_list_free_full(reds->qxl_instances, (GDestroyNotify)red_qxl_destroy);
+    image_encoder_pool_free(reds->image_encoder_pool);
+    handshake_pool_free(reds->handshake_pool);
 
     if (reds->inputs_channel) {
         red_channel_destroy(RED_CHANNEL(reds->inputs_channel));
@@ -3912,6 +4032,7 @@ SPICE_GNUC_VISIBLE void spice_server_destroy(SpiceServer *reds)
     if (reds->ctx) {
         SSL_CTX_free(reds->ctx);
     }
+    tls_session_cache_free(reds->tls_session_cache);
 
     if (reds->main_dispatcher) {
         g_object_unref(reds->main_dispatcher);
@@ -3939,6 +4060,7 @@ SPICE_GNUC_VISIBLE void spice_server_destroy(SpiceServer *reds)
 #endif
 
     reds_config_free(reds->config);
+    pthread_mutex_destroy(&reds->handshake_lock);
     g_free(reds);
 }
 
@@ -4000,8 +4122,10 @@ SPICE_GNUC_VISIBLE int spice_server_set_exit_on_disconnect(SpiceServer *s, int f
 
 SPICE_GNUC_VISIBLE int spice_server_set_noauth(SpiceServer *s)
 {
+    pthread_mutex_lock(&s->handshake_lock);
     memset(s->config->taTicket.password, 0, sizeof(s->config->taTicket.password));
     s->config->ticketing_enabled = FALSE;
+    pthread_mutex_unlock(&s->handshake_lock);
     return 0;
 }
 
@@ -4053,6 +4177,7 @@ SPICE_GNUC_VISIBLE int spice_server_set_ticket(SpiceServer *reds,
     }
 
     on_activating_ticketing(reds);
+    pthread_mutex_lock(&reds->handshake_lock);
     reds->config->ticketing_enabled = TRUE;
     if (lifetime == 0) {
         reds->config->taTicket.expiration_time = INT_MAX;
@@ -4061,13 +4186,16 @@ SPICE_GNUC_VISIBLE int spice_server_set_ticket(SpiceServer *reds,
         reds->config->taTicket.expiration_time = now + lifetime;
     }
     if (passwd != NULL) {
-        if (strlen(passwd) > SPICE_MAX_PASSWORD_LENGTH)
+        if (strlen(passwd) > SPICE_MAX_PASSWORD_LENGTH) {
+            pthread_mutex_unlock(&reds->handshake_lock);
             return -1;
+        }
         g_strlcpy(reds->config->taTicket.password, passwd, sizeof(reds->config->taTicket.password));
     } else {
         memset(reds->config->taTicket.password, 0, sizeof(reds->config->taTicket.password));
         reds->config->taTicket.expiration_time = 0;
     }
+    pthread_mutex_unlock(&reds->handshake_lock);
     return 0;
 }
 
@@ -4108,6 +4236,35 @@ SPICE_GNUC_VISIBLE int spice_server_set_tls(SpiceServer *s, int port,
     return 0;
 }
 
+SPICE_GNUC_VISIBLE int spice_server_set_tls_session_cache(SpiceServer *s,
+                                                          unsigned int cache_size,
+                                                          unsigned int timeout,
+                                                          unsigned int ticket_key_lifetime)
+{
+    if (s->ctx) {
+        spice_warning("TLS session cache must be set before initializing the server");
+        return -1;
+    }
+    s->config->tls_session.cache_size = cache_size;
+    s->config->tls_session.timeout = timeout;
+    s->config->tls_session.ticket_key_lifetime = ticket_key_lifetime;
+    return 0;
+}
+
+SPICE_GNUC_VISIBLE int spice_server_set_ktls(SpiceServer *s, int enable)
+{
+    if (s->ctx) {
+        spice_warning("kTLS must be set before initializing the server");
+        return -1;
+    }
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+    s->config->ktls = !!enable;
+    return 0;
+#else
+    return enable ? -1 : 0;
+#endif
+}
+
 SPICE_GNUC_VISIBLE int spice_server_set_image_compression(SpiceServer *s,
                                                           SpiceImageCompression comp)
 {
@@ -4171,6 +4328,25 @@ SPICE_GNUC_VISIBLE int spice_server_set_channel_security(SpiceServer *s, const c
     return 0;
 }
 
+SPICE_GNUC_VISIBLE int spice_server_set_channel_max_bit_rate(SpiceServer *s,
+                                                             const char *channel,
+                                                             uint64_t bit_rate)
+{
+    int type = channel ? red_channel_name_to_type(channel) : -1;
+
+    if (type < 0 || type >= SPICE_END_CHANNEL) {
+        return -1;
+    }
+    s->config->channel_max_rates[type] = bit_rate / 8;
+    return 0;
+}
+
+uint64_t reds_get_channel_max_rate(const RedsState *reds, uint32_t channel_type)
+{
+    spice_return_val_if_fail(channel_type < SPICE_END_CHANNEL, 0);
+    return reds->config->channel_max_rates[channel_type];
+}
+
 /* very obsolete and old function, retain only for ABI */
 SPICE_GNUC_VISIBLE int spice_server_get_sock_info(SpiceServer *reds, struct sockaddr *sa, socklen_t *salen)
 {
@@ -4212,6 +4388,73 @@ uint32_t reds_get_streaming_video(const RedsState *reds)
     return reds->config->streaming_video;
 }
 
+SPICE_GNUC_VISIBLE int spice_server_set_zerocopy(SpiceServer *reds, int enable)
+{
+    reds->config->zerocopy = !!enable;
+    return 0;
+}
+
+bool reds_get_zerocopy(const RedsState *reds)
+{
+    return reds->config->zerocopy;
+}
+
+SPICE_GNUC_VISIBLE int spice_server_set_compress_cache_memory(SpiceServer *reds,
+                                                              unsigned int megabytes)
+{
+    if (megabytes > INT_MAX) {
+        return -1;
+    }
+    reds->config->compress_cache_memory = megabytes;
+    return 0;
+}
+
+int reds_get_compress_cache_memory(const RedsState *reds)
+{
+    return reds->config->compress_cache_memory;
+}
+
+SPICE_GNUC_VISIBLE int spice_server_set_drawables_memory(SpiceServer *reds,
+                                                         unsigned int megabytes)
+{
+    if (megabytes == 0 || megabytes > INT_MAX) {
+        return -1;
+    }
+    reds->config->drawables_memory = megabytes;
+    return 0;
+}
+
+int reds_get_drawables_memory(const RedsState *reds)
+{
+    return reds->config->drawables_memory;
+}
+
+SPICE_GNUC_VISIBLE int spice_server_set_io_uring(SpiceServer *reds, int enable)
+{
+#ifdef HAVE_LIBURING
+    reds->config->io_uring = !!enable;
+    return 0;
+#else
+    return enable ? -1 : 0;
+#endif
+}
+
+bool reds_get_io_uring(const RedsState *reds)
+{
+    return reds->config->io_uring;
+}
+
+SPICE_GNUC_VISIBLE int spice_server_set_shared_video_encoders(SpiceServer *reds, int enable)
+{
+    reds->config->shared_video_encoders = !!enable;
+    return 0;
+}
+
+bool reds_get_shared_video_encoders(const RedsState *reds)
+{
+    return reds->config->shared_video_encoders;
+}
+
 SPICE_GNUC_VISIBLE int spice_server_set_video_codecs(SpiceServer *reds, const char *video_codecs)
 {
     unsigned int installed = 0;
@@ -4241,6 +4484,40 @@ GArray* reds_get_video_codecs(const RedsState *reds)
     return reds->config->video_codecs;
 }
 
+SPICE_GNUC_VISIBLE int spice_server_set_image_encoder_threads(SpiceServer *reds,
+                                                              unsigned int threads)
+{
+    // the pool is used by the display channels without locking
+    if (reds->qxl_instances != NULL || reds->image_encoder_pool != NULL) {
+        spice_warning("image encoder threads must be set once before adding QXL devices");
+        return -1;
+    }
+    if (threads == 0) {
+        return 0;
+    }
+    reds->image_encoder_pool = image_encoder_pool_new(threads);
+    return reds->image_encoder_pool != NULL ? 0 : -1;
+}
+
+ImageEncoderPool *reds_get_image_encoder_pool(RedsState *reds)
+{
+    return reds->image_encoder_pool;
+}
+
+SPICE_GNUC_VISIBLE int spice_server_set_handshake_threads(SpiceServer *reds,
+                                                          unsigned int threads)
+{
+    if (reds->handshake_pool != NULL) {
+        spice_warning("handshake threads can be set only once");
+        return -1;
+    }
+    if (threads == 0) {
+        return 0;
+    }
+    reds->handshake_pool = handshake_pool_new(threads);
+    return reds->handshake_pool != NULL ? 0 : -1;
+}
+
 static void reds_set_video_codecs(RedsState *reds, GArray *video_codecs)
 {
     /* The video_codecs array is immutable */
@@ -68,6 +68,7 @@ enum {
 
 /* should be called only from main_dispatcher */
 void reds_client_disconnect(RedsState *reds, RedClient *client);
+void reds_handle_authenticated_link(RedsState *reds, RedLinkInfo *link);
 
 // Temporary (?) for splitting main channel
 void reds_marshall_migrate_data(RedsState *reds, SpiceMarshaller *m);
@@ -95,6 +96,16 @@ void reds_on_main_channel_migrate(RedsState *reds, MainChannelClient *mcc);
 
 void reds_set_client_mm_time_latency(RedsState *reds, RedClient *client, uint32_t latency);
 uint32_t reds_get_streaming_video(const RedsState *reds);
+bool reds_get_zerocopy(const RedsState *reds);
+/* Return the size of the cache of the compressed images in MiB, -1 if not set */
+int reds_get_compress_cache_memory(const RedsState *reds);
+/* Return the memory budget of the drawables in MiB, -1 if not set */
+int reds_get_drawables_memory(const RedsState *reds);
+bool reds_get_io_uring(const RedsState *reds);
+bool reds_get_shared_video_encoders(const RedsState *reds);
+/* Return the maximum sending rate of a channel type in bytes per second,
+ * 0 for no limit */
+uint64_t reds_get_channel_max_rate(const RedsState *reds, uint32_t channel_type);
 GArray* reds_get_video_codecs(const RedsState *reds);
 spice_wan_compression_t reds_get_jpeg_state(const RedsState *reds);
 spice_wan_compression_t reds_get_zlib_glz_state(const RedsState *reds);
@@ -110,6 +121,9 @@ void reds_marshall_device_display_info(RedsState *reds, SpiceMarshaller *m);
  */
 struct RedRecord *reds_get_record(RedsState *reds);
 
+/* Get the pool of threads compressing images, NULL if disabled */
+struct ImageEncoderPool *reds_get_image_encoder_pool(RedsState *reds);
+
 /* fd watches/timers */
 SpiceWatch *reds_core_watch_add(RedsState *reds,
                                 int fd, int event_mask,
@@ -0,0 +1,253 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 agent <agent@local>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include <config.h>
+
+#include <stdbool.h>
+#include <glib.h>
+#include <common/log.h>
+
+#include "ring-index.h"
+
+/* blocks are split when they get bigger and merged with the next one
+ * when they get small enough */
+#define BLOCK_MAX_ITEMS 32
+#define BLOCK_MERGE_ITEMS (BLOCK_MAX_ITEMS / 2)
+
+struct RingIndexBlock {
+    RingItem link; /* in RingIndex::blocks, in the order of the ring */
+    RingIndex *index;
+    RingItem *first;
+    RingItem *last;
+    uint32_t num_items;
+    /* items removed since the bounds were computed */
+    uint32_t num_removed;
+    pixman_box32_t bounds;
+};
+
+static inline RingIndexEntry *link_entry(RingIndex *index, RingItem *link)
+{
+    return (RingIndexEntry *) ((uint8_t *) link + index->entry_offset);
+}
+
+static inline bool box_is_empty(const pixman_box32_t *box)
+{
+    return box->x1 >= box->x2 || box->y1 >= box->y2;
+}
+
+static inline bool box_intersects(const pixman_box32_t *a, const pixman_box32_t *b)
+{
+    return a->x1 < b->x2 && a->x2 > b->x1 && a->y1 < b->y2 && a->y2 > b->y1;
+}
+
+static void box_union(pixman_box32_t *box, const pixman_box32_t *other)
+{
+    if (box_is_empty(other)) {
+        return;
+    }
+    if (box_is_empty(box)) {
+        *box = *other;
+        return;
+    }
+    box->x1 = MIN(box->x1, other->x1);
+    box->y1 = MIN(box->y1, other->y1);
+    box->x2 = MAX(box->x2, other->x2);
+    box->y2 = MAX(box->y2, other->y2);
+}
+
+void ring_index_init(RingIndex *index, Ring *ring, ptrdiff_t entry_offset,
+                     ring_index_get_bounds_t get_bounds)
+{
+    index->ring = ring;
+    index->entry_offset = entry_offset;
+    index->get_bounds = get_bounds;
+    ring_init(&index->blocks);
+}
+
+void ring_index_clear(RingIndex *index)
+{
+    RingItem *link;
+
+    while ((link = ring_get_head(&index->blocks))) {
+        RingIndexBlock *block = SPICE_CONTAINEROF(link, RingIndexBlock, link);
+        RingItem *item;
+
+        for (item = block->first; ; item = item->next) {
+            link_entry(index, item)->block = NULL;
+            if (item == block->last) {
+                break;
+            }
+        }
+        ring_remove(&block->link);
+        g_free(block);
+    }
+}
+
+static RingIndexBlock *block_new(RingIndex *index)
+{
+    RingIndexBlock *block = g_new0(RingIndexBlock, 1);
+
+    block->index = index;
+    ring_item_init(&block->link);
+    return block;
+}
+
+/* Set @block for the items from @first to @last and compute the bounds.
+ * @removed is an item being removed, still linked, to leave out */
+static void block_assign(RingIndexBlock *block, RingItem *first, RingItem *last,
+                         RingItem *removed)
+{
+    RingIndex *index = block->index;
+    RingItem *item;
+
+    block->first = first;
+    block->last = last;
+    block->num_items = 0;
+    block->num_removed = 0;
+    block->bounds.x1 = block->bounds.y1 = block->bounds.x2 = block->bounds.y2 = 0;
+    for (item = first; ; item = item->next) {
+        if (item != removed) {
+            link_entry(index, item)->block = block;
+            box_union(&block->bounds, index->get_bounds(item));
+            block->num_items++;
+        }
+        if (item == last) {
+            break;
+        }
+    }
+}
+
+static void block_split(RingIndexBlock *block)
+{
+    RingIndexBlock *new_block = block_new(block->index);
+    RingItem *middle = block->first;
+    RingItem *last = block->last;
+    uint32_t i;
+
+    for (i = 1; i < block->num_items / 2; i++) {
+        middle = middle->next;
+    }
+    ring_add_after(&new_block->link, &block->link);
+    block_assign(block, block->first, middle, NULL);
+    block_assign(new_block, middle->next, last, NULL);
+}
+
+/* Merge @block with the next one if both are small */
+static void block_try_merge(RingIndexBlock *block, RingItem *removed)
+{
+    RingIndex *index = block->index;
+    RingItem *next_link = ring_next(&index->blocks, &block->link);
+    RingIndexBlock *next;
+
+    if (!next_link) {
+        return;
+    }
+    next = SPICE_CONTAINEROF(next_link, RingIndexBlock, link);
+    if (block->num_items + next->num_items > BLOCK_MERGE_ITEMS) {
+        return;
+    }
+    ring_remove(&next->link);
+    block_assign(block, block->first, next->last, removed);
+    g_free(next);
+}
+
+RingIndex *ring_index_entry_get_index(const RingIndexEntry *entry)
+{
+    return entry->block ? entry->block->index : NULL;
+}
+
+void ring_index_add(RingIndex *index, RingItem *link)
+{
+    RingItem *prev = ring_prev(index->ring, link);
+    RingItem *next = ring_next(index->ring, link);
+    RingIndexBlock *block;
+
+    /* join the block of a neighbour so the blocks stay contiguous */
+    if (prev) {
+        block = link_entry(index, prev)->block;
+        spice_assert(block);
+        if (block->last == prev) {
+            block->last = link;
+        }
+    } else if (next) {
+        block = link_entry(index, next)->block;
+        spice_assert(block && block->first == next);
+        block->first = link;
+    } else {
+        block = block_new(index);
+        block->first = block->last = link;
+        ring_add(&index->blocks, &block->link);
+    }
+
+    link_entry(index, link)->block = block;
+    block->num_items++;
+    box_union(&block->bounds, index->get_bounds(link));
+    if (block->num_items > BLOCK_MAX_ITEMS) {
+        block_split(block);
+    }
+}
+
+void ring_index_remove(RingItem *link, RingIndexEntry *entry)
+{
+    RingIndexBlock *block = entry->block;
+
+    if (!block) {
+        return;
+    }
+    entry->block = NULL;
+    if (--block->num_items == 0) {
+        ring_remove(&block->link);
+        g_free(block);
+        return;
+    }
+    if (block->first == link) {
+        block->first = link->next;
+    }
+    if (block->last == link) {
+        block->last = link->prev;
+    }
+
+    /* the bounds only shrink when recomputed, do it once the block got
+     * many removals */
+    if (++block->num_removed >= block->num_items) {
+        block_assign(block, block->first, block->last, link);
+    }
+    block_try_merge(block, link);
+}
+
+RingItem *ring_index_skip(RingItem *link, const RingIndexEntry *entry,
+                          const pixman_box32_t *area, const RingItem *stop)
+{
+    RingIndexBlock *block = entry->block;
+    RingIndex *index;
+
+    if (!block) {
+        return link;
+    }
+    index = block->index;
+    while (link) {
+        block = link_entry(index, link)->block;
+        if (!block || box_intersects(&block->bounds, area)) {
+            return link;
+        }
+        if (stop && link_entry(index, (RingItem *) stop)->block == block) {
+            return link;
+        }
+        link = ring_next(index->ring, block->last);
+    }
+    return NULL;
+}
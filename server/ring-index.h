@@ -0,0 +1,77 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 agent <agent@local>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RING_INDEX_H_
+#define RING_INDEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pixman.h>
+#include <common/ring.h>
+
+/* Spatial index of the items of a Ring.
+ *
+ * Consecutive items are grouped in blocks which keep the union of the
+ * bounds of their items. Walks looking for the items intersecting an area
+ * can skip whole blocks, the order of the ring is preserved.
+ *
+ * Items must be added to the index right after being linked to the ring and
+ * removed from the index right before being unlinked. The bounds of an item
+ * can shrink while the item is indexed, they must not grow.
+ */
+typedef struct RingIndex RingIndex;
+typedef struct RingIndexBlock RingIndexBlock;
+
+/* Embedded in the indexed items */
+typedef struct RingIndexEntry {
+    RingIndexBlock *block; /* NULL if the item is not indexed */
+} RingIndexEntry;
+
+typedef const pixman_box32_t *(*ring_index_get_bounds_t)(RingItem *link);
+
+struct RingIndex {
+    Ring *ring;
+    /* offset of the RingIndexEntry from the RingItem of the items */
+    ptrdiff_t entry_offset;
+    ring_index_get_bounds_t get_bounds;
+    Ring blocks;
+};
+
+#define RING_INDEX_ENTRY_OFFSET(type, link_member, entry_member) \
+    ((ptrdiff_t) offsetof(type, entry_member) - (ptrdiff_t) offsetof(type, link_member))
+
+void ring_index_init(RingIndex *index, Ring *ring, ptrdiff_t entry_offset,
+                     ring_index_get_bounds_t get_bounds);
+/* Free the blocks left, the items are not touched */
+void ring_index_clear(RingIndex *index);
+
+/* Return the index of an item, NULL if it is not indexed */
+RingIndex *ring_index_entry_get_index(const RingIndexEntry *entry);
+
+void ring_index_add(RingIndex *index, RingItem *link);
+/* Remove an item from its index, if any */
+void ring_index_remove(RingItem *link, RingIndexEntry *entry);
+
+/* Return the first item from @link which can intersect @area, @link
+ * included, or NULL if none. Items not indexed are never skipped. The walk
+ * does not skip @stop, if not NULL, which must embed its entry like the
+ * indexed items */
+RingItem *ring_index_skip(RingItem *link, const RingIndexEntry *entry,
+                          const pixman_box32_t *area, const RingItem *stop);
+
+#endif /* RING_INDEX_H_ */
@@ -0,0 +1,273 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 agent <agent@local>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include <config.h>
+
+#include <pthread.h>
+
+#include "send-scheduler.h"
+
+/* a channel sending within this interval shares the link */
+#define ACTIVE_INTERVAL NSEC_PER_SEC
+/* the bucket holds at most this time of sending */
+#define BURST_TIME (NSEC_PER_SEC / 20)
+#define BURST_MIN_BYTES (16 * 1024)
+#define PRIORITY_SAMPLE_INTERVAL (NSEC_PER_SEC / 10)
+/* a limited channel is let send without limit for PROBE_TIME every
+ * PROBE_INTERVAL, the time for several bandwidth samples */
+#define PROBE_INTERVAL (4 * NSEC_PER_SEC)
+#define PROBE_TIME (NSEC_PER_SEC / 4)
+
+typedef struct ChannelClass {
+    uint32_t type;
+    bool priority;
+    uint32_t weight;
+} ChannelClass;
+
+/* the channels not listed are bulk channels of weight 1 */
+static const ChannelClass channel_classes[] = {
+    { SPICE_CHANNEL_MAIN, true, 0 },
+    { SPICE_CHANNEL_INPUTS, true, 0 },
+    { SPICE_CHANNEL_CURSOR, true, 0 },
+    { SPICE_CHANNEL_PLAYBACK, true, 0 },
+    { SPICE_CHANNEL_RECORD, true, 0 },
+    { SPICE_CHANNEL_DISPLAY, false, 4 },
+};
+
+struct SendSchedulerEntry {
+    uint32_t channel_type;
+    bool priority;
+    uint32_t weight;
+    uint64_t max_rate; /* bytes per second, 0 for no limit */
+    uint64_t bandwidth;
+
+    int64_t tokens; /* bytes that can be sent, negative after a large message */
+    uint64_t last_refill;
+    uint64_t last_active;
+    uint64_t next_probe;
+};
+
+struct SendScheduler {
+    pthread_mutex_t lock;
+    int refs;
+    GList *entries;
+    uint64_t max_rates[SPICE_END_CHANNEL];
+
+    /* sending rate of the priority channels */
+    uint64_t priority_sample_start;
+    uint64_t priority_sample_bytes;
+    uint64_t priority_bytes_per_sec;
+    uint64_t priority_last_active;
+};
+
+SendScheduler *send_scheduler_new(void)
+{
+    SendScheduler *scheduler = g_new0(SendScheduler, 1);
+
+    pthread_mutex_init(&scheduler->lock, NULL);
+    scheduler->refs = 1;
+    return scheduler;
+}
+
+SendScheduler *send_scheduler_ref(SendScheduler *scheduler)
+{
+    g_atomic_int_inc(&scheduler->refs);
+    return scheduler;
+}
+
+void send_scheduler_unref(SendScheduler *scheduler)
+{
+    if (!g_atomic_int_dec_and_test(&scheduler->refs)) {
+        return;
+    }
+    g_list_free_full(scheduler->entries, g_free);
+    pthread_mutex_destroy(&scheduler->lock);
+    g_free(scheduler);
+}
+
+void send_scheduler_set_max_rate(SendScheduler *scheduler, uint32_t channel_type,
+                                 uint64_t bytes_per_sec)
+{
+    GList *l;
+
+    spice_return_if_fail(channel_type < SPICE_END_CHANNEL);
+
+    pthread_mutex_lock(&scheduler->lock);
+    scheduler->max_rates[channel_type] = bytes_per_sec;
+    for (l = scheduler->entries; l != NULL; l = l->next) {
+        SendSchedulerEntry *entry = l->data;
+
+        if (entry->channel_type == channel_type) {
+            entry->max_rate = bytes_per_sec;
+        }
+    }
+    pthread_mutex_unlock(&scheduler->lock);
+}
+
+SendSchedulerEntry *send_scheduler_add(SendScheduler *scheduler, uint32_t channel_type)
+{
+    SendSchedulerEntry *entry = g_new0(SendSchedulerEntry, 1);
+    int i;
+
+    entry->channel_type = channel_type;
+    entry->weight = 1;
+    for (i = 0; i < G_N_ELEMENTS(channel_classes); i++) {
+        if (channel_classes[i].type == channel_type) {
+            entry->priority = channel_classes[i].priority;
+            entry->weight = channel_classes[i].weight;
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&scheduler->lock);
+    if (channel_type < SPICE_END_CHANNEL) {
+        entry->max_rate = scheduler->max_rates[channel_type];
+    }
+    scheduler->entries = g_list_prepend(scheduler->entries, entry);
+    pthread_mutex_unlock(&scheduler->lock);
+    return entry;
+}
+
+void send_scheduler_remove(SendScheduler *scheduler, SendSchedulerEntry *entry)
+{
+    pthread_mutex_lock(&scheduler->lock);
+    scheduler->entries = g_list_remove(scheduler->entries, entry);
+    pthread_mutex_unlock(&scheduler->lock);
+    g_free(entry);
+}
+
+static inline bool entry_is_active(SendSchedulerEntry *entry, uint64_t now)
+{
+    return entry->last_active && now - entry->last_active < ACTIVE_INTERVAL;
+}
+
+/* Rate the entry can send at, 0 for no limit. Called with the lock held */
+static uint64_t send_scheduler_get_rate(SendScheduler *scheduler, SendSchedulerEntry *entry,
+                                        uint64_t now)
+{
+    uint64_t bandwidth = 0, reserve, rate;
+    uint32_t weights = 0, num_active = 0;
+    bool priority_active;
+    GList *l;
+
+    for (l = scheduler->entries; l != NULL; l = l->next) {
+        SendSchedulerEntry *other = l->data;
+
+        // the channels share the link, the best measurement is the largest
+        bandwidth = MAX(bandwidth, other->bandwidth);
+        if (!other->priority && (other == entry || entry_is_active(other, now))) {
+            weights += other->weight;
+            num_active++;
+        }
+    }
+    priority_active = scheduler->priority_last_active &&
+                      now - scheduler->priority_last_active < ACTIVE_INTERVAL;
+
+    if (bandwidth == 0 || (!priority_active && num_active == 1) || weights == 0) {
+        return entry->max_rate;
+    }
+
+    /* the bandwidth is only measured while the channels fill the link, the
+     * limit would keep it from growing back after a slow period */
+    if (entry->next_probe == 0 || now >= entry->next_probe + PROBE_TIME) {
+        entry->next_probe = now + PROBE_INTERVAL;
+    }
+    if (now >= entry->next_probe) {
+        return entry->max_rate;
+    }
+
+    // keep twice what the interactive channels use, at least 5% of the link
+    reserve = 0;
+    if (priority_active) {
+        reserve = CLAMP(scheduler->priority_bytes_per_sec * 2, bandwidth / 20, bandwidth / 2);
+    }
+    rate = (bandwidth - reserve) * entry->weight / weights;
+    if (entry->max_rate) {
+        rate = MIN(rate, entry->max_rate);
+    }
+    return MAX(rate, 1);
+}
+
+uint64_t send_scheduler_get_delay(SendScheduler *scheduler, SendSchedulerEntry *entry,
+                                  uint64_t now)
+{
+    uint64_t rate, burst, delay = 0;
+
+    if (entry->priority) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&scheduler->lock);
+    entry->last_active = now;
+    rate = send_scheduler_get_rate(scheduler, entry, now);
+    if (rate == 0) {
+        entry->tokens = 0;
+        entry->last_refill = now;
+        goto end;
+    }
+
+    burst = MAX(rate * BURST_TIME / NSEC_PER_SEC, BURST_MIN_BYTES);
+    if (entry->last_refill) {
+        uint64_t elapsed = MIN(now - entry->last_refill, BURST_TIME);
+
+        entry->tokens += rate * elapsed / NSEC_PER_SEC;
+    }
+    entry->tokens = MIN(entry->tokens, (int64_t) burst);
+    entry->last_refill = now;
+    if (entry->tokens <= 0) {
+        delay = (1 - entry->tokens) * NSEC_PER_SEC / rate;
+    }
+
+end:
+    pthread_mutex_unlock(&scheduler->lock);
+    return delay;
+}
+
+void send_scheduler_sent(SendScheduler *scheduler, SendSchedulerEntry *entry,
+                         uint64_t bytes, uint64_t now)
+{
+    pthread_mutex_lock(&scheduler->lock);
+    if (!entry->priority) {
+        entry->tokens -= bytes;
+        entry->last_active = now;
+        pthread_mutex_unlock(&scheduler->lock);
+        return;
+    }
+
+    scheduler->priority_last_active = now;
+    if (scheduler->priority_sample_start == 0) {
+        scheduler->priority_sample_start = now;
+    }
+    scheduler->priority_sample_bytes += bytes;
+    if (now - scheduler->priority_sample_start >= PRIORITY_SAMPLE_INTERVAL) {
+        uint64_t rate = scheduler->priority_sample_bytes * NSEC_PER_SEC /
+                        (now - scheduler->priority_sample_start);
+
+        scheduler->priority_bytes_per_sec = (scheduler->priority_bytes_per_sec * 7 + rate) / 8;
+        scheduler->priority_sample_start = now;
+        scheduler->priority_sample_bytes = 0;
+    }
+    pthread_mutex_unlock(&scheduler->lock);
+}
+
+void send_scheduler_set_bandwidth(SendScheduler *scheduler, SendSchedulerEntry *entry,
+                                  uint64_t bytes_per_sec)
+{
+    pthread_mutex_lock(&scheduler->lock);
+    entry->bandwidth = bytes_per_sec;
+    pthread_mutex_unlock(&scheduler->lock);
+}
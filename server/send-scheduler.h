@@ -0,0 +1,68 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 agent <agent@local>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SEND_SCHEDULER_H_
+#define SEND_SCHEDULER_H_
+
+#include "red-common.h"
+
+/* Shares the bandwidth of a client between its channels.
+ *
+ * The channels of a client share the same network link but write to their
+ * own socket, from different threads. Without coordination a burst of the
+ * display channel fills the link queues and delays the inputs, cursor and
+ * audio messages.
+ *
+ * The interactive channels (main, inputs, cursor, playback, record) are never
+ * delayed. The other channels get a token bucket each, refilled with a share
+ * of the measured bandwidth, minus a reserve for the interactive channels,
+ * according to their weight. The buckets are only used while the link is
+ * shared: with the interactive channels idle and a single bulk channel active
+ * no delay is added, so the bandwidth keeps being measured. While limited, a
+ * channel is regularly let send without limit for a short time, so that the
+ * measurement can follow a link getting faster.
+ *
+ * A maximum rate can be set per channel type, see
+ * spice_server_set_channel_max_bit_rate().
+ *
+ * The functions are thread safe, the current time is given by the callers.
+ */
+
+typedef struct SendScheduler SendScheduler;
+typedef struct SendSchedulerEntry SendSchedulerEntry;
+
+SendScheduler *send_scheduler_new(void);
+SendScheduler *send_scheduler_ref(SendScheduler *scheduler);
+void send_scheduler_unref(SendScheduler *scheduler);
+/* Set the maximum rate of a channel type, 0 for no limit */
+void send_scheduler_set_max_rate(SendScheduler *scheduler, uint32_t channel_type,
+                                 uint64_t bytes_per_sec);
+
+SendSchedulerEntry *send_scheduler_add(SendScheduler *scheduler, uint32_t channel_type);
+void send_scheduler_remove(SendScheduler *scheduler, SendSchedulerEntry *entry);
+
+/* Returns 0 if the channel can send now, otherwise the nanoseconds to wait */
+uint64_t send_scheduler_get_delay(SendScheduler *scheduler, SendSchedulerEntry *entry,
+                                  uint64_t now);
+void send_scheduler_sent(SendScheduler *scheduler, SendSchedulerEntry *entry,
+                         uint64_t bytes, uint64_t now);
+/* Bandwidth measured on the connection of the channel, 0 if unknown */
+void send_scheduler_set_bandwidth(SendScheduler *scheduler, SendSchedulerEntry *entry,
+                                  uint64_t bytes_per_sec);
+
+#endif /* SEND_SCHEDULER_H_ */
@@ -0,0 +1,378 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 agent <agent@local>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include <config.h>
+
+#include <common/rect.h>
+
+#include "red-common.h"
+#include "shared-video-encoder.h"
+
+/* the frames kept for the clients which did not send them yet, the slower
+ * clients encode the older frames again */
+#define MAX_FRAMES 4
+
+/* A compressed frame sent to several clients */
+typedef struct SharedVideoBuffer {
+    VideoBuffer base;
+    int refs;
+    VideoBuffer *buffer;
+} SharedVideoBuffer;
+
+typedef struct SharedVideoFrame {
+    const SpiceBitmap *bitmap; /* NULL for an unused entry */
+    SpiceRect src;
+    gpointer bitmap_opaque;
+    int result;
+    SharedVideoBuffer *buffer;
+    unsigned int num_clients; /* the clients which got the frame */
+} SharedVideoFrame;
+
+typedef struct SharedVideoEncoderClient {
+    VideoEncoder base;
+    SharedVideoEncoder *shared;
+    VideoEncoderRateControlCbs cbs;
+} SharedVideoEncoderClient;
+
+struct SharedVideoEncoder {
+    int refs;
+    new_video_encoder_t create;
+    SpiceVideoCodecType codec_type;
+    uint64_t starting_bit_rate;
+    bitmap_ref_t bitmap_ref;
+    bitmap_unref_t bitmap_unref;
+
+    VideoEncoder *encoder;
+    VideoEncoderRateControlCbs cbs;
+    GList *clients;
+    unsigned int num_clients;
+
+    SharedVideoFrame frames[MAX_FRAMES];
+    unsigned int next_frame;
+};
+
+static void shared_video_buffer_free(VideoBuffer *video_buffer)
+{
+    SharedVideoBuffer *buffer = SPICE_CONTAINEROF(video_buffer, SharedVideoBuffer, base);
+
+    if (--buffer->refs != 0) {
+        return;
+    }
+    buffer->buffer->free(buffer->buffer);
+    g_free(buffer);
+}
+
+static SharedVideoBuffer *shared_video_buffer_new(VideoBuffer *video_buffer)
+{
+    SharedVideoBuffer *buffer = g_new0(SharedVideoBuffer, 1);
+
+    buffer->base.data = video_buffer->data;
+    buffer->base.size = video_buffer->size;
+    buffer->base.free = shared_video_buffer_free;
+    buffer->refs = 1;
+    buffer->buffer = video_buffer;
+    return buffer;
+}
+
+static void shared_video_frame_release(SharedVideoEncoder *shared, SharedVideoFrame *frame)
+{
+    if (!frame->bitmap) {
+        return;
+    }
+    if (frame->buffer) {
+        frame->buffer->base.free(&frame->buffer->base);
+    }
+    if (frame->bitmap_opaque) {
+        shared->bitmap_unref(frame->bitmap_opaque);
+    }
+    memset(frame, 0, sizeof(*frame));
+}
+
+/* Release the frames all the clients got */
+static void shared_video_encoder_release_sent_frames(SharedVideoEncoder *shared)
+{
+    int i;
+
+    for (i = 0; i < MAX_FRAMES; i++) {
+        if (shared->frames[i].num_clients >= shared->num_clients) {
+            shared_video_frame_release(shared, &shared->frames[i]);
+        }
+    }
+}
+
+static SharedVideoFrame *shared_video_encoder_find_frame(SharedVideoEncoder *shared,
+                                                         const SpiceBitmap *bitmap,
+                                                         const SpiceRect *src,
+                                                         gpointer bitmap_opaque)
+{
+    int i;
+
+    for (i = 0; i < MAX_FRAMES; i++) {
+        SharedVideoFrame *frame = &shared->frames[i];
+
+        if (frame->bitmap == bitmap && rect_is_equal(&frame->src, src) &&
+            (!frame->bitmap_opaque || frame->bitmap_opaque == bitmap_opaque)) {
+            return frame;
+        }
+    }
+    return NULL;
+}
+
+static SharedVideoFrame *shared_video_encoder_add_frame(SharedVideoEncoder *shared,
+                                                        const SpiceBitmap *bitmap,
+                                                        const SpiceRect *src,
+                                                        gpointer bitmap_opaque,
+                                                        int result, VideoBuffer *buffer)
+{
+    SharedVideoFrame *frame = &shared->frames[shared->next_frame];
+
+    shared->next_frame = (shared->next_frame + 1) % MAX_FRAMES;
+    shared_video_frame_release(shared, frame);
+
+    frame->bitmap = bitmap;
+    frame->src = *src;
+    frame->result = result;
+    if (result == VIDEO_ENCODER_FRAME_ENCODE_DONE) {
+        frame->buffer = shared_video_buffer_new(buffer);
+    }
+    // keep the bitmap, and so its address, until all the clients got it
+    if (shared->bitmap_ref && bitmap_opaque) {
+        shared->bitmap_ref(bitmap_opaque);
+        frame->bitmap_opaque = bitmap_opaque;
+    }
+    return frame;
+}
+
+static int shared_video_encoder_encode_frame(VideoEncoder *video_encoder,
+                                             uint32_t frame_mm_time,
+                                             const SpiceBitmap *bitmap,
+                                             const SpiceRect *src, int top_down,
+                                             gpointer bitmap_opaque,
+                                             VideoBuffer **outbuf)
+{
+    SharedVideoEncoderClient *client = SPICE_CONTAINEROF(video_encoder,
+                                                         SharedVideoEncoderClient, base);
+    SharedVideoEncoder *shared = client->shared;
+    SharedVideoFrame *frame;
+    int result;
+
+    frame = shared_video_encoder_find_frame(shared, bitmap, src, bitmap_opaque);
+    if (!frame) {
+        VideoBuffer *buffer = NULL;
+
+        result = shared->encoder->encode_frame(shared->encoder, frame_mm_time, bitmap, src,
+                                               top_down, bitmap_opaque, &buffer);
+        if (result == VIDEO_ENCODER_FRAME_UNSUPPORTED || shared->num_clients == 1) {
+            *outbuf = buffer;
+            return result;
+        }
+        frame = shared_video_encoder_add_frame(shared, bitmap, src, bitmap_opaque,
+                                               result, buffer);
+    }
+
+    result = frame->result;
+    if (result == VIDEO_ENCODER_FRAME_ENCODE_DONE) {
+        frame->buffer->refs++;
+        *outbuf = &frame->buffer->base;
+    }
+    if (++frame->num_clients >= shared->num_clients) {
+        shared_video_frame_release(shared, frame);
+    }
+    return result;
+}
+
+static void shared_video_encoder_client_stream_report(VideoEncoder *video_encoder,
+                                                      uint32_t num_frames, uint32_t num_drops,
+                                                      uint32_t start_frame_mm_time,
+                                                      uint32_t end_frame_mm_time,
+                                                      int32_t end_frame_delay,
+                                                      uint32_t audio_delay)
+{
+    SharedVideoEncoderClient *client = SPICE_CONTAINEROF(video_encoder,
+                                                         SharedVideoEncoderClient, base);
+    VideoEncoder *encoder = client->shared->encoder;
+
+    encoder->client_stream_report(encoder, num_frames, num_drops, start_frame_mm_time,
+                                  end_frame_mm_time, end_frame_delay, audio_delay);
+}
+
+static void shared_video_encoder_notify_server_frame_drop(VideoEncoder *video_encoder)
+{
+    SharedVideoEncoderClient *client = SPICE_CONTAINEROF(video_encoder,
+                                                         SharedVideoEncoderClient, base);
+    VideoEncoder *encoder = client->shared->encoder;
+
+    encoder->notify_server_frame_drop(encoder);
+}
+
+static uint64_t shared_video_encoder_get_bit_rate(VideoEncoder *video_encoder)
+{
+    SharedVideoEncoderClient *client = SPICE_CONTAINEROF(video_encoder,
+                                                         SharedVideoEncoderClient, base);
+    VideoEncoder *encoder = client->shared->encoder;
+
+    return encoder->get_bit_rate(encoder);
+}
+
+static void shared_video_encoder_get_stats(VideoEncoder *video_encoder, VideoEncoderStats *stats)
+{
+    SharedVideoEncoderClient *client = SPICE_CONTAINEROF(video_encoder,
+                                                         SharedVideoEncoderClient, base);
+    VideoEncoder *encoder = client->shared->encoder;
+
+    encoder->get_stats(encoder, stats);
+}
+
+static void shared_video_encoder_leave(VideoEncoder *video_encoder)
+{
+    SharedVideoEncoderClient *client = SPICE_CONTAINEROF(video_encoder,
+                                                         SharedVideoEncoderClient, base);
+    SharedVideoEncoder *shared = client->shared;
+
+    shared->clients = g_list_remove(shared->clients, client);
+    shared->num_clients--;
+    g_free(client);
+
+    shared_video_encoder_release_sent_frames(shared);
+    if (shared->num_clients == 0) {
+        shared->encoder->destroy(shared->encoder);
+        shared->encoder = NULL;
+    }
+    shared_video_encoder_unref(shared);
+}
+
+/* The rate control callbacks of the shared encoder, they follow the
+ * slowest client */
+static uint32_t shared_video_encoder_get_roundtrip_ms(void *opaque)
+{
+    SharedVideoEncoder *shared = opaque;
+    uint32_t roundtrip = 0;
+    GList *l;
+
+    for (l = shared->clients; l != NULL; l = l->next) {
+        SharedVideoEncoderClient *client = l->data;
+
+        roundtrip = MAX(roundtrip, client->cbs.get_roundtrip_ms(client->cbs.opaque));
+    }
+    return roundtrip;
+}
+
+static uint32_t shared_video_encoder_get_source_fps(void *opaque)
+{
+    SharedVideoEncoder *shared = opaque;
+    uint32_t fps = 0;
+    GList *l;
+
+    for (l = shared->clients; l != NULL; l = l->next) {
+        SharedVideoEncoderClient *client = l->data;
+
+        fps = MAX(fps, client->cbs.get_source_fps(client->cbs.opaque));
+    }
+    return fps;
+}
+
+static void shared_video_encoder_update_client_playback_delay(void *opaque, uint32_t delay_ms)
+{
+    SharedVideoEncoder *shared = opaque;
+    GList *l;
+
+    for (l = shared->clients; l != NULL; l = l->next) {
+        SharedVideoEncoderClient *client = l->data;
+
+        client->cbs.update_client_playback_delay(client->cbs.opaque, delay_ms);
+    }
+}
+
+static uint64_t shared_video_encoder_get_pipe_bytes(void *opaque)
+{
+    SharedVideoEncoder *shared = opaque;
+    uint64_t pipe_bytes = 0;
+    GList *l;
+
+    for (l = shared->clients; l != NULL; l = l->next) {
+        SharedVideoEncoderClient *client = l->data;
+
+        if (client->cbs.get_pipe_bytes) {
+            pipe_bytes = MAX(pipe_bytes, client->cbs.get_pipe_bytes(client->cbs.opaque));
+        }
+    }
+    return pipe_bytes;
+}
+
+SharedVideoEncoder *shared_video_encoder_new(new_video_encoder_t create,
+                                             SpiceVideoCodecType codec_type,
+                                             uint64_t starting_bit_rate,
+                                             bitmap_ref_t bitmap_ref,
+                                             bitmap_unref_t bitmap_unref)
+{
+    SharedVideoEncoder *shared = g_new0(SharedVideoEncoder, 1);
+
+    shared->refs = 1;
+    shared->create = create;
+    shared->codec_type = codec_type;
+    shared->starting_bit_rate = starting_bit_rate;
+    shared->bitmap_ref = bitmap_ref;
+    shared->bitmap_unref = bitmap_unref;
+
+    shared->cbs.opaque = shared;
+    shared->cbs.get_roundtrip_ms = shared_video_encoder_get_roundtrip_ms;
+    shared->cbs.get_source_fps = shared_video_encoder_get_source_fps;
+    shared->cbs.update_client_playback_delay = shared_video_encoder_update_client_playback_delay;
+    shared->cbs.get_pipe_bytes = shared_video_encoder_get_pipe_bytes;
+    return shared;
+}
+
+void shared_video_encoder_unref(SharedVideoEncoder *shared)
+{
+    if (--shared->refs != 0) {
+        return;
+    }
+    spice_assert(shared->clients == NULL);
+    g_free(shared);
+}
+
+VideoEncoder *shared_video_encoder_join(SharedVideoEncoder *shared,
+                                        const VideoEncoderRateControlCbs *cbs)
+{
+    SharedVideoEncoderClient *client = g_new0(SharedVideoEncoderClient, 1);
+
+    client->shared = shared;
+    client->cbs = *cbs;
+    shared->clients = g_list_prepend(shared->clients, client);
+    shared->num_clients++;
+
+    if (!shared->encoder) {
+        shared->encoder = shared->create(shared->codec_type, shared->starting_bit_rate,
+                                         &shared->cbs, shared->bitmap_ref, shared->bitmap_unref);
+        if (!shared->encoder) {
+            shared->clients = g_list_remove(shared->clients, client);
+            shared->num_clients--;
+            g_free(client);
+            return NULL;
+        }
+    }
+
+    client->base.destroy = shared_video_encoder_leave;
+    client->base.encode_frame = shared_video_encoder_encode_frame;
+    client->base.client_stream_report = shared_video_encoder_client_stream_report;
+    client->base.notify_server_frame_drop = shared_video_encoder_notify_server_frame_drop;
+    client->base.get_bit_rate = shared_video_encoder_get_bit_rate;
+    client->base.get_stats = shared_video_encoder_get_stats;
+    client->base.codec_type = shared->encoder->codec_type;
+    shared->refs++;
+    return &client->base;
+}
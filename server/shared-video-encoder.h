@@ -0,0 +1,59 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 agent <agent@local>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SHARED_VIDEO_ENCODER_H_
+#define SHARED_VIDEO_ENCODER_H_
+
+#include "video-encoder.h"
+
+/* A video encoder whose frames are sent to several clients.
+ *
+ * Each client joins the shared encoder and gets its own VideoEncoder. The
+ * first client asking for a frame encodes it, the others get the same
+ * compressed buffer. The rate control of the shared encoder follows all
+ * the clients: it gets the reports and the frame drops of each of them,
+ * and sees the longest roundtrip.
+ *
+ * The frames must not depend on each other, since a client can miss some
+ * of them, so only the intra frame codecs such as MJPEG can be shared.
+ *
+ * The frames are told apart by their bitmap, which the shared encoder keeps
+ * alive with bitmap_ref() while the frame is waiting for some clients.
+ */
+typedef struct SharedVideoEncoder SharedVideoEncoder;
+
+/* The parameters are the ones of new_video_encoder_t. The encoder itself is
+ * created when the first client joins. */
+SharedVideoEncoder *shared_video_encoder_new(new_video_encoder_t create,
+                                             SpiceVideoCodecType codec_type,
+                                             uint64_t starting_bit_rate,
+                                             bitmap_ref_t bitmap_ref,
+                                             bitmap_unref_t bitmap_unref);
+void shared_video_encoder_unref(SharedVideoEncoder *shared);
+
+/* Adds a client to the shared encoder.
+ *
+ * @cbs:    The rate control callbacks of the client.
+ * @return: The video encoder of the client, to destroy when the client
+ *          leaves, or NULL if the encoder cannot be created. It keeps a
+ *          reference to the shared encoder.
+ */
+VideoEncoder *shared_video_encoder_join(SharedVideoEncoder *shared,
+                                        const VideoEncoderRateControlCbs *cbs);
+
+#endif /* SHARED_VIDEO_ENCODER_H_ */
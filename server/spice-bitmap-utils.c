@@ -17,10 +17,29 @@
 */
 #include <config.h>
 
+#include <string.h>
 #include <sys/stat.h>
 
 #include "spice-bitmap-utils.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GRADUAL_SIMD
+#include <immintrin.h>
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+/* Scores of the pixel pairs, scaled by GRADUAL_SCORE_SCALE to use integers */
+#define SAME_PIXEL_SCORE 2
+#define CONTRAST_PIXELS_SCORE 4
+#define NOT_CONTRAST_PIXELS_SCORE -1
+#define GRADUAL_SCORE_SCALE 4
+
+#define GRADUAL_CONTRAST_TH_RGB 60
+#define GRADUAL_CONTRAST_TH_RGB16 8
+
+#define SAMPLE_JUMP 15
+
 #define RED_BITMAP_UTILS_RGB16
 #include "spice-bitmap-utils.tmpl.c"
 #define RED_BITMAP_UTILS_RGB24
@@ -36,44 +55,444 @@
 // in window media player 12). see red_stream_add_frame
 #define GRADUAL_MEDIUM_SCORE_TH 0.002
 
-// assumes that stride doesn't overflow
-BitmapGradualType bitmap_get_graduality_level(SpiceBitmap *bitmap)
+#ifdef GRADUAL_SIMD
+/* Walk the samples the same way compute_lines_gradual_score() does and
+ * return their offsets in batches, to load them in vectors */
+typedef struct {
+    int width;
+    int jump;
+    int pos;
+    int col;
+    int end;
+} GradualSampler;
+
+static inline void gradual_sampler_init(GradualSampler *sampler, int width, int num_lines)
 {
-    double score = 0.0;
-    int num_samples = 0;
-    int num_lines;
-    double chunk_score = 0.0;
-    int chunk_num_samples = 0;
-    uint32_t x, i;
-    SpiceChunk *chunk;
+    sampler->width = width;
+    sampler->jump = (SAMPLE_JUMP % width) ? SAMPLE_JUMP : SAMPLE_JUMP - 1;
+    sampler->pos = width / 2;
+    sampler->col = width / 2;
+    sampler->end = (num_lines - 1) * width;
+}
 
-    chunk = bitmap->data->chunk;
-    for (i = 0; i < bitmap->data->num_chunks; i++) {
-        num_lines = chunk[i].len / bitmap->stride;
-        x = bitmap->x;
-        switch (bitmap->format) {
-        case SPICE_BITMAP_FMT_16BIT:
-            compute_lines_gradual_score_rgb16((rgb16_pixel_t *)chunk[i].data, x, num_lines,
-                                              &chunk_score, &chunk_num_samples);
+static inline int gradual_sampler_next(GradualSampler *sampler, int32_t *offsets, int count)
+{
+    int i;
+
+    for (i = 0; i < count && sampler->pos < sampler->end; i++) {
+        if (sampler->col == sampler->width - 1) { // last pixel in the row
+            sampler->pos--;
+            sampler->col--;
+        }
+        offsets[i] = sampler->pos;
+        sampler->pos += sampler->jump;
+        sampler->col += sampler->jump;
+        while (sampler->col >= sampler->width) {
+            sampler->col -= sampler->width;
+        }
+    }
+    return i;
+}
+
+/* The vector kernels below compute the same integer scores as
+ * pixels_square_score(), one sample per 32 bit lane:
+ * - @diff lanes are set if the pixels differ,
+ * - @contrast lanes are set if the pixels are contrasting;
+ * the score of a pair is then SAME_PIXEL_SCORE, adjusted by
+ * (NOT_CONTRAST_PIXELS_SCORE - SAME_PIXEL_SCORE) if the pixels differ and by
+ * (CONTRAST_PIXELS_SCORE - NOT_CONTRAST_PIXELS_SCORE) if they contrast.
+ * The lanes accumulate at most 12 per sample, they can't overflow for
+ * chunks smaller than 4GiB. */
+
+static TARGET_SSE2 inline __m128i pair_score_sse2(__m128i diff, __m128i contrast)
+{
+    __m128i score = _mm_set1_epi32(SAME_PIXEL_SCORE);
+
+    score = _mm_add_epi32(score, _mm_and_si128(diff, _mm_set1_epi32(NOT_CONTRAST_PIXELS_SCORE -
+                                                                    SAME_PIXEL_SCORE)));
+    return _mm_add_epi32(score, _mm_and_si128(contrast, _mm_set1_epi32(CONTRAST_PIXELS_SCORE -
+                                                                       NOT_CONTRAST_PIXELS_SCORE)));
+}
+
+static TARGET_SSE2 inline __m128i pair_score_rgb32_sse2(__m128i a, __m128i b, __m128i *diff)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi32(-1);
+    __m128i abs_diff = _mm_and_si128(_mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a)),
+                                     _mm_set1_epi32(0x00ffffff));
+    __m128i contrast = _mm_subs_epu8(abs_diff, _mm_set1_epi8(GRADUAL_CONTRAST_TH_RGB - 1));
+
+    *diff = _mm_xor_si128(_mm_cmpeq_epi32(abs_diff, zero), ones);
+    contrast = _mm_xor_si128(_mm_cmpeq_epi32(contrast, zero), ones);
+    return pair_score_sse2(*diff, contrast);
+}
+
+static TARGET_SSE2 inline __m128i channel_contrast_rgb16_sse2(__m128i a, __m128i b, int shift)
+{
+    const __m128i mask = _mm_set1_epi32(0x1f);
+    __m128i diff = _mm_sub_epi32(_mm_and_si128(_mm_srli_epi32(a, shift), mask),
+                                 _mm_and_si128(_mm_srli_epi32(b, shift), mask));
+
+    return _mm_or_si128(_mm_cmpgt_epi32(diff, _mm_set1_epi32(GRADUAL_CONTRAST_TH_RGB16 - 1)),
+                        _mm_cmplt_epi32(diff, _mm_set1_epi32(1 - GRADUAL_CONTRAST_TH_RGB16)));
+}
+
+static TARGET_SSE2 inline __m128i pair_score_rgb16_sse2(__m128i a, __m128i b, __m128i *diff)
+{
+    __m128i contrast = _mm_or_si128(channel_contrast_rgb16_sse2(a, b, 10),
+                                    _mm_or_si128(channel_contrast_rgb16_sse2(a, b, 5),
+                                                 channel_contrast_rgb16_sse2(a, b, 0)));
+    __m128i same = _mm_cmpeq_epi32(_mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi32(0x7fff)),
+                                   _mm_setzero_si128());
+
+    *diff = _mm_xor_si128(same, _mm_set1_epi32(-1));
+    return pair_score_sse2(*diff, contrast);
+}
+
+static TARGET_SSE2 inline int64_t sum_lanes_sse2(__m128i sum)
+{
+    int32_t lanes[4];
+
+    _mm_storeu_si128((__m128i *)lanes, sum);
+    return (int64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+/* Load the pixel at each offset in @left and the one at its right in @right */
+static TARGET_SSE2 inline void load_pairs_rgb32_sse2(const rgb32_pixel_t *base,
+                                                     const int32_t *offsets,
+                                                     __m128i *left, __m128i *right)
+{
+    __m128i pairs01 = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)(base + offsets[0])),
+                                         _mm_loadl_epi64((const __m128i *)(base + offsets[1])));
+    __m128i pairs23 = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)(base + offsets[2])),
+                                         _mm_loadl_epi64((const __m128i *)(base + offsets[3])));
+
+    pairs01 = _mm_shuffle_epi32(pairs01, _MM_SHUFFLE(3, 1, 2, 0));
+    pairs23 = _mm_shuffle_epi32(pairs23, _MM_SHUFFLE(3, 1, 2, 0));
+    *left = _mm_unpacklo_epi64(pairs01, pairs23);
+    *right = _mm_unpackhi_epi64(pairs01, pairs23);
+}
+
+static TARGET_SSE2 inline void load_pairs_rgb16_sse2(const rgb16_pixel_t *base,
+                                                     const int32_t *offsets,
+                                                     __m128i *left, __m128i *right)
+{
+    uint32_t pairs[4];
+    __m128i vec;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        memcpy(&pairs[i], base + offsets[i], sizeof(pairs[i]));
+    }
+    vec = _mm_loadu_si128((const __m128i *)pairs);
+    *left = _mm_and_si128(vec, _mm_set1_epi32(0xffff));
+    *right = _mm_srli_epi32(vec, 16);
+}
+
+#define DEFINE_COMPUTE_LINES_SSE2(FORMAT, PIXEL)                                             \
+static TARGET_SSE2 void compute_lines_gradual_score_##FORMAT##_sse2(PIXEL *lines, int width, \
+                                                                    int num_lines,           \
+                                                                    int64_t *o_samples_sum_score, \
+                                                                    int *o_num_samples)      \
+{                                                                                            \
+    GradualSampler sampler;                                                                  \
+    int32_t offsets[4];                                                                      \
+    __m128i sum = _mm_setzero_si128();                                                       \
+    int64_t score = 0;                                                                       \
+    int num_samples = 0;                                                                     \
+    int count, i;                                                                            \
+                                                                                             \
+    if ((width <= 1) || (num_lines <= 1)) {                                                  \
+        compute_lines_gradual_score_##FORMAT(lines, width, num_lines,                        \
+                                             o_samples_sum_score, o_num_samples);            \
+        return;                                                                              \
+    }                                                                                        \
+                                                                                             \
+    gradual_sampler_init(&sampler, width, num_lines);                                        \
+    while ((count = gradual_sampler_next(&sampler, offsets, 4)) == 4) {                      \
+        __m128i p0, p1, p2, p3, diff1, diff2, diff3, square;                                 \
+                                                                                             \
+        load_pairs_##FORMAT##_sse2(lines, offsets, &p0, &p1);                                \
+        load_pairs_##FORMAT##_sse2(lines + width, offsets, &p2, &p3);                        \
+        square = _mm_add_epi32(pair_score_##FORMAT##_sse2(p0, p1, &diff1),                   \
+                               pair_score_##FORMAT##_sse2(p0, p2, &diff2));                  \
+        square = _mm_add_epi32(square, pair_score_##FORMAT##_sse2(p0, p3, &diff3));          \
+        /* ignore squares where all pixels are identical */                                  \
+        square = _mm_and_si128(square, _mm_or_si128(diff1, _mm_or_si128(diff2, diff3)));     \
+        sum = _mm_add_epi32(sum, square);                                                    \
+        num_samples += 4;                                                                    \
+    }                                                                                        \
+    for (i = 0; i < count; i++) {                                                            \
+        score += pixels_square_score_##FORMAT(lines + offsets[i], lines + offsets[i] + width); \
+        num_samples++;                                                                       \
+    }                                                                                        \
+                                                                                             \
+    *o_samples_sum_score = score + sum_lanes_sse2(sum);                                      \
+    *o_num_samples = num_samples * 3;                                                        \
+}
+
+DEFINE_COMPUTE_LINES_SSE2(rgb16, rgb16_pixel_t)
+DEFINE_COMPUTE_LINES_SSE2(rgb32, rgb32_pixel_t)
+
+static TARGET_AVX2 inline __m256i pair_score_avx2(__m256i diff, __m256i contrast)
+{
+    __m256i score = _mm256_set1_epi32(SAME_PIXEL_SCORE);
+
+    score = _mm256_add_epi32(score,
+                             _mm256_and_si256(diff, _mm256_set1_epi32(NOT_CONTRAST_PIXELS_SCORE -
+                                                                      SAME_PIXEL_SCORE)));
+    return _mm256_add_epi32(score,
+                            _mm256_and_si256(contrast,
+                                             _mm256_set1_epi32(CONTRAST_PIXELS_SCORE -
+                                                               NOT_CONTRAST_PIXELS_SCORE)));
+}
+
+static TARGET_AVX2 inline __m256i pair_score_rgb32_avx2(__m256i a, __m256i b, __m256i *diff)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi32(-1);
+    __m256i abs_diff = _mm256_and_si256(_mm256_or_si256(_mm256_subs_epu8(a, b),
+                                                        _mm256_subs_epu8(b, a)),
+                                        _mm256_set1_epi32(0x00ffffff));
+    __m256i contrast = _mm256_subs_epu8(abs_diff, _mm256_set1_epi8(GRADUAL_CONTRAST_TH_RGB - 1));
+
+    *diff = _mm256_xor_si256(_mm256_cmpeq_epi32(abs_diff, zero), ones);
+    contrast = _mm256_xor_si256(_mm256_cmpeq_epi32(contrast, zero), ones);
+    return pair_score_avx2(*diff, contrast);
+}
+
+static TARGET_AVX2 inline __m256i channel_contrast_rgb16_avx2(__m256i a, __m256i b, int shift)
+{
+    const __m256i mask = _mm256_set1_epi32(0x1f);
+    __m256i diff = _mm256_sub_epi32(_mm256_and_si256(_mm256_srli_epi32(a, shift), mask),
+                                    _mm256_and_si256(_mm256_srli_epi32(b, shift), mask));
+
+    return _mm256_or_si256(_mm256_cmpgt_epi32(diff,
+                                              _mm256_set1_epi32(GRADUAL_CONTRAST_TH_RGB16 - 1)),
+                           _mm256_cmpgt_epi32(_mm256_set1_epi32(1 - GRADUAL_CONTRAST_TH_RGB16),
+                                              diff));
+}
+
+static TARGET_AVX2 inline __m256i pair_score_rgb16_avx2(__m256i a, __m256i b, __m256i *diff)
+{
+    __m256i contrast = _mm256_or_si256(channel_contrast_rgb16_avx2(a, b, 10),
+                                       _mm256_or_si256(channel_contrast_rgb16_avx2(a, b, 5),
+                                                       channel_contrast_rgb16_avx2(a, b, 0)));
+    __m256i same = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_xor_si256(a, b),
+                                                       _mm256_set1_epi32(0x7fff)),
+                                      _mm256_setzero_si256());
+
+    *diff = _mm256_xor_si256(same, _mm256_set1_epi32(-1));
+    return pair_score_avx2(*diff, contrast);
+}
+
+static TARGET_AVX2 inline int64_t sum_lanes_avx2(__m256i sum)
+{
+    int32_t lanes[8];
+    int64_t total = 0;
+    int i;
+
+    _mm256_storeu_si256((__m256i *)lanes, sum);
+    for (i = 0; i < 8; i++) {
+        total += lanes[i];
+    }
+    return total;
+}
+
+/* Gathers are slower than plain loads for the sparse samples, the pairs are
+ * loaded in 128 bit halves */
+static TARGET_AVX2 inline void load_pairs_rgb32_avx2(const rgb32_pixel_t *base,
+                                                     const int32_t *offsets,
+                                                     __m256i *left, __m256i *right)
+{
+    __m128i left_low, right_low, left_high, right_high;
+
+    load_pairs_rgb32_sse2(base, offsets, &left_low, &right_low);
+    load_pairs_rgb32_sse2(base, offsets + 4, &left_high, &right_high);
+    *left = _mm256_inserti128_si256(_mm256_castsi128_si256(left_low), left_high, 1);
+    *right = _mm256_inserti128_si256(_mm256_castsi128_si256(right_low), right_high, 1);
+}
+
+static TARGET_AVX2 inline void load_pairs_rgb16_avx2(const rgb16_pixel_t *base,
+                                                     const int32_t *offsets,
+                                                     __m256i *left, __m256i *right)
+{
+    uint32_t pairs[8];
+    __m256i vec;
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        memcpy(&pairs[i], base + offsets[i], sizeof(pairs[i]));
+    }
+    vec = _mm256_loadu_si256((const __m256i *)pairs);
+    *left = _mm256_and_si256(vec, _mm256_set1_epi32(0xffff));
+    *right = _mm256_srli_epi32(vec, 16);
+}
+
+#define DEFINE_COMPUTE_LINES_AVX2(FORMAT, PIXEL)                                             \
+static TARGET_AVX2 void compute_lines_gradual_score_##FORMAT##_avx2(PIXEL *lines, int width, \
+                                                                    int num_lines,           \
+                                                                    int64_t *o_samples_sum_score, \
+                                                                    int *o_num_samples)      \
+{                                                                                            \
+    GradualSampler sampler;                                                                  \
+    int32_t offsets[8];                                                                      \
+    __m256i sum = _mm256_setzero_si256();                                                    \
+    int64_t score = 0;                                                                       \
+    int num_samples = 0;                                                                     \
+    int count, i;                                                                            \
+                                                                                             \
+    if ((width <= 1) || (num_lines <= 1)) {                                                  \
+        compute_lines_gradual_score_##FORMAT(lines, width, num_lines,                        \
+                                             o_samples_sum_score, o_num_samples);            \
+        return;                                                                              \
+    }                                                                                        \
+                                                                                             \
+    gradual_sampler_init(&sampler, width, num_lines);                                        \
+    while ((count = gradual_sampler_next(&sampler, offsets, 8)) == 8) {                      \
+        __m256i p0, p1, p2, p3, diff1, diff2, diff3, square;                                 \
+                                                                                             \
+        load_pairs_##FORMAT##_avx2(lines, offsets, &p0, &p1);                                \
+        load_pairs_##FORMAT##_avx2(lines + width, offsets, &p2, &p3);                        \
+        square = _mm256_add_epi32(pair_score_##FORMAT##_avx2(p0, p1, &diff1),                \
+                                  pair_score_##FORMAT##_avx2(p0, p2, &diff2));               \
+        square = _mm256_add_epi32(square, pair_score_##FORMAT##_avx2(p0, p3, &diff3));       \
+        /* ignore squares where all pixels are identical */                                  \
+        square = _mm256_and_si256(square,                                                    \
+                                  _mm256_or_si256(diff1, _mm256_or_si256(diff2, diff3)));    \
+        sum = _mm256_add_epi32(sum, square);                                                 \
+        num_samples += 8;                                                                    \
+    }                                                                                        \
+    for (i = 0; i < count; i++) {                                                            \
+        score += pixels_square_score_##FORMAT(lines + offsets[i], lines + offsets[i] + width); \
+        num_samples++;                                                                       \
+    }                                                                                        \
+                                                                                             \
+    *o_samples_sum_score = score + sum_lanes_avx2(sum);                                      \
+    *o_num_samples = num_samples * 3;                                                        \
+}
+
+DEFINE_COMPUTE_LINES_AVX2(rgb16, rgb16_pixel_t)
+DEFINE_COMPUTE_LINES_AVX2(rgb32, rgb32_pixel_t)
+#endif /* GRADUAL_SIMD */
+
+bool bitmap_graduality_impl_supported(BitmapGradualityImpl impl)
+{
+    switch (impl) {
+    case BITMAP_GRADUALITY_IMPL_AUTO:
+    case BITMAP_GRADUALITY_IMPL_SCALAR:
+        return true;
+#ifdef GRADUAL_SIMD
+    case BITMAP_GRADUALITY_IMPL_SSE2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse2");
+    case BITMAP_GRADUALITY_IMPL_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+static BitmapGradualityImpl graduality_get_best_impl(void)
+{
+    static gsize best_impl = 0;
+
+    if (g_once_init_enter(&best_impl)) {
+        BitmapGradualityImpl impl = BITMAP_GRADUALITY_IMPL_SCALAR;
+
+        if (bitmap_graduality_impl_supported(BITMAP_GRADUALITY_IMPL_AVX2)) {
+            impl = BITMAP_GRADUALITY_IMPL_AVX2;
+        } else if (bitmap_graduality_impl_supported(BITMAP_GRADUALITY_IMPL_SSE2)) {
+            impl = BITMAP_GRADUALITY_IMPL_SSE2;
+        }
+        g_once_init_leave(&best_impl, impl);
+    }
+    return best_impl;
+}
+
+static void compute_chunk_gradual_score(SpiceChunk *chunk, SpiceBitmap *bitmap,
+                                        BitmapGradualityImpl impl,
+                                        int64_t *o_samples_sum_score, int *o_num_samples)
+{
+    int num_lines = chunk->len / bitmap->stride;
+    uint32_t x = bitmap->x;
+
+    switch (bitmap->format) {
+    case SPICE_BITMAP_FMT_16BIT:
+#ifdef GRADUAL_SIMD
+        if (impl == BITMAP_GRADUALITY_IMPL_AVX2) {
+            compute_lines_gradual_score_rgb16_avx2((rgb16_pixel_t *)chunk->data, x, num_lines,
+                                                   o_samples_sum_score, o_num_samples);
+            break;
+        }
+        if (impl == BITMAP_GRADUALITY_IMPL_SSE2) {
+            compute_lines_gradual_score_rgb16_sse2((rgb16_pixel_t *)chunk->data, x, num_lines,
+                                                   o_samples_sum_score, o_num_samples);
             break;
-        case SPICE_BITMAP_FMT_24BIT:
-            compute_lines_gradual_score_rgb24((rgb24_pixel_t *)chunk[i].data, x, num_lines,
-                                              &chunk_score, &chunk_num_samples);
+        }
+#endif
+        compute_lines_gradual_score_rgb16((rgb16_pixel_t *)chunk->data, x, num_lines,
+                                          o_samples_sum_score, o_num_samples);
+        break;
+    case SPICE_BITMAP_FMT_24BIT:
+        compute_lines_gradual_score_rgb24((rgb24_pixel_t *)chunk->data, x, num_lines,
+                                          o_samples_sum_score, o_num_samples);
+        break;
+    case SPICE_BITMAP_FMT_32BIT:
+    case SPICE_BITMAP_FMT_RGBA:
+#ifdef GRADUAL_SIMD
+        if (impl == BITMAP_GRADUALITY_IMPL_AVX2) {
+            compute_lines_gradual_score_rgb32_avx2((rgb32_pixel_t *)chunk->data, x, num_lines,
+                                                   o_samples_sum_score, o_num_samples);
             break;
-        case SPICE_BITMAP_FMT_32BIT:
-        case SPICE_BITMAP_FMT_RGBA:
-            compute_lines_gradual_score_rgb32((rgb32_pixel_t *)chunk[i].data, x, num_lines,
-                                              &chunk_score, &chunk_num_samples);
+        }
+        if (impl == BITMAP_GRADUALITY_IMPL_SSE2) {
+            compute_lines_gradual_score_rgb32_sse2((rgb32_pixel_t *)chunk->data, x, num_lines,
+                                                   o_samples_sum_score, o_num_samples);
             break;
-        default:
-            spice_error("invalid bitmap format (not RGB) %u", bitmap->format);
         }
-        score += chunk_score;
+#endif
+        compute_lines_gradual_score_rgb32((rgb32_pixel_t *)chunk->data, x, num_lines,
+                                          o_samples_sum_score, o_num_samples);
+        break;
+    default:
+        spice_error("invalid bitmap format (not RGB) %u", bitmap->format);
+    }
+}
+
+// assumes that stride doesn't overflow
+BitmapGradualType bitmap_get_graduality_level_impl(SpiceBitmap *bitmap,
+                                                   BitmapGradualityImpl impl,
+                                                   double *o_score)
+{
+    int64_t samples_sum_score = 0;
+    int num_samples = 0;
+    double score;
+    uint32_t i;
+
+    if (impl == BITMAP_GRADUALITY_IMPL_AUTO) {
+        impl = graduality_get_best_impl();
+    } else if (!bitmap_graduality_impl_supported(impl)) {
+        return BITMAP_GRADUAL_NOT_AVAIL;
+    }
+
+    for (i = 0; i < bitmap->data->num_chunks; i++) {
+        int64_t chunk_score = 0;
+        int chunk_num_samples = 0;
+
+        compute_chunk_gradual_score(&bitmap->data->chunk[i], bitmap, impl,
+                                    &chunk_score, &chunk_num_samples);
+        samples_sum_score += chunk_score;
         num_samples += chunk_num_samples;
     }
 
     spice_assert(num_samples);
-    score /= num_samples;
+    score = (double) samples_sum_score / GRADUAL_SCORE_SCALE / num_samples;
+    if (o_score) {
+        *o_score = score;
+    }
 
     if (bitmap->format == SPICE_BITMAP_FMT_16BIT) {
         if (score < GRADUAL_HIGH_RGB16_TH) {
@@ -92,6 +511,11 @@ BitmapGradualType bitmap_get_graduality_level(SpiceBitmap *bitmap)
     }
 }
 
+BitmapGradualType bitmap_get_graduality_level(SpiceBitmap *bitmap)
+{
+    return bitmap_get_graduality_level_impl(bitmap, BITMAP_GRADUALITY_IMPL_AUTO, NULL);
+}
+
 int bitmap_has_extra_stride(SpiceBitmap *bitmap)
 {
     spice_assert(bitmap);
@@ -83,7 +83,23 @@ static inline int bitmap_fmt_has_graduality(uint8_t fmt)
 }
 
 
+/* Implementations of the graduality detection, AUTO selects the fastest
+ * one supported by the CPU */
+typedef enum {
+    BITMAP_GRADUALITY_IMPL_AUTO,
+    BITMAP_GRADUALITY_IMPL_SCALAR,
+    BITMAP_GRADUALITY_IMPL_SSE2,
+    BITMAP_GRADUALITY_IMPL_AVX2,
+} BitmapGradualityImpl;
+
 BitmapGradualType bitmap_get_graduality_level     (SpiceBitmap *bitmap);
+/* Same as bitmap_get_graduality_level() using the given implementation,
+ * for testing. Returns BITMAP_GRADUAL_NOT_AVAIL if the implementation is not
+ * supported. @score, if not NULL, is set to the score of the bitmap */
+BitmapGradualType bitmap_get_graduality_level_impl(SpiceBitmap *bitmap,
+                                                   BitmapGradualityImpl impl,
+                                                   double *score);
+bool              bitmap_graduality_impl_supported(BitmapGradualityImpl impl);
 int               bitmap_has_extra_stride         (SpiceBitmap *bitmap);
 
 void dump_bitmap(SpiceBitmap *bitmap);
@@ -40,25 +40,17 @@
 #define FNAME(name) name##_rgb32
 #endif
 
-
-#define SAME_PIXEL_WEIGHT 0.5
-#define NOT_CONTRAST_PIXELS_WEIGHT -0.25
-#define CONTRAST_PIXELS_WEIGHT 1.0
-
 #ifndef RED_BITMAP_UTILS_RGB16
-#define CONTRAST_TH 60
+#define CONTRAST_TH GRADUAL_CONTRAST_TH_RGB
 #else
-#define CONTRAST_TH 8
+#define CONTRAST_TH GRADUAL_CONTRAST_TH_RGB16
 #endif
 #define CONTRASTING(n) ((n) <= -CONTRAST_TH || (n) >= CONTRAST_TH)
 
-
-#define SAMPLE_JUMP 15
-
-static const double FNAME(PIX_PAIR_SCORE)[] = {
-    SAME_PIXEL_WEIGHT,
-    CONTRAST_PIXELS_WEIGHT,
-    NOT_CONTRAST_PIXELS_WEIGHT,
+static const int FNAME(PIX_PAIR_SCORE)[] = {
+    SAME_PIXEL_SCORE,
+    CONTRAST_PIXELS_SCORE,
+    NOT_CONTRAST_PIXELS_SCORE,
 };
 
 // return 0 - equal, 1 - for contrast, 2 for no contrast (PIX_PAIR_SCORE is defined accordingly)
@@ -91,9 +83,9 @@ static inline int FNAME(pixelcmp)(PIXEL p1, PIXEL p2)
     }
 }
 
-static inline double FNAME(pixels_square_score)(PIXEL *line1, PIXEL *line2)
+static inline int FNAME(pixels_square_score)(const PIXEL *line1, const PIXEL *line2)
 {
-    double ret;
+    int ret;
     int any_different = 0;
     int cmp_res;
     cmp_res = FNAME(pixelcmp)(*line1, line1[1]);
@@ -114,8 +106,9 @@ static inline double FNAME(pixels_square_score)(PIXEL *line1, PIXEL *line2)
     return ret;
 }
 
+/* The sum of the scores is scaled by GRADUAL_SCORE_SCALE */
 static void FNAME(compute_lines_gradual_score)(PIXEL *lines, int width, int num_lines,
-                                               double *o_samples_sum_score, int *o_num_samples)
+                                               int64_t *o_samples_sum_score, int *o_num_samples)
 {
     int jump = (SAMPLE_JUMP % width) ? SAMPLE_JUMP : SAMPLE_JUMP - 1;
     PIXEL *cur_pix = lines + width / 2;
@@ -124,7 +117,7 @@ static void FNAME(compute_lines_gradual_score)(PIXEL *lines, int width, int num_
 
     if ((width <= 1) || (num_lines <= 1)) {
         *o_num_samples = 1;
-        *o_samples_sum_score = 1.0;
+        *o_samples_sum_score = GRADUAL_SCORE_SCALE;
         return;
     }
 
@@ -152,7 +145,5 @@ static void FNAME(compute_lines_gradual_score)(PIXEL *lines, int width, int num_
 #undef RED_BITMAP_UTILS_RGB16
 #undef RED_BITMAP_UTILS_RGB24
 #undef RED_BITMAP_UTILS_RGB32
-#undef SAMPLE_JUMP
 #undef CONTRAST_TH
-#undef SAME_PIXEL_WEIGHT
-#undef NOT_CONTRAST_PIXELS_WEIGHT
+#undef CONTRASTING
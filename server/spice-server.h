@@ -59,9 +59,52 @@ int spice_server_set_tls(SpiceServer *s, int port,
                          const char *ca_cert_file, const char *certs_file,
                          const char *private_key_file, const char *key_passwd,
                          const char *dh_key_file, const char *ciphersuite);
+/**
+ * Configures the resumption of the TLS sessions, letting the clients
+ * reconnect their channels without a full handshake.
+ * By default the server keeps 20480 sessions, uses the OpenSSL timeout
+ * and rotates the ticket keys every hour.
+ * Must be called before spice_server_init().
+ *
+ * @s: the Spice server to configure
+ * @cache_size: the number of sessions kept by the server, 0 disables the cache
+ * @timeout: the number of seconds a session can be resumed, 0 for the
+ *           OpenSSL default
+ * @ticket_key_lifetime: the number of seconds between the rotations of the
+ *                       keys encrypting the session tickets, 0 disables
+ *                       the tickets
+ * @return 0 on success, -1 on failure
+ */
+int spice_server_set_tls_session_cache(SpiceServer *s, unsigned int cache_size,
+                                       unsigned int timeout,
+                                       unsigned int ticket_key_lifetime);
+/**
+ * Lets the kernel encrypt the TLS connections (Linux kTLS), the OpenSSL
+ * encryption being used when the kernel does not support the negotiated
+ * cipher. Disabled by default.
+ * Must be called before spice_server_init().
+ *
+ * @s: the Spice server to configure
+ * @enable: whether to let the kernel encrypt
+ * @return 0 on success, -1 on failure, in particular when spice-server was
+ *         built with an OpenSSL version without kTLS support
+ */
+int spice_server_set_ktls(SpiceServer *s, int enable);
 
 int spice_server_add_client(SpiceServer *s, int socket, int skip_auth);
 int spice_server_add_ssl_client(SpiceServer *s, int socket, int skip_auth);
+/**
+ * Sets the number of threads running the TLS handshakes and the
+ * authentication of the new connections. 0, the default, runs them in the
+ * main loop. The connections are handled by the main loop once
+ * authenticated.
+ * Can be called only once.
+ *
+ * @s: the Spice server to configure
+ * @threads: the number of handshake threads
+ * @return 0 on success, -1 on failure
+ */
+int spice_server_set_handshake_threads(SpiceServer *s, unsigned int threads);
 
 int spice_server_add_interface(SpiceServer *s,
                                SpiceBaseInstance *sin);
@@ -117,6 +160,18 @@ int spice_server_set_zlib_glz_compression(SpiceServer *s, spice_wan_compression_
 #define SPICE_CHANNEL_SECURITY_SSL (1 << 1)
 
 int spice_server_set_channel_security(SpiceServer *s, const char *channel, int security);
+/**
+ * Limits the rate at which the channels of a type send to each client, for
+ * instance to keep the display channel from using all the bandwidth of the
+ * clients. No limit by default. Only the new clients are affected.
+ *
+ * @s: the Spice server to configure
+ * @channel: the name of the channel type, for instance "display"
+ * @bit_rate: the maximum rate in bits per second, 0 for no limit
+ * @return 0 on success, -1 on failure
+ */
+int spice_server_set_channel_max_bit_rate(SpiceServer *s, const char *channel,
+                                          uint64_t bit_rate);
 
 int spice_server_add_renderer(SpiceServer *s, const char *name) SPICE_GNUC_DEPRECATED;
 
@@ -137,6 +192,18 @@ enum {
 
 int spice_server_set_video_codecs(SpiceServer *s, const char* video_codecs);
 
+/**
+ * Sets the compression of the messages sent to the WebSocket clients
+ * supporting the permessage-deflate extension. Only the new connections
+ * are affected.
+ *
+ * @s: the Spice server to configure
+ * @level: the zlib compression level, from 1 to 9, 0 disables the
+ *         compression. The default is 1
+ * @return 0 on success, -1 on failure
+ */
+int spice_server_set_websocket_compression(SpiceServer *s, int level);
+
 /**
  * Returns a newly allocated string describing video encoders/codecs
  * currently allowed in @s Spice server. The string returned by
@@ -152,6 +219,81 @@ const char *spice_server_get_video_codecs(SpiceServer *s);
  * spice_server_get_video_codecs.
  */
 void spice_server_free_video_codecs(SpiceServer *s, const char *video_codecs);
+
+/**
+ * Sets the number of threads used to compress images ahead of sending
+ * them to the display clients. 0, the default, compresses the images in
+ * the worker thread when they are sent.
+ * Must be called before adding QXL devices and can be called only once.
+ *
+ * @s: the Spice server to configure
+ * @threads: the number of compression threads
+ * @return 0 on success, -1 on failure
+ */
+int spice_server_set_image_encoder_threads(SpiceServer *s, unsigned int threads);
+
+/**
+ * Enables the sending of the large display messages of the LAN clients
+ * without copying them to the socket buffers (Linux MSG_ZEROCOPY, plain
+ * TCP connections only). Disabled by default. Only the new connections
+ * are affected.
+ *
+ * @s: the Spice server to configure
+ * @enable: whether to send without copy
+ * @return 0 on success, -1 on failure
+ */
+int spice_server_set_zerocopy(SpiceServer *s, int enable);
+
+/**
+ * Sets the size of the cache keeping the images compressed for a display
+ * client so that the other clients showing the same display can send them
+ * without compressing them again. The default is 16 MiB, 0 disables the
+ * cache.
+ * Must be called before adding QXL devices.
+ *
+ * @s: the Spice server to configure
+ * @megabytes: the size of the cache, in MiB
+ * @return 0 on success, -1 on failure
+ */
+int spice_server_set_compress_cache_memory(SpiceServer *s, unsigned int megabytes);
+
+/**
+ * Sets the maximum memory used for the drawing commands waiting to be
+ * rendered or sent to the display clients. Beyond that the older commands
+ * are rendered to make room for the new ones. The default is enough for
+ * about 8000 commands.
+ * Must be called before adding QXL devices.
+ *
+ * @s: the Spice server to configure
+ * @megabytes: the memory budget, in MiB, must not be 0
+ * @return 0 on success, -1 on failure
+ */
+int spice_server_set_drawables_memory(SpiceServer *s, unsigned int megabytes);
+
+/**
+ * Polls the sockets of the display channels with io_uring (Linux 5.1 or
+ * newer) instead of poll(), which is costly with many clients. Disabled by
+ * default.
+ * Must be called before adding QXL devices.
+ *
+ * @s: the Spice server to configure
+ * @enable: whether to use io_uring
+ * @return 0 on success, -1 on failure, in particular when spice-server was
+ *         built without liburing
+ */
+int spice_server_set_io_uring(SpiceServer *s, int enable);
+
+/**
+ * Encodes the MJPEG video streams once for all the clients with similar
+ * bandwidths instead of once per client. Disabled by default. Only the new
+ * streams are affected.
+ *
+ * @s: the Spice server to configure
+ * @enable: whether to share the video encoders
+ * @return 0 on success, -1 on failure
+ */
+int spice_server_set_shared_video_encoders(SpiceServer *s, int enable);
+
 int spice_server_set_playback_compression(SpiceServer *s, int enable);
 int spice_server_set_agent_mouse(SpiceServer *s, int enable);
 int spice_server_set_agent_copypaste(SpiceServer *s, int enable);
@@ -0,0 +1,222 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 agent <agent@local>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/* Test the implementations of the bitmap graduality detection.
+ * The vectorized implementations must give the same scores as the scalar
+ * one for all the formats, sizes and chunk layouts.
+ * When run in performance mode (-m perf) the time taken by each
+ * implementation on a full HD bitmap is reported.
+ */
+#include <config.h>
+
+#include <string.h>
+
+#include "test-glib-compat.h"
+#include "spice-bitmap-utils.h"
+
+#define NUM_BITMAPS 2000
+#define MAX_CHUNKS 3
+
+static const char *const impl_names[] = {
+    [BITMAP_GRADUALITY_IMPL_AUTO] = "auto",
+    [BITMAP_GRADUALITY_IMPL_SCALAR] = "scalar",
+    [BITMAP_GRADUALITY_IMPL_SSE2] = "sse2",
+    [BITMAP_GRADUALITY_IMPL_AVX2] = "avx2",
+};
+
+typedef enum {
+    CONTENT_NOISE,
+    CONTENT_GRADIENT,
+    CONTENT_FLAT,
+    CONTENT_TEXT,
+} Content;
+
+static void fill_data(GRand *rand, uint8_t *data, uint32_t len, int bpp, Content content)
+{
+    uint8_t base = g_rand_int(rand);
+    uint32_t i;
+
+    for (i = 0; i < len; i++) {
+        switch (content) {
+        case CONTENT_NOISE:
+            data[i] = g_rand_int(rand);
+            break;
+        case CONTENT_GRADIENT:
+            data[i] = base + (i / bpp) % 7;
+            break;
+        case CONTENT_FLAT:
+            data[i] = base + g_rand_int_range(rand, 0, 3);
+            break;
+        case CONTENT_TEXT:
+            data[i] = g_rand_int_range(rand, 0, 8) ? base : g_rand_int(rand);
+            break;
+        }
+    }
+}
+
+static void init_bitmap(SpiceBitmap *bitmap, uint8_t format, uint32_t width, uint32_t height,
+                        int num_chunks, GRand *rand, Content content)
+{
+    int bpp = bitmap_fmt_get_bytes_per_pixel(format);
+    int i;
+
+    memset(bitmap, 0, sizeof(*bitmap));
+    bitmap->format = format;
+    bitmap->flags = SPICE_BITMAP_FLAGS_TOP_DOWN;
+    bitmap->x = width;
+    bitmap->y = height;
+    bitmap->stride = width * bpp;
+    bitmap->data = spice_chunks_new(num_chunks);
+    for (i = 0; i < num_chunks; i++) {
+        SpiceChunk *chunk = &bitmap->data->chunk[i];
+        uint32_t num_lines = num_chunks == 1 ? height : g_rand_int_range(rand, 1, height + 1);
+
+        chunk->len = num_lines * bitmap->stride;
+        chunk->data = g_malloc(chunk->len);
+        fill_data(rand, chunk->data, chunk->len, bpp, content);
+        bitmap->data->data_size += chunk->len;
+    }
+}
+
+static void destroy_bitmap(SpiceBitmap *bitmap)
+{
+    uint32_t i;
+
+    for (i = 0; i < bitmap->data->num_chunks; i++) {
+        g_free(bitmap->data->chunk[i].data);
+    }
+    spice_chunks_destroy(bitmap->data);
+}
+
+static void test_graduality_impl(gconstpointer user_data)
+{
+    static const uint8_t formats[] = {
+        SPICE_BITMAP_FMT_16BIT,
+        SPICE_BITMAP_FMT_24BIT,
+        SPICE_BITMAP_FMT_32BIT,
+        SPICE_BITMAP_FMT_RGBA,
+    };
+    BitmapGradualityImpl impl = GPOINTER_TO_INT(user_data);
+    GRand *rand;
+    int i;
+
+    if (!bitmap_graduality_impl_supported(impl)) {
+        g_test_skip("implementation not supported by this CPU");
+        return;
+    }
+
+    rand = g_rand_new_with_seed(0x6ad);
+    for (i = 0; i < NUM_BITMAPS; i++) {
+        SpiceBitmap bitmap;
+        uint8_t format = formats[g_rand_int_range(rand, 0, G_N_ELEMENTS(formats))];
+        // mostly narrow bitmaps to test the ends of the lines
+        uint32_t width = g_rand_int_range(rand, 1, i % 4 ? 40 : 400);
+        uint32_t height = g_rand_int_range(rand, 1, 60);
+        BitmapGradualType expected_level, level;
+        double expected_score, score;
+
+        init_bitmap(&bitmap, format, width, height, g_rand_int_range(rand, 1, MAX_CHUNKS + 1),
+                    rand, g_rand_int_range(rand, CONTENT_NOISE, CONTENT_TEXT + 1));
+
+        expected_level = bitmap_get_graduality_level_impl(&bitmap, BITMAP_GRADUALITY_IMPL_SCALAR,
+                                                          &expected_score);
+        level = bitmap_get_graduality_level_impl(&bitmap, impl, &score);
+        g_assert_cmpint(level, ==, expected_level);
+        g_assert_cmpfloat(score, ==, expected_score);
+
+        destroy_bitmap(&bitmap);
+    }
+    g_rand_free(rand);
+}
+
+static void test_graduality_levels(void)
+{
+    GRand *rand = g_rand_new_with_seed(0x6ad);
+    SpiceBitmap bitmap;
+
+    // identical pixels are ignored, the score is 0
+    init_bitmap(&bitmap, SPICE_BITMAP_FMT_32BIT, 64, 64, 1, rand, CONTENT_FLAT);
+    memset(bitmap.data->chunk[0].data, 0x80, bitmap.data->chunk[0].len);
+    g_assert_cmpint(bitmap_get_graduality_level(&bitmap), ==, BITMAP_GRADUAL_MEDIUM);
+    destroy_bitmap(&bitmap);
+
+    // noise is contrasting
+    init_bitmap(&bitmap, SPICE_BITMAP_FMT_32BIT, 64, 64, 1, rand, CONTENT_NOISE);
+    g_assert_cmpint(bitmap_get_graduality_level(&bitmap), ==, BITMAP_GRADUAL_LOW);
+    destroy_bitmap(&bitmap);
+
+    // small variations everywhere are gradual
+    init_bitmap(&bitmap, SPICE_BITMAP_FMT_32BIT, 64, 64, 1, rand, CONTENT_GRADIENT);
+    g_assert_cmpint(bitmap_get_graduality_level(&bitmap), ==, BITMAP_GRADUAL_HIGH);
+    destroy_bitmap(&bitmap);
+
+    g_rand_free(rand);
+}
+
+static void test_graduality_perf(void)
+{
+    static const uint8_t formats[] = {
+        SPICE_BITMAP_FMT_16BIT,
+        SPICE_BITMAP_FMT_24BIT,
+        SPICE_BITMAP_FMT_32BIT,
+    };
+    GRand *rand = g_rand_new_with_seed(0x6ad);
+    unsigned int i;
+
+    for (i = 0; i < G_N_ELEMENTS(formats); i++) {
+        SpiceBitmap bitmap;
+        BitmapGradualityImpl impl;
+
+        init_bitmap(&bitmap, formats[i], 1920, 1080, 1, rand, CONTENT_TEXT);
+        for (impl = BITMAP_GRADUALITY_IMPL_SCALAR; impl <= BITMAP_GRADUALITY_IMPL_AVX2; impl++) {
+            int n;
+
+            if (!bitmap_graduality_impl_supported(impl)) {
+                continue;
+            }
+            g_test_timer_start();
+            for (n = 0; n < 100; n++) {
+                bitmap_get_graduality_level_impl(&bitmap, impl, NULL);
+            }
+            g_test_message("%d bpp %s: %.3f ms per bitmap",
+                           bitmap_fmt_get_bytes_per_pixel(formats[i]) * 8, impl_names[impl],
+                           g_test_timer_elapsed() * 1000 / n);
+        }
+        destroy_bitmap(&bitmap);
+    }
+    g_rand_free(rand);
+}
+
+int main(int argc, char *argv[])
+{
+    BitmapGradualityImpl impl;
+
+    g_test_init(&argc, &argv, NULL);
+
+    for (impl = BITMAP_GRADUALITY_IMPL_AUTO; impl <= BITMAP_GRADUALITY_IMPL_AVX2; impl++) {
+        char *path = g_strdup_printf("/server/bitmap-graduality/%s", impl_names[impl]);
+
+        g_test_add_data_func(path, GINT_TO_POINTER(impl), test_graduality_impl);
+        g_free(path);
+    }
+    g_test_add_func("/server/bitmap-graduality/levels", test_graduality_levels);
+    if (g_test_perf()) {
+        g_test_add_func("/server/bitmap-graduality/perf", test_graduality_perf);
+    }
+
+    return g_test_run();
+}
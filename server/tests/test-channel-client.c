@@ -0,0 +1,834 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 agent <agent@local>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * Test the pipe handling of RedChannelClient: the positions of the items
+ * shared between clients, the flow control based on the estimated size of
+ * the queued items and the batching of the messages written to the stream.
+ */
+#include <config.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <spice.h>
+
+#include "test-glib-compat.h"
+#include "basic-event-loop.h"
+#include "reds.h"
+#include "red-client.h"
+#include "main-channel.h"
+#include "net-utils.h"
+
+/* must match the values in red-channel-client.c */
+#define PIPE_ITEM_MIN_SIZE 64
+#define PIPE_BYTES_DEFAULT (4 * 1024 * 1024)
+
+SPICE_DECLARE_TYPE(RedTestChannel, red_test_channel, TEST_CHANNEL);
+#define RED_TYPE_TEST_CHANNEL red_test_channel_get_type()
+
+struct RedTestChannel
+{
+    RedChannel parent;
+};
+
+struct RedTestChannelClass
+{
+    RedChannelClass parent_class;
+};
+
+G_DEFINE_TYPE(RedTestChannel, red_test_channel, RED_TYPE_CHANNEL)
+
+SPICE_DECLARE_TYPE(RedTestChannelClient, red_test_channel_client, TEST_CHANNEL_CLIENT);
+#define RED_TYPE_TEST_CHANNEL_CLIENT red_test_channel_client_get_type()
+
+struct RedTestChannelClient
+{
+    RedChannelClient parent;
+};
+
+struct RedTestChannelClientClass
+{
+    RedChannelClientClass parent_class;
+};
+
+G_DEFINE_TYPE(RedTestChannelClient, red_test_channel_client, RED_TYPE_CHANNEL_CLIENT)
+
+enum {
+    RED_PIPE_ITEM_TYPE_TEST = RED_PIPE_ITEM_TYPE_CHANNEL_BASE,
+};
+
+typedef struct {
+    RedPipeItem base;
+    uint8_t value;
+} TestPipeItem;
+
+static void
+red_test_channel_init(RedTestChannel *self)
+{
+}
+
+static void
+red_test_channel_client_init(RedTestChannelClient *self)
+{
+}
+
+/* the test items are sent as a message of size_hint bytes of their value */
+static void
+test_channel_send_item(RedChannelClient *rcc, RedPipeItem *item)
+{
+    TestPipeItem *test_item = SPICE_UPCAST(TestPipeItem, item);
+    SpiceMarshaller *m = red_channel_client_get_marshaller(rcc);
+
+    red_channel_client_init_send_data(rcc, SPICE_MSG_MIGRATE_DATA);
+    memset(spice_marshaller_reserve_space(m, item->size_hint), test_item->value,
+           item->size_hint);
+    red_channel_client_begin_send_message(rcc);
+}
+
+static void
+test_connect_client(RedChannel *channel, RedClient *client, RedStream *stream,
+                    int migration, RedChannelCapabilities *caps)
+{
+    RedChannelClient *rcc;
+    rcc = g_initable_new(RED_TYPE_TEST_CHANNEL_CLIENT,
+                         NULL, NULL,
+                         "channel", channel,
+                         "client", client,
+                         "stream", stream,
+                         "caps", caps,
+                         NULL);
+    g_assert_nonnull(rcc);
+}
+
+static void
+red_test_channel_class_init(RedTestChannelClass *klass)
+{
+    RedChannelClass *channel_class = RED_CHANNEL_CLASS(klass);
+    channel_class->parser = spice_get_client_channel_parser(SPICE_CHANNEL_PORT, NULL);
+    channel_class->handle_message = red_channel_client_handle_message;
+    channel_class->send_item = test_channel_send_item;
+    channel_class->connect = test_connect_client;
+}
+
+static uint8_t *
+red_test_channel_client_alloc_msg_rcv_buf(RedChannelClient *rcc, uint16_t type, uint32_t size)
+{
+    return g_malloc(size);
+}
+
+static void
+red_test_channel_client_release_msg_rcv_buf(RedChannelClient *rcc,
+                                            uint16_t type, uint32_t size, uint8_t *msg)
+{
+    g_free(msg);
+}
+
+static void
+red_test_channel_client_class_init(RedTestChannelClientClass *klass)
+{
+    RedChannelClientClass *client_class = RED_CHANNEL_CLIENT_CLASS(klass);
+    client_class->alloc_recv_buf = red_test_channel_client_alloc_msg_rcv_buf;
+    client_class->release_recv_buf = red_test_channel_client_release_msg_rcv_buf;
+}
+
+/*
+ * Main test part
+ */
+typedef struct {
+    RedClient *client;
+    RedChannelClient *rcc;
+    int client_socket;
+} TestClient;
+
+typedef struct {
+    SpiceCoreInterface *core;
+    SpiceServer *server;
+    RedChannel *channel;
+    MainChannel *main_channel;
+    RedClient *client;
+    RedChannelClient *rcc;
+    int client_socket;
+    /* the channel is connected through TCP instead of a socket pair */
+    bool tcp;
+    /* additional client, see fixture_add_client() */
+    TestClient other;
+} TestFixture;
+
+static RedStream *create_dummy_stream(SpiceServer *server, int *p_socket)
+{
+    int sv[2];
+    g_assert_cmpint(socketpair(AF_LOCAL, SOCK_STREAM, 0, sv), ==, 0);
+    if (p_socket) {
+        *p_socket = sv[1];
+    } else {
+        close(sv[1]);
+    }
+    red_socket_set_non_blocking(sv[0], true);
+    red_socket_set_non_blocking(sv[1], true);
+
+    RedStream * stream = red_stream_new(server, sv[0]);
+    g_assert_nonnull(stream);
+
+    return stream;
+}
+
+/* Same as create_dummy_stream() with a TCP connection on the loopback */
+static RedStream *create_tcp_stream(SpiceServer *server, int *p_socket)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    socklen_t addr_len = sizeof(addr);
+    int listen_socket, client_socket, server_socket;
+
+    listen_socket = socket(AF_INET, SOCK_STREAM, 0);
+    g_assert_cmpint(listen_socket, >=, 0);
+    g_assert_cmpint(bind(listen_socket, (struct sockaddr *) &addr, addr_len), ==, 0);
+    g_assert_cmpint(listen(listen_socket, 1), ==, 0);
+    g_assert_cmpint(getsockname(listen_socket, (struct sockaddr *) &addr, &addr_len), ==, 0);
+
+    client_socket = socket(AF_INET, SOCK_STREAM, 0);
+    g_assert_cmpint(client_socket, >=, 0);
+    g_assert_cmpint(connect(client_socket, (struct sockaddr *) &addr, addr_len), ==, 0);
+    server_socket = accept(listen_socket, NULL, NULL);
+    g_assert_cmpint(server_socket, >=, 0);
+    close(listen_socket);
+
+    *p_socket = client_socket;
+    red_socket_set_non_blocking(server_socket, true);
+    red_socket_set_non_blocking(client_socket, true);
+
+    RedStream * stream = red_stream_new(server, server_socket);
+    g_assert_nonnull(stream);
+
+    return stream;
+}
+
+static void test_client_connect(TestFixture *fixture, TestClient *test_client)
+{
+    RedChannelCapabilities caps;
+    memset(&caps, 0, sizeof(caps));
+    uint32_t common_caps = 1 << SPICE_COMMON_CAP_MINI_HEADER;
+    caps.num_common_caps = 1;
+    caps.common_caps = spice_memdup(&common_caps, sizeof(common_caps));
+
+    test_client->client = red_client_new(fixture->server, FALSE);
+    g_assert_nonnull(test_client->client);
+
+    MainChannelClient *mcc;
+    mcc = main_channel_link(fixture->main_channel, test_client->client,
+                            create_dummy_stream(fixture->server, NULL),
+                            0, FALSE, &caps);
+    g_assert_nonnull(mcc);
+    red_client_set_main(test_client->client, mcc);
+
+    red_channel_connect(fixture->channel, test_client->client,
+                        fixture->tcp ?
+                            create_tcp_stream(fixture->server, &test_client->client_socket) :
+                            create_dummy_stream(fixture->server, &test_client->client_socket),
+                        FALSE, &caps);
+    red_channel_capabilities_reset(&caps);
+
+    // the new client is the first one of the channel
+    GList *clients = red_channel_get_clients(fixture->channel);
+    g_assert_nonnull(clients);
+    test_client->rcc = g_object_ref(clients->data);
+    g_assert_true(red_channel_client_get_client(test_client->rcc) == test_client->client);
+}
+
+static void test_client_destroy(TestClient *test_client)
+{
+    g_object_unref(test_client->rcc);
+    red_client_destroy(test_client->client);
+    close(test_client->client_socket);
+}
+
+static void fixture_setup_full(TestFixture *fixture, bool tcp)
+{
+    TestClient test_client;
+
+    memset(fixture, 0, sizeof(*fixture));
+    fixture->tcp = tcp;
+    fixture->server = spice_server_new();
+    g_assert_nonnull(fixture->server);
+
+    fixture->core = basic_event_loop_init();
+    g_assert_nonnull(fixture->core);
+
+    g_assert_cmpint(spice_server_init(fixture->server, fixture->core), ==, 0);
+
+    fixture->channel =
+        g_object_new(RED_TYPE_TEST_CHANNEL,
+                     "spice-server", fixture->server,
+                     "core-interface", reds_get_core_interface(fixture->server),
+                     "channel-type", SPICE_CHANNEL_PORT,
+                     "id", 0,
+                     "handle-acks", FALSE,
+                     NULL);
+
+    fixture->main_channel = main_channel_new(fixture->server);
+    g_assert_nonnull(fixture->main_channel);
+
+    test_client_connect(fixture, &test_client);
+    fixture->client = test_client.client;
+    fixture->rcc = test_client.rcc;
+    fixture->client_socket = test_client.client_socket;
+}
+
+static void fixture_setup(TestFixture *fixture)
+{
+    fixture_setup_full(fixture, false);
+}
+
+/* connect a second client to the channel */
+static void fixture_add_client(TestFixture *fixture)
+{
+    test_client_connect(fixture, &fixture->other);
+    g_assert_cmpuint(g_list_length(red_channel_get_clients(fixture->channel)), ==, 2);
+}
+
+static void fixture_teardown(TestFixture *fixture)
+{
+    if (fixture->other.client) {
+        test_client_destroy(&fixture->other);
+    }
+    g_object_unref(fixture->rcc);
+    red_client_destroy(fixture->client);
+    g_object_unref(fixture->main_channel);
+    g_object_unref(fixture->channel);
+    close(fixture->client_socket);
+
+    spice_server_destroy(fixture->server);
+
+    basic_event_loop_destroy();
+}
+
+static RedPipeItem *test_item_new_full(uint32_t size_hint, uint8_t value)
+{
+    TestPipeItem *item = g_new(TestPipeItem, 1);
+
+    red_pipe_item_init(&item->base, RED_PIPE_ITEM_TYPE_TEST);
+    item->base.size_hint = size_hint;
+    item->value = value;
+    return &item->base;
+}
+
+static RedPipeItem *test_item_new(uint32_t size_hint)
+{
+    return test_item_new_full(size_hint, 0);
+}
+
+/* append to @data what is available on the client side of the connection */
+static void read_client_socket(int fd, GByteArray *data)
+{
+    uint8_t buffer[16 * 1024];
+    ssize_t len;
+
+    while ((len = socket_read(fd, buffer, sizeof(buffer))) > 0) {
+        g_byte_array_append(data, buffer, len);
+    }
+}
+
+/* Return the items of the pipe of @rcc, from the first one to be sent */
+static GList *get_pipe_items(RedChannelClient *rcc)
+{
+    GList *items = NULL;
+    GList *l;
+
+    for (l = red_channel_client_get_pipe(rcc)->head; l != NULL; l = l->next) {
+        items = g_list_prepend(items, l->data);
+    }
+    return items;
+}
+
+/* An item queued to several clients has a position in each pipe, which are
+ * found and removed independently */
+static void test_pipe_shared_items(void)
+{
+    TestFixture fixture;
+    RedChannelClient *rcc, *other;
+    RedPipeItem *shared, *first, *after;
+    GList *items;
+
+    fixture_setup(&fixture);
+    fixture_add_client(&fixture);
+    rcc = fixture.rcc;
+    other = fixture.other.rcc;
+
+    shared = test_item_new(100);
+    first = test_item_new(100);
+    g_assert_false(red_channel_client_pipe_item_is_linked(rcc, shared));
+
+    red_channel_client_pipe_add(rcc, red_pipe_item_ref(first));
+    red_channel_client_pipe_add(other, red_pipe_item_ref(first));
+    red_channel_pipes_add(fixture.channel, red_pipe_item_ref(shared));
+    g_assert_true(red_channel_client_pipe_item_is_linked(rcc, shared));
+    g_assert_true(red_channel_client_pipe_item_is_linked(other, shared));
+
+    // the position of the item in the second pipe is found
+    after = test_item_new(100);
+    red_channel_client_pipe_add_after(other, after, shared);
+    items = get_pipe_items(other);
+    g_assert_true(g_list_nth_data(items, 0) == first);
+    g_assert_true(g_list_nth_data(items, 1) == after);
+    g_assert_true(g_list_nth_data(items, 2) == shared);
+    g_list_free(items);
+    g_assert_false(red_channel_client_pipe_item_is_linked(rcc, after));
+
+    // removing the item from the first pipe leaves the second one untouched
+    red_channel_client_pipe_remove_and_release(rcc, shared);
+    g_assert_false(red_channel_client_pipe_item_is_linked(rcc, shared));
+    g_assert_true(red_channel_client_pipe_item_is_linked(other, shared));
+    g_assert_cmpuint(red_channel_client_get_pipe_size(rcc), ==, 1);
+    g_assert_cmpuint(red_channel_client_get_pipe_size(other), ==, 3);
+
+    // queued again, the item uses the position released by the first pipe
+    red_channel_client_pipe_add_tail(rcc, red_pipe_item_ref(shared));
+    g_assert_true(red_channel_client_pipe_item_is_linked(rcc, shared));
+    red_channel_client_pipe_remove_and_release(other, shared);
+    g_assert_true(red_channel_client_pipe_item_is_linked(rcc, shared));
+    g_assert_false(red_channel_client_pipe_item_is_linked(other, shared));
+
+    // sending the pipes releases all the positions
+    red_channel_client_push(rcc);
+    red_channel_client_push(other);
+    g_assert_true(red_channel_client_pipe_is_empty(rcc));
+    g_assert_true(red_channel_client_pipe_is_empty(other));
+    g_assert_false(red_channel_client_pipe_item_is_linked(rcc, shared));
+    g_assert_false(red_channel_client_pipe_item_is_linked(rcc, first));
+    g_assert_false(red_channel_client_pipe_item_is_linked(other, first));
+    g_assert_cmpint(shared->refcount, ==, 1);
+    g_assert_cmpint(first->refcount, ==, 1);
+
+    red_pipe_item_unref(shared);
+    red_pipe_item_unref(first);
+    fixture_teardown(&fixture);
+}
+
+/* the items count for their size hint, small ones for a minimum size */
+static void test_pipe_bytes_estimation(void)
+{
+    TestFixture fixture;
+    RedChannelClient *rcc;
+    RedPipeItem *small, *large;
+
+    fixture_setup(&fixture);
+    rcc = fixture.rcc;
+    g_assert_cmpuint(red_channel_client_get_pipe_bytes(rcc), ==, 0);
+
+    small = test_item_new(10);
+    red_channel_client_pipe_add(rcc, red_pipe_item_ref(small));
+    g_assert_cmpuint(red_channel_client_get_pipe_bytes(rcc), ==, PIPE_ITEM_MIN_SIZE);
+
+    large = test_item_new(100000);
+    red_channel_client_pipe_add_tail(rcc, red_pipe_item_ref(large));
+    g_assert_cmpuint(red_channel_client_get_pipe_bytes(rcc), ==,
+                     PIPE_ITEM_MIN_SIZE + 100000);
+
+    red_channel_client_pipe_remove_and_release(rcc, small);
+    g_assert_cmpuint(red_channel_client_get_pipe_bytes(rcc), ==, 100000);
+    red_channel_client_pipe_remove_and_release(rcc, large);
+    g_assert_cmpuint(red_channel_client_get_pipe_bytes(rcc), ==, 0);
+    g_assert_true(red_channel_client_pipe_is_empty(rcc));
+
+    red_pipe_item_unref(small);
+    red_pipe_item_unref(large);
+    fixture_teardown(&fixture);
+}
+
+/* without a bandwidth measurement the pipe is full when the queued items
+ * exceed the default limit, long before the maximum number of items */
+static void test_pipe_bytes_limit(void)
+{
+    const uint32_t item_size = 64 * 1024;
+    TestFixture fixture;
+    RedChannelClient *rcc;
+    unsigned int n;
+
+    fixture_setup(&fixture);
+    rcc = fixture.rcc;
+    g_assert_cmpuint(red_channel_client_get_pipe_bytes_limit(rcc), ==, PIPE_BYTES_DEFAULT);
+
+    for (n = 0; !red_channel_client_pipe_is_full(rcc); n++) {
+        g_assert_cmpuint(red_channel_client_get_pipe_bytes(rcc), <=, PIPE_BYTES_DEFAULT);
+        red_channel_client_pipe_add(rcc, test_item_new(item_size));
+    }
+    g_assert_cmpuint(n, ==, PIPE_BYTES_DEFAULT / item_size + 1);
+    g_assert_cmpuint(red_channel_client_get_pipe_size(rcc), ==, n);
+    g_assert_cmpuint(red_channel_client_get_pipe_bytes(rcc), >, PIPE_BYTES_DEFAULT);
+    g_assert_true(red_channel_any_pipe_full(fixture.channel));
+
+    /* the clients which are parked do not block their channel */
+    red_channel_client_set_parked(rcc, TRUE);
+    g_assert_false(red_channel_any_pipe_full(fixture.channel));
+    red_channel_client_set_parked(rcc, FALSE);
+
+    fixture_teardown(&fixture);
+}
+
+/* a client is slow only once its pipe stayed full for the grace time, a
+ * pipe which drains in the meantime starts over */
+static void test_pipe_slow_client(void)
+{
+    const uint64_t grace_time = 50 * NSEC_PER_MILLISEC;
+    TestFixture fixture;
+    RedChannelClient *rcc;
+    RedPipeItem *last = NULL;
+
+    fixture_setup(&fixture);
+    rcc = fixture.rcc;
+
+    while (!red_channel_client_pipe_is_full(rcc)) {
+        last = test_item_new(64 * 1024);
+        red_channel_client_pipe_add_tail(rcc, red_pipe_item_ref(last));
+    }
+    g_assert_false(red_channel_client_is_slow(rcc, grace_time));
+    g_usleep(60 * 1000);
+    g_assert_true(red_channel_client_is_slow(rcc, grace_time));
+
+    red_channel_client_pipe_remove_and_release(rcc, last);
+    g_assert_false(red_channel_client_pipe_is_full(rcc));
+    red_channel_client_pipe_add_tail(rcc, last);
+    g_assert_true(red_channel_client_pipe_is_full(rcc));
+    g_assert_false(red_channel_client_is_slow(rcc, grace_time));
+
+    fixture_teardown(&fixture);
+}
+
+/* the bytes are released when the items are sent */
+static void test_pipe_bytes_release_on_send(void)
+{
+    TestFixture fixture;
+    RedChannelClient *rcc;
+    GByteArray *data = g_byte_array_new();
+    int i;
+
+    fixture_setup(&fixture);
+    rcc = fixture.rcc;
+
+    for (i = 0; i < 4; i++) {
+        red_channel_client_pipe_add(rcc, test_item_new(1000));
+    }
+    g_assert_cmpuint(red_channel_client_get_pipe_bytes(rcc), ==, 4000);
+
+    red_channel_client_push(rcc);
+    g_assert_true(red_channel_client_pipe_is_empty(rcc));
+    g_assert_cmpuint(red_channel_client_get_pipe_bytes(rcc), ==, 0);
+    read_client_socket(fixture.client_socket, data);
+    g_assert_cmpuint(data->len, >=, 4000);
+    g_byte_array_free(data, TRUE);
+
+    fixture_teardown(&fixture);
+}
+
+/* the bytes are released when the pipe is cleared on disconnection */
+static void test_pipe_bytes_release_on_clear(void)
+{
+    TestFixture fixture;
+    RedChannelClient *rcc;
+    int i;
+
+    fixture_setup(&fixture);
+    rcc = fixture.rcc;
+
+    for (i = 0; i < 4; i++) {
+        red_channel_client_pipe_add(rcc, test_item_new(1000));
+    }
+    g_assert_cmpuint(red_channel_client_get_pipe_bytes(rcc), ==, 4000);
+
+    red_channel_client_disconnect(rcc);
+    g_assert_true(red_channel_client_pipe_is_empty(rcc));
+    g_assert_cmpuint(red_channel_client_get_pipe_bytes(rcc), ==, 0);
+
+    fixture_teardown(&fixture);
+}
+
+/* The messages are batched and written through small socket buffers so
+ * that the writes stop in the middle of the batches and of the large
+ * messages. All the messages must be received complete and in order */
+static void test_batch_partial_writes(void)
+{
+    static const uint32_t sizes[] = { 10, 3000, 0, 100, 70000, 20, 1 };
+    const unsigned int num_items = 200;
+    TestFixture fixture;
+    RedChannelClient *rcc;
+    GByteArray *data = g_byte_array_new();
+    bool was_blocked = false;
+    unsigned int i, iterations;
+    int buf_size = 4096;
+    size_t expected_len = 0;
+    size_t pos;
+    int fd;
+
+    fixture_setup(&fixture);
+    rcc = fixture.rcc;
+    fd = red_channel_client_get_stream(rcc)->socket;
+    g_assert_cmpint(setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buf_size, sizeof(buf_size)), ==, 0);
+    g_assert_cmpint(setsockopt(fixture.client_socket, SOL_SOCKET, SO_RCVBUF,
+                               &buf_size, sizeof(buf_size)), ==, 0);
+
+    for (i = 0; i < num_items; i++) {
+        uint32_t size = sizes[i % G_N_ELEMENTS(sizes)];
+
+        red_channel_client_pipe_add(rcc, test_item_new_full(size, i));
+        expected_len += 6 + size;
+    }
+
+    // each iteration writes what the socket buffers accept
+    for (iterations = 0; data->len < expected_len; iterations++) {
+        struct pollfd pfd = { .fd = fixture.client_socket, .events = POLLIN };
+
+        g_assert_cmpuint(iterations, <, 100000);
+        red_channel_client_push(rcc);
+        was_blocked = was_blocked || red_channel_client_is_blocked(rcc);
+        g_assert_cmpint(poll(&pfd, 1, 1000), ==, 1);
+        read_client_socket(fixture.client_socket, data);
+    }
+    g_assert_true(was_blocked);
+    g_assert_true(red_channel_client_pipe_is_empty(rcc));
+    g_assert_true(red_channel_client_no_item_being_sent(rcc));
+    g_assert_cmpuint(data->len, ==, expected_len);
+
+    // check the mini headers and the payloads
+    for (i = 0, pos = 0; i < num_items; i++) {
+        uint32_t size = sizes[i % G_N_ELEMENTS(sizes)];
+        uint16_t type;
+        uint32_t msg_size;
+        uint32_t j;
+
+        memcpy(&type, data->data + pos, sizeof(type));
+        memcpy(&msg_size, data->data + pos + 2, sizeof(msg_size));
+        g_assert_cmpuint(GUINT16_FROM_LE(type), ==, SPICE_MSG_MIGRATE_DATA);
+        g_assert_cmpuint(GUINT32_FROM_LE(msg_size), ==, size);
+        pos += 6;
+        for (j = 0; j < size; j++) {
+            if (data->data[pos + j] != (uint8_t) i) {
+                g_assert_cmpuint(data->data[pos + j], ==, (uint8_t) i);
+            }
+        }
+        pos += size;
+    }
+
+    g_byte_array_free(data, TRUE);
+    fixture_teardown(&fixture);
+}
+
+/* must match CLIENT_ACK_WINDOW in red-channel-client.c */
+#define ACK_WINDOW 20
+
+/* The client acks the window, the channel not handling the acks the
+ * generation is still 0 */
+static void client_send_ack(TestFixture *fixture)
+{
+    uint8_t msgs[6 + 4 + 6];
+    uint16_t type;
+    uint32_t size, generation = 0;
+
+    type = GUINT16_TO_LE(SPICE_MSGC_ACK_SYNC);
+    size = GUINT32_TO_LE(sizeof(generation));
+    memcpy(msgs, &type, sizeof(type));
+    memcpy(msgs + 2, &size, sizeof(size));
+    memcpy(msgs + 6, &generation, sizeof(generation));
+    type = GUINT16_TO_LE(SPICE_MSGC_ACK);
+    size = 0;
+    memcpy(msgs + 10, &type, sizeof(type));
+    memcpy(msgs + 12, &size, sizeof(size));
+    g_assert_cmpint(socket_write(fixture->client_socket, msgs, sizeof(msgs)), ==, sizeof(msgs));
+
+    red_channel_client_receive(fixture->rcc);
+}
+
+/* Send a window of messages, the last one of @last_size bytes */
+static void send_window(TestFixture *fixture, uint32_t last_size)
+{
+    unsigned int i;
+
+    for (i = 1; i < ACK_WINDOW; i++) {
+        red_channel_client_pipe_add(fixture->rcc, test_item_new(10));
+    }
+    red_channel_client_pipe_add_push(fixture->rcc, test_item_new(last_size));
+}
+
+/* Read on the client side till @data has @expected_len bytes */
+static void client_read_all(TestFixture *fixture, GByteArray *data, size_t expected_len)
+{
+    unsigned int iterations;
+
+    for (iterations = 0; data->len < expected_len; iterations++) {
+        struct pollfd pfd = { .fd = fixture->client_socket, .events = POLLIN };
+
+        g_assert_cmpuint(iterations, <, 100000);
+        red_channel_client_push(fixture->rcc);
+        g_assert_cmpint(poll(&pfd, 1, 1000), ==, 1);
+        read_client_socket(fixture->client_socket, data);
+    }
+    g_assert_cmpuint(data->len, ==, expected_len);
+    g_assert_true(red_channel_client_pipe_is_empty(fixture->rcc));
+}
+
+/* The roundtrip of an ack window starts when its last message is written,
+ * not when it is marshalled and waits for the socket */
+static void test_roundtrip_ack_write_time(void)
+{
+    const uint32_t last_size = 1024 * 1024;
+    TestFixture fixture;
+    GByteArray *data = g_byte_array_new();
+    int buf_size = 4096;
+    int fd;
+
+    fixture_setup(&fixture);
+    fd = red_channel_client_get_stream(fixture.rcc)->socket;
+    g_assert_cmpint(setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buf_size, sizeof(buf_size)), ==, 0);
+    g_assert_cmpint(setsockopt(fixture.client_socket, SOL_SOCKET, SO_RCVBUF,
+                               &buf_size, sizeof(buf_size)), ==, 0);
+    red_channel_client_init_outgoing_messages_window(fixture.rcc);
+    g_assert_cmpint(red_channel_client_get_roundtrip_ms(fixture.rcc), ==, -1);
+
+    // the last message is marshalled but blocked in the socket
+    send_window(&fixture, last_size);
+    g_assert_true(red_channel_client_pipe_is_empty(fixture.rcc));
+    g_assert_true(red_channel_client_is_blocked(fixture.rcc));
+    g_usleep(300 * 1000);
+
+    client_read_all(&fixture, data, (ACK_WINDOW - 1) * (6 + 10) + 6 + last_size);
+    client_send_ack(&fixture);
+    g_assert_cmpint(red_channel_client_get_roundtrip_ms(fixture.rcc), >=, 0);
+    g_assert_cmpint(red_channel_client_get_roundtrip_ms(fixture.rcc), <, 150);
+
+    g_byte_array_free(data, TRUE);
+    fixture_teardown(&fixture);
+}
+
+/* A single slow ack only moves the roundtrip by 1/8 of the difference */
+static void test_roundtrip_ack_smoothing(void)
+{
+    const size_t window_len = ACK_WINDOW * (6 + 10);
+    TestFixture fixture;
+    GByteArray *data = g_byte_array_new();
+    int fast, slow, recovered;
+
+    fixture_setup(&fixture);
+    red_channel_client_init_outgoing_messages_window(fixture.rcc);
+
+    send_window(&fixture, 10);
+    client_read_all(&fixture, data, window_len);
+    client_send_ack(&fixture);
+    fast = red_channel_client_get_roundtrip_ms(fixture.rcc);
+    g_assert_cmpint(fast, >=, 0);
+    g_assert_cmpint(fast, <, 50);
+
+    send_window(&fixture, 10);
+    client_read_all(&fixture, data, 2 * window_len);
+    g_usleep(400 * 1000);
+    client_send_ack(&fixture);
+    slow = red_channel_client_get_roundtrip_ms(fixture.rcc);
+    g_assert_cmpint(slow, >=, 400 / 8);
+    g_assert_cmpint(slow, <, 400 / 2);
+
+    send_window(&fixture, 10);
+    client_read_all(&fixture, data, 3 * window_len);
+    client_send_ack(&fixture);
+    recovered = red_channel_client_get_roundtrip_ms(fixture.rcc);
+    g_assert_cmpint(recovered, <, slow);
+    g_assert_cmpint(recovered, >=, slow * 7 / 8 - 1);
+
+    g_byte_array_free(data, TRUE);
+    fixture_teardown(&fixture);
+}
+
+static bool socket_has_error(int fd)
+{
+    struct pollfd pfd = { .fd = fd, .events = 0 };
+
+    return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLERR);
+}
+
+/* The zerocopy writes completed while the message is still being written
+ * have no data held but their notifications must be read, the error queue
+ * of the socket would otherwise wake up the event loop forever */
+static void test_zerocopy_blocked_write(void)
+{
+    TestFixture fixture;
+    RedChannelClient *rcc;
+    RedStream *stream;
+    GByteArray *data = g_byte_array_new();
+    int buf_size = 4096;
+    unsigned int iterations;
+
+    fixture_setup_full(&fixture, true);
+    rcc = fixture.rcc;
+    stream = red_channel_client_get_stream(rcc);
+    if (!red_stream_enable_zerocopy(stream, 1)) {
+        g_test_skip("zerocopy not supported");
+        goto cleanup;
+    }
+    g_assert_cmpint(setsockopt(stream->socket, SOL_SOCKET, SO_SNDBUF,
+                               &buf_size, sizeof(buf_size)), ==, 0);
+    g_assert_cmpint(setsockopt(fixture.client_socket, SOL_SOCKET, SO_RCVBUF,
+                               &buf_size, sizeof(buf_size)), ==, 0);
+
+    // the message is too large to be written at once
+    red_channel_client_pipe_add_push(rcc, test_item_new(1024 * 1024));
+    g_assert_true(red_channel_client_is_blocked(rcc));
+    g_assert_cmpuint(red_stream_zerocopy_sent(stream), >, 0);
+
+    // the client reads till the kernel completes some of the writes
+    for (iterations = 0; !socket_has_error(stream->socket); iterations++) {
+        struct pollfd pfd = { .fd = fixture.client_socket, .events = POLLIN };
+
+        g_assert_cmpuint(iterations, <, 1000);
+        g_assert_cmpint(poll(&pfd, 1, 1000), ==, 1);
+        read_client_socket(fixture.client_socket, data);
+    }
+    g_assert_cmpuint(data->len, <, 1024 * 1024);
+
+    // the event handler reads the notifications
+    g_main_context_iteration(basic_event_loop_get_context(), FALSE);
+    g_assert_false(socket_has_error(stream->socket));
+    g_assert_cmpuint(red_stream_zerocopy_completed(stream), >, 0);
+
+cleanup:
+    g_byte_array_free(data, TRUE);
+    fixture_teardown(&fixture);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/channel-client/pipe-shared-items", test_pipe_shared_items);
+    g_test_add_func("/server/channel-client/pipe-bytes/estimation",
+                    test_pipe_bytes_estimation);
+    g_test_add_func("/server/channel-client/pipe-bytes/limit", test_pipe_bytes_limit);
+    g_test_add_func("/server/channel-client/pipe-bytes/slow-client", test_pipe_slow_client);
+    g_test_add_func("/server/channel-client/pipe-bytes/release-on-send",
+                    test_pipe_bytes_release_on_send);
+    g_test_add_func("/server/channel-client/pipe-bytes/release-on-clear",
+                    test_pipe_bytes_release_on_clear);
+    g_test_add_func("/server/channel-client/batch-partial-writes",
+                    test_batch_partial_writes);
+    g_test_add_func("/server/channel-client/roundtrip/ack-write-time",
+                    test_roundtrip_ack_write_time);
+    g_test_add_func("/server/channel-client/roundtrip/ack-smoothing",
+                    test_roundtrip_ack_smoothing);
+    g_test_add_func("/server/channel-client/zerocopy-blocked-write",
+                    test_zerocopy_blocked_write);
+
+    return g_test_run();
+}
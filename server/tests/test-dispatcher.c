@@ -0,0 +1,154 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 agent <agent@local>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/* Test Dispatcher message passing between threads.
+ * Several senders send messages, some requiring an ACK, checking that all
+ * messages are received in order and with correct content.
+ */
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "test-glib-compat.h"
+#include "dispatcher.h"
+
+#define NUM_SENDERS 3
+#define NUM_MESSAGES 20000
+#define BIG_PAYLOAD_SIZE 4096
+
+enum {
+    MESSAGE_NO_ACK,
+    MESSAGE_ACK,
+
+    MESSAGE_COUNT
+};
+
+typedef struct {
+    uint32_t sender;
+    uint32_t seq;
+} Message;
+
+typedef struct {
+    uint32_t sender;
+    uint32_t seq;
+    uint8_t data[BIG_PAYLOAD_SIZE];
+} BigMessage;
+
+static Dispatcher *dispatcher;
+static uint32_t next_seq[NUM_SENDERS];
+static unsigned received;
+
+static void check_message(uint32_t sender, uint32_t seq)
+{
+    g_assert_cmpuint(sender, <, NUM_SENDERS);
+    g_assert_cmpuint(seq, ==, next_seq[sender]);
+    next_seq[sender]++;
+    received++;
+}
+
+static void handle_message(void *opaque, void *payload)
+{
+    Message *msg = payload;
+
+    g_assert(opaque == &received);
+    check_message(msg->sender, msg->seq);
+}
+
+static void handle_big_message(void *opaque, void *payload)
+{
+    BigMessage *msg = payload;
+    int i;
+
+    for (i = 0; i < BIG_PAYLOAD_SIZE; i++) {
+        g_assert_cmpuint(msg->data[i], ==, (uint8_t) (msg->seq + i));
+    }
+    check_message(msg->sender, msg->seq);
+}
+
+static void *sender_thread(void *arg)
+{
+    uint32_t sender = GPOINTER_TO_UINT(arg);
+    BigMessage *big = g_new0(BigMessage, 1);
+    uint32_t seq;
+    int i;
+
+    for (seq = 0; seq < NUM_MESSAGES; seq++) {
+        if (seq % 100 == 50) {
+            big->sender = sender;
+            big->seq = seq;
+            for (i = 0; i < BIG_PAYLOAD_SIZE; i++) {
+                big->data[i] = seq + i;
+            }
+            dispatcher_send_message_custom(dispatcher, handle_big_message,
+                                           big, sizeof(*big), seq % 200 == 50);
+        } else {
+            Message msg = { sender, seq };
+            dispatcher_send_message(dispatcher,
+                                    seq % 37 == 0 ? MESSAGE_ACK : MESSAGE_NO_ACK, &msg);
+        }
+    }
+    g_free(big);
+    return NULL;
+}
+
+static void test_dispatcher(void)
+{
+    SpiceCoreInterfaceInternal core = event_loop_core;
+    pthread_t threads[NUM_SENDERS];
+    SpiceWatch *watch;
+    int i;
+
+    core.main_context = g_main_context_new();
+
+    dispatcher = dispatcher_new(MESSAGE_COUNT);
+    dispatcher_set_opaque(dispatcher, &received);
+    dispatcher_register_handler(dispatcher, MESSAGE_NO_ACK, handle_message,
+                                sizeof(Message), false);
+    dispatcher_register_handler(dispatcher, MESSAGE_ACK, handle_message,
+                                sizeof(Message), true);
+    watch = dispatcher_create_watch(dispatcher, &core);
+    g_assert_nonnull(watch);
+
+    for (i = 0; i < NUM_SENDERS; i++) {
+        g_assert_cmpint(pthread_create(&threads[i], NULL, sender_thread,
+                                       GUINT_TO_POINTER(i)), ==, 0);
+    }
+
+    while (received < NUM_SENDERS * NUM_MESSAGES) {
+        g_main_context_iteration(core.main_context, TRUE);
+    }
+
+    for (i = 0; i < NUM_SENDERS; i++) {
+        pthread_join(threads[i], NULL);
+        g_assert_cmpuint(next_seq[i], ==, NUM_MESSAGES);
+    }
+
+    core.watch_remove(&core, watch);
+    g_object_unref(dispatcher);
+    g_main_context_unref(core.main_context);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/dispatcher", test_dispatcher);
+
+    return g_test_run();
+}
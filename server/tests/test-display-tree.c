@@ -0,0 +1,285 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 agent <agent@local>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/* Test the spatial index of the display tree.
+ * The same sequence of synthetic drawables is processed with and without
+ * the index, the resulting surfaces must be identical.
+ * When run in performance mode (-m perf) the time spent processing the
+ * drawables is reported for both cases.
+ * Also test that the drawables memory budget is respected by rendering the
+ * older drawables.
+ */
+#include <config.h>
+
+#include <string.h>
+
+#include "test-glib-compat.h"
+#include "basic-event-loop.h"
+#include "reds.h"
+#include "display-channel.h"
+
+#define WIDTH 1024
+#define HEIGHT 768
+#define STRIDE (WIDTH * 4)
+#define SEED 0x5eed
+
+typedef struct {
+    SpiceCoreInterface *core;
+    SpiceServer *server;
+    QXLInstance qxl;
+    DisplayChannel *display;
+    uint32_t *surfaces[2];
+} Fixture;
+
+static void fixture_init(Fixture *fixture)
+{
+    GArray *video_codecs;
+    unsigned int i;
+
+    memset(fixture, 0, sizeof(*fixture));
+    fixture->core = basic_event_loop_init();
+    g_assert_nonnull(fixture->core);
+    fixture->server = spice_server_new();
+    g_assert_nonnull(fixture->server);
+    g_assert_cmpint(spice_server_init(fixture->server, fixture->core), ==, 0);
+
+    video_codecs = g_array_new(FALSE, FALSE, sizeof(RedVideoCodec));
+    fixture->display = display_channel_new(fixture->server, &fixture->qxl,
+                                           reds_get_core_interface(fixture->server),
+                                           NULL, FALSE, SPICE_STREAM_VIDEO_OFF,
+                                           video_codecs, G_N_ELEMENTS(fixture->surfaces));
+    g_array_unref(video_codecs);
+    g_assert_nonnull(fixture->display);
+
+    for (i = 0; i < G_N_ELEMENTS(fixture->surfaces); i++) {
+        fixture->surfaces[i] = g_new0(uint32_t, WIDTH * HEIGHT);
+        display_channel_create_surface(fixture->display, i, WIDTH, HEIGHT, STRIDE,
+                                       SPICE_SURFACE_FMT_32_xRGB, fixture->surfaces[i],
+                                       FALSE, FALSE);
+    }
+}
+
+static void fixture_destroy(Fixture *fixture)
+{
+    unsigned int i;
+
+    red_channel_destroy(RED_CHANNEL(fixture->display));
+    for (i = 0; i < G_N_ELEMENTS(fixture->surfaces); i++) {
+        g_free(fixture->surfaces[i]);
+    }
+    spice_server_destroy(fixture->server);
+    basic_event_loop_destroy();
+}
+
+/* Return a drawable filling a random rectangle, mostly small ones as
+ * usually produced by desktops, with some copy bits to get shadows */
+static RedDrawable *random_drawable(GRand *rand, uint32_t surface_id)
+{
+    RedDrawable *red_drawable = g_new0(RedDrawable, 1);
+    SpiceRect *bbox = &red_drawable->bbox;
+    int max_size = g_rand_int_range(rand, 0, 16) == 0 ? WIDTH / 2 : 64;
+    int width = g_rand_int_range(rand, 1, max_size);
+    int height = g_rand_int_range(rand, 1, max_size);
+
+    red_drawable->refs = 1;
+    red_drawable->surface_id = surface_id;
+    bbox->left = g_rand_int_range(rand, 0, WIDTH - width);
+    bbox->top = g_rand_int_range(rand, 0, HEIGHT - height);
+    bbox->right = bbox->left + width;
+    bbox->bottom = bbox->top + height;
+    red_drawable->clip.type = SPICE_CLIP_TYPE_NONE;
+    red_drawable->surface_deps[0] = -1;
+    red_drawable->surface_deps[1] = -1;
+    red_drawable->surface_deps[2] = -1;
+
+    if (g_rand_int_range(rand, 0, 32) == 0) {
+        red_drawable->type = QXL_COPY_BITS;
+        red_drawable->effect = QXL_EFFECT_OPAQUE;
+        red_drawable->u.copy_bits.src_pos.x = g_rand_int_range(rand, 0, WIDTH - width);
+        red_drawable->u.copy_bits.src_pos.y = g_rand_int_range(rand, 0, HEIGHT - height);
+        return red_drawable;
+    }
+
+    red_drawable->type = QXL_DRAW_FILL;
+    red_drawable->effect = g_rand_boolean(rand) ? QXL_EFFECT_OPAQUE : QXL_EFFECT_BLEND;
+    red_drawable->u.fill.brush.type = SPICE_BRUSH_TYPE_SOLID;
+    red_drawable->u.fill.brush.u.color = g_rand_int(rand) & 0xffffff;
+    red_drawable->u.fill.rop_descriptor = SPICE_ROPD_OP_PUT;
+    return red_drawable;
+}
+
+/* Process @count drawables on @surface_id and render them all, return the
+ * time spent in seconds */
+static double process_drawables(Fixture *fixture, uint32_t surface_id, bool tree_index,
+                                unsigned int count)
+{
+    const SpiceRect area = { .left = 0, .top = 0, .right = WIDTH, .bottom = HEIGHT };
+    GRand *rand = g_rand_new_with_seed(SEED);
+    GTimer *timer = g_timer_new();
+    double elapsed;
+    unsigned int i;
+
+    display_channel_set_tree_index(fixture->display, tree_index);
+    for (i = 0; i < count; i++) {
+        RedDrawable *red_drawable = random_drawable(rand, surface_id);
+
+        display_channel_process_draw(fixture->display, red_drawable, 0);
+        red_drawable_unref(red_drawable);
+    }
+    display_channel_draw(fixture->display, &area, surface_id);
+    elapsed = g_timer_elapsed(timer, NULL);
+
+    g_timer_destroy(timer);
+    g_rand_free(rand);
+    return elapsed;
+}
+
+/* Return a drawable filling the @index cell of a grid of 8x8 cells so that
+ * no drawable hides another and all stay in the tree until rendered */
+static RedDrawable *grid_drawable(unsigned int index, uint32_t surface_id)
+{
+    RedDrawable *red_drawable = g_new0(RedDrawable, 1);
+    SpiceRect *bbox = &red_drawable->bbox;
+
+    red_drawable->refs = 1;
+    red_drawable->surface_id = surface_id;
+    bbox->left = (index % (WIDTH / 8)) * 8;
+    bbox->top = (index / (WIDTH / 8)) * 8;
+    bbox->right = bbox->left + 8;
+    bbox->bottom = bbox->top + 8;
+    red_drawable->clip.type = SPICE_CLIP_TYPE_NONE;
+    red_drawable->surface_deps[0] = -1;
+    red_drawable->surface_deps[1] = -1;
+    red_drawable->surface_deps[2] = -1;
+    red_drawable->type = QXL_DRAW_FILL;
+    red_drawable->effect = QXL_EFFECT_OPAQUE;
+    red_drawable->u.fill.brush.type = SPICE_BRUSH_TYPE_SOLID;
+    red_drawable->u.fill.brush.u.color = (index * 0x10101) & 0xffffff;
+    red_drawable->u.fill.rop_descriptor = SPICE_ROPD_OP_PUT;
+    return red_drawable;
+}
+
+/* Process @count grid drawables on @surface_id without rendering them,
+ * return the number of drawables left in use */
+static uint32_t process_grid_drawables(Fixture *fixture, uint32_t surface_id,
+                                       unsigned int count)
+{
+    uint32_t used, peak;
+    unsigned int i;
+
+    g_assert_cmpuint(count, <=, (WIDTH / 8) * (HEIGHT / 8));
+    for (i = 0; i < count; i++) {
+        RedDrawable *red_drawable = grid_drawable(i, surface_id);
+
+        display_channel_process_draw(fixture->display, red_drawable, 0);
+        red_drawable_unref(red_drawable);
+    }
+    display_channel_get_drawables_count(fixture->display, &used, &peak);
+    return used;
+}
+
+/* Without rendering all the drawables the default budget allows about
+ * 1000 of them */
+static void test_display_tree_drawables_default(void)
+{
+    const SpiceRect area = { .left = 0, .top = 0, .right = WIDTH, .bottom = HEIGHT };
+    Fixture fixture;
+    uint32_t used, peak;
+
+    fixture_init(&fixture);
+
+    used = process_grid_drawables(&fixture, 0, 3000);
+    g_assert_cmpuint(used, >=, 1000);
+    g_assert_cmpuint(used, <, 1100);
+
+    display_channel_draw(fixture.display, &area, 0);
+    display_channel_get_drawables_count(fixture.display, &used, &peak);
+    g_assert_cmpuint(used, ==, 0);
+    g_assert_cmpuint(peak, <, 1100);
+
+    fixture_destroy(&fixture);
+}
+
+/* When the budget is exhausted the older drawables are rendered, the result
+ * must be the same as with a budget large enough for all the drawables */
+static void test_display_tree_drawables_budget(void)
+{
+    const SpiceRect area = { .left = 0, .top = 0, .right = WIDTH, .bottom = HEIGHT };
+    const unsigned int count = 3000;
+    Fixture fixture;
+    uint32_t used, small_used, peak;
+
+    fixture_init(&fixture);
+
+    /* the smallest budget still allows a slab of drawables */
+    display_channel_set_drawables_memory(fixture.display, 1);
+    small_used = process_grid_drawables(&fixture, 0, count);
+    g_assert_cmpuint(small_used, >, 0);
+    g_assert_cmpuint(small_used, <, 1000);
+    display_channel_get_drawables_count(fixture.display, &used, &peak);
+    g_assert_cmpuint(peak, ==, small_used);
+
+    display_channel_set_drawables_memory(fixture.display, 1024 * 1024 * 1024);
+    used = process_grid_drawables(&fixture, 1, count);
+    g_assert_cmpuint(used, ==, small_used + count);
+
+    display_channel_draw(fixture.display, &area, 0);
+    display_channel_draw(fixture.display, &area, 1);
+    display_channel_get_drawables_count(fixture.display, &used, &peak);
+    g_assert_cmpuint(used, ==, 0);
+    g_assert_cmpuint(peak, ==, small_used + count);
+    g_assert_cmpint(memcmp(fixture.surfaces[0], fixture.surfaces[1],
+                           WIDTH * HEIGHT * sizeof(uint32_t)), ==, 0);
+
+    fixture_destroy(&fixture);
+}
+
+static void test_display_tree_index(void)
+{
+    Fixture fixture;
+    unsigned int count = g_test_perf() ? 200000 : 5000;
+    double elapsed_no_index, elapsed_index;
+
+    fixture_init(&fixture);
+
+    elapsed_no_index = process_drawables(&fixture, 0, false, count);
+    elapsed_index = process_drawables(&fixture, 1, true, count);
+    g_assert_cmpint(memcmp(fixture.surfaces[0], fixture.surfaces[1],
+                           WIDTH * HEIGHT * sizeof(uint32_t)), ==, 0);
+
+    if (g_test_perf()) {
+        g_test_message("%u drawables: %.3f s without index, %.3f s with index",
+                       count, elapsed_no_index, elapsed_index);
+        g_test_minimized_result(elapsed_index, "processing time with index %.3f s",
+                                elapsed_index);
+    }
+
+    fixture_destroy(&fixture);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/display-tree/index", test_display_tree_index);
+    g_test_add_func("/server/display-tree/drawables-default",
+                    test_display_tree_drawables_default);
+    g_test_add_func("/server/display-tree/drawables-budget",
+                    test_display_tree_drawables_budget);
+
+    return g_test_run();
+}
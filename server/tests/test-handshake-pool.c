@@ -0,0 +1,167 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 agent <agent@local>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/* Test the handshake pool.
+ * The handshakes must run in the threads of the pool with their own main
+ * context, the ones still in progress when the pool is freed must be
+ * destroyed.
+ */
+#include <config.h>
+
+#include <string.h>
+
+#include "test-glib-compat.h"
+#include "handshake-pool.h"
+
+#define NUM_THREADS 3
+#define NUM_HANDSHAKES 30
+
+typedef struct {
+    HandshakePool *pool;
+    GMutex lock;
+    GCond cond;
+    unsigned int num_run;
+    unsigned int num_destroyed;
+    /* the core interfaces passed to the handshakes */
+    GHashTable *cores;
+} TestPool;
+
+typedef struct {
+    TestPool *test;
+    /* the handshake completes when run */
+    bool release;
+    bool destroyed;
+    const SpiceCoreInterfaceInternal *core;
+    SpiceTimer *timer;
+} TestHandshake;
+
+static void handshake_timeout(void *opaque)
+{
+    g_assert_not_reached();
+}
+
+static void handshake_run(SpiceCoreInterfaceInternal *core, void *opaque)
+{
+    TestHandshake *handshake = opaque;
+    TestPool *test = handshake->test;
+
+    /* the watches and timers of the handshake are handled by the thread */
+    g_assert_nonnull(core->main_context);
+    g_assert_true(g_main_context_is_owner(core->main_context));
+    g_assert_true(g_main_context_get_thread_default() == core->main_context);
+
+    if (handshake->release) {
+        handshake_pool_release(test->pool, handshake);
+    } else {
+        /* waiting for the client, the timer must be removed when the
+         * handshake is destroyed */
+        handshake->core = core;
+        handshake->timer = core->timer_add(core, handshake_timeout, handshake);
+        core->timer_start(core, handshake->timer, 60 * 1000);
+    }
+
+    g_mutex_lock(&test->lock);
+    g_hash_table_add(test->cores, core);
+    test->num_run++;
+    g_cond_signal(&test->cond);
+    g_mutex_unlock(&test->lock);
+}
+
+static void handshake_destroy(void *opaque)
+{
+    TestHandshake *handshake = opaque;
+
+    g_assert_false(handshake->release);
+    g_assert_false(handshake->destroyed);
+    handshake->core->timer_remove(handshake->core, handshake->timer);
+    handshake->destroyed = true;
+    handshake->test->num_destroyed++;
+}
+
+/* Run NUM_HANDSHAKES handshakes, the ones for which @in_progress returns
+ * true are not completed before the pool is freed */
+static void run_handshakes(bool (*in_progress)(unsigned int index))
+{
+    TestHandshake handshakes[NUM_HANDSHAKES];
+    TestPool test = { 0 };
+    unsigned int i, num_in_progress = 0;
+
+    g_mutex_init(&test.lock);
+    g_cond_init(&test.cond);
+    test.cores = g_hash_table_new(NULL, NULL);
+    test.pool = handshake_pool_new(NUM_THREADS);
+    g_assert_nonnull(test.pool);
+
+    for (i = 0; i < NUM_HANDSHAKES; i++) {
+        TestHandshake *handshake = &handshakes[i];
+
+        memset(handshake, 0, sizeof(*handshake));
+        handshake->test = &test;
+        handshake->release = !in_progress(i);
+        num_in_progress += !handshake->release;
+        handshake_pool_run(test.pool, handshake_run, handshake_destroy, handshake);
+    }
+
+    g_mutex_lock(&test.lock);
+    while (test.num_run < NUM_HANDSHAKES) {
+        g_cond_wait(&test.cond, &test.lock);
+    }
+    g_mutex_unlock(&test.lock);
+    /* the handshakes are spread between all the threads */
+    g_assert_cmpuint(g_hash_table_size(test.cores), ==, NUM_THREADS);
+
+    handshake_pool_free(test.pool);
+    g_assert_cmpuint(test.num_destroyed, ==, num_in_progress);
+    for (i = 0; i < NUM_HANDSHAKES; i++) {
+        g_assert_true(handshakes[i].destroyed == in_progress(i));
+    }
+
+    g_hash_table_unref(test.cores);
+    g_cond_clear(&test.cond);
+    g_mutex_clear(&test.lock);
+}
+
+static bool none_in_progress(unsigned int index)
+{
+    return false;
+}
+
+static bool some_in_progress(unsigned int index)
+{
+    return index % 3 == 1;
+}
+
+static void test_handshake_pool_run(void)
+{
+    run_handshakes(none_in_progress);
+}
+
+static void test_handshake_pool_free_in_progress(void)
+{
+    run_handshakes(some_in_progress);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/handshake-pool/run", test_handshake_pool_run);
+    g_test_add_func("/server/handshake-pool/free-in-progress",
+                    test_handshake_pool_free_in_progress);
+
+    return g_test_run();
+}
@@ -0,0 +1,175 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 agent <agent@local>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/* Test the cache of the images compressed for the clients */
+#include <config.h>
+
+#include <string.h>
+
+#include "test-glib-compat.h"
+#include "image-compress-cache.h"
+
+/* Return the result of a fake compression using @num_bufs buffers */
+static void fake_compress(SpiceImage *dest, compress_send_data_t *comp_data,
+                          unsigned int num_bufs)
+{
+    RedCompressBuf **next = &comp_data->comp_buf;
+    unsigned int i;
+
+    memset(comp_data, 0, sizeof(*comp_data));
+    for (i = 0; i < num_bufs; i++) {
+        *next = g_new0(RedCompressBuf, 1);
+        (*next)->buf.bytes[0] = i;
+        next = &(*next)->send_next;
+    }
+    comp_data->comp_buf_size = num_bufs * sizeof(comp_data->comp_buf->buf);
+    comp_data->is_lossy = TRUE;
+    dest->descriptor.type = SPICE_IMAGE_TYPE_JPEG;
+    dest->u.jpeg.data_size = comp_data->comp_buf_size;
+}
+
+static void init_key(ImageCompressCacheKey *key, const SpiceBitmap *bitmap, uint64_t id)
+{
+    memset(key, 0, sizeof(*key));
+    key->bitmap = bitmap;
+    key->image_id = id;
+    key->compression = SPICE_IMAGE_COMPRESSION_QUIC;
+    key->jpeg = TRUE;
+    key->jpeg_quality = 85;
+}
+
+static void test_compress_cache_lookup(void)
+{
+    ImageCompressCache cache;
+    ImageCompressCacheKey key, other_key;
+    SpiceBitmap bitmap, other_bitmap;
+    SpiceImage image, cached_image;
+    compress_send_data_t comp_data, cached_comp_data;
+    Ring owner;
+
+    image_compress_cache_init(&cache, 1024 * 1024);
+    ring_init(&owner);
+    init_key(&key, &bitmap, 1);
+
+    g_assert_false(image_compress_cache_lookup(&cache, &owner, &key,
+                                               &cached_image, &cached_comp_data));
+
+    fake_compress(&image, &comp_data, 2);
+    g_assert_true(image_compress_cache_add(&cache, &owner, &key, &image, &comp_data));
+    g_assert_nonnull(comp_data.cache_entry);
+    g_assert_cmpuint(cache.size, ==, 2 * sizeof(RedCompressBuf));
+
+    memset(&cached_image, 0, sizeof(cached_image));
+    memset(&cached_comp_data, 0, sizeof(cached_comp_data));
+    g_assert_true(image_compress_cache_lookup(&cache, &owner, &key,
+                                              &cached_image, &cached_comp_data));
+    g_assert_true(cached_comp_data.cache_entry == comp_data.cache_entry);
+    g_assert_true(cached_comp_data.comp_buf == comp_data.comp_buf);
+    g_assert_cmpuint(cached_comp_data.comp_buf_size, ==, comp_data.comp_buf_size);
+    g_assert_true(cached_comp_data.is_lossy);
+    g_assert_cmpint(cached_image.descriptor.type, ==, SPICE_IMAGE_TYPE_JPEG);
+    g_assert_cmpuint(cached_image.u.jpeg.data_size, ==, comp_data.comp_buf_size);
+    image_compress_cache_entry_unref(cached_comp_data.cache_entry);
+
+    // any difference in the key is a different image
+    other_key = key;
+    other_key.bitmap = &other_bitmap;
+    g_assert_false(image_compress_cache_lookup(&cache, &owner, &other_key,
+                                               &cached_image, &cached_comp_data));
+    other_key = key;
+    other_key.image_id = 2;
+    g_assert_false(image_compress_cache_lookup(&cache, &owner, &other_key,
+                                               &cached_image, &cached_comp_data));
+    other_key = key;
+    other_key.jpeg_quality = 50;
+    g_assert_false(image_compress_cache_lookup(&cache, &owner, &other_key,
+                                               &cached_image, &cached_comp_data));
+    other_key = key;
+    other_key.jpeg = FALSE;
+    g_assert_false(image_compress_cache_lookup(&cache, &owner, &other_key,
+                                               &cached_image, &cached_comp_data));
+
+    // the buffers are kept till the last reference is released
+    image_compress_cache_drop_owner(&cache, &owner);
+    g_assert_true(ring_is_empty(&owner));
+    g_assert_cmpuint(cache.size, ==, 0);
+    g_assert_cmpint(comp_data.comp_buf->send_next->buf.bytes[0], ==, 1);
+    image_compress_cache_entry_unref(comp_data.cache_entry);
+
+    image_compress_cache_clear(&cache);
+}
+
+static void test_compress_cache_eviction(void)
+{
+    ImageCompressCache cache;
+    ImageCompressCacheKey keys[3];
+    SpiceBitmap bitmaps[3];
+    Ring owners[3];
+    SpiceImage image;
+    compress_send_data_t comp_data;
+    unsigned int i;
+
+    image_compress_cache_init(&cache, 4 * sizeof(RedCompressBuf));
+    for (i = 0; i < G_N_ELEMENTS(owners); i++) {
+        ring_init(&owners[i]);
+        init_key(&keys[i], &bitmaps[i], i);
+        fake_compress(&image, &comp_data, 2);
+        g_assert_true(image_compress_cache_add(&cache, &owners[i], &keys[i],
+                                               &image, &comp_data));
+        image_compress_cache_entry_unref(comp_data.cache_entry);
+
+        // keep the first image used so the second one is evicted
+        if (i == 1) {
+            g_assert_true(image_compress_cache_lookup(&cache, &owners[0], &keys[0],
+                                                      &image, &comp_data));
+            image_compress_cache_entry_unref(comp_data.cache_entry);
+        }
+    }
+    g_assert_cmpuint(cache.size, ==, 4 * sizeof(RedCompressBuf));
+    g_assert_false(ring_is_empty(&owners[0]));
+    g_assert_true(ring_is_empty(&owners[1]));
+    g_assert_false(ring_is_empty(&owners[2]));
+
+    // images bigger than the cache are not kept
+    fake_compress(&image, &comp_data, 5);
+    g_assert_false(image_compress_cache_add(&cache, &owners[1], &keys[1], &image, &comp_data));
+    g_assert_null(comp_data.cache_entry);
+    g_assert_true(ring_is_empty(&owners[1]));
+    while (comp_data.comp_buf) {
+        RedCompressBuf *next = comp_data.comp_buf->send_next;
+        compress_buf_free(comp_data.comp_buf);
+        comp_data.comp_buf = next;
+    }
+
+    image_compress_cache_set_max_size(&cache, 2 * sizeof(RedCompressBuf));
+    g_assert_cmpuint(cache.size, ==, 2 * sizeof(RedCompressBuf));
+    g_assert_true(ring_is_empty(&owners[0]));
+
+    image_compress_cache_clear(&cache);
+    g_assert_cmpuint(cache.size, ==, 0);
+    g_assert_true(ring_is_empty(&owners[2]));
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/image-compress-cache/lookup", test_compress_cache_lookup);
+    g_test_add_func("/server/image-compress-cache/eviction", test_compress_cache_eviction);
+
+    return g_test_run();
+}
@@ -0,0 +1,171 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 agent <agent@local>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/* Test the image encoder pool.
+ * Images compressed by the pool must be identical to the ones compressed
+ * directly with the encoders.
+ */
+#include <config.h>
+
+#include <string.h>
+
+#include "test-glib-compat.h"
+#include "image-encoder-pool.h"
+
+#define WIDTH 256
+#define HEIGHT 256
+#define NUM_JOBS 16
+
+static uint32_t pixels[WIDTH * HEIGHT];
+
+static void fill_pixels(void)
+{
+    int x, y;
+
+    for (y = 0; y < HEIGHT; y++) {
+        for (x = 0; x < WIDTH; x++) {
+            pixels[y * WIDTH + x] = (x << 16) | (y << 8) | ((x ^ y) & 0xff);
+        }
+    }
+}
+
+static void init_bitmap(SpiceBitmap *bitmap)
+{
+    memset(bitmap, 0, sizeof(*bitmap));
+    bitmap->format = SPICE_BITMAP_FMT_32BIT;
+    bitmap->flags = SPICE_BITMAP_FLAGS_TOP_DOWN;
+    bitmap->x = WIDTH;
+    bitmap->y = HEIGHT;
+    bitmap->stride = WIDTH * 4;
+    bitmap->data = spice_chunks_new_linear((uint8_t *) pixels, sizeof(pixels));
+}
+
+static GByteArray *comp_data_to_bytes(const compress_send_data_t *comp_data)
+{
+    GByteArray *bytes = g_byte_array_new();
+    RedCompressBuf *buf = comp_data->comp_buf;
+    uint32_t left = comp_data->comp_buf_size;
+
+    while (left > 0) {
+        uint32_t n = MIN(left, sizeof(buf->buf.bytes));
+
+        g_assert_nonnull(buf);
+        g_byte_array_append(bytes, buf->buf.bytes, n);
+        left -= n;
+        buf = buf->send_next;
+    }
+    return bytes;
+}
+
+static void free_comp_data(compress_send_data_t *comp_data)
+{
+    RedCompressBuf *buf = comp_data->comp_buf;
+
+    while (buf) {
+        RedCompressBuf *next = buf->send_next;
+        compress_buf_free(buf);
+        buf = next;
+    }
+}
+
+static void test_compress(SpiceImageCompression compression)
+{
+    ImageEncoderSharedData shared_data;
+    ImageEncoders encoders;
+    ImageEncoderPool *pool;
+    ImageEncoderJob *jobs[NUM_JOBS];
+    SpiceBitmap bitmap;
+    SpiceImage image;
+    compress_send_data_t comp_data = { 0 };
+    GByteArray *expected;
+    int i;
+
+    fill_pixels();
+    init_bitmap(&bitmap);
+
+    image_encoder_shared_init(&shared_data);
+    image_encoders_init(&encoders, &shared_data);
+    if (compression == SPICE_IMAGE_COMPRESSION_QUIC) {
+        g_assert_true(image_encoders_compress_quic(&encoders, &image, &bitmap, &comp_data));
+    } else {
+        g_assert_true(image_encoders_compress_lz(&encoders, &image, &bitmap, &comp_data));
+    }
+    expected = comp_data_to_bytes(&comp_data);
+    free_comp_data(&comp_data);
+    image_encoders_free(&encoders);
+
+    pool = image_encoder_pool_new(4);
+    g_assert_nonnull(pool);
+
+    for (i = 0; i < NUM_JOBS; i++) {
+        jobs[i] = image_encoder_pool_submit(pool, &bitmap, compression, false, 85);
+        g_assert_nonnull(jobs[i]);
+        g_assert_true(image_encoder_job_matches(jobs[i], &bitmap, compression, false, 85));
+        // the quality only matters for JPEG
+        g_assert_true(image_encoder_job_matches(jobs[i], &bitmap, compression, false, 50));
+        g_assert_false(image_encoder_job_matches(jobs[i], &bitmap, compression, true, 85));
+    }
+
+    for (i = 0; i < NUM_JOBS; i++) {
+        ImageEncoderJobResult result;
+        SpiceImage pool_image;
+        compress_send_data_t pool_comp_data = { 0 };
+        GByteArray *bytes;
+
+        // drop some jobs, either still queued or already compressed
+        if (i % 4 == 3) {
+            image_encoder_job_cancel(jobs[i]);
+            continue;
+        }
+
+        result = image_encoder_job_take_result(jobs[i], &pool_image, &pool_comp_data);
+        if (result == IMAGE_ENCODER_JOB_NOT_DONE) {
+            continue;
+        }
+        g_assert_cmpint(result, ==, IMAGE_ENCODER_JOB_COMPRESSED);
+        g_assert_cmpint(pool_image.descriptor.type, ==, image.descriptor.type);
+        bytes = comp_data_to_bytes(&pool_comp_data);
+        g_assert_cmpuint(bytes->len, ==, expected->len);
+        g_assert_cmpint(memcmp(bytes->data, expected->data, bytes->len), ==, 0);
+        g_byte_array_unref(bytes);
+        free_comp_data(&pool_comp_data);
+    }
+
+    image_encoder_pool_free(pool);
+    g_byte_array_unref(expected);
+    spice_chunks_destroy(bitmap.data);
+}
+
+static void test_compress_quic(void)
+{
+    test_compress(SPICE_IMAGE_COMPRESSION_QUIC);
+}
+
+static void test_compress_lz(void)
+{
+    test_compress(SPICE_IMAGE_COMPRESSION_LZ);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/image-encoder-pool/quic", test_compress_quic);
+    g_test_add_func("/server/image-encoder-pool/lz", test_compress_lz);
+
+    return g_test_run();
+}
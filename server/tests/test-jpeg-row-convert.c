@@ -0,0 +1,159 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 agent <agent@local>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/* Test the implementations of the line conversions of the JPEG encoders.
+ * The vectorized implementations must give the same lines as the scalar one
+ * for all the widths, without writing past the end of the lines.
+ * When run in performance mode (-m perf) the time taken by each
+ * implementation on a full HD frame is reported.
+ */
+#include <config.h>
+
+#include <string.h>
+
+#include "test-glib-compat.h"
+#include "jpeg-encoder.h"
+
+#define MAX_WIDTH 200
+#define CANARY 0xa5
+
+static const char *const impl_names[] = {
+    [JPEG_ROW_CONVERT_IMPL_AUTO] = "auto",
+    [JPEG_ROW_CONVERT_IMPL_SCALAR] = "scalar",
+    [JPEG_ROW_CONVERT_IMPL_SSSE3] = "ssse3",
+};
+
+static const struct {
+    JpegEncoderImageType type;
+    unsigned int bpp;
+} types[] = {
+    { JPEG_IMAGE_TYPE_RGB16, 2 },
+    { JPEG_IMAGE_TYPE_BGR24, 3 },
+    { JPEG_IMAGE_TYPE_BGRX32, 4 },
+};
+
+static void test_row_convert_impl(gconstpointer user_data)
+{
+    JpegRowConvertImpl impl = GPOINTER_TO_INT(user_data);
+    GRand *rand;
+    unsigned int i, width;
+
+    if (jpeg_row_converter_get(JPEG_IMAGE_TYPE_RGB16, impl) == NULL) {
+        g_test_skip("implementation not supported by this CPU");
+        return;
+    }
+
+    rand = g_rand_new_with_seed(0x1be6);
+    for (i = 0; i < G_N_ELEMENTS(types); i++) {
+        JpegRowConverter expected_convert =
+            jpeg_row_converter_get(types[i].type, JPEG_ROW_CONVERT_IMPL_SCALAR);
+        JpegRowConverter convert = jpeg_row_converter_get(types[i].type, impl);
+
+        for (width = 1; width <= MAX_WIDTH; width++) {
+            // the source is exactly the line, to catch reads past its end
+            uint8_t *src = g_malloc(width * types[i].bpp);
+            uint8_t expected[MAX_WIDTH * 3];
+            uint8_t dest[MAX_WIDTH * 3 + 16];
+            unsigned int j;
+
+            for (j = 0; j < width * types[i].bpp; j++) {
+                src[j] = g_rand_int(rand);
+            }
+            memset(dest, CANARY, sizeof(dest));
+
+            expected_convert(src, expected, width);
+            convert(src, dest, width);
+            g_assert_cmpint(memcmp(dest, expected, width * 3), ==, 0);
+            for (j = width * 3; j < sizeof(dest); j++) {
+                g_assert_cmpuint(dest[j], ==, CANARY);
+            }
+            g_free(src);
+        }
+    }
+    g_rand_free(rand);
+}
+
+static void test_row_convert_values(void)
+{
+    // 0x7c00 is pure red in RGB16 (x1r5g5b5), the low bits are replicated
+    const uint16_t rgb16[] = { GUINT16_TO_LE(0x7c00), GUINT16_TO_LE(0x03e0),
+                               GUINT16_TO_LE(0x001f), GUINT16_TO_LE(0x4210) };
+    const uint8_t rgb16_expected[] = { 0xff, 0, 0, 0, 0xff, 0, 0, 0, 0xff, 0x84, 0x84, 0x84 };
+    const uint8_t bgrx32[] = { 1, 2, 3, 0xff, 4, 5, 6, 0 };
+    const uint8_t bgrx32_expected[] = { 3, 2, 1, 6, 5, 4 };
+    uint8_t dest[12];
+
+    jpeg_row_converter_get(JPEG_IMAGE_TYPE_RGB16, JPEG_ROW_CONVERT_IMPL_AUTO)
+        ((const uint8_t *) rgb16, dest, G_N_ELEMENTS(rgb16));
+    g_assert_cmpint(memcmp(dest, rgb16_expected, sizeof(rgb16_expected)), ==, 0);
+
+    jpeg_row_converter_get(JPEG_IMAGE_TYPE_BGRX32, JPEG_ROW_CONVERT_IMPL_AUTO)(bgrx32, dest, 2);
+    g_assert_cmpint(memcmp(dest, bgrx32_expected, sizeof(bgrx32_expected)), ==, 0);
+
+    g_assert_null(jpeg_row_converter_get(JPEG_IMAGE_TYPE_INVALID, JPEG_ROW_CONVERT_IMPL_AUTO));
+}
+
+static void test_row_convert_perf(void)
+{
+    const unsigned int width = 1920, height = 1080;
+    uint8_t *src = g_malloc0(width * 4);
+    uint8_t *dest = g_malloc(width * 3);
+    unsigned int i;
+
+    for (i = 0; i < G_N_ELEMENTS(types); i++) {
+        JpegRowConvertImpl impl;
+
+        for (impl = JPEG_ROW_CONVERT_IMPL_SCALAR; impl <= JPEG_ROW_CONVERT_IMPL_SSSE3; impl++) {
+            JpegRowConverter convert = jpeg_row_converter_get(types[i].type, impl);
+            unsigned int n, y;
+
+            if (convert == NULL) {
+                continue;
+            }
+            g_test_timer_start();
+            for (n = 0; n < 20; n++) {
+                for (y = 0; y < height; y++) {
+                    convert(src, dest, width);
+                }
+            }
+            g_test_message("%u bpp %s: %.3f ms per frame", types[i].bpp * 8, impl_names[impl],
+                           g_test_timer_elapsed() * 1000 / n);
+        }
+    }
+    g_free(dest);
+    g_free(src);
+}
+
+int main(int argc, char *argv[])
+{
+    JpegRowConvertImpl impl;
+
+    g_test_init(&argc, &argv, NULL);
+
+    for (impl = JPEG_ROW_CONVERT_IMPL_AUTO; impl <= JPEG_ROW_CONVERT_IMPL_SSSE3; impl++) {
+        char *path = g_strdup_printf("/server/jpeg-row-convert/%s", impl_names[impl]);
+
+        g_test_add_data_func(path, GINT_TO_POINTER(impl), test_row_convert_impl);
+        g_free(path);
+    }
+    g_test_add_func("/server/jpeg-row-convert/values", test_row_convert_values);
+    if (g_test_perf()) {
+        g_test_add_func("/server/jpeg-row-convert/perf", test_row_convert_perf);
+    }
+
+    return g_test_run();
+}
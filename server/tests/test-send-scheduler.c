@@ -0,0 +1,209 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 agent <agent@local>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/* Test the sharing of the client bandwidth between its channels */
+#include <config.h>
+
+#include "test-glib-compat.h"
+#include "send-scheduler.h"
+
+#define BANDWIDTH (10 * 1024 * 1024)
+#define STEP (NSEC_PER_MILLISEC)
+
+/* Send as much as allowed for a second, return the bytes sent */
+static uint64_t send_for_a_second(SendScheduler *scheduler, SendSchedulerEntry *entry,
+                                  SendSchedulerEntry *other, uint64_t *now)
+{
+    uint64_t end = *now + NSEC_PER_SEC, sent = 0;
+
+    for (; *now < end; *now += STEP) {
+        // the link cannot send more than its bandwidth
+        uint64_t link = BANDWIDTH * STEP / NSEC_PER_SEC;
+
+        while (link >= 1024 && send_scheduler_get_delay(scheduler, entry, *now) == 0) {
+            send_scheduler_sent(scheduler, entry, 1024, *now);
+            sent += 1024;
+            link -= 1024;
+        }
+        if (other) {
+            send_scheduler_sent(scheduler, other, 100, *now);
+        }
+    }
+    return sent;
+}
+
+/* Send as much as allowed for @duration, measuring the bandwidth like the
+ * channel clients do: the samples taken while the link was full and the
+ * channel not delayed update the estimation, the others are lower bounds */
+static void send_and_measure(SendScheduler *scheduler, SendSchedulerEntry *entry,
+                             SendSchedulerEntry *other, uint64_t duration,
+                             uint64_t *bandwidth, uint64_t *now)
+{
+    const uint64_t sample_interval = NSEC_PER_SEC / 10;
+    uint64_t end = *now + duration, sample_start = *now, sample_bytes = 0;
+    bool sample_full = false, sample_delayed = false;
+
+    for (; *now < end; *now += STEP) {
+        uint64_t link = BANDWIDTH * STEP / NSEC_PER_SEC;
+
+        while (link >= 1024) {
+            if (send_scheduler_get_delay(scheduler, entry, *now) != 0) {
+                sample_delayed = true;
+                break;
+            }
+            send_scheduler_sent(scheduler, entry, 1024, *now);
+            sample_bytes += 1024;
+            link -= 1024;
+        }
+        sample_full = sample_full || link < 1024;
+        send_scheduler_sent(scheduler, other, 100, *now);
+
+        if (*now + STEP - sample_start >= sample_interval) {
+            uint64_t rate = sample_bytes * NSEC_PER_SEC / (*now + STEP - sample_start);
+
+            if (sample_full && !sample_delayed) {
+                *bandwidth = MAX((*bandwidth * 7 + rate) / 8, rate);
+            } else {
+                *bandwidth = MAX(*bandwidth, rate);
+            }
+            send_scheduler_set_bandwidth(scheduler, entry, *bandwidth);
+            sample_start = *now + STEP;
+            sample_bytes = 0;
+            sample_full = sample_delayed = false;
+        }
+    }
+}
+
+static void test_no_delay_alone(void)
+{
+    SendScheduler *scheduler = send_scheduler_new();
+    SendSchedulerEntry *display = send_scheduler_add(scheduler, SPICE_CHANNEL_DISPLAY);
+    uint64_t now = NSEC_PER_SEC;
+
+    send_scheduler_set_bandwidth(scheduler, display, BANDWIDTH);
+    // the channel is not limited, so the bandwidth keeps being measured
+    g_assert_cmpuint(send_for_a_second(scheduler, display, NULL, &now), >=, BANDWIDTH * 97 / 100);
+
+    send_scheduler_remove(scheduler, display);
+    send_scheduler_unref(scheduler);
+}
+
+static void test_priority_reserve(void)
+{
+    SendScheduler *scheduler = send_scheduler_new();
+    SendSchedulerEntry *display = send_scheduler_add(scheduler, SPICE_CHANNEL_DISPLAY);
+    SendSchedulerEntry *inputs = send_scheduler_add(scheduler, SPICE_CHANNEL_INPUTS);
+    uint64_t now = NSEC_PER_SEC, sent;
+
+    send_scheduler_set_bandwidth(scheduler, display, BANDWIDTH);
+    // the interactive channels are never delayed
+    g_assert_cmpuint(send_scheduler_get_delay(scheduler, inputs, now), ==, 0);
+
+    // the display leaves room for the inputs
+    send_for_a_second(scheduler, display, inputs, &now);
+    sent = send_for_a_second(scheduler, display, inputs, &now);
+    g_assert_cmpuint(sent, <=, BANDWIDTH * 96 / 100);
+    g_assert_cmpuint(sent, >=, BANDWIDTH / 2);
+
+    send_scheduler_remove(scheduler, inputs);
+    send_scheduler_remove(scheduler, display);
+    send_scheduler_unref(scheduler);
+}
+
+static void test_weights(void)
+{
+    SendScheduler *scheduler = send_scheduler_new();
+    SendSchedulerEntry *display = send_scheduler_add(scheduler, SPICE_CHANNEL_DISPLAY);
+    SendSchedulerEntry *usbredir = send_scheduler_add(scheduler, SPICE_CHANNEL_USBREDIR);
+    uint64_t now = NSEC_PER_SEC, end, display_sent = 0, usbredir_sent = 0;
+
+    send_scheduler_set_bandwidth(scheduler, usbredir, BANDWIDTH);
+    send_scheduler_sent(scheduler, display, 1, now);
+    send_scheduler_sent(scheduler, usbredir, 1, now);
+
+    for (end = now + 2 * NSEC_PER_SEC; now < end; now += STEP) {
+        while (send_scheduler_get_delay(scheduler, display, now) == 0) {
+            send_scheduler_sent(scheduler, display, 1024, now);
+            display_sent += 1024;
+        }
+        while (send_scheduler_get_delay(scheduler, usbredir, now) == 0) {
+            send_scheduler_sent(scheduler, usbredir, 1024, now);
+            usbredir_sent += 1024;
+        }
+    }
+    // the display has 4 times the weight of the usbredir channel
+    g_assert_cmpuint(display_sent + usbredir_sent, <=, 2 * BANDWIDTH * 11 / 10);
+    g_assert_cmpuint(display_sent, >, usbredir_sent * 3);
+    g_assert_cmpuint(display_sent, <, usbredir_sent * 5);
+
+    send_scheduler_remove(scheduler, usbredir);
+    send_scheduler_remove(scheduler, display);
+    send_scheduler_unref(scheduler);
+}
+
+/* A channel limited to a share of a low estimation must still be able to
+ * measure the link when it gets faster */
+static void test_bandwidth_recovery(void)
+{
+    SendScheduler *scheduler = send_scheduler_new();
+    SendSchedulerEntry *display = send_scheduler_add(scheduler, SPICE_CHANNEL_DISPLAY);
+    SendSchedulerEntry *inputs = send_scheduler_add(scheduler, SPICE_CHANNEL_INPUTS);
+    uint64_t now = NSEC_PER_SEC, bandwidth = BANDWIDTH / 4;
+
+    send_scheduler_set_bandwidth(scheduler, display, bandwidth);
+    // the estimation does not go down with the limited rate
+    send_and_measure(scheduler, display, inputs, NSEC_PER_SEC, &bandwidth, &now);
+    g_assert_cmpuint(bandwidth, >=, BANDWIDTH / 4);
+
+    send_and_measure(scheduler, display, inputs, 10 * NSEC_PER_SEC, &bandwidth, &now);
+    g_assert_cmpuint(bandwidth, >=, BANDWIDTH * 9 / 10);
+    g_assert_cmpuint(bandwidth, <=, BANDWIDTH * 11 / 10);
+
+    send_scheduler_remove(scheduler, inputs);
+    send_scheduler_remove(scheduler, display);
+    send_scheduler_unref(scheduler);
+}
+
+static void test_max_rate(void)
+{
+    SendScheduler *scheduler = send_scheduler_new();
+    SendSchedulerEntry *display = send_scheduler_add(scheduler, SPICE_CHANNEL_DISPLAY);
+    uint64_t now = NSEC_PER_SEC, sent;
+
+    // the maximum applies even without bandwidth measurement
+    send_scheduler_set_max_rate(scheduler, SPICE_CHANNEL_DISPLAY, BANDWIDTH / 4);
+    send_for_a_second(scheduler, display, NULL, &now);
+    sent = send_for_a_second(scheduler, display, NULL, &now);
+    g_assert_cmpuint(sent, <=, BANDWIDTH / 4 * 11 / 10);
+    g_assert_cmpuint(sent, >=, BANDWIDTH / 4 * 9 / 10);
+
+    send_scheduler_remove(scheduler, display);
+    send_scheduler_unref(scheduler);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/send-scheduler/no-delay-alone", test_no_delay_alone);
+    g_test_add_func("/server/send-scheduler/priority-reserve", test_priority_reserve);
+    g_test_add_func("/server/send-scheduler/weights", test_weights);
+    g_test_add_func("/server/send-scheduler/max-rate", test_max_rate);
+    g_test_add_func("/server/send-scheduler/bandwidth-recovery", test_bandwidth_recovery);
+
+    return g_test_run();
+}
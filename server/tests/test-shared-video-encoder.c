@@ -0,0 +1,342 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 agent <agent@local>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/* Test the video encoder shared by several clients.
+ * Each frame must be encoded once whatever the number of clients, and the
+ * rate control must see all the clients.
+ */
+#include <config.h>
+
+#include "test-glib-compat.h"
+#include "shared-video-encoder.h"
+
+#define NUM_CLIENTS 3
+
+/* A video encoder counting the frames and the calls */
+typedef struct FakeEncoder {
+    VideoEncoder base;
+    VideoEncoderRateControlCbs cbs;
+    unsigned int num_encoded;
+    unsigned int num_reports;
+    unsigned int num_server_drops;
+    bool drop_next;
+} FakeEncoder;
+
+static FakeEncoder *fake_encoder;
+static unsigned int num_bitmap_refs;
+
+typedef struct TestClient {
+    VideoEncoder *encoder;
+    uint32_t roundtrip_ms;
+    uint32_t playback_delay;
+} TestClient;
+
+static void fake_buffer_free(VideoBuffer *buffer)
+{
+    g_free(buffer->data);
+    g_free(buffer);
+}
+
+static void fake_encoder_destroy(VideoEncoder *encoder)
+{
+    g_assert_true(encoder == &fake_encoder->base);
+    g_free(fake_encoder);
+    fake_encoder = NULL;
+}
+
+static int fake_encoder_encode_frame(VideoEncoder *encoder, uint32_t frame_mm_time,
+                                     const SpiceBitmap *bitmap, const SpiceRect *src,
+                                     int top_down, gpointer bitmap_opaque,
+                                     VideoBuffer **outbuf)
+{
+    VideoBuffer *buffer;
+
+    if (fake_encoder->drop_next) {
+        fake_encoder->drop_next = false;
+        return VIDEO_ENCODER_FRAME_DROP;
+    }
+    fake_encoder->num_encoded++;
+    buffer = g_new0(VideoBuffer, 1);
+    buffer->data = (uint8_t *) g_strdup_printf("frame %u", frame_mm_time);
+    buffer->size = strlen((char *) buffer->data) + 1;
+    buffer->free = fake_buffer_free;
+    *outbuf = buffer;
+    return VIDEO_ENCODER_FRAME_ENCODE_DONE;
+}
+
+static void fake_encoder_client_stream_report(VideoEncoder *encoder,
+                                              uint32_t num_frames, uint32_t num_drops,
+                                              uint32_t start_frame_mm_time,
+                                              uint32_t end_frame_mm_time,
+                                              int32_t end_frame_delay, uint32_t audio_delay)
+{
+    fake_encoder->num_reports++;
+}
+
+static void fake_encoder_notify_server_frame_drop(VideoEncoder *encoder)
+{
+    fake_encoder->num_server_drops++;
+}
+
+static uint64_t fake_encoder_get_bit_rate(VideoEncoder *encoder)
+{
+    return 1000;
+}
+
+static void fake_encoder_get_stats(VideoEncoder *encoder, VideoEncoderStats *stats)
+{
+}
+
+static VideoEncoder *fake_encoder_new(SpiceVideoCodecType codec_type, uint64_t starting_bit_rate,
+                                      VideoEncoderRateControlCbs *cbs,
+                                      bitmap_ref_t bitmap_ref, bitmap_unref_t bitmap_unref)
+{
+    g_assert_null(fake_encoder);
+    fake_encoder = g_new0(FakeEncoder, 1);
+    fake_encoder->base.destroy = fake_encoder_destroy;
+    fake_encoder->base.encode_frame = fake_encoder_encode_frame;
+    fake_encoder->base.client_stream_report = fake_encoder_client_stream_report;
+    fake_encoder->base.notify_server_frame_drop = fake_encoder_notify_server_frame_drop;
+    fake_encoder->base.get_bit_rate = fake_encoder_get_bit_rate;
+    fake_encoder->base.get_stats = fake_encoder_get_stats;
+    fake_encoder->base.codec_type = codec_type;
+    fake_encoder->cbs = *cbs;
+    return &fake_encoder->base;
+}
+
+static void bitmap_ref(gpointer data)
+{
+    num_bitmap_refs++;
+}
+
+static void bitmap_unref(gpointer data)
+{
+    g_assert_cmpuint(num_bitmap_refs, >, 0);
+    num_bitmap_refs--;
+}
+
+static uint32_t get_roundtrip_ms(void *opaque)
+{
+    TestClient *client = opaque;
+
+    return client->roundtrip_ms;
+}
+
+static uint32_t get_source_fps(void *opaque)
+{
+    return 25;
+}
+
+static void update_client_playback_delay(void *opaque, uint32_t delay_ms)
+{
+    TestClient *client = opaque;
+
+    client->playback_delay = delay_ms;
+}
+
+static SharedVideoEncoder *join_clients(TestClient *clients, unsigned int num_clients)
+{
+    SharedVideoEncoder *shared;
+    unsigned int i;
+
+    shared = shared_video_encoder_new(fake_encoder_new, SPICE_VIDEO_CODEC_TYPE_MJPEG,
+                                      1000, bitmap_ref, bitmap_unref);
+    for (i = 0; i < num_clients; i++) {
+        VideoEncoderRateControlCbs cbs = {
+            .opaque = &clients[i],
+            .get_roundtrip_ms = get_roundtrip_ms,
+            .get_source_fps = get_source_fps,
+            .update_client_playback_delay = update_client_playback_delay,
+        };
+
+        memset(&clients[i], 0, sizeof(clients[i]));
+        clients[i].encoder = shared_video_encoder_join(shared, &cbs);
+        g_assert_nonnull(clients[i].encoder);
+        g_assert_cmpint(clients[i].encoder->codec_type, ==, SPICE_VIDEO_CODEC_TYPE_MJPEG);
+    }
+    return shared;
+}
+
+static int encode_frame(TestClient *client, SpiceBitmap *bitmap, uint32_t frame_mm_time,
+                        VideoBuffer **outbuf)
+{
+    SpiceRect src = { .left = 0, .top = 0, .right = 16, .bottom = 16 };
+
+    *outbuf = NULL;
+    return client->encoder->encode_frame(client->encoder, frame_mm_time, bitmap, &src, TRUE,
+                                         bitmap, outbuf);
+}
+
+static void test_shared_encode_once(void)
+{
+    TestClient clients[NUM_CLIENTS];
+    SpiceBitmap bitmaps[2];
+    VideoBuffer *buffers[NUM_CLIENTS];
+    SharedVideoEncoder *shared;
+    unsigned int i;
+
+    shared = join_clients(clients, NUM_CLIENTS);
+
+    for (i = 0; i < NUM_CLIENTS; i++) {
+        g_assert_cmpint(encode_frame(&clients[i], &bitmaps[0], 1, &buffers[i]), ==,
+                        VIDEO_ENCODER_FRAME_ENCODE_DONE);
+        g_assert_true(buffers[i]->data == buffers[0]->data);
+        g_assert_cmpstr((char *) buffers[i]->data, ==, "frame 1");
+    }
+    g_assert_cmpuint(fake_encoder->num_encoded, ==, 1);
+    // all the clients got the frame, only the buffers keep it
+    g_assert_cmpuint(num_bitmap_refs, ==, 0);
+
+    // the buffers are released in any order
+    buffers[1]->free(buffers[1]);
+    buffers[0]->free(buffers[0]);
+    g_assert_cmpstr((char *) buffers[2]->data, ==, "frame 1");
+    buffers[2]->free(buffers[2]);
+
+    // the first client is ahead of the others
+    g_assert_cmpint(encode_frame(&clients[0], &bitmaps[1], 2, &buffers[0]), ==,
+                    VIDEO_ENCODER_FRAME_ENCODE_DONE);
+    g_assert_cmpuint(num_bitmap_refs, ==, 1);
+    g_assert_cmpint(encode_frame(&clients[1], &bitmaps[1], 2, &buffers[1]), ==,
+                    VIDEO_ENCODER_FRAME_ENCODE_DONE);
+    g_assert_cmpuint(fake_encoder->num_encoded, ==, 2);
+    g_assert_cmpstr((char *) buffers[1]->data, ==, "frame 2");
+
+    // the frame is released once the last client left
+    clients[2].encoder->destroy(clients[2].encoder);
+    g_assert_cmpuint(num_bitmap_refs, ==, 0);
+    buffers[0]->free(buffers[0]);
+    buffers[1]->free(buffers[1]);
+
+    clients[0].encoder->destroy(clients[0].encoder);
+    clients[1].encoder->destroy(clients[1].encoder);
+    g_assert_null(fake_encoder);
+    shared_video_encoder_unref(shared);
+}
+
+static void test_shared_drop(void)
+{
+    TestClient clients[2];
+    SpiceBitmap bitmap;
+    VideoBuffer *buffer;
+    SharedVideoEncoder *shared;
+
+    shared = join_clients(clients, G_N_ELEMENTS(clients));
+
+    // the rate control drops the frame for all the clients
+    fake_encoder->drop_next = true;
+    g_assert_cmpint(encode_frame(&clients[0], &bitmap, 1, &buffer), ==,
+                    VIDEO_ENCODER_FRAME_DROP);
+    g_assert_cmpint(encode_frame(&clients[1], &bitmap, 1, &buffer), ==,
+                    VIDEO_ENCODER_FRAME_DROP);
+    g_assert_null(buffer);
+    g_assert_cmpuint(fake_encoder->num_encoded, ==, 0);
+    g_assert_cmpuint(num_bitmap_refs, ==, 0);
+
+    clients[0].encoder->destroy(clients[0].encoder);
+    clients[1].encoder->destroy(clients[1].encoder);
+    shared_video_encoder_unref(shared);
+}
+
+static void test_shared_lagging_client(void)
+{
+    TestClient clients[2];
+    SpiceBitmap bitmaps[10];
+    VideoBuffer *buffer;
+    SharedVideoEncoder *shared;
+    unsigned int i;
+
+    shared = join_clients(clients, G_N_ELEMENTS(clients));
+
+    for (i = 0; i < G_N_ELEMENTS(bitmaps); i++) {
+        g_assert_cmpint(encode_frame(&clients[0], &bitmaps[i], i, &buffer), ==,
+                        VIDEO_ENCODER_FRAME_ENCODE_DONE);
+        buffer->free(buffer);
+    }
+    // only the last frames are kept for the other client
+    g_assert_cmpuint(num_bitmap_refs, <, G_N_ELEMENTS(bitmaps));
+
+    // the oldest frames are encoded again
+    g_assert_cmpint(encode_frame(&clients[1], &bitmaps[0], 0, &buffer), ==,
+                    VIDEO_ENCODER_FRAME_ENCODE_DONE);
+    g_assert_cmpstr((char *) buffer->data, ==, "frame 0");
+    buffer->free(buffer);
+    g_assert_cmpuint(fake_encoder->num_encoded, ==, G_N_ELEMENTS(bitmaps) + 1);
+
+    // while the latest ones are not
+    g_assert_cmpint(encode_frame(&clients[1], &bitmaps[9], 9, &buffer), ==,
+                    VIDEO_ENCODER_FRAME_ENCODE_DONE);
+    g_assert_cmpstr((char *) buffer->data, ==, "frame 9");
+    buffer->free(buffer);
+    g_assert_cmpuint(fake_encoder->num_encoded, ==, G_N_ELEMENTS(bitmaps) + 1);
+
+    clients[0].encoder->destroy(clients[0].encoder);
+    clients[1].encoder->destroy(clients[1].encoder);
+    g_assert_cmpuint(num_bitmap_refs, ==, 0);
+    shared_video_encoder_unref(shared);
+}
+
+static void test_shared_rate_control(void)
+{
+    TestClient clients[NUM_CLIENTS];
+    SharedVideoEncoder *shared;
+    unsigned int i;
+
+    shared = join_clients(clients, NUM_CLIENTS);
+    clients[0].roundtrip_ms = 10;
+    clients[1].roundtrip_ms = 80;
+    clients[2].roundtrip_ms = 30;
+
+    // the encoder follows the slowest client
+    g_assert_cmpuint(fake_encoder->cbs.get_roundtrip_ms(fake_encoder->cbs.opaque), ==, 80);
+    g_assert_cmpuint(fake_encoder->cbs.get_source_fps(fake_encoder->cbs.opaque), ==, 25);
+
+    fake_encoder->cbs.update_client_playback_delay(fake_encoder->cbs.opaque, 120);
+    for (i = 0; i < NUM_CLIENTS; i++) {
+        g_assert_cmpuint(clients[i].playback_delay, ==, 120);
+    }
+
+    // the reports and the drops of all the clients reach the encoder
+    for (i = 0; i < NUM_CLIENTS; i++) {
+        clients[i].encoder->client_stream_report(clients[i].encoder, 5, 0, 0, 100, 50, 0);
+    }
+    clients[1].encoder->notify_server_frame_drop(clients[1].encoder);
+    g_assert_cmpuint(fake_encoder->num_reports, ==, NUM_CLIENTS);
+    g_assert_cmpuint(fake_encoder->num_server_drops, ==, 1);
+    g_assert_cmpuint(clients[2].encoder->get_bit_rate(clients[2].encoder), ==, 1000);
+
+    // a client leaving is no longer asked
+    clients[1].encoder->destroy(clients[1].encoder);
+    g_assert_cmpuint(fake_encoder->cbs.get_roundtrip_ms(fake_encoder->cbs.opaque), ==, 30);
+
+    clients[0].encoder->destroy(clients[0].encoder);
+    clients[2].encoder->destroy(clients[2].encoder);
+    g_assert_null(fake_encoder);
+    shared_video_encoder_unref(shared);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/shared-video-encoder/encode-once", test_shared_encode_once);
+    g_test_add_func("/server/shared-video-encoder/drop", test_shared_drop);
+    g_test_add_func("/server/shared-video-encoder/lagging-client", test_shared_lagging_client);
+    g_test_add_func("/server/shared-video-encoder/rate-control", test_shared_rate_control);
+
+    return g_test_run();
+}
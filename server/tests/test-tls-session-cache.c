@@ -0,0 +1,255 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 agent <agent@local>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/* Test the resumption of the TLS sessions by a reconnecting client,
+ * using the session cache of the server or the session tickets */
+#include <config.h>
+
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <openssl/ssl.h>
+
+#include "test-glib-compat.h"
+#include "basic-event-loop.h"
+#include "tls-session-cache.h"
+
+#define PKI_DIR SPICE_TOP_SRCDIR "/server/tests/pki/"
+
+static SpiceServer *server;
+
+/* clock of the ticket key rotations */
+static red_time_t test_time_ns;
+
+static red_time_t test_get_time_ns(void)
+{
+    return test_time_ns;
+}
+
+typedef struct {
+    const char *name;
+    TlsSessionConfig config;
+    bool resumed;
+} TestConfig;
+
+static const TestConfig test_configs[] = {
+    { "cache", { 16, 0, 0 }, true },
+    { "tickets", { 0, 0, 3600 }, true },
+    { "cache-tickets", { 16, 60, 3600 }, true },
+    { "disabled", { 0, 0, 0 }, false },
+};
+
+typedef struct {
+    int fd;
+    SSL_CTX *ctx;
+    SSL_SESSION *session;
+    bool connected;
+} Client;
+
+static gpointer client_thread(gpointer opaque)
+{
+    Client *client = opaque;
+    SSL *ssl = SSL_new(client->ctx);
+    char c;
+
+    SSL_set_fd(ssl, client->fd);
+    if (client->session) {
+        SSL_set_session(ssl, client->session);
+        SSL_SESSION_free(client->session);
+        client->session = NULL;
+    }
+    // with TLS 1.3 the tickets are received after the handshake
+    client->connected = SSL_connect(ssl) == 1 && SSL_read(ssl, &c, 1) == 1;
+    if (client->connected) {
+        client->session = SSL_get1_session(ssl);
+        SSL_shutdown(ssl);
+    }
+    SSL_free(ssl);
+    return NULL;
+}
+
+/* Connect @client to a server using @ctx, return whether the session was
+ * resumed */
+static bool client_connect(Client *client, SSL_CTX *ctx, TlsSessionCache *cache)
+{
+    int sv[2];
+    GThread *thread;
+    SSL *ssl;
+    bool resumed;
+
+    g_assert_cmpint(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), ==, 0);
+    client->fd = sv[0];
+    thread = g_thread_new("client", client_thread, client);
+
+    ssl = SSL_new(ctx);
+    SSL_set_fd(ssl, sv[1]);
+    g_assert_cmpint(SSL_accept(ssl), ==, 1);
+    g_assert_cmpint(SSL_write(ssl, "x", 1), ==, 1);
+    resumed = SSL_session_reused(ssl);
+    tls_session_cache_handshake_done(cache, resumed, 1000);
+
+    g_thread_join(thread);
+    g_assert_true(client->connected);
+    SSL_shutdown(ssl);
+    SSL_free(ssl);
+    close(sv[0]);
+    close(sv[1]);
+    return resumed;
+}
+
+static void test_session_resumption(gconstpointer user_data)
+{
+    const TestConfig *test = user_data;
+    static const int versions[] = {
+        TLS1_2_VERSION,
+#ifdef TLS1_3_VERSION
+        TLS1_3_VERSION,
+#endif
+    };
+    unsigned int i;
+
+    for (i = 0; i < G_N_ELEMENTS(versions); i++) {
+        SSL_CTX *ctx = SSL_CTX_new(SSLv23_server_method());
+        Client client = { .ctx = SSL_CTX_new(SSLv23_client_method()) };
+        TlsSessionCache *cache;
+
+        g_assert_cmpint(SSL_CTX_use_certificate_chain_file(ctx, PKI_DIR "server-cert.pem"), ==, 1);
+        g_assert_cmpint(SSL_CTX_use_PrivateKey_file(ctx, PKI_DIR "server-key.pem",
+                                                    SSL_FILETYPE_PEM), ==, 1);
+        SSL_CTX_set_session_id_context(ctx, (const unsigned char *)"SPICE", 5);
+        SSL_CTX_set_max_proto_version(client.ctx, versions[i]);
+        cache = tls_session_cache_new(server, ctx, &test->config);
+        g_assert_nonnull(cache);
+
+        g_assert_false(client_connect(&client, ctx, cache));
+        g_assert_nonnull(client.session);
+        g_assert_cmpint(client_connect(&client, ctx, cache), ==, test->resumed);
+        // a resumed session can be resumed again
+        g_assert_cmpint(client_connect(&client, ctx, cache), ==, test->resumed);
+
+        SSL_SESSION_free(client.session);
+        SSL_CTX_free(client.ctx);
+        SSL_CTX_free(ctx);
+        tls_session_cache_free(cache);
+    }
+}
+
+/* Return the name of the key encrypting the ticket of @session */
+static GBytes *session_get_ticket_key_name(SSL_SESSION *session)
+{
+    const unsigned char *ticket;
+    size_t len;
+
+    SSL_SESSION_get0_ticket(session, &ticket, &len);
+    g_assert_cmpuint(len, >=, 16);
+    return g_bytes_new(ticket, 16);
+}
+
+/* Use @session for the next connection of @client */
+static void client_set_session(Client *client, SSL_SESSION *session)
+{
+    SSL_SESSION_free(client->session);
+    client->session = session;
+}
+
+/* The tickets encrypted with the previous key are accepted and renewed,
+ * the ones encrypted with older keys are rejected */
+static void test_ticket_key_rotation(gconstpointer user_data)
+{
+    const int version = GPOINTER_TO_INT(user_data);
+    const TlsSessionConfig config = { 0, 0, 3600, test_get_time_ns };
+    SSL_CTX *ctx = SSL_CTX_new(SSLv23_server_method());
+    Client client = { .ctx = SSL_CTX_new(SSLv23_client_method()) };
+    TlsSessionCache *cache;
+    SSL_SESSION *first_session;
+    GBytes *first_key, *renewed_key;
+
+    g_assert_cmpint(SSL_CTX_use_certificate_chain_file(ctx, PKI_DIR "server-cert.pem"), ==, 1);
+    g_assert_cmpint(SSL_CTX_use_PrivateKey_file(ctx, PKI_DIR "server-key.pem",
+                                                SSL_FILETYPE_PEM), ==, 1);
+    SSL_CTX_set_session_id_context(ctx, (const unsigned char *)"SPICE", 5);
+    SSL_CTX_set_max_proto_version(client.ctx, version);
+    cache = tls_session_cache_new(server, ctx, &config);
+    g_assert_nonnull(cache);
+
+    g_assert_false(client_connect(&client, ctx, cache));
+    first_session = client.session;
+    SSL_SESSION_up_ref(first_session);
+    first_key = session_get_ticket_key_name(first_session);
+
+    // the key is rotated, the ticket is still accepted and renewed
+    test_time_ns += config.ticket_key_lifetime * NSEC_PER_SEC;
+    g_assert_true(client_connect(&client, ctx, cache));
+    renewed_key = session_get_ticket_key_name(client.session);
+    g_assert_false(g_bytes_equal(first_key, renewed_key));
+
+    // after another rotation the first key is dropped but not the second
+    test_time_ns += config.ticket_key_lifetime * NSEC_PER_SEC;
+    SSL_SESSION_up_ref(client.session);
+    {
+        SSL_SESSION *renewed_session = client.session;
+
+        client_set_session(&client, first_session);
+        g_assert_false(client_connect(&client, ctx, cache));
+        client_set_session(&client, renewed_session);
+    }
+    g_assert_true(client_connect(&client, ctx, cache));
+
+    // all the keys are dropped when not rotated for too long
+    test_time_ns += 2 * config.ticket_key_lifetime * NSEC_PER_SEC;
+    g_assert_false(client_connect(&client, ctx, cache));
+    g_assert_true(client_connect(&client, ctx, cache));
+
+    g_bytes_unref(first_key);
+    g_bytes_unref(renewed_key);
+    SSL_SESSION_free(client.session);
+    SSL_CTX_free(client.ctx);
+    SSL_CTX_free(ctx);
+    tls_session_cache_free(cache);
+}
+
+int main(int argc, char *argv[])
+{
+    SpiceCoreInterface *core;
+    unsigned int i;
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    core = basic_event_loop_init();
+    server = spice_server_new();
+    g_assert_cmpint(spice_server_init(server, core), ==, 0);
+
+    for (i = 0; i < G_N_ELEMENTS(test_configs); i++) {
+        char *path = g_strdup_printf("/server/tls-session-cache/%s", test_configs[i].name);
+
+        g_test_add_data_func(path, &test_configs[i], test_session_resumption);
+        g_free(path);
+    }
+    g_test_add_data_func("/server/tls-session-cache/key-rotation-tls1.2",
+                         GINT_TO_POINTER(TLS1_2_VERSION), test_ticket_key_rotation);
+#ifdef TLS1_3_VERSION
+    g_test_add_data_func("/server/tls-session-cache/key-rotation-tls1.3",
+                         GINT_TO_POINTER(TLS1_3_VERSION), test_ticket_key_rotation);
+#endif
+
+    ret = g_test_run();
+
+    spice_server_destroy(server);
+    basic_event_loop_destroy();
+    return ret;
+}
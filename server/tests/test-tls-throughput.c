@@ -0,0 +1,407 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 agent <agent@local>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/* Test the writes of the streams over a loopback TCP connection.
+ * The data written with red_stream_writev() must be received by a client
+ * whether the TLS records are produced by OpenSSL or by the kernel (kTLS).
+ * The kTLS case is skipped if not supported by OpenSSL or the kernel.
+ * Plain connections are also tested with MSG_ZEROCOPY, which must report
+ * the completion of all the writes.
+ * The coalescing of the small buffers done for TLS is tested with a
+ * non-blocking connection, retrying the interrupted writes from a
+ * different buffer as the channels do.
+ * When run in performance mode (-m perf) the throughput of plain, zerocopy,
+ * OpenSSL and kTLS connections is reported.
+ */
+#include <config.h>
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <openssl/ssl.h>
+
+#include "test-glib-compat.h"
+#include "basic-event-loop.h"
+#include "red-stream.h"
+#include "net-utils.h"
+
+#define PKI_DIR SPICE_TOP_SRCDIR "/server/tests/pki/"
+
+/* size of the messages, written 16 at a time as a channel does */
+#define MESSAGE_SIZE 1024
+#define MESSAGES_PER_WRITE 16
+/* the data is a pattern repeating every PATTERN_LEN bytes */
+#define PATTERN_LEN 251
+
+typedef enum {
+    MODE_PLAIN,
+    MODE_ZEROCOPY,
+    MODE_OPENSSL,
+    MODE_KTLS,
+} Mode;
+
+static const char *const mode_names[] = {
+    [MODE_PLAIN] = "plain",
+    [MODE_ZEROCOPY] = "zerocopy",
+    [MODE_OPENSSL] = "openssl",
+    [MODE_KTLS] = "ktls",
+};
+
+static SpiceServer *server;
+
+typedef struct {
+    int fd;
+    SSL_CTX *ctx;
+    unsigned int start_delay_ms;
+    size_t len;
+    size_t received;
+    bool valid;
+} Client;
+
+/* Return a buffer of @len bytes of pattern usable from any offset
+ * within the pattern */
+static uint8_t *pattern_new(size_t len)
+{
+    uint8_t *pattern = g_malloc(len + PATTERN_LEN);
+    size_t i;
+
+    for (i = 0; i < len + PATTERN_LEN; i++) {
+        pattern[i] = i % PATTERN_LEN;
+    }
+    return pattern;
+}
+
+/* Receive the data checking it matches the pattern */
+static gpointer client_thread(gpointer opaque)
+{
+    Client *client = opaque;
+    SSL *ssl = NULL;
+    uint8_t buf[64 * 1024];
+    uint8_t *pattern = pattern_new(sizeof(buf));
+
+    client->valid = true;
+    if (client->ctx) {
+        ssl = SSL_new(client->ctx);
+        SSL_set_fd(ssl, client->fd);
+        if (SSL_connect(ssl) != 1) {
+            client->valid = false;
+            SSL_free(ssl);
+            g_free(pattern);
+            return NULL;
+        }
+    }
+    g_usleep(client->start_delay_ms * 1000);
+    while (client->received < client->len) {
+        ssize_t n;
+
+        n = ssl ? SSL_read(ssl, buf, sizeof(buf)) : read(client->fd, buf, sizeof(buf));
+        if (n <= 0) {
+            break;
+        }
+        if (memcmp(buf, pattern + client->received % PATTERN_LEN, n) != 0) {
+            client->valid = false;
+        }
+        client->received += n;
+    }
+    if (ssl) {
+        SSL_free(ssl);
+    }
+    g_free(pattern);
+    return NULL;
+}
+
+static void tcp_socketpair(int sv[2])
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    int listener;
+
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    g_assert_cmpint(listener, >=, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    g_assert_cmpint(bind(listener, (struct sockaddr *) &addr, sizeof(addr)), ==, 0);
+    g_assert_cmpint(listen(listener, 1), ==, 0);
+    g_assert_cmpint(getsockname(listener, (struct sockaddr *) &addr, &addr_len), ==, 0);
+
+    sv[0] = socket(AF_INET, SOCK_STREAM, 0);
+    g_assert_cmpint(connect(sv[0], (struct sockaddr *) &addr, sizeof(addr)), ==, 0);
+    sv[1] = accept(listener, NULL, NULL);
+    g_assert_cmpint(sv[1], >=, 0);
+    close(listener);
+}
+
+static SSL_CTX *server_ctx_new(Mode mode)
+{
+    SSL_CTX *ctx = SSL_CTX_new(SSLv23_server_method());
+
+    g_assert_nonnull(ctx);
+    g_assert_cmpint(SSL_CTX_use_certificate_chain_file(ctx, PKI_DIR "server-cert.pem"), ==, 1);
+    g_assert_cmpint(SSL_CTX_use_PrivateKey_file(ctx, PKI_DIR "server-key.pem",
+                                                SSL_FILETYPE_PEM), ==, 1);
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+    if (mode == MODE_KTLS) {
+        SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+    }
+#endif
+    return ctx;
+}
+
+/* Send @len bytes from the server to a client, returning the time taken
+ * or a negative value if the mode is not supported */
+static double transfer(Mode mode, size_t len)
+{
+    SSL_CTX *server_ctx = NULL;
+    Client client = { .len = len };
+    struct iovec iov[MESSAGES_PER_WRITE];
+    uint8_t *data;
+    RedStream *stream;
+    GThread *thread;
+    size_t sent = 0;
+    double elapsed;
+    int sv[2];
+    int i;
+
+    tcp_socketpair(sv);
+    client.fd = sv[0];
+    if (mode != MODE_PLAIN && mode != MODE_ZEROCOPY) {
+        client.ctx = SSL_CTX_new(SSLv23_client_method());
+        server_ctx = server_ctx_new(mode);
+    }
+    thread = g_thread_new("client", client_thread, &client);
+
+    stream = red_stream_new(server, sv[1]);
+    if (server_ctx) {
+        g_assert_cmpint(red_stream_enable_ssl(stream, server_ctx), ==,
+                        RED_STREAM_SSL_STATUS_OK);
+    }
+    if (mode == MODE_KTLS && !red_stream_is_ktls(stream)) {
+        elapsed = -1;
+        shutdown(sv[1], SHUT_RDWR);
+        goto end;
+    }
+    g_assert_cmpint(red_stream_is_ktls(stream), ==, mode == MODE_KTLS);
+    if (mode == MODE_ZEROCOPY && !red_stream_enable_zerocopy(stream, 1)) {
+        elapsed = -1;
+        shutdown(sv[1], SHUT_RDWR);
+        goto end;
+    }
+
+    data = pattern_new(MESSAGE_SIZE * MESSAGES_PER_WRITE);
+    g_test_timer_start();
+    while (sent < len) {
+        size_t left = len - sent;
+        uint8_t *pos = data + sent % PATTERN_LEN;
+        ssize_t n;
+
+        for (i = 0; i < MESSAGES_PER_WRITE; i++) {
+            iov[i].iov_base = pos + i * MESSAGE_SIZE;
+            iov[i].iov_len = MIN(left, MESSAGE_SIZE);
+            left -= iov[i].iov_len;
+        }
+        n = red_stream_writev(stream, iov, MESSAGES_PER_WRITE);
+        g_assert_cmpint(n, >, 0);
+        sent += n;
+    }
+    g_thread_join(thread);
+    thread = NULL;
+    elapsed = g_test_timer_elapsed();
+
+    g_assert_cmpuint(client.received, ==, len);
+    g_assert_true(client.valid);
+
+    // all the data was received, the completions must follow
+    while (red_stream_zerocopy_completed(stream) != red_stream_zerocopy_sent(stream)) {
+        struct pollfd pfd = { .fd = sv[1] };
+
+        g_assert_cmpint(poll(&pfd, 1, 5000), ==, 1);
+        g_assert_true(pfd.revents & POLLERR);
+    }
+    g_free(data);
+    if (mode == MODE_ZEROCOPY) {
+        g_assert_cmpuint(red_stream_zerocopy_sent(stream), >, 0);
+    }
+
+end:
+    if (thread) {
+        g_thread_join(thread);
+    }
+    red_stream_free(stream);
+    close(sv[0]);
+    if (server_ctx) {
+        SSL_CTX_free(server_ctx);
+        SSL_CTX_free(client.ctx);
+    }
+    return elapsed;
+}
+
+static void test_tls_transfer(gconstpointer user_data)
+{
+    Mode mode = GPOINTER_TO_INT(user_data);
+
+    if (transfer(mode, 3 * 1024 * 1024 + 17) < 0) {
+        g_test_skip(mode == MODE_ZEROCOPY ? "MSG_ZEROCOPY not available" :
+                                            "kernel TLS not available");
+    }
+}
+
+/* Fill @iov with the messages following the first @sent bytes of the data,
+ * copied to a new buffer. Returns the number of buffers */
+static int retry_iov_fill(struct iovec *iov, int max_iov, size_t sent, size_t len,
+                          uint8_t **copy)
+{
+    static const size_t sizes[] = { 10, 3000, 200, 20000, 1, 500, 40 };
+    size_t pos = 0, total = 0, offset = 0;
+    unsigned int msg = 0;
+    int n, i;
+
+    // skip the messages already sent
+    while (pos + sizes[msg % G_N_ELEMENTS(sizes)] <= sent) {
+        pos += sizes[msg % G_N_ELEMENTS(sizes)];
+        msg++;
+    }
+    for (n = 0; n < max_iov && pos < len; n++, msg++) {
+        size_t end = MIN(pos + sizes[msg % G_N_ELEMENTS(sizes)], len);
+
+        iov[n].iov_len = end - MAX(pos, sent);
+        total += iov[n].iov_len;
+        pos = end;
+    }
+
+    *copy = g_malloc(total);
+    for (i = 0; i < n; i++) {
+        uint8_t *buf = *copy + offset;
+        size_t j;
+
+        for (j = 0; j < iov[i].iov_len; j++) {
+            buf[j] = (sent + offset + j) % PATTERN_LEN;
+        }
+        iov[i].iov_base = buf;
+        offset += iov[i].iov_len;
+    }
+    return n;
+}
+
+/* Write through small socket buffers to a client which starts reading late,
+ * so that the coalesced writes fail with EAGAIN and are retried */
+static void test_tls_retry(void)
+{
+    const size_t len = 2 * 1024 * 1024 + 3;
+    Client client = { .len = len, .start_delay_ms = 100 };
+    struct iovec iov[MESSAGES_PER_WRITE];
+    SSL_CTX *server_ctx;
+    RedStream *stream;
+    GThread *thread;
+    unsigned int retries = 0;
+    size_t sent = 0;
+    int buf_size = 16 * 1024;
+    int sv[2];
+
+    tcp_socketpair(sv);
+    g_assert_cmpint(setsockopt(sv[1], SOL_SOCKET, SO_SNDBUF, &buf_size, sizeof(buf_size)), ==, 0);
+    g_assert_cmpint(setsockopt(sv[0], SOL_SOCKET, SO_RCVBUF, &buf_size, sizeof(buf_size)), ==, 0);
+    client.fd = sv[0];
+    client.ctx = SSL_CTX_new(SSLv23_client_method());
+    server_ctx = server_ctx_new(MODE_OPENSSL);
+    thread = g_thread_new("client", client_thread, &client);
+
+    stream = red_stream_new(server, sv[1]);
+    g_assert_cmpint(red_stream_enable_ssl(stream, server_ctx), ==, RED_STREAM_SSL_STATUS_OK);
+    g_assert_false(red_stream_is_ktls(stream));
+    red_socket_set_non_blocking(sv[1], true);
+
+    while (sent < len) {
+        uint8_t *copy;
+        int iovcnt = retry_iov_fill(iov, MESSAGES_PER_WRITE, sent, len, &copy);
+        ssize_t n;
+
+        n = red_stream_writev(stream, iov, iovcnt);
+        g_free(copy);
+        if (n < 0) {
+            struct pollfd pfd = { .fd = sv[1], .events = POLLOUT };
+
+            g_assert_cmpint(errno, ==, EAGAIN);
+            retries++;
+            g_assert_cmpint(poll(&pfd, 1, 5000), ==, 1);
+            continue;
+        }
+        g_assert_cmpint(n, >, 0);
+        sent += n;
+    }
+    g_thread_join(thread);
+
+    g_assert_cmpuint(retries, >, 0);
+    g_assert_cmpuint(client.received, ==, len);
+    g_assert_true(client.valid);
+
+    red_stream_free(stream);
+    close(sv[0]);
+    SSL_CTX_free(server_ctx);
+    SSL_CTX_free(client.ctx);
+}
+
+static void test_tls_perf(void)
+{
+    const size_t len = 512 * 1024 * 1024;
+    Mode mode;
+
+    for (mode = MODE_PLAIN; mode <= MODE_KTLS; mode++) {
+        double elapsed = transfer(mode, len);
+
+        if (elapsed < 0) {
+            g_test_message("%s: not available", mode_names[mode]);
+            continue;
+        }
+        g_test_message("%s: %.1f MiB/s", mode_names[mode], len / elapsed / (1024 * 1024));
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    SpiceCoreInterface *core;
+    Mode mode;
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    core = basic_event_loop_init();
+    server = spice_server_new();
+    g_assert_cmpint(spice_server_init(server, core), ==, 0);
+
+    for (mode = MODE_PLAIN; mode <= MODE_KTLS; mode++) {
+        char *path = g_strdup_printf("/server/tls/%s", mode_names[mode]);
+
+        g_test_add_data_func(path, GINT_TO_POINTER(mode), test_tls_transfer);
+        g_free(path);
+    }
+    g_test_add_func("/server/tls/retry", test_tls_retry);
+    if (g_test_perf()) {
+        g_test_add_func("/server/tls/perf", test_tls_perf);
+    }
+
+    ret = g_test_run();
+
+    spice_server_destroy(server);
+    basic_event_loop_destroy();
+    return ret;
+}
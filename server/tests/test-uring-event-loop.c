@@ -0,0 +1,205 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 agent <agent@local>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/* Test the watches polled with io_uring.
+ * The test is skipped if io_uring is not available.
+ */
+#include <config.h>
+
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "test-glib-compat.h"
+#include "uring-event-loop.h"
+
+typedef struct {
+    SpiceCoreInterfaceInternal *core;
+    SpiceWatch *watch;
+    int fd;
+    int events;
+    unsigned int calls;
+    /* mask to set from the callback, -1 to remove the watch */
+    int next_mask;
+} WatchData;
+
+static void watch_func(int fd, int event, void *opaque)
+{
+    WatchData *data = opaque;
+    char c;
+
+    g_assert_cmpint(fd, ==, data->fd);
+    data->events |= event;
+    data->calls++;
+    if (event & SPICE_WATCH_EVENT_READ) {
+        g_assert_cmpint(read(fd, &c, 1), ==, 1);
+    }
+    if (data->next_mask < 0) {
+        data->core->watch_remove(data->core, data->watch);
+        data->watch = NULL;
+    } else {
+        data->core->watch_update_mask(data->core, data->watch, data->next_mask);
+    }
+}
+
+static void error_watch_func(int fd, int event, void *opaque)
+{
+    WatchData *data = opaque;
+
+    g_assert_cmpint(fd, ==, data->fd);
+    data->events |= event;
+    data->calls++;
+}
+
+static gboolean timeout_func(gpointer user_data)
+{
+    bool *expired = user_data;
+
+    *expired = true;
+    return G_SOURCE_REMOVE;
+}
+
+/* Run the loop till the callback is called or for 100ms if it is not */
+static void run_loop(SpiceCoreInterfaceInternal *core, WatchData *data)
+{
+    unsigned int calls = data->calls;
+    bool expired = false;
+    GSource *timeout = g_timeout_source_new(100);
+
+    g_source_set_callback(timeout, timeout_func, &expired, NULL);
+    g_source_attach(timeout, core->main_context);
+    while (!expired && data->calls == calls) {
+        g_main_context_iteration(core->main_context, TRUE);
+    }
+    g_source_destroy(timeout);
+    g_source_unref(timeout);
+}
+
+static void test_uring_watches(void)
+{
+    SpiceCoreInterfaceInternal core = event_loop_core;
+    WatchData data = { .core = &core };
+    int sv[2];
+
+    core.main_context = g_main_context_new();
+    if (!uring_event_loop_init(&core)) {
+        g_test_skip("io_uring not available");
+        g_main_context_unref(core.main_context);
+        return;
+    }
+    g_assert_cmpint(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), ==, 0);
+    data.fd = sv[0];
+    data.next_mask = SPICE_WATCH_EVENT_READ;
+    data.watch = core.watch_add(&core, sv[0], SPICE_WATCH_EVENT_READ, watch_func, &data);
+    g_assert_nonnull(data.watch);
+
+    // nothing to read
+    run_loop(&core, &data);
+    g_assert_cmpuint(data.calls, ==, 0);
+
+    g_assert_cmpint(write(sv[1], "a", 1), ==, 1);
+    run_loop(&core, &data);
+    g_assert_cmpuint(data.calls, ==, 1);
+    g_assert_cmpint(data.events, ==, SPICE_WATCH_EVENT_READ);
+
+    // the mask is extended while a request is pending
+    data.events = 0;
+    core.watch_update_mask(&core, data.watch, SPICE_WATCH_EVENT_READ | SPICE_WATCH_EVENT_WRITE);
+    run_loop(&core, &data);
+    g_assert_cmpuint(data.calls, ==, 2);
+    g_assert_cmpint(data.events, ==, SPICE_WATCH_EVENT_WRITE);
+
+    // the callback removed the write events
+    data.events = 0;
+    run_loop(&core, &data);
+    g_assert_cmpuint(data.calls, ==, 2);
+
+    // no event with an empty mask
+    core.watch_update_mask(&core, data.watch, 0);
+    g_assert_cmpint(write(sv[1], "b", 1), ==, 1);
+    run_loop(&core, &data);
+    g_assert_cmpuint(data.calls, ==, 2);
+
+    core.watch_update_mask(&core, data.watch, SPICE_WATCH_EVENT_READ);
+    run_loop(&core, &data);
+    g_assert_cmpuint(data.calls, ==, 3);
+    g_assert_cmpint(data.events, ==, SPICE_WATCH_EVENT_READ);
+
+    // remove the watch from its callback
+    data.next_mask = -1;
+    g_assert_cmpint(write(sv[1], "c", 1), ==, 1);
+    run_loop(&core, &data);
+    g_assert_cmpuint(data.calls, ==, 4);
+    g_assert_null(data.watch);
+    g_assert_cmpint(write(sv[1], "d", 1), ==, 1);
+    run_loop(&core, &data);
+    g_assert_cmpuint(data.calls, ==, 4);
+
+    // remove a watch with a pending request, then the ring
+    data.watch = core.watch_add(&core, sv[1], SPICE_WATCH_EVENT_READ, watch_func, &data);
+    run_loop(&core, &data);
+    core.watch_remove(&core, data.watch);
+    uring_event_loop_destroy(&core);
+    g_assert_null(core.uring_loop);
+
+    close(sv[0]);
+    close(sv[1]);
+    g_main_context_unref(core.main_context);
+}
+
+/* A failed poll request is reported once as the events of the watch and
+ * not requested again */
+static void test_uring_watch_error(void)
+{
+    SpiceCoreInterfaceInternal core = event_loop_core;
+    WatchData data = { .core = &core };
+    int sv[2];
+
+    core.main_context = g_main_context_new();
+    if (!uring_event_loop_init(&core)) {
+        g_test_skip("io_uring not available");
+        g_main_context_unref(core.main_context);
+        return;
+    }
+    g_assert_cmpint(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), ==, 0);
+    close(sv[1]);
+    // the fd is closed before the request is submitted, failing with EBADF
+    data.fd = sv[0];
+    data.watch = core.watch_add(&core, sv[0], SPICE_WATCH_EVENT_READ, error_watch_func, &data);
+    g_assert_nonnull(data.watch);
+    close(sv[0]);
+
+    run_loop(&core, &data);
+    g_assert_cmpuint(data.calls, ==, 1);
+    g_assert_cmpint(data.events, ==, SPICE_WATCH_EVENT_READ);
+
+    run_loop(&core, &data);
+    g_assert_cmpuint(data.calls, ==, 1);
+
+    core.watch_remove(&core, data.watch);
+    uring_event_loop_destroy(&core);
+    g_main_context_unref(core.main_context);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/uring-event-loop/watches", test_uring_watches);
+    g_test_add_func("/server/uring-event-loop/watch-error", test_uring_watch_error);
+
+    return g_test_run();
+}
@@ -0,0 +1,367 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 agent <agent@local>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/* Test the network bit rate control of the video streams.
+ * A stream is sent on a simulated link and the bit rate must converge to
+ * the link capacity without letting the latency grow. The simulation is
+ * deterministic so the same run always gives the same bit rates; run with
+ * --verbose to get the trace.
+ */
+#include <config.h>
+
+#include "test-glib-compat.h"
+#include "video-rate-control.h"
+
+#define MBPS (1024 * 1024)
+#define FPS 25
+#define PERIOD (MSEC_PER_SEC / FPS)
+
+/* The server drops the frames if the pipe already holds these many */
+#define MAX_PIPE_FRAMES 5
+/* The client sends a report every these many frames */
+#define REPORT_FRAMES 5
+/* The roundtrip is measured every second */
+#define PING_INTERVAL MSEC_PER_SEC
+
+typedef struct LinkFrame {
+    uint32_t mm_time;
+    uint64_t bits;
+} LinkFrame;
+
+/* A link with a fixed capacity and the queue of the frames being sent */
+typedef struct Link {
+    uint64_t capacity;
+    uint32_t base_roundtrip;
+    uint32_t playback_delay;
+    bool client_reports;
+
+    VideoRateControl *rate_control;
+    uint32_t now;
+    uint32_t roundtrip;
+
+    LinkFrame queue[MAX_PIPE_FRAMES];
+    unsigned int queue_first;
+    unsigned int queue_len;
+    uint64_t queue_bits;
+
+    /* the report being gathered by the client */
+    uint32_t report_frames;
+    uint32_t report_drops;
+    uint32_t report_start;
+
+    /* the statistics of the end of the run */
+    uint64_t sum_bit_rate;
+    uint32_t num_samples;
+    int32_t min_margin;
+    uint32_t client_drops;
+    uint32_t server_drops;
+} Link;
+
+static uint32_t link_get_roundtrip_ms(void *opaque)
+{
+    Link *link = opaque;
+    return link->roundtrip;
+}
+
+static uint32_t link_get_source_fps(void *opaque)
+{
+    return FPS;
+}
+
+static void link_update_client_playback_delay(void *opaque, uint32_t delay_ms)
+{
+}
+
+/* The bytes of the queued frames, including what is left of the one
+ * being sent */
+static uint64_t link_get_pipe_bytes(void *opaque)
+{
+    Link *link = opaque;
+    return link->queue_bits / 8;
+}
+
+static void link_frame_received(Link *link, const LinkFrame *frame, uint32_t arrival)
+{
+    int32_t margin = (int32_t)(frame->mm_time + link->playback_delay - arrival);
+
+    if (link->report_frames == 0) {
+        link->report_start = frame->mm_time;
+    }
+    link->report_frames++;
+    if (margin < 0) {
+        link->report_drops++;
+    }
+    if (link->num_samples) {
+        link->min_margin = MIN(link->min_margin, margin);
+        link->client_drops += margin < 0;
+    }
+    if (link->report_frames == REPORT_FRAMES && link->client_reports) {
+        video_rate_control_client_report(link->rate_control, link->report_frames,
+                                         link->report_drops, link->report_start,
+                                         frame->mm_time, margin, link->playback_delay);
+        link->report_frames = 0;
+        link->report_drops = 0;
+    }
+}
+
+/* Sends the queued frames for one frame period */
+static void link_send(Link *link)
+{
+    uint64_t budget = link->capacity * PERIOD / MSEC_PER_SEC;
+    uint64_t sent = 0;
+
+    while (link->queue_len > 0) {
+        LinkFrame *frame = &link->queue[link->queue_first];
+        uint64_t bits = MIN(frame->bits, budget - sent);
+
+        frame->bits -= bits;
+        link->queue_bits -= bits;
+        sent += bits;
+        if (frame->bits > 0) {
+            break;
+        }
+        link_frame_received(link, frame, link->now + sent * MSEC_PER_SEC / link->capacity +
+                                         link->base_roundtrip / 2);
+        link->queue_first = (link->queue_first + 1) % MAX_PIPE_FRAMES;
+        link->queue_len--;
+    }
+}
+
+/* Runs the stream for the specified time and returns the final bit rate.
+ * The statistics are gathered over the last @measure_time milliseconds.
+ */
+static uint64_t link_run(Link *link, uint32_t duration, uint32_t measure_time)
+{
+    uint32_t end = link->now + duration;
+
+    for (; link->now < end; link->now += PERIOD) {
+        uint64_t bit_rate = video_rate_control_get_bit_rate(link->rate_control);
+
+        if (link->now % PING_INTERVAL == 0) {
+            link->roundtrip = link->base_roundtrip +
+                              link->queue_bits * MSEC_PER_SEC / link->capacity;
+        }
+        if (link->queue_len == MAX_PIPE_FRAMES) {
+            video_rate_control_server_frame_drop(link->rate_control);
+            link->server_drops += link->num_samples > 0;
+        } else {
+            /* An encoder following the bit rate, with a larger frame from
+             * time to time */
+            LinkFrame *frame = &link->queue[(link->queue_first + link->queue_len) %
+                                            MAX_PIPE_FRAMES];
+
+            frame->mm_time = link->now;
+            frame->bits = bit_rate / FPS;
+            if (link->now % (PERIOD * 10) == 0) {
+                frame->bits *= 2;
+            }
+            link->queue_len++;
+            link->queue_bits += frame->bits;
+            video_rate_control_frame_encoded(link->rate_control, frame->mm_time,
+                                             frame->bits / 8);
+        }
+        link_send(link);
+
+        if (link->now + measure_time >= end) {
+            if (link->num_samples == 0) {
+                link->min_margin = link->playback_delay;
+            }
+            link->sum_bit_rate += bit_rate;
+            link->num_samples++;
+        }
+        if (g_test_verbose() && link->now % MSEC_PER_SEC == 0) {
+            g_printerr("%6u ms: %.2f Mbps, queue %u frames, roundtrip %u ms\n",
+                       link->now, (double)bit_rate / MBPS, link->queue_len, link->roundtrip);
+        }
+    }
+    return video_rate_control_get_bit_rate(link->rate_control);
+}
+
+static void link_init(Link *link, uint64_t capacity, uint64_t starting_bit_rate,
+                      bool client_reports)
+{
+    VideoEncoderRateControlCbs cbs = {
+        .opaque = link,
+        .get_roundtrip_ms = link_get_roundtrip_ms,
+        .get_source_fps = link_get_source_fps,
+        .update_client_playback_delay = link_update_client_playback_delay,
+        .get_pipe_bytes = link_get_pipe_bytes,
+    };
+
+    memset(link, 0, sizeof(*link));
+    link->capacity = capacity;
+    link->base_roundtrip = 20;
+    link->roundtrip = link->base_roundtrip;
+    link->playback_delay = 400;
+    link->client_reports = client_reports;
+    /* start with a non-zero time like the real mm_time */
+    link->now = 1000;
+    link->rate_control = video_rate_control_new(starting_bit_rate, &cbs);
+}
+
+static void check_convergence(Link *link)
+{
+    uint64_t avg_bit_rate = link->sum_bit_rate / link->num_samples;
+
+    if (g_test_verbose()) {
+        g_printerr("average %.2f Mbps for %.2f Mbps, minimum margin %d ms, drops %u/%u\n",
+                   (double)avg_bit_rate / MBPS, (double)link->capacity / MBPS,
+                   link->min_margin, link->client_drops, link->server_drops);
+    }
+    /* the stream uses the link without exceeding it */
+    g_assert_cmpuint(avg_bit_rate, >=, link->capacity / 2);
+    g_assert_cmpuint(avg_bit_rate, <=, link->capacity);
+    /* and the frames arrive in time */
+    g_assert_cmpint(link->min_margin, >, 0);
+    g_assert_cmpuint(link->client_drops, ==, 0);
+}
+
+/* The starting bit rate is too high and must come down */
+static void test_rate_control_decrease(void)
+{
+    Link link;
+
+    link_init(&link, 4 * MBPS, 20 * MBPS, TRUE);
+    link_run(&link, 60 * MSEC_PER_SEC, 30 * MSEC_PER_SEC);
+    check_convergence(&link);
+    video_rate_control_free(link.rate_control);
+}
+
+/* The starting bit rate is too low and must go up */
+static void test_rate_control_increase(void)
+{
+    Link link;
+
+    link_init(&link, 8 * MBPS, MBPS, TRUE);
+    link_run(&link, 90 * MSEC_PER_SEC, 30 * MSEC_PER_SEC);
+    check_convergence(&link);
+    video_rate_control_free(link.rate_control);
+}
+
+/* Without the client reports the server side signals must be enough */
+static void test_rate_control_server_only(void)
+{
+    Link link;
+
+    link_init(&link, 4 * MBPS, 20 * MBPS, FALSE);
+    link_run(&link, 60 * MSEC_PER_SEC, 30 * MSEC_PER_SEC);
+    check_convergence(&link);
+    video_rate_control_free(link.rate_control);
+}
+
+/* The link capacity drops in the middle of the stream */
+static void test_rate_control_capacity_drop(void)
+{
+    Link link;
+
+    link_init(&link, 8 * MBPS, 4 * MBPS, TRUE);
+    link_run(&link, 60 * MSEC_PER_SEC, 0);
+    link.capacity = 2 * MBPS;
+    link_run(&link, 60 * MSEC_PER_SEC, 30 * MSEC_PER_SEC);
+    check_convergence(&link);
+    video_rate_control_free(link.rate_control);
+}
+
+/* The cap limits the bit rate even if the link could do more */
+static void test_rate_control_cap(void)
+{
+    Link link;
+
+    link_init(&link, 16 * MBPS, 4 * MBPS, TRUE);
+    video_rate_control_set_max_bit_rate(link.rate_control, 3 * MBPS);
+    g_assert_cmpuint(video_rate_control_get_bit_rate(link.rate_control), ==, 3 * MBPS);
+    link_run(&link, 30 * MSEC_PER_SEC, 0);
+    g_assert_cmpuint(video_rate_control_get_bit_rate(link.rate_control), <=, 3 * MBPS);
+    video_rate_control_free(link.rate_control);
+}
+
+/* A recorded sequence of client reports, 5 frames / 200ms each, and the
+ * bit rate expected after each of them */
+typedef struct RecordedReport {
+    uint32_t num_drops;
+    int32_t video_margin;
+    uint64_t bit_rate;
+} RecordedReport;
+
+static const RecordedReport recorded_reports[] = {
+    /* the drops of the warmup are ignored */
+    { 2, -20, 4 * MBPS }, { 0, 120, 4 * MBPS }, { 0, 180, 4 * MBPS },
+    { 0, 200, 4 * MBPS }, { 0, 200, 4 * MBPS }, { 0, 200, 4 * MBPS },
+    { 0, 210, 4 * MBPS }, { 0, 200, 4 * MBPS }, { 0, 200, 4 * MBPS },
+    { 0, 205, 4 * MBPS },
+    /* stable for 2 seconds: probe a higher bit rate */
+    { 0, 200, 5 * MBPS }, { 0, 200, 5 * MBPS }, { 0, 200, 5 * MBPS },
+    { 0, 200, 5 * MBPS }, { 0, 200, 5 * MBPS },
+    /* drops: back to the last bit rate that worked, the next report
+     * predates the change so it is ignored */
+    { 3, -40, 4 * MBPS }, { 4, -60, 4 * MBPS },
+    /* the last good bit rate does not work anymore: cut it */
+    { 1, 20, 2 * MBPS },
+    /* and increase it once stable again, by a tenth of the range between
+     * the last bit rate that worked and the last that did not */
+    { 0, 120, 2 * MBPS }, { 0, 190, 2 * MBPS }, { 0, 190, 2 * MBPS },
+    { 0, 200, 2 * MBPS }, { 0, 200, 2 * MBPS }, { 0, 200, 2 * MBPS },
+    { 0, 200, 2 * MBPS }, { 0, 200, 2 * MBPS }, { 0, 200, 2 * MBPS },
+    { 0, 200, 2 * MBPS + (4 * MBPS - 128 * 1024 - 2 * MBPS) / 10 },
+};
+
+static void test_rate_control_replay(void)
+{
+    VideoEncoderRateControlCbs cbs = {
+        .get_source_fps = link_get_source_fps,
+    };
+    VideoRateControl *rate_control = video_rate_control_new(4 * MBPS, &cbs);
+    uint32_t mm_time = 1000;
+    unsigned int i, j;
+
+    for (i = 0; i < G_N_ELEMENTS(recorded_reports); i++) {
+        const RecordedReport *report = &recorded_reports[i];
+        uint64_t bit_rate;
+
+        for (j = 0; j < REPORT_FRAMES; j++, mm_time += PERIOD) {
+            video_rate_control_frame_encoded(rate_control, mm_time,
+                                             video_rate_control_get_bit_rate(rate_control) /
+                                             8 / FPS);
+        }
+        /* the report is about the frames sent before the last ones */
+        video_rate_control_client_report(rate_control, REPORT_FRAMES, report->num_drops,
+                                         mm_time - 2 * REPORT_FRAMES * PERIOD,
+                                         mm_time - REPORT_FRAMES * PERIOD - PERIOD,
+                                         report->video_margin, 0);
+        bit_rate = video_rate_control_get_bit_rate(rate_control);
+        if (g_test_verbose()) {
+            g_printerr("%6u ms: drops %u margin %4d -> %.2f Mbps\n", mm_time,
+                       report->num_drops, report->video_margin, (double)bit_rate / MBPS);
+        }
+        g_assert_cmpuint(bit_rate, ==, report->bit_rate);
+    }
+    video_rate_control_free(rate_control);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/video-rate-control/decrease", test_rate_control_decrease);
+    g_test_add_func("/server/video-rate-control/increase", test_rate_control_increase);
+    g_test_add_func("/server/video-rate-control/server-only", test_rate_control_server_only);
+    g_test_add_func("/server/video-rate-control/capacity-drop", test_rate_control_capacity_drop);
+    g_test_add_func("/server/video-rate-control/cap", test_rate_control_cap);
+    g_test_add_func("/server/video-rate-control/replay", test_rate_control_replay);
+
+    return g_test_run();
+}
@@ -0,0 +1,752 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 agent <agent@local>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/* Test the WebSocket framing over a memory stream.
+ * Masked frames sent by a client must be unmasked whatever the split of
+ * the reads, frames written must contain the data written whatever the
+ * split of the writes. The same is checked for the messages compressed
+ * with the permessage-deflate extension.
+ * When run in performance mode (-m perf) the throughput of the reads and
+ * writes is reported.
+ */
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <zlib.h>
+
+#include "test-glib-compat.h"
+#include "websocket.h"
+
+#define HANDSHAKE_START "GET "
+#define HANDSHAKE_END \
+    "/ HTTP/1.1\r\n" \
+    "Host: localhost\r\n" \
+    "Upgrade: websocket\r\n" \
+    "Connection: Upgrade\r\n" \
+    "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n" \
+    "Sec-WebSocket-Protocol: binary\r\n" \
+    "Sec-WebSocket-Version: 13\r\n"
+
+#define DEFLATE_OFFER "permessage-deflate; client_max_window_bits"
+#define RSV1 0x40
+
+typedef struct {
+    GByteArray *input;
+    size_t input_pos;
+    GByteArray *output;
+    /* if set reads and writes are short of a random length */
+    GRand *rand;
+    /* if set writes are limited to this length */
+    size_t max_write;
+    unsigned int num_writes;
+} MemoryStream;
+
+static size_t io_len(MemoryStream *stream, size_t len)
+{
+    if (stream->max_write) {
+        len = MIN(len, stream->max_write);
+    }
+    if (stream->rand && len > 1) {
+        return g_rand_int_range(stream->rand, 1, len + 1);
+    }
+    return len;
+}
+
+static ssize_t stream_read(void *opaque, void *buf, size_t nbyte)
+{
+    MemoryStream *stream = opaque;
+    size_t len = MIN(nbyte, stream->input->len - stream->input_pos);
+
+    if (len == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    len = io_len(stream, len);
+    memcpy(buf, stream->input->data + stream->input_pos, len);
+    stream->input_pos += len;
+    return len;
+}
+
+static ssize_t stream_write(void *opaque, const void *buf, size_t nbyte)
+{
+    MemoryStream *stream = opaque;
+    size_t len = io_len(stream, nbyte);
+
+    stream->num_writes++;
+    g_byte_array_append(stream->output, buf, len);
+    return len;
+}
+
+static ssize_t stream_writev(void *opaque, struct iovec *iov, int iovcnt)
+{
+    MemoryStream *stream = opaque;
+    size_t total = 0, len;
+    int i;
+
+    for (i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+    }
+    total = len = io_len(stream, total);
+    for (i = 0; i < iovcnt && len > 0; i++) {
+        size_t chunk = MIN(iov[i].iov_len, len);
+
+        g_byte_array_append(stream->output, iov[i].iov_base, chunk);
+        len -= chunk;
+    }
+    stream->num_writes++;
+    return total;
+}
+
+/* Create a WebSocket, @extensions being the extensions requested by the
+ * client if any. The reply of the server is returned in @reply */
+static RedsWebSocket *memory_websocket_new_full(MemoryStream *stream, const char *extensions,
+                                                int compression, char **reply)
+{
+    RedsWebSocket *ws;
+    char *request;
+
+    memset(stream, 0, sizeof(*stream));
+    stream->input = g_byte_array_new();
+    stream->output = g_byte_array_new();
+    request = g_strdup_printf(HANDSHAKE_END "%s%s%s\r\n",
+                              extensions ? "Sec-WebSocket-Extensions: " : "",
+                              extensions ? extensions : "",
+                              extensions ? "\r\n" : "");
+    g_byte_array_append(stream->input, (const uint8_t *) request, strlen(request));
+    g_free(request);
+
+    ws = websocket_new(HANDSHAKE_START, strlen(HANDSHAKE_START), stream, compression,
+                       stream_read, stream_write, stream_writev);
+    g_assert_nonnull(ws);
+    g_byte_array_append(stream->output, (const uint8_t *) "", 1);
+    g_assert_nonnull(strstr((const char *) stream->output->data, "101 Switching Protocols"));
+    if (reply) {
+        *reply = g_strdup((const char *) stream->output->data);
+    }
+
+    g_byte_array_set_size(stream->input, 0);
+    g_byte_array_set_size(stream->output, 0);
+    stream->input_pos = 0;
+    return ws;
+}
+
+static RedsWebSocket *memory_websocket_new(MemoryStream *stream)
+{
+    return memory_websocket_new_full(stream, NULL, WEBSOCKET_DEFAULT_COMPRESSION, NULL);
+}
+
+static void memory_websocket_free(RedsWebSocket *ws, MemoryStream *stream)
+{
+    websocket_free(ws);
+    g_byte_array_unref(stream->input);
+    g_byte_array_unref(stream->output);
+}
+
+/* Append a masked frame as a client would send it */
+static void append_client_frame(GByteArray *out, uint8_t type,
+                                const uint8_t *data, size_t len, uint32_t mask)
+{
+    uint8_t header[14];
+    size_t header_len = 2;
+    size_t i;
+
+    header[0] = type;
+    if (len >= 65536) {
+        header[1] = 0x80 | 127;
+        for (i = 0; i < 8; i++) {
+            header[2 + i] = (uint64_t) len >> (56 - i * 8);
+        }
+        header_len += 8;
+    } else if (len >= 126) {
+        header[1] = 0x80 | 126;
+        header[2] = len >> 8;
+        header[3] = len;
+        header_len += 2;
+    } else {
+        header[1] = 0x80 | len;
+    }
+    memcpy(header + header_len, &mask, 4);
+    g_byte_array_append(out, header, header_len + 4);
+
+    for (i = 0; i < len; i++) {
+        uint8_t byte = data[i] ^ header[header_len + i % 4];
+        g_byte_array_append(out, &byte, 1);
+    }
+}
+
+/* Append the data of a compressed message to @out */
+static void inflate_message(z_stream *stream, GByteArray *out, const uint8_t *data, size_t len)
+{
+    static const uint8_t tail[] = { 0x00, 0x00, 0xff, 0xff };
+    uint8_t buf[4096];
+    int pass;
+
+    for (pass = 0; pass < 2; pass++) {
+        stream->next_in = pass ? (uint8_t *) tail : (uint8_t *) data;
+        stream->avail_in = pass ? sizeof(tail) : len;
+        do {
+            stream->next_out = buf;
+            stream->avail_out = sizeof(buf);
+            g_assert_cmpint(inflate(stream, Z_SYNC_FLUSH), !=, Z_DATA_ERROR);
+            g_byte_array_append(out, buf, sizeof(buf) - stream->avail_out);
+        } while (stream->avail_out == 0);
+        g_assert_cmpuint(stream->avail_in, ==, 0);
+    }
+}
+
+/* Parse the frames written by the server, returning their payload.
+ * Compressed frames are allowed if @stream is set and are inflated with
+ * it, their number is returned in @num_compressed */
+static GByteArray *parse_server_frames(const GByteArray *frames, unsigned int *num_frames,
+                                       z_stream *stream, unsigned int *num_compressed)
+{
+    GByteArray *payload = g_byte_array_new();
+    size_t pos = 0;
+
+    *num_frames = 0;
+    if (num_compressed) {
+        *num_compressed = 0;
+    }
+    while (pos < frames->len) {
+        const uint8_t *header = frames->data + pos;
+        uint64_t len = header[1] & 0x7f;
+        size_t header_len = 2;
+        int i;
+
+        if (stream && (header[0] & RSV1)) {
+            g_assert_cmpint(header[0], ==, WEBSOCKET_BINARY_FINAL | RSV1);
+        } else {
+            g_assert_cmpint(header[0], ==, WEBSOCKET_BINARY_FINAL);
+        }
+        g_assert_cmpint(header[1] & 0x80, ==, 0);
+        if (len == 127) {
+            len = 0;
+            for (i = 0; i < 8; i++) {
+                len = (len << 8) | header[2 + i];
+            }
+            header_len += 8;
+        } else if (len == 126) {
+            len = (header[2] << 8) | header[3];
+            header_len += 2;
+        }
+        g_assert_cmpuint(pos + header_len + len, <=, frames->len);
+        if (header[0] & RSV1) {
+            inflate_message(stream, payload, header + header_len, len);
+            (*num_compressed)++;
+        } else {
+            g_byte_array_append(payload, header + header_len, len);
+        }
+        pos += header_len + len;
+        (*num_frames)++;
+    }
+    return payload;
+}
+
+static void fill_random(GRand *rand, uint8_t *data, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        data[i] = g_rand_int(rand);
+    }
+}
+
+/* Fill with data compressing well, like most of the protocol messages */
+static void fill_compressible(GRand *rand, uint8_t *data, size_t len)
+{
+    static const char *const words[] = {
+        "spice", "display", "cursor", "surface", "draw", "copy", "fill", "stream",
+    };
+    size_t i = 0;
+
+    while (i < len) {
+        const char *word = words[g_rand_int_range(rand, 0, G_N_ELEMENTS(words))];
+        size_t word_len = MIN(strlen(word), len - i);
+
+        memcpy(data + i, word, word_len);
+        i += word_len;
+        if (i < len) {
+            data[i++] = g_rand_int_range(rand, 0, 4) ? ' ' : g_rand_int(rand);
+        }
+    }
+}
+
+static void deflate_init(z_stream *stream)
+{
+    memset(stream, 0, sizeof(*stream));
+    g_assert_cmpint(deflateInit2(stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+                                 Z_DEFAULT_STRATEGY), ==, Z_OK);
+}
+
+static void inflate_init(z_stream *stream)
+{
+    memset(stream, 0, sizeof(*stream));
+    g_assert_cmpint(inflateInit2(stream, -15), ==, Z_OK);
+}
+
+/* Append a message compressed by @stream as a client would send it,
+ * split in @num_frames frames */
+static void append_client_deflated_message(GByteArray *out, z_stream *stream, GRand *rand,
+                                           const uint8_t *data, size_t len,
+                                           unsigned int num_frames)
+{
+    uint8_t *compressed = g_malloc(deflateBound(stream, len) + 16);
+    size_t compressed_len, pos = 0;
+    unsigned int i;
+
+    stream->next_in = (uint8_t *) data;
+    stream->avail_in = len;
+    stream->next_out = compressed;
+    stream->avail_out = deflateBound(stream, len) + 16;
+    g_assert_cmpint(deflate(stream, Z_SYNC_FLUSH), ==, Z_OK);
+    g_assert_cmpuint(stream->avail_in, ==, 0);
+    compressed_len = stream->next_out - compressed - 4;
+    g_assert_cmpint(memcmp(compressed + compressed_len, "\x00\x00\xff\xff", 4), ==, 0);
+
+    for (i = 0; i < num_frames; i++) {
+        size_t frame_len = i == num_frames - 1 ? compressed_len - pos
+                         : g_rand_int_range(rand, 0, compressed_len - pos + 1);
+        uint8_t type = i == 0 ? WEBSOCKET_BINARY | RSV1 : 0;
+
+        if (i == num_frames - 1) {
+            type |= WEBSOCKET_FINAL;
+        }
+        append_client_frame(out, type, compressed + pos, frame_len, g_rand_int(rand));
+        pos += frame_len;
+    }
+    g_free(compressed);
+}
+
+static void test_websocket_read(void)
+{
+    GRand *rand = g_rand_new_with_seed(0x3eb);
+    MemoryStream stream;
+    RedsWebSocket *ws = memory_websocket_new(&stream);
+    GByteArray *expected = g_byte_array_new();
+    GByteArray *received = g_byte_array_new();
+    uint8_t buf[70000 + 16];
+    int i;
+
+    for (i = 0; i < 300; i++) {
+        size_t len = g_rand_int_range(rand, 0, i % 50 ? 2000 : 70000);
+        size_t pos = expected->len;
+
+        g_byte_array_set_size(expected, pos + len);
+        fill_random(rand, expected->data + pos, len);
+        append_client_frame(stream.input, WEBSOCKET_BINARY_FINAL, expected->data + pos, len, g_rand_int(rand));
+    }
+
+    /* read in random chunks at random alignments */
+    stream.rand = rand;
+    while (stream.input_pos < stream.input->len) {
+        unsigned int offset = g_rand_int_range(rand, 0, 16);
+        unsigned int flags;
+        int rc = websocket_read(ws, buf + offset,
+                                g_rand_int_range(rand, 1, sizeof(buf) - offset), &flags);
+
+        if (rc < 0) {
+            g_assert_cmpint(errno, ==, EAGAIN);
+            continue;
+        }
+        g_byte_array_append(received, buf + offset, rc);
+    }
+    g_assert_cmpuint(received->len, ==, expected->len);
+    g_assert_cmpint(memcmp(received->data, expected->data, expected->len), ==, 0);
+
+    g_byte_array_unref(expected);
+    g_byte_array_unref(received);
+    memory_websocket_free(ws, &stream);
+    g_rand_free(rand);
+}
+
+/* Write @len bytes of @data split in @iovcnt buffers, retrying the
+ * short writes */
+static void write_all(RedsWebSocket *ws, const uint8_t *data, size_t len, int iovcnt)
+{
+    struct iovec iov[8];
+    size_t written = 0;
+
+    while (written < len) {
+        size_t left = len - written;
+        int rc, i, n = 0;
+
+        if (iovcnt == 1) {
+            rc = websocket_write(ws, data + written, left, WEBSOCKET_BINARY_FINAL);
+        } else {
+            size_t pos = written;
+
+            for (i = 0; i < iovcnt; i++) {
+                size_t chunk = i == iovcnt - 1 ? left : MIN(left, len / iovcnt);
+
+                iov[n].iov_base = (uint8_t *) data + pos;
+                iov[n++].iov_len = chunk;
+                pos += chunk;
+                left -= chunk;
+            }
+            rc = websocket_writev(ws, iov, n, WEBSOCKET_BINARY_FINAL);
+        }
+        if (rc < 0) {
+            g_assert_cmpint(errno, ==, EAGAIN);
+            continue;
+        }
+        written += rc;
+    }
+}
+
+static void test_websocket_write(gconstpointer user_data)
+{
+    int iovcnt = GPOINTER_TO_INT(user_data);
+    GRand *rand = g_rand_new_with_seed(0x3eb);
+    MemoryStream stream;
+    RedsWebSocket *ws = memory_websocket_new(&stream);
+    GByteArray *expected = g_byte_array_new();
+    GByteArray *payload;
+    unsigned int num_frames;
+    int i;
+
+    stream.rand = rand;
+    for (i = 0; i < 300; i++) {
+        size_t len = g_rand_int_range(rand, 1, i % 50 ? 3000 : 70000);
+        size_t pos = expected->len;
+
+        g_byte_array_set_size(expected, pos + len);
+        fill_random(rand, expected->data + pos, len);
+        write_all(ws, expected->data + pos, len, iovcnt);
+    }
+    payload = parse_server_frames(stream.output, &num_frames, NULL, NULL);
+    g_assert_cmpuint(payload->len, ==, expected->len);
+    g_assert_cmpint(memcmp(payload->data, expected->data, expected->len), ==, 0);
+    /* each write starts at most one frame */
+    g_assert_cmpuint(num_frames, <=, stream.num_writes);
+
+    g_byte_array_unref(payload);
+    g_byte_array_unref(expected);
+    memory_websocket_free(ws, &stream);
+    g_rand_free(rand);
+}
+
+static void test_websocket_deflate_negotiation(void)
+{
+    static const struct {
+        const char *offer;
+        const char *response;
+    } cases[] = {
+        { NULL, NULL },
+        { "x-webkit-deflate-frame", NULL },
+        { DEFLATE_OFFER, "permessage-deflate\r\n" },
+        { "permessage-deflate; server_no_context_takeover; client_no_context_takeover",
+          "permessage-deflate; server_no_context_takeover\r\n" },
+        { "permessage-deflate; server_max_window_bits=\"10\"",
+          "permessage-deflate; server_max_window_bits=10\r\n" },
+        /* zlib can't produce streams with a window of 8 bits */
+        { "permessage-deflate; server_max_window_bits=8, permessage-deflate",
+          "permessage-deflate\r\n" },
+        { "permessage-deflate; unknown_param", NULL },
+        { "permessage-deflate; client_no_context_takeover; client_no_context_takeover", NULL },
+        { "permessage-deflate; server_max_window_bits=16", NULL },
+    };
+    unsigned int i;
+
+    for (i = 0; i < G_N_ELEMENTS(cases); i++) {
+        MemoryStream stream;
+        RedsWebSocket *ws;
+        char *reply;
+        const char *extensions;
+
+        ws = memory_websocket_new_full(&stream, cases[i].offer,
+                                       WEBSOCKET_DEFAULT_COMPRESSION, &reply);
+        extensions = strstr(reply, "Sec-WebSocket-Extensions: ");
+        if (cases[i].response) {
+            g_assert_nonnull(extensions);
+            g_assert_true(g_str_has_prefix(extensions + strlen("Sec-WebSocket-Extensions: "),
+                                           cases[i].response));
+        } else {
+            g_assert_null(extensions);
+        }
+        g_free(reply);
+        memory_websocket_free(ws, &stream);
+    }
+
+    /* the compression can be disabled */
+    {
+        MemoryStream stream;
+        RedsWebSocket *ws;
+        char *reply;
+
+        ws = memory_websocket_new_full(&stream, DEFLATE_OFFER, 0, &reply);
+        g_assert_null(strstr(reply, "Sec-WebSocket-Extensions"));
+        g_free(reply);
+        memory_websocket_free(ws, &stream);
+    }
+}
+
+static void test_websocket_deflate_read(void)
+{
+    GRand *rand = g_rand_new_with_seed(0x3eb);
+    MemoryStream stream;
+    RedsWebSocket *ws = memory_websocket_new_full(&stream, DEFLATE_OFFER,
+                                                  WEBSOCKET_DEFAULT_COMPRESSION, NULL);
+    GByteArray *expected = g_byte_array_new();
+    GByteArray *received = g_byte_array_new();
+    z_stream client;
+    uint8_t buf[70000 + 16];
+    int i;
+
+    /* compressed messages, with the context kept between them, mixed
+     * with uncompressed ones */
+    deflate_init(&client);
+    for (i = 0; i < 300; i++) {
+        size_t len = g_rand_int_range(rand, 0, i % 50 ? 2000 : 70000);
+        size_t pos = expected->len;
+
+        g_byte_array_set_size(expected, pos + len);
+        if (i % 7 == 0) {
+            fill_random(rand, expected->data + pos, len);
+            append_client_frame(stream.input, WEBSOCKET_BINARY_FINAL,
+                                expected->data + pos, len, g_rand_int(rand));
+        } else {
+            fill_compressible(rand, expected->data + pos, len);
+            append_client_deflated_message(stream.input, &client, rand,
+                                           expected->data + pos, len,
+                                           g_rand_int_range(rand, 1, 4));
+        }
+    }
+    deflateEnd(&client);
+
+    stream.rand = rand;
+    while (stream.input_pos < stream.input->len) {
+        unsigned int offset = g_rand_int_range(rand, 0, 16);
+        unsigned int flags;
+        int rc = websocket_read(ws, buf + offset,
+                                g_rand_int_range(rand, 1, sizeof(buf) - offset), &flags);
+
+        if (rc < 0) {
+            g_assert_cmpint(errno, ==, EAGAIN);
+            continue;
+        }
+        g_byte_array_append(received, buf + offset, rc);
+    }
+    g_assert_cmpuint(received->len, ==, expected->len);
+    g_assert_cmpint(memcmp(received->data, expected->data, expected->len), ==, 0);
+
+    g_byte_array_unref(expected);
+    g_byte_array_unref(received);
+    memory_websocket_free(ws, &stream);
+    g_rand_free(rand);
+}
+
+static void test_websocket_deflate_write(gconstpointer user_data)
+{
+    const char *offer = user_data;
+    GRand *rand = g_rand_new_with_seed(0x3eb);
+    MemoryStream stream;
+    RedsWebSocket *ws = memory_websocket_new_full(&stream, offer,
+                                                  WEBSOCKET_DEFAULT_COMPRESSION, NULL);
+    GByteArray *expected = g_byte_array_new();
+    GByteArray *payload;
+    unsigned int num_frames, num_compressed;
+    z_stream client;
+    int i;
+
+    stream.rand = rand;
+    for (i = 0; i < 300; i++) {
+        size_t len = g_rand_int_range(rand, 1, i % 50 ? 3000 : 70000);
+        size_t pos = expected->len;
+
+        g_byte_array_set_size(expected, pos + len);
+        fill_compressible(rand, expected->data + pos, len);
+        write_all(ws, expected->data + pos, len, i % 2 ? 1 : 3);
+    }
+    g_assert_cmpuint(stream.output->len, <, expected->len / 2);
+
+    inflate_init(&client);
+    payload = parse_server_frames(stream.output, &num_frames, &client, &num_compressed);
+    inflateEnd(&client);
+    g_assert_cmpuint(payload->len, ==, expected->len);
+    g_assert_cmpint(memcmp(payload->data, expected->data, expected->len), ==, 0);
+    /* the small messages are not compressed */
+    g_assert_cmpuint(num_compressed, >, 0);
+    g_assert_cmpuint(num_compressed, <, num_frames);
+
+    g_byte_array_unref(payload);
+    g_byte_array_unref(expected);
+    memory_websocket_free(ws, &stream);
+    g_rand_free(rand);
+}
+
+static void test_websocket_deflate_incompressible(void)
+{
+    GRand *rand = g_rand_new_with_seed(0x3eb);
+    MemoryStream stream;
+    RedsWebSocket *ws = memory_websocket_new_full(&stream, DEFLATE_OFFER,
+                                                  WEBSOCKET_DEFAULT_COMPRESSION, NULL);
+    GByteArray *expected = g_byte_array_new();
+    GByteArray *payload;
+    unsigned int num_frames, num_compressed;
+    z_stream client;
+    int i;
+
+    /* already compressed data is sent as is, then compressible data is
+     * compressed again once the compression is retried */
+    for (i = 0; i < 200; i++) {
+        size_t len = 4096;
+        size_t pos = expected->len;
+
+        g_byte_array_set_size(expected, pos + len);
+        if (i < 100) {
+            fill_random(rand, expected->data + pos, len);
+        } else {
+            fill_compressible(rand, expected->data + pos, len);
+        }
+        write_all(ws, expected->data + pos, len, 1);
+    }
+
+    inflate_init(&client);
+    payload = parse_server_frames(stream.output, &num_frames, &client, &num_compressed);
+    inflateEnd(&client);
+    g_assert_cmpuint(payload->len, ==, expected->len);
+    g_assert_cmpint(memcmp(payload->data, expected->data, expected->len), ==, 0);
+    g_assert_cmpuint(num_frames, ==, 200);
+    g_assert_cmpuint(num_compressed, >, 0);
+    g_assert_cmpuint(num_compressed, <, 100);
+
+    g_byte_array_unref(payload);
+    g_byte_array_unref(expected);
+    memory_websocket_free(ws, &stream);
+    g_rand_free(rand);
+}
+
+/* A message following a partially written frame is compressed and sent in
+ * the same write as the rest of the frame */
+static void test_websocket_deflate_write_after_partial(void)
+{
+    GRand *rand = g_rand_new_with_seed(0x3eb);
+    MemoryStream stream;
+    RedsWebSocket *ws = memory_websocket_new_full(&stream, DEFLATE_OFFER,
+                                                  WEBSOCKET_DEFAULT_COMPRESSION, NULL);
+    uint8_t data[1000 + 4096];
+    GByteArray *payload;
+    unsigned int num_frames, num_compressed;
+    struct iovec iov[2];
+    z_stream client;
+    int rc;
+
+    fill_random(rand, data, 1000);
+    fill_compressible(rand, data + 1000, 4096);
+
+    /* the random data is not compressed, only 4 bytes of header and
+     * 496 bytes of payload are written */
+    stream.max_write = 500;
+    iov[0].iov_base = data;
+    iov[0].iov_len = 1000;
+    rc = websocket_writev(ws, iov, 1, WEBSOCKET_BINARY_FINAL);
+    g_assert_cmpint(rc, ==, 496);
+
+    stream.max_write = 0;
+    stream.num_writes = 0;
+    iov[0].iov_base = data + 496;
+    iov[0].iov_len = 1000 - 496;
+    iov[1].iov_base = data + 1000;
+    iov[1].iov_len = 4096;
+    rc = websocket_writev(ws, iov, 2, WEBSOCKET_BINARY_FINAL);
+    g_assert_cmpint(rc, ==, sizeof(data) - 496);
+    g_assert_cmpuint(stream.num_writes, ==, 1);
+
+    inflate_init(&client);
+    payload = parse_server_frames(stream.output, &num_frames, &client, &num_compressed);
+    inflateEnd(&client);
+    g_assert_cmpuint(payload->len, ==, sizeof(data));
+    g_assert_cmpint(memcmp(payload->data, data, sizeof(data)), ==, 0);
+    g_assert_cmpuint(num_frames, ==, 2);
+    g_assert_cmpuint(num_compressed, ==, 1);
+    g_assert_cmpuint(stream.output->len, <, sizeof(data) - 2048);
+
+    g_byte_array_unref(payload);
+    memory_websocket_free(ws, &stream);
+    g_rand_free(rand);
+}
+
+static void test_websocket_perf(void)
+{
+    const size_t frame_len = 64 * 1024;
+    const unsigned int num_frames = 1024;
+    GRand *rand = g_rand_new_with_seed(0x3eb);
+    MemoryStream stream;
+    RedsWebSocket *ws = memory_websocket_new(&stream);
+    uint8_t *data = g_malloc(frame_len);
+    struct iovec iov[16];
+    unsigned int i;
+    unsigned int flags;
+    double elapsed;
+
+    fill_random(rand, data, frame_len);
+    for (i = 0; i < num_frames; i++) {
+        append_client_frame(stream.input, WEBSOCKET_BINARY_FINAL, data, frame_len, g_rand_int(rand));
+    }
+
+    g_test_timer_start();
+    while (websocket_read(ws, data, frame_len, &flags) > 0) {
+        continue;
+    }
+    elapsed = g_test_timer_elapsed();
+    g_test_message("read: %.1f MiB/s", num_frames * frame_len / elapsed / (1024 * 1024));
+
+    /* messages of 1 KiB written 16 at a time */
+    for (i = 0; i < G_N_ELEMENTS(iov); i++) {
+        iov[i].iov_base = data + i * 1024;
+        iov[i].iov_len = 1024;
+    }
+    g_test_timer_start();
+    for (i = 0; i < num_frames * 4; i++) {
+        g_byte_array_set_size(stream.output, 0);
+        g_assert_cmpint(websocket_writev(ws, iov, G_N_ELEMENTS(iov), WEBSOCKET_BINARY_FINAL),
+                        ==, 16 * 1024);
+    }
+    elapsed = g_test_timer_elapsed();
+    g_test_message("writev: %.1f MiB/s", num_frames * 4 * 16 / elapsed / 1024);
+
+    g_free(data);
+    memory_websocket_free(ws, &stream);
+    g_rand_free(rand);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/websocket/read", test_websocket_read);
+    g_test_add_data_func("/server/websocket/write", GINT_TO_POINTER(1), test_websocket_write);
+    g_test_add_data_func("/server/websocket/writev", GINT_TO_POINTER(3), test_websocket_write);
+    g_test_add_func("/server/websocket/deflate/negotiation", test_websocket_deflate_negotiation);
+    g_test_add_func("/server/websocket/deflate/read", test_websocket_deflate_read);
+    g_test_add_data_func("/server/websocket/deflate/write", DEFLATE_OFFER,
+                         test_websocket_deflate_write);
+    g_test_add_data_func("/server/websocket/deflate/write-no-context-takeover",
+                         DEFLATE_OFFER "; server_no_context_takeover",
+                         test_websocket_deflate_write);
+    g_test_add_func("/server/websocket/deflate/write-after-partial",
+                    test_websocket_deflate_write_after_partial);
+    g_test_add_func("/server/websocket/deflate/incompressible",
+                    test_websocket_deflate_incompressible);
+    if (g_test_perf()) {
+        g_test_add_func("/server/websocket/perf", test_websocket_perf);
+    }
+
+    return g_test_run();
+}
@@ -206,6 +206,7 @@ handle_client(int new_sock)
     wait_for(new_sock, POLLIN);
 
     RedsWebSocket *ws = websocket_new("", 0, GINT_TO_POINTER(new_sock),
+                                      WEBSOCKET_DEFAULT_COMPRESSION,
                                       ws_read, ws_write, ws_writev);
     assert(ws);
 
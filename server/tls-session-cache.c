@@ -0,0 +1,242 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 agent <agent@local>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include <config.h>
+
+#include <pthread.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#else
+#include <openssl/hmac.h>
+#endif
+
+#include "tls-session-cache.h"
+
+#define TICKET_KEY_NAME_LEN 16
+
+typedef struct TicketKey {
+    uint8_t name[TICKET_KEY_NAME_LEN];
+    uint8_t aes_key[32];
+    uint8_t hmac_key[32];
+} TicketKey;
+
+struct TlsSessionCache {
+    /* the handshakes can run in several threads */
+    pthread_mutex_t lock;
+
+    unsigned int ticket_key_lifetime;
+    red_time_t (*get_time_ns)(void);
+    /* key of the new tickets */
+    TicketKey key;
+    /* key replaced by the last rotation, still accepted */
+    TicketKey previous_key;
+    bool has_previous_key;
+    /* time of the last rotation in seconds */
+    int64_t key_time;
+
+    RedStatNode stat;
+    RedStatCounter full_counter;
+    RedStatCounter full_time_counter;
+    RedStatCounter resumed_counter;
+    RedStatCounter resumed_time_counter;
+    RedStatCounter key_rotations_counter;
+};
+
+static bool ticket_key_generate(TicketKey *key)
+{
+    if (RAND_bytes((unsigned char *) key, sizeof(*key)) != 1) {
+        red_dump_openssl_errors();
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* Rotate the ticket keys if the current one is too old, called locked */
+static bool cache_rotate_keys(TlsSessionCache *cache)
+{
+    int64_t now = cache->get_time_ns() / NSEC_PER_SEC;
+    int64_t elapsed = now - cache->key_time;
+    TicketKey key;
+
+    if (elapsed < cache->ticket_key_lifetime) {
+        return TRUE;
+    }
+    if (!ticket_key_generate(&key)) {
+        return FALSE;
+    }
+    cache->previous_key = cache->key;
+    /* the key would have been dropped if rotated on time */
+    cache->has_previous_key = elapsed < 2 * (int64_t) cache->ticket_key_lifetime;
+    cache->key = key;
+    cache->key_time = now;
+    OPENSSL_cleanse(&key, sizeof(key));
+    stat_inc_counter(cache->key_rotations_counter, 1);
+    return TRUE;
+}
+
+/* Get the key to encrypt a new ticket or to decrypt the ticket with
+ * @key_name. Return values are the ones of the OpenSSL ticket callbacks */
+static int cache_get_ticket_key(TlsSessionCache *cache, unsigned char *key_name,
+                                int enc, TicketKey *key)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&cache->lock);
+    if (!cache_rotate_keys(cache)) {
+        ret = -1;
+    } else if (enc) {
+        *key = cache->key;
+        memcpy(key_name, key->name, TICKET_KEY_NAME_LEN);
+        ret = 1;
+    } else if (memcmp(key_name, cache->key.name, TICKET_KEY_NAME_LEN) == 0) {
+        *key = cache->key;
+        ret = 1;
+    } else if (cache->has_previous_key &&
+               memcmp(key_name, cache->previous_key.name, TICKET_KEY_NAME_LEN) == 0) {
+        /* accepted but renewed with the current key */
+        *key = cache->previous_key;
+        ret = 2;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return ret;
+}
+
+static int ticket_cipher_init(SSL *ssl, unsigned char *key_name, unsigned char *iv,
+                              EVP_CIPHER_CTX *cipher_ctx, TicketKey *key, int enc)
+{
+    TlsSessionCache *cache = SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+    const EVP_CIPHER *cipher = EVP_aes_256_cbc();
+    int ret;
+
+    if (enc && RAND_bytes(iv, EVP_CIPHER_iv_length(cipher)) != 1) {
+        return -1;
+    }
+    ret = cache_get_ticket_key(cache, key_name, enc, key);
+    if (ret > 0 && !EVP_CipherInit_ex(cipher_ctx, cipher, NULL, key->aes_key, iv, enc)) {
+        ret = -1;
+    }
+    return ret;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static int ticket_key_cb(SSL *ssl, unsigned char *key_name, unsigned char *iv,
+                         EVP_CIPHER_CTX *cipher_ctx, EVP_MAC_CTX *mac_ctx, int enc)
+{
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, (char *) "SHA256", 0),
+        OSSL_PARAM_construct_end(),
+    };
+    TicketKey key;
+    int ret;
+
+    ret = ticket_cipher_init(ssl, key_name, iv, cipher_ctx, &key, enc);
+    if (ret > 0 && !EVP_MAC_init(mac_ctx, key.hmac_key, sizeof(key.hmac_key), params)) {
+        ret = -1;
+    }
+    OPENSSL_cleanse(&key, sizeof(key));
+    return ret;
+}
+#else
+static int ticket_key_cb(SSL *ssl, unsigned char *key_name, unsigned char *iv,
+                         EVP_CIPHER_CTX *cipher_ctx, HMAC_CTX *hmac_ctx, int enc)
+{
+    TicketKey key;
+    int ret;
+
+    ret = ticket_cipher_init(ssl, key_name, iv, cipher_ctx, &key, enc);
+    if (ret > 0 && !HMAC_Init_ex(hmac_ctx, key.hmac_key, sizeof(key.hmac_key),
+                                 EVP_sha256(), NULL)) {
+        ret = -1;
+    }
+    OPENSSL_cleanse(&key, sizeof(key));
+    return ret;
+}
+#endif
+
+TlsSessionCache *tls_session_cache_new(RedsState *reds, SSL_CTX *ctx,
+                                       const TlsSessionConfig *config)
+{
+    TlsSessionCache *cache = g_new0(TlsSessionCache, 1);
+
+    pthread_mutex_init(&cache->lock, NULL);
+    stat_init_node(&cache->stat, reds, NULL, "tls", TRUE);
+    stat_init_counter(&cache->full_counter, reds, &cache->stat,
+                      "full_handshakes", TRUE);
+    stat_init_counter(&cache->full_time_counter, reds, &cache->stat,
+                      "full_handshakes_us", TRUE);
+    stat_init_counter(&cache->resumed_counter, reds, &cache->stat,
+                      "resumed_handshakes", TRUE);
+    stat_init_counter(&cache->resumed_time_counter, reds, &cache->stat,
+                      "resumed_handshakes_us", TRUE);
+    stat_init_counter(&cache->key_rotations_counter, reds, &cache->stat,
+                      "ticket_key_rotations", TRUE);
+
+    if (config->cache_size > 0) {
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(ctx, config->cache_size);
+    } else {
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+    }
+    if (config->timeout > 0) {
+        SSL_CTX_set_timeout(ctx, config->timeout);
+    }
+
+    cache->ticket_key_lifetime = config->ticket_key_lifetime;
+    if (cache->ticket_key_lifetime == 0) {
+        SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+        return cache;
+    }
+    cache->get_time_ns = config->get_time_ns ? config->get_time_ns : spice_get_monotonic_time_ns;
+    cache->key_time = cache->get_time_ns() / NSEC_PER_SEC;
+    if (!ticket_key_generate(&cache->key)) {
+        tls_session_cache_free(cache);
+        return NULL;
+    }
+    SSL_CTX_set_app_data(ctx, cache);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, ticket_key_cb);
+#else
+    SSL_CTX_set_tlsext_ticket_key_cb(ctx, ticket_key_cb);
+#endif
+    return cache;
+}
+
+void tls_session_cache_free(TlsSessionCache *cache)
+{
+    if (!cache) {
+        return;
+    }
+    OPENSSL_cleanse(&cache->key, sizeof(cache->key));
+    OPENSSL_cleanse(&cache->previous_key, sizeof(cache->previous_key));
+    pthread_mutex_destroy(&cache->lock);
+    g_free(cache);
+}
+
+void tls_session_cache_handshake_done(TlsSessionCache *cache, bool resumed, uint64_t time_ns)
+{
+    pthread_mutex_lock(&cache->lock);
+    if (resumed) {
+        stat_inc_counter(cache->resumed_counter, 1);
+        stat_inc_counter(cache->resumed_time_counter, time_ns / 1000);
+    } else {
+        stat_inc_counter(cache->full_counter, 1);
+        stat_inc_counter(cache->full_time_counter, time_ns / 1000);
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,63 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 agent <agent@local>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TLS_SESSION_CACHE_H_
+#define TLS_SESSION_CACHE_H_
+
+#include <openssl/ssl.h>
+
+#include "red-common.h"
+#include "stat.h"
+
+/* Resumption of the TLS sessions of the clients.
+ *
+ * A client opens a connection for each channel and reconnects all of them
+ * after a network failure. Resuming the session of the first connection
+ * avoids a full handshake for the others.
+ *
+ * The sessions are kept in the cache of the SSL context and in session
+ * tickets. The tickets are encrypted with keys rotated regularly, the
+ * previous key is still accepted for a lifetime so the tickets issued just
+ * before a rotation can be used; such tickets are renewed. The duration of
+ * the handshakes is reported in the statistics.
+ */
+typedef struct TlsSessionCache TlsSessionCache;
+
+typedef struct TlsSessionConfig {
+    /* number of sessions kept by the server, 0 disables the cache */
+    unsigned int cache_size;
+    /* seconds a session can be resumed, 0 for the OpenSSL default */
+    unsigned int timeout;
+    /* seconds between the rotations of the ticket keys, 0 disables the
+     * tickets */
+    unsigned int ticket_key_lifetime;
+    /* clock of the key rotations in nanoseconds, NULL for the monotonic
+     * clock. The tests set it to avoid waiting for the rotations */
+    red_time_t (*get_time_ns)(void);
+} TlsSessionConfig;
+
+/* Configure the session resumption of @ctx. The cache must be freed after
+ * @ctx */
+TlsSessionCache *tls_session_cache_new(RedsState *reds, SSL_CTX *ctx,
+                                       const TlsSessionConfig *config);
+void tls_session_cache_free(TlsSessionCache *cache);
+
+/* Account a completed handshake which took @time_ns */
+void tls_session_cache_handshake_done(TlsSessionCache *cache, bool resumed, uint64_t time_ns);
+
+#endif /* TLS_SESSION_CACHE_H_ */
@@ -200,6 +200,7 @@ Shadow* shadow_new(DrawItem *item, const SpicePoint *delta)
     region_clone(&shadow->base.rgn, &item->base.rgn);
     region_offset(&shadow->base.rgn, delta->x, delta->y);
     ring_item_init(&shadow->base.siblings_link);
+    shadow->base.index_entry.block = NULL;
     region_init(&shadow->on_hold);
     item->shadow = shadow;
 
@@ -214,6 +215,7 @@ Shadow* shadow_new(DrawItem *item, const SpicePoint *delta)
 Container* container_new(DrawItem *item)
 {
     Container *container = g_new(Container, 1);
+    RingIndex *index = ring_index_entry_get_index(&item->base.index_entry);
 
     container->base.type = TREE_ITEM_TYPE_CONTAINER;
     container->base.container = item->base.container;
@@ -221,7 +223,12 @@ Container* container_new(DrawItem *item)
     item->container_root = TRUE;
     region_clone(&container->base.rgn, &item->base.rgn);
     ring_item_init(&container->base.siblings_link);
+    container->base.index_entry.block = NULL;
     ring_add_after(&container->base.siblings_link, &item->base.siblings_link);
+    if (index) {
+        ring_index_add(index, &container->base.siblings_link);
+    }
+    ring_index_remove(&item->base.siblings_link, &item->base.index_entry);
     ring_remove(&item->base.siblings_link);
     ring_init(&container->items);
     ring_add(&container->items, &item->base.siblings_link);
@@ -233,6 +240,7 @@ void container_free(Container *container)
 {
     spice_return_if_fail(ring_is_empty(&container->items));
 
+    ring_index_remove(&container->base.siblings_link, &container->base.index_entry);
     ring_remove(&container->base.siblings_link);
     region_destroy(&container->base.rgn);
     g_free(container);
@@ -247,10 +255,15 @@ void container_cleanup(Container *container)
         if (container->items.next != &container->items) {
             SPICE_VERIFY(SPICE_OFFSETOF(TreeItem, siblings_link) == 0);
             TreeItem *item = (TreeItem *)ring_get_head(&container->items);
+            RingIndex *index = ring_index_entry_get_index(&container->base.index_entry);
+
             spice_assert(item);
             ring_remove(&item->siblings_link);
             ring_add_after(&item->siblings_link, &container->base.siblings_link);
             item->container = container->base.container;
+            if (index) {
+                ring_index_add(index, &item->siblings_link);
+            }
         }
         container_free(container);
         container = next;
@@ -303,6 +316,7 @@ void draw_item_remove_shadow(DrawItem *item)
     }
     shadow = item->shadow;
     item->shadow = NULL;
+    ring_index_remove(&shadow->base.siblings_link, &shadow->base.index_entry);
     ring_remove(&shadow->base.siblings_link);
     region_destroy(&shadow->base.rgn);
     region_destroy(&shadow->on_hold);
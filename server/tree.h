@@ -24,6 +24,7 @@
 #include <common/ring.h>
 
 #include "spice-bitmap-utils.h"
+#include "ring-index.h"
 
 enum {
     TREE_ITEM_TYPE_NONE,
@@ -42,6 +43,8 @@ typedef struct DrawItem DrawItem;
 /* TODO consider GNode instead */
 struct TreeItem {
     RingItem siblings_link;
+    /* only the items at the top level of the tree are indexed */
+    RingIndexEntry index_entry;
     uint32_t type;
     Container *container;
     /* rgn holds the region of the item. As additional items get added to the
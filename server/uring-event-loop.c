@@ -0,0 +1,315 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 agent <agent@local>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include <config.h>
+
+#include <poll.h>
+#include <liburing.h>
+
+#include "uring-event-loop.h"
+
+/* enough for the channels of a few clients, if full the queue is
+ * submitted early */
+#define URING_ENTRIES 256
+
+struct UringEventLoop {
+    GSource source;
+    gpointer ring_tag;
+    struct io_uring ring;
+    /* watches removed while their poll request is still in the kernel */
+    Ring removed_watches;
+};
+
+struct SpiceWatch {
+    UringEventLoop *loop;
+    int fd;
+    SpiceWatchFunc func;
+    void *opaque;
+    int event_mask;
+    /* mask of the poll request in the kernel, 0 if there is none */
+    int polled_mask;
+    /* the poll request is being cancelled to change the mask */
+    bool cancelling;
+    bool dispatching;
+    bool removed;
+    /* the poll request failed, the watch is no longer armed */
+    bool failed;
+    RingItem link;
+};
+
+static struct io_uring_sqe *uring_get_sqe(UringEventLoop *loop)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&loop->ring);
+
+    if (!sqe) {
+        io_uring_submit(&loop->ring);
+        sqe = io_uring_get_sqe(&loop->ring);
+        spice_assert(sqe != NULL);
+    }
+    return sqe;
+}
+
+static unsigned spice_event_to_poll(int event_mask)
+{
+    unsigned events = 0;
+
+    if (event_mask & SPICE_WATCH_EVENT_READ) {
+        events |= POLLIN;
+    }
+    if (event_mask & SPICE_WATCH_EVENT_WRITE) {
+        events |= POLLOUT;
+    }
+    return events;
+}
+
+static int poll_to_spice_event(int revents)
+{
+    int event = 0;
+
+    /* like in event-loop.c the errors are reported as read events */
+    if (revents & (POLLIN | POLLERR | POLLHUP)) {
+        event |= SPICE_WATCH_EVENT_READ;
+    }
+    if (revents & POLLOUT) {
+        event |= SPICE_WATCH_EVENT_WRITE;
+    }
+    return event;
+}
+
+/* Queue a one shot poll request for the current mask of the watch, the
+ * request is submitted at the next iteration of the loop */
+static void watch_arm(SpiceWatch *watch)
+{
+    struct io_uring_sqe *sqe;
+
+    if (watch->event_mask == 0 || watch->removed || watch->failed) {
+        return;
+    }
+    sqe = uring_get_sqe(watch->loop);
+    io_uring_prep_poll_add(sqe, watch->fd, spice_event_to_poll(watch->event_mask));
+    io_uring_sqe_set_data(sqe, watch);
+    watch->polled_mask = watch->event_mask;
+}
+
+static void watch_cancel(SpiceWatch *watch)
+{
+    struct io_uring_sqe *sqe;
+
+    if (watch->polled_mask == 0 || watch->cancelling) {
+        return;
+    }
+    sqe = uring_get_sqe(watch->loop);
+    io_uring_prep_poll_remove(sqe, (uintptr_t) watch);
+    // the completion of the removal itself is ignored
+    io_uring_sqe_set_data(sqe, NULL);
+    watch->cancelling = true;
+}
+
+static void watch_free(SpiceWatch *watch)
+{
+    if (ring_item_is_linked(&watch->link)) {
+        ring_remove(&watch->link);
+    }
+    g_free(watch);
+}
+
+static void watch_complete(SpiceWatch *watch, int res)
+{
+    int events;
+
+    if (res >= 0) {
+        events = poll_to_spice_event(res) & watch->event_mask;
+    } else if (res == -ECANCELED && watch->cancelling) {
+        // cancelled to change the mask, armed again below
+        events = 0;
+    } else {
+        /* the poll request failed, for instance with EBADF if the fd was
+         * closed. Polling again would fail the same way, so report the
+         * requested events instead, the callback then gets the error from
+         * the fd */
+        spice_debug("polling fd %d failed: %s", watch->fd, g_strerror(-res));
+        watch->failed = true;
+        events = watch->event_mask;
+    }
+    watch->polled_mask = 0;
+    watch->cancelling = false;
+
+    if (events && !watch->removed) {
+        // the watch can be changed or removed by the callback
+        watch->dispatching = true;
+        watch->func(watch->fd, events, watch->opaque);
+        watch->dispatching = false;
+    }
+    if (watch->removed) {
+        watch_free(watch);
+        return;
+    }
+    watch_arm(watch);
+}
+
+static gboolean uring_source_prepare(GSource *source, gint *timeout)
+{
+    UringEventLoop *loop = SPICE_CONTAINEROF(source, UringEventLoop, source);
+
+    // one system call for all the requests queued since the last iteration
+    if (io_uring_sq_ready(&loop->ring) > 0) {
+        io_uring_submit(&loop->ring);
+    }
+    *timeout = -1;
+    return io_uring_cq_ready(&loop->ring) > 0;
+}
+
+static gboolean uring_source_check(GSource *source)
+{
+    UringEventLoop *loop = SPICE_CONTAINEROF(source, UringEventLoop, source);
+
+    return io_uring_cq_ready(&loop->ring) > 0;
+}
+
+static gboolean uring_source_dispatch(GSource *source, GSourceFunc callback,
+                                      gpointer user_data)
+{
+    UringEventLoop *loop = SPICE_CONTAINEROF(source, UringEventLoop, source);
+    struct io_uring_cqe *cqe;
+
+    /* only the completions available when starting, the ones of the
+     * requests submitted by the callbacks are handled at the next
+     * iteration */
+    unsigned count = io_uring_cq_ready(&loop->ring);
+
+    while (count-- > 0 && io_uring_peek_cqe(&loop->ring, &cqe) == 0) {
+        SpiceWatch *watch = io_uring_cqe_get_data(cqe);
+        int res = cqe->res;
+
+        io_uring_cqe_seen(&loop->ring, cqe);
+        if (watch) {
+            watch_complete(watch, res);
+        }
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs uring_source_funcs = {
+    .prepare = uring_source_prepare,
+    .check = uring_source_check,
+    .dispatch = uring_source_dispatch,
+};
+
+static SpiceWatch *uring_watch_add(const SpiceCoreInterfaceInternal *iface,
+                                   int fd, int event_mask, SpiceWatchFunc func, void *opaque)
+{
+    SpiceWatch *watch;
+
+    spice_return_val_if_fail(fd != -1, NULL);
+    spice_return_val_if_fail(func != NULL, NULL);
+
+    watch = g_new0(SpiceWatch, 1);
+    watch->loop = iface->uring_loop;
+    watch->fd = fd;
+    watch->func = func;
+    watch->opaque = opaque;
+    watch->event_mask = event_mask;
+    ring_item_init(&watch->link);
+    watch_arm(watch);
+
+    return watch;
+}
+
+static void uring_watch_update_mask(const SpiceCoreInterfaceInternal *iface,
+                                    SpiceWatch *watch, int event_mask)
+{
+    if (watch->event_mask == event_mask) {
+        return;
+    }
+    watch->event_mask = event_mask;
+
+    /* during the callback the watch is armed once it returns, otherwise
+     * the pending request is cancelled and the new mask is requested when
+     * its completion is received */
+    if (watch->polled_mask != 0) {
+        watch_cancel(watch);
+    } else if (!watch->dispatching) {
+        watch_arm(watch);
+    }
+}
+
+static void uring_watch_remove(const SpiceCoreInterfaceInternal *iface,
+                               SpiceWatch *watch)
+{
+    watch->removed = true;
+    watch->event_mask = 0;
+    if (watch->dispatching) {
+        return;
+    }
+    if (watch->polled_mask == 0) {
+        watch_free(watch);
+        return;
+    }
+    // the kernel still references the watch, free it on completion
+    watch_cancel(watch);
+    ring_add(&watch->loop->removed_watches, &watch->link);
+}
+
+bool uring_event_loop_init(SpiceCoreInterfaceInternal *core)
+{
+    UringEventLoop *loop;
+    int ret;
+
+    spice_return_val_if_fail(core->uring_loop == NULL, false);
+
+    loop = (UringEventLoop *) g_source_new(&uring_source_funcs, sizeof(UringEventLoop));
+    ret = io_uring_queue_init(URING_ENTRIES, &loop->ring, 0);
+    if (ret < 0) {
+        spice_debug("io_uring not available: %s", g_strerror(-ret));
+        g_source_unref(&loop->source);
+        return false;
+    }
+    ring_init(&loop->removed_watches);
+    loop->ring_tag = g_source_add_unix_fd(&loop->source, loop->ring.ring_fd, G_IO_IN);
+    g_source_attach(&loop->source, core->main_context);
+
+    core->uring_loop = loop;
+    core->watch_add = uring_watch_add;
+    core->watch_update_mask = uring_watch_update_mask;
+    core->watch_remove = uring_watch_remove;
+    return true;
+}
+
+void uring_event_loop_destroy(SpiceCoreInterfaceInternal *core)
+{
+    UringEventLoop *loop = core->uring_loop;
+    RingItem *link;
+
+    if (!loop) {
+        return;
+    }
+
+    // exiting the ring cancels the pending requests
+    io_uring_queue_exit(&loop->ring);
+    while ((link = ring_get_head(&loop->removed_watches))) {
+        watch_free(SPICE_CONTAINEROF(link, SpiceWatch, link));
+    }
+
+    g_source_remove_unix_fd(&loop->source, loop->ring_tag);
+    g_source_destroy(&loop->source);
+    g_source_unref(&loop->source);
+
+    core->uring_loop = NULL;
+    core->watch_add = event_loop_core.watch_add;
+    core->watch_update_mask = event_loop_core.watch_update_mask;
+    core->watch_remove = event_loop_core.watch_remove;
+}
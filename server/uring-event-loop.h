@@ -0,0 +1,44 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 agent <agent@local>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef URING_EVENT_LOOP_H_
+#define URING_EVENT_LOOP_H_
+
+#include "red-common.h"
+
+/* Watches of a glib based core interface polled with io_uring.
+ *
+ * With the glib watches every iteration of the loop passes all the file
+ * descriptors to poll() and every change of the mask of a watch modifies
+ * the set. Here each watch is a poll request of an io_uring instance: the
+ * loop only waits for the file descriptor of the ring, the requests added,
+ * changed or cancelled during an iteration are submitted together at the
+ * next one and only the ready watches are returned by the kernel.
+ *
+ * The timers are still the glib ones.
+ */
+typedef struct UringEventLoop UringEventLoop;
+
+/* Replace the watch functions of @core, a copy of event_loop_core with its
+ * main_context set. Return false if io_uring is not available, @core being
+ * left unchanged */
+bool uring_event_loop_init(SpiceCoreInterfaceInternal *core);
+/* Release the ring of @core, the loop must not be running anymore */
+void uring_event_loop_destroy(SpiceCoreInterfaceInternal *core);
+
+#endif /* URING_EVENT_LOOP_H_ */
@@ -167,6 +167,13 @@ typedef struct VideoEncoderRateControlCbs {
      *              frames to reach the client.
      */
     void (*update_client_playback_delay)(void *opaque, uint32_t delay_ms);
+
+    /* Returns an estimate of the number of bytes waiting to be sent to the
+     * client, whether they belong to the stream or not.
+     *
+     * This is optional and may be NULL.
+     */
+    uint64_t (*get_pipe_bytes)(void *opaque);
 } VideoEncoderRateControlCbs;
 
 typedef void (*bitmap_ref_t)(gpointer data);
@@ -0,0 +1,542 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 agent <agent@local>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include <config.h>
+
+#include "red-common.h"
+#include "video-rate-control.h"
+
+#define DEFAULT_FPS 30
+
+#define DEFAULT_BIT_RATE (8 * 1024 * 1024)
+/* The minimum bit rate / bit rate increment */
+#define MIN_BIT_RATE (128 * 1024)
+/* Never increase the bit rate by more than this amount */
+#define MAX_BIT_RATE_STEP (1024 * 1024)
+
+/* How much to reduce the bit rate on congestion */
+#define BIT_RATE_CUT 2
+#define BIT_RATE_REDUCE (4.0 / 3.0)
+/* The bit rate settles once the lowest bit rate that failed is within this
+ * factor of the highest one that worked */
+#define BIT_RATE_MARGIN BIT_RATE_REDUCE
+
+/* How often to increase the bit rate */
+#define UP_INTERVAL (MSEC_PER_SEC * 2)
+#define UP_CLIENT_STABLE (MSEC_PER_SEC * 60 * 2)
+#define UP_SERVER_STABLE (MSEC_PER_SEC * 3600 * 4)
+/* Probe above the highest bit rate that worked again after this time */
+#define UP_RESET_MAX (MSEC_PER_SEC * 30)
+/* The encoder must use this part of the bit rate for it to be increased */
+#define UP_MIN_USAGE 0.75
+
+/* The stream starts after lossless frames were sent to the client, so the
+ * first drops do not come from the stream bit rate */
+#define WARMUP_TIME (MSEC_PER_SEC * 3)
+/* Wait for the frames queued before a decrease to be sent before deciding
+ * of another decrease */
+#define DECREASE_HOLD_TIME (MSEC_PER_SEC / 2)
+
+/* The frames taken into account for the effective bit rate */
+#define FRAME_HISTORY_SIZE 21
+
+/* Drop rate over about a second of frames above which the pipe is congested */
+#define SERVER_DROPS_BAD 0.1
+#define SERVER_DROPS_VERY_BAD 0.5
+
+/* The pipe is congested if sending its messages takes longer than this */
+#define MAX_QUEUE_DELAY 300
+
+/* The network queues are filling up if the roundtrip goes over twice the
+ * minimum roundtrip plus this margin (ms) */
+#define ROUNDTRIP_MARGIN 30
+/* The minimum roundtrip is the minimum over this period, for the route to
+ * be allowed to change */
+#define ROUNDTRIP_WINDOW (MSEC_PER_SEC * 30)
+
+/* The margin is the amount of time between the reception of a frame by the
+ * client and the time when it should be displayed. Increasing the bit rate
+ * increases the transmission time and thus reduces the margin.
+ */
+#define LATENCY_MARGIN 0.1
+#define VIDEO_MARGIN_GOOD 0.75
+#define VIDEO_MARGIN_AVERAGE 0.5
+#define VIDEO_MARGIN_BAD 0.3
+#define VIDEO_DELTA_BAD 0.2
+#define VIDEO_DELTA_AVERAGE 0.15
+#define AUDIO_MARGIN_BAD 0.5
+#define AUDIO_VIDEO_RATIO 1.25
+
+typedef enum VideoRateControlStatus {
+    VIDEO_RATE_CONTROL_DECREASING,
+    VIDEO_RATE_CONTROL_INCREASING,
+    VIDEO_RATE_CONTROL_STABLE,
+} VideoRateControlStatus;
+
+typedef struct VideoRateControlFrame {
+    uint32_t mm_time;
+    uint32_t size;
+} VideoRateControlFrame;
+
+struct VideoRateControl {
+    VideoEncoderRateControlCbs cbs;
+
+    uint64_t bit_rate;
+    uint64_t bit_rate_cap;
+
+    /* The last bit rate that let the stream recover from a congestion */
+    uint64_t min_bit_rate;
+    /* Just below the last bit rate that caused a congestion */
+    uint64_t max_bit_rate;
+    uint64_t bit_rate_step;
+    VideoRateControlStatus status;
+    uint32_t increase_interval;
+
+    /* The clock is the mm_time of the frames */
+    bool started;
+    uint32_t start_time;
+    uint32_t now;
+    uint32_t last_change;
+
+    VideoRateControlFrame frames[FRAME_HISTORY_SIZE];
+    uint32_t first_frame;
+    uint32_t num_frames;
+    uint64_t frames_size;
+
+    uint32_t num_frames_encoded;
+    uint32_t num_server_drops;
+
+    uint32_t min_roundtrip;
+    uint32_t window_min_roundtrip;
+    uint32_t window_start;
+    uint32_t last_roundtrip;
+
+    bool has_client_reports;
+    int32_t last_video_margin;
+    int32_t max_video_margin;
+    uint32_t max_audio_margin;
+};
+
+static inline double get_mbps(uint64_t bit_rate)
+{
+    return (double)bit_rate / 1024 / 1024;
+}
+
+static uint32_t get_source_fps(const VideoRateControl *rate_control)
+{
+    uint32_t fps = rate_control->cbs.get_source_fps ?
+        rate_control->cbs.get_source_fps(rate_control->cbs.opaque) : DEFAULT_FPS;
+
+    return MAX(fps, 1);
+}
+
+static uint32_t get_roundtrip_ms(const VideoRateControl *rate_control)
+{
+    return rate_control->cbs.get_roundtrip_ms ?
+        rate_control->cbs.get_roundtrip_ms(rate_control->cbs.opaque) : 0;
+}
+
+uint64_t video_rate_control_get_effective_bit_rate(const VideoRateControl *rate_control)
+{
+    const VideoRateControlFrame *first, *last;
+    uint32_t elapsed;
+
+    if (rate_control->num_frames == 0) {
+        return 0;
+    }
+    first = &rate_control->frames[rate_control->first_frame];
+    last = &rate_control->frames[(rate_control->first_frame + rate_control->num_frames - 1) %
+                                 FRAME_HISTORY_SIZE];
+    /* the last frame lasts until the next one */
+    elapsed = last->mm_time - first->mm_time + MSEC_PER_SEC / get_source_fps(rate_control);
+    return rate_control->frames_size * 8 * MSEC_PER_SEC / elapsed;
+}
+
+uint64_t video_rate_control_get_bit_rate(const VideoRateControl *rate_control)
+{
+    return rate_control->bit_rate;
+}
+
+static void video_rate_control_update_step(VideoRateControl *rate_control)
+{
+    uint64_t range = rate_control->max_bit_rate > rate_control->min_bit_rate ?
+                     rate_control->max_bit_rate - rate_control->min_bit_rate : 0;
+
+    rate_control->bit_rate_step = CLAMP(range / 10, MIN_BIT_RATE, MAX_BIT_RATE_STEP);
+}
+
+static void video_rate_control_set_bit_rate(VideoRateControl *rate_control, uint64_t bit_rate)
+{
+    bool range_changed = FALSE;
+
+    if (bit_rate < MIN_BIT_RATE) {
+        bit_rate = MIN_BIT_RATE;
+    } else if (bit_rate > rate_control->bit_rate && rate_control->bit_rate_cap) {
+        bit_rate = MAX(rate_control->bit_rate, MIN(bit_rate, rate_control->bit_rate_cap));
+    }
+    if (bit_rate == rate_control->bit_rate) {
+        return;
+    }
+
+    if (bit_rate < rate_control->bit_rate) {
+        if (rate_control->status != VIDEO_RATE_CONTROL_DECREASING) {
+            /* the current bit rate caused the congestion */
+            rate_control->max_bit_rate = rate_control->bit_rate - MIN_BIT_RATE;
+            rate_control->status = VIDEO_RATE_CONTROL_DECREASING;
+            range_changed = TRUE;
+        }
+        if (bit_rate < rate_control->min_bit_rate) {
+            rate_control->min_bit_rate = bit_rate;
+            range_changed = TRUE;
+        }
+        /* the margins depended on the previous bit rate */
+        rate_control->max_video_margin = 0;
+        rate_control->max_audio_margin = 0;
+    } else if (rate_control->status == VIDEO_RATE_CONTROL_DECREASING) {
+        /* the stream recovered at the current bit rate */
+        rate_control->min_bit_rate = rate_control->bit_rate;
+        rate_control->status = VIDEO_RATE_CONTROL_INCREASING;
+        range_changed = TRUE;
+    }
+    rate_control->increase_interval = UP_INTERVAL;
+
+    if (range_changed) {
+        video_rate_control_update_step(rate_control);
+        if (rate_control->max_bit_rate / BIT_RATE_MARGIN < rate_control->min_bit_rate) {
+            /* The range of the optimal bit rate is narrow enough. Settle on
+             * its lower end to keep a safety margin and stop rocking the boat.
+             */
+            bit_rate = rate_control->min_bit_rate;
+            rate_control->status = VIDEO_RATE_CONTROL_STABLE;
+            rate_control->increase_interval = rate_control->has_client_reports ?
+                                              UP_CLIENT_STABLE : UP_SERVER_STABLE;
+        }
+    }
+    spice_debug("%u set bit rate %.3fMbps (eff %.3f) range %.3f-%.3f status %d",
+                rate_control->now - rate_control->last_change, get_mbps(bit_rate),
+                get_mbps(video_rate_control_get_effective_bit_rate(rate_control)),
+                get_mbps(rate_control->min_bit_rate), get_mbps(rate_control->max_bit_rate),
+                rate_control->status);
+
+    rate_control->bit_rate = bit_rate;
+    rate_control->last_change = rate_control->now;
+
+    /* The frames preceding the change are not relevant anymore */
+    rate_control->num_frames = 0;
+    rate_control->frames_size = 0;
+}
+
+static void video_rate_control_increase(VideoRateControl *rate_control)
+{
+    if (video_rate_control_get_effective_bit_rate(rate_control) <
+        rate_control->bit_rate * UP_MIN_USAGE) {
+        /* The encoder does not use the bandwidth it has, more would not help */
+        return;
+    }
+
+    if (rate_control->bit_rate >= rate_control->max_bit_rate &&
+        rate_control->now - rate_control->last_change > UP_RESET_MAX) {
+        /* The maximum bit rate seems to be sustainable so it was probably
+         * set too low. Probe for the maximum bit rate again.
+         */
+        rate_control->max_bit_rate = rate_control->bit_rate_cap ?
+                                     rate_control->bit_rate_cap : G_MAXUINT64;
+        rate_control->status = VIDEO_RATE_CONTROL_INCREASING;
+        video_rate_control_update_step(rate_control);
+    }
+    video_rate_control_set_bit_rate(rate_control,
+                                    MIN(rate_control->bit_rate + rate_control->bit_rate_step,
+                                        rate_control->max_bit_rate));
+}
+
+/* @factor: BIT_RATE_CUT or BIT_RATE_REDUCE, 0 to decrement the bit rate */
+static void video_rate_control_decrease(VideoRateControl *rate_control, double factor)
+{
+    uint64_t bit_rate;
+
+    if (factor == 0) {
+        bit_rate = rate_control->bit_rate > rate_control->bit_rate_step ?
+                   rate_control->bit_rate - rate_control->bit_rate_step : 0;
+    } else if (rate_control->bit_rate == rate_control->min_bit_rate) {
+        /* the lowest bit rate that worked does not work anymore */
+        bit_rate = rate_control->bit_rate / factor;
+    } else {
+        bit_rate = MAX(rate_control->min_bit_rate, rate_control->bit_rate / factor);
+    }
+    video_rate_control_set_bit_rate(rate_control, bit_rate);
+}
+
+/* Whether the server side congestion signals come from the current bit
+ * rate */
+static bool video_rate_control_can_decrease(const VideoRateControl *rate_control)
+{
+    uint32_t hold_time;
+
+    if (rate_control->now - rate_control->start_time < WARMUP_TIME) {
+        return FALSE;
+    }
+    if (rate_control->status != VIDEO_RATE_CONTROL_DECREASING) {
+        return TRUE;
+    }
+    hold_time = MAX(DECREASE_HOLD_TIME, get_roundtrip_ms(rate_control) * 2);
+    return rate_control->now - rate_control->last_change >= hold_time;
+}
+
+static void video_rate_control_process_server_drops(VideoRateControl *rate_control)
+{
+    uint32_t num_frames = rate_control->num_frames_encoded + rate_control->num_server_drops;
+
+    if (num_frames < get_source_fps(rate_control)) {
+        return;
+    }
+    spice_debug("server drops %u/%u", rate_control->num_server_drops, num_frames);
+    if (rate_control->num_server_drops > num_frames * SERVER_DROPS_BAD &&
+        video_rate_control_can_decrease(rate_control)) {
+        video_rate_control_decrease(rate_control,
+                                    rate_control->num_server_drops >
+                                    num_frames * SERVER_DROPS_VERY_BAD ?
+                                    BIT_RATE_CUT : BIT_RATE_REDUCE);
+    }
+    rate_control->num_frames_encoded = 0;
+    rate_control->num_server_drops = 0;
+}
+
+/* Returns TRUE if the data queued in the pipe takes too long to send.
+ * The pipe also holds the other messages of the channel so its size in
+ * bytes is used rather than its number of items.
+ */
+static bool video_rate_control_pipe_is_congested(const VideoRateControl *rate_control)
+{
+    uint64_t pipe_bytes, queue_delay;
+    uint32_t max_delay;
+
+    if (!rate_control->cbs.get_pipe_bytes) {
+        return FALSE;
+    }
+    pipe_bytes = rate_control->cbs.get_pipe_bytes(rate_control->cbs.opaque);
+    queue_delay = pipe_bytes * 8 * MSEC_PER_SEC / rate_control->bit_rate;
+    max_delay = MAX(MAX_QUEUE_DELAY, 2 * MSEC_PER_SEC / get_source_fps(rate_control));
+    if (queue_delay > max_delay) {
+        spice_debug("pipe congested: %" G_GUINT64_FORMAT " bytes, about %" G_GUINT64_FORMAT "ms",
+                    pipe_bytes, queue_delay);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+/* Returns TRUE if the roundtrip grew since the network queues were empty */
+static bool video_rate_control_roundtrip_is_inflated(VideoRateControl *rate_control)
+{
+    uint32_t roundtrip = get_roundtrip_ms(rate_control);
+    bool new_roundtrip = roundtrip != rate_control->last_roundtrip;
+
+    if (roundtrip == 0) {
+        return FALSE;
+    }
+    rate_control->last_roundtrip = roundtrip;
+    if (rate_control->min_roundtrip == 0 ||
+        rate_control->now - rate_control->window_start > ROUNDTRIP_WINDOW) {
+        rate_control->min_roundtrip = rate_control->window_min_roundtrip ?
+                                      rate_control->window_min_roundtrip : roundtrip;
+        rate_control->window_min_roundtrip = roundtrip;
+        rate_control->window_start = rate_control->now;
+    }
+    rate_control->min_roundtrip = MIN(rate_control->min_roundtrip, roundtrip);
+    rate_control->window_min_roundtrip = MIN(rate_control->window_min_roundtrip, roundtrip);
+
+    /* react once per measure */
+    if (new_roundtrip && roundtrip > rate_control->min_roundtrip * 2 + ROUNDTRIP_MARGIN) {
+        spice_debug("roundtrip %ums, minimum %ums", roundtrip, rate_control->min_roundtrip);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+void video_rate_control_frame_encoded(VideoRateControl *rate_control,
+                                      uint32_t frame_mm_time, uint32_t size)
+{
+    VideoRateControlFrame *frame;
+
+    if (!rate_control->started) {
+        rate_control->started = TRUE;
+        rate_control->start_time = frame_mm_time;
+        rate_control->last_change = frame_mm_time;
+    }
+    rate_control->now = frame_mm_time;
+
+    if (rate_control->num_frames == FRAME_HISTORY_SIZE) {
+        rate_control->frames_size -= rate_control->frames[rate_control->first_frame].size;
+        rate_control->first_frame = (rate_control->first_frame + 1) % FRAME_HISTORY_SIZE;
+        rate_control->num_frames--;
+    }
+    frame = &rate_control->frames[(rate_control->first_frame + rate_control->num_frames) %
+                                  FRAME_HISTORY_SIZE];
+    frame->mm_time = frame_mm_time;
+    frame->size = size;
+    rate_control->num_frames++;
+    rate_control->frames_size += size;
+
+    rate_control->num_frames_encoded++;
+    video_rate_control_process_server_drops(rate_control);
+
+    if ((video_rate_control_roundtrip_is_inflated(rate_control) ||
+         video_rate_control_pipe_is_congested(rate_control)) &&
+        video_rate_control_can_decrease(rate_control)) {
+        video_rate_control_decrease(rate_control, BIT_RATE_REDUCE);
+    } else if (!rate_control->has_client_reports && rate_control->num_server_drops == 0 &&
+               rate_control->now - rate_control->last_change >= rate_control->increase_interval) {
+        /* the client reports drive the increases when there are some */
+        video_rate_control_increase(rate_control);
+    }
+}
+
+void video_rate_control_server_frame_drop(VideoRateControl *rate_control)
+{
+    rate_control->num_server_drops++;
+    video_rate_control_process_server_drops(rate_control);
+}
+
+void video_rate_control_client_report(VideoRateControl *rate_control,
+                                      uint32_t num_frames, uint32_t num_drops,
+                                      uint32_t start_frame_mm_time,
+                                      uint32_t end_frame_mm_time,
+                                      int32_t video_margin, uint32_t audio_margin)
+{
+    int32_t margin_delta;
+    uint32_t min_margin;
+    uint32_t score;
+
+    rate_control->has_client_reports = TRUE;
+    rate_control->max_video_margin = MAX(rate_control->max_video_margin, video_margin);
+    rate_control->max_audio_margin = MAX(rate_control->max_audio_margin, audio_margin);
+    margin_delta = video_margin - rate_control->last_video_margin;
+    rate_control->last_video_margin = video_margin;
+
+    spice_debug("client report: %u/%u drops in %ums margins video %3d/%3d audio %3u/%3u%s",
+                num_drops, num_frames, end_frame_mm_time - start_frame_mm_time,
+                video_margin, rate_control->max_video_margin,
+                audio_margin, rate_control->max_audio_margin,
+                start_frame_mm_time < rate_control->last_change ? " obsolete" : "");
+    if (rate_control->status != VIDEO_RATE_CONTROL_INCREASING &&
+        start_frame_mm_time < rate_control->last_change) {
+        /* Some of this data predates the last bit rate reduction
+         * so it is obsolete. Note that settling on a bit rate also
+         * follows a reduction.
+         */
+        return;
+    }
+
+    /* We normally arrange for even the largest frames to arrive a bit over
+     * one period before they should be displayed.
+     */
+    min_margin = MSEC_PER_SEC / get_source_fps(rate_control) +
+                 get_roundtrip_ms(rate_control) / 2 * LATENCY_MARGIN;
+
+    /* A low video margin indicates that the bit rate is too high. */
+    if (num_drops) {
+        score = 4;
+    } else if (margin_delta >= 0) {
+        /* The situation was bad but seems to be improving */
+        score = 0;
+    } else if (video_margin < min_margin * VIDEO_MARGIN_BAD ||
+               video_margin < rate_control->max_video_margin * VIDEO_MARGIN_BAD) {
+        score = 3;
+    } else if (video_margin < min_margin ||
+               video_margin < rate_control->max_video_margin * VIDEO_MARGIN_AVERAGE) {
+        score = 2;
+    } else if (video_margin < rate_control->max_video_margin * VIDEO_MARGIN_GOOD) {
+        score = 1;
+    } else {
+        score = 0;
+    }
+    /* A fast dropping video margin is a compounding factor. */
+    if (margin_delta < -abs(rate_control->max_video_margin) * VIDEO_DELTA_BAD) {
+        score += 2;
+    } else if (margin_delta < -abs(rate_control->max_video_margin) * VIDEO_DELTA_AVERAGE) {
+        score += 1;
+    }
+
+    if (score >= 2 && rate_control->now - rate_control->start_time < WARMUP_TIME) {
+        spice_debug("score %u during the warmup, ignored", score);
+    } else if (score > 3) {
+        spice_debug("score %u, cut the bit rate", score);
+        video_rate_control_decrease(rate_control, BIT_RATE_CUT);
+    } else if (score == 3) {
+        spice_debug("score %u, reduce the bit rate", score);
+        video_rate_control_decrease(rate_control, BIT_RATE_REDUCE);
+    } else if (score == 2) {
+        spice_debug("score %u, decrement the bit rate", score);
+        video_rate_control_decrease(rate_control, 0);
+    } else if (audio_margin < rate_control->max_audio_margin * AUDIO_MARGIN_BAD &&
+               audio_margin * AUDIO_VIDEO_RATIO < video_margin) {
+        /* The audio margin has decreased a lot while the video_margin
+         * remained higher. It may be that the video stream is starving the
+         * audio one of bandwidth. So reduce the bit rate.
+         */
+        spice_debug("free some bandwidth for the audio stream");
+        video_rate_control_decrease(rate_control, 0);
+    } else if (score == 1 && rate_control->status == VIDEO_RATE_CONTROL_INCREASING) {
+        /* We only increase the bit rate when score == 0 so things got worse
+         * since the last increase.
+         */
+        spice_debug("degraded margin, decrement the bit rate");
+        video_rate_control_decrease(rate_control, 0);
+    } else if (score == 0 &&
+               rate_control->now - rate_control->last_change >= rate_control->increase_interval) {
+        /* The video margin is consistently high so increase the bit rate. */
+        video_rate_control_increase(rate_control);
+    }
+}
+
+void video_rate_control_set_max_bit_rate(VideoRateControl *rate_control, uint64_t bit_rate)
+{
+    rate_control->bit_rate_cap = bit_rate ? MAX(bit_rate, MIN_BIT_RATE) : 0;
+    if (rate_control->bit_rate_cap == 0) {
+        return;
+    }
+    /* A higher bit rate would not improve the stream, this is not a
+     * congestion */
+    rate_control->bit_rate = MIN(rate_control->bit_rate, rate_control->bit_rate_cap);
+    if (rate_control->max_bit_rate > rate_control->bit_rate_cap) {
+        rate_control->max_bit_rate = rate_control->bit_rate_cap;
+        video_rate_control_update_step(rate_control);
+    }
+}
+
+VideoRateControl *video_rate_control_new(uint64_t starting_bit_rate,
+                                         const VideoEncoderRateControlCbs *cbs)
+{
+    VideoRateControl *rate_control = g_new0(VideoRateControl, 1);
+
+    if (cbs) {
+        rate_control->cbs = *cbs;
+    }
+    rate_control->bit_rate = starting_bit_rate ? MAX(starting_bit_rate, MIN_BIT_RATE) :
+                                                 DEFAULT_BIT_RATE;
+    /* until the first increase tells that the starting bit rate works */
+    rate_control->status = VIDEO_RATE_CONTROL_DECREASING;
+    rate_control->min_bit_rate = MIN_BIT_RATE;
+    rate_control->max_bit_rate = G_MAXUINT64;
+    rate_control->increase_interval = UP_INTERVAL;
+    video_rate_control_update_step(rate_control);
+    return rate_control;
+}
+
+void video_rate_control_free(VideoRateControl *rate_control)
+{
+    g_free(rate_control);
+}
@@ -0,0 +1,73 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 agent <agent@local>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef VIDEO_RATE_CONTROL_H_
+#define VIDEO_RATE_CONTROL_H_
+
+#include "video-encoder.h"
+
+/* The network bit rate control of the video encoders.
+ *
+ * The controller estimates the bit rate a stream can use without congesting
+ * the network, and the encoder follows it by changing its quality, frame
+ * rate or bit rate setting. The congestion is detected from:
+ * - the client reports: the frames dropped by the client and the margin
+ *   between the arrival and the display of the frames,
+ * - the frames dropped by the server because the pipe is full,
+ * - the time needed to send the messages queued in the pipe,
+ * - the roundtrip time, which grows as the network queues fill up.
+ *
+ * The bit rate is cut on congestion and increased by steps while the stream
+ * is stable. The steps shrink as the range between the lowest bit rate that
+ * failed and the highest one that worked narrows, until the bit rate settles
+ * on the latter.
+ *
+ * The time is the mm_time of the frames, so the controller can be replayed
+ * from a recorded sequence of frames and reports.
+ */
+typedef struct VideoRateControl VideoRateControl;
+
+/* @starting_bit_rate: The initial bit rate in bits per second, 0 for a
+ *                     default one.
+ * @cbs:               The rate control callbacks of the stream.
+ */
+VideoRateControl *video_rate_control_new(uint64_t starting_bit_rate,
+                                         const VideoEncoderRateControlCbs *cbs);
+void video_rate_control_free(VideoRateControl *rate_control);
+
+/* Sets the highest bit rate worth using for the stream, for instance
+ * depending on its resolution, 0 for no limit */
+void video_rate_control_set_max_bit_rate(VideoRateControl *rate_control, uint64_t bit_rate);
+
+/* The bit rate the encoder should follow, in bits per second */
+uint64_t video_rate_control_get_bit_rate(const VideoRateControl *rate_control);
+
+/* The bit rate of the last frames, in bits per second */
+uint64_t video_rate_control_get_effective_bit_rate(const VideoRateControl *rate_control);
+
+/* The feedback, see the methods of the same name in VideoEncoder */
+void video_rate_control_frame_encoded(VideoRateControl *rate_control,
+                                      uint32_t frame_mm_time, uint32_t size);
+void video_rate_control_server_frame_drop(VideoRateControl *rate_control);
+void video_rate_control_client_report(VideoRateControl *rate_control,
+                                      uint32_t num_frames, uint32_t num_drops,
+                                      uint32_t start_frame_mm_time,
+                                      uint32_t end_frame_mm_time,
+                                      int32_t video_margin, uint32_t audio_margin);
+
+#endif /* VIDEO_RATE_CONTROL_H_ */
@@ -20,6 +20,7 @@
 #include "display-channel-private.h"
 #include "main-channel-client.h"
 #include "red-client.h"
+#include "shared-video-encoder.h"
 
 #define FPS_TEST_INTERVAL 1
 #define FOREACH_STREAMS(display, item)                  \
@@ -92,6 +93,24 @@ static RedPipeItem *video_stream_destroy_item_new(VideoStreamAgent *agent)
 }
 
 
+/* The clients of a stream using the same video codec and with starting bit
+ * rates of the same power of two share a video encoder */
+typedef struct VideoStreamEncoderTier {
+    new_video_encoder_t create;
+    SpiceVideoCodecType codec_type;
+    unsigned int bit_rate_class;
+    SharedVideoEncoder *encoder;
+} VideoStreamEncoderTier;
+
+static void video_stream_encoder_tier_free(gpointer data)
+{
+    VideoStreamEncoderTier *tier = data;
+
+    // the clients keep the shared encoder until they stop the stream
+    shared_video_encoder_unref(tier->encoder);
+    g_free(tier);
+}
+
 void video_stream_stop(DisplayChannel *display, VideoStream *stream)
 {
     DisplayChannelClient *dcc;
@@ -121,6 +140,8 @@ void video_stream_stop(DisplayChannel *display, VideoStream *stream)
                                     video_stream_destroy_item_new(stream_agent));
         video_stream_agent_stats_print(stream_agent);
     }
+    g_list_free_full(stream->encoder_tiers, video_stream_encoder_tier_free);
+    stream->encoder_tiers = NULL;
     display->priv->streams_size_total -= stream->width * stream->height;
     ring_remove(&stream->link);
     video_stream_unref(display, stream);
@@ -635,6 +656,11 @@ static uint64_t get_initial_bit_rate(DisplayChannelClient *dcc, VideoStream *str
         }
     }
 
+    // the bandwidth measured on the display connection is the most recent
+    if (!bit_rate) {
+        bit_rate = red_channel_client_get_bandwidth(RED_CHANNEL_CLIENT(dcc)) * 8;
+    }
+
     if (!bit_rate) {
         MainChannelClient *mcc;
         uint64_t net_test_bit_rate;
@@ -692,6 +718,13 @@ static uint32_t get_source_fps(void *opaque)
     return agent->stream->input_fps;
 }
 
+static uint64_t get_pipe_bytes(void *opaque)
+{
+    VideoStreamAgent *agent = opaque;
+
+    return red_channel_client_get_pipe_bytes(RED_CHANNEL_CLIENT(agent->dcc));
+}
+
 static void update_client_playback_delay(void *opaque, uint32_t delay_ms)
 {
     VideoStreamAgent *agent = opaque;
@@ -723,8 +756,54 @@ static void bitmap_unref(gpointer data)
     red_drawable_unref(red_drawable);
 }
 
+/* A helper for dcc_create_video_encoder().
+ * With spice_server_set_shared_video_encoders() the MJPEG frames are encoded
+ * once per tier of clients instead of once per client. The other codecs cannot be
+ * shared since their frames depend on the previous ones, which some clients
+ * may not have received. */
+static VideoEncoder* video_stream_create_video_encoder(DisplayChannelClient *dcc,
+                                                       VideoStream *stream,
+                                                       new_video_encoder_t create,
+                                                       SpiceVideoCodecType codec_type,
+                                                       uint64_t starting_bit_rate,
+                                                       VideoEncoderRateControlCbs *cbs)
+{
+    RedsState *reds = red_channel_get_server(RED_CHANNEL(DCC_TO_DC(dcc)));
+    VideoStreamEncoderTier *tier = NULL;
+    unsigned int bit_rate_class;
+    GList *l;
+
+    if (codec_type != SPICE_VIDEO_CODEC_TYPE_MJPEG || !reds_get_shared_video_encoders(reds)) {
+        return create(codec_type, starting_bit_rate, cbs, bitmap_ref, bitmap_unref);
+    }
+
+    bit_rate_class = g_bit_storage(starting_bit_rate / (1024 * 1024));
+    for (l = stream->encoder_tiers; l != NULL; l = l->next) {
+        VideoStreamEncoderTier *other_tier = l->data;
+
+        if (other_tier->create == create && other_tier->codec_type == codec_type &&
+            other_tier->bit_rate_class == bit_rate_class) {
+            tier = other_tier;
+            break;
+        }
+    }
+    if (!tier) {
+        tier = g_new0(VideoStreamEncoderTier, 1);
+        tier->create = create;
+        tier->codec_type = codec_type;
+        tier->bit_rate_class = bit_rate_class;
+        tier->encoder = shared_video_encoder_new(create, codec_type, starting_bit_rate,
+                                                 bitmap_ref, bitmap_unref);
+        stream->encoder_tiers = g_list_prepend(stream->encoder_tiers, tier);
+        spice_debug("stream %p: new encoder tier, %.2f Mbps", stream,
+                    starting_bit_rate / 1024.0 / 1024.0);
+    }
+    return shared_video_encoder_join(tier->encoder, cbs);
+}
+
 /* A helper for dcc_create_stream(). */
 static VideoEncoder* dcc_create_video_encoder(DisplayChannelClient *dcc,
+                                              VideoStream *stream,
                                               uint64_t starting_bit_rate,
                                               VideoEncoderRateControlCbs *cbs)
 {
@@ -748,7 +827,10 @@ static VideoEncoder* dcc_create_video_encoder(DisplayChannelClient *dcc,
             continue;
         }
 
-        VideoEncoder* video_encoder = video_codec->create(video_codec->type, starting_bit_rate, cbs, bitmap_ref, bitmap_unref);
+        VideoEncoder* video_encoder = video_stream_create_video_encoder(dcc, stream,
+                                                                        video_codec->create,
+                                                                        video_codec->type,
+                                                                        starting_bit_rate, cbs);
         if (video_encoder) {
             return video_encoder;
         }
@@ -756,7 +838,9 @@ static VideoEncoder* dcc_create_video_encoder(DisplayChannelClient *dcc,
 
     /* Try to use the builtin MJPEG video encoder as a fallback */
     if (!client_has_multi_codec || red_channel_client_test_remote_cap(rcc, SPICE_DISPLAY_CAP_CODEC_MJPEG)) {
-        return mjpeg_encoder_new(SPICE_VIDEO_CODEC_TYPE_MJPEG, starting_bit_rate, cbs, bitmap_ref, bitmap_unref);
+        return video_stream_create_video_encoder(dcc, stream, mjpeg_encoder_new,
+                                                 SPICE_VIDEO_CODEC_TYPE_MJPEG,
+                                                 starting_bit_rate, cbs);
     }
 
     return NULL;
@@ -781,9 +865,10 @@ void dcc_create_stream(DisplayChannelClient *dcc, VideoStream *stream)
     video_cbs.get_roundtrip_ms = get_roundtrip_ms;
     video_cbs.get_source_fps = get_source_fps;
     video_cbs.update_client_playback_delay = update_client_playback_delay;
+    video_cbs.get_pipe_bytes = get_pipe_bytes;
 
     uint64_t initial_bit_rate = get_initial_bit_rate(dcc, stream);
-    agent->video_encoder = dcc_create_video_encoder(dcc, initial_bit_rate, &video_cbs);
+    agent->video_encoder = dcc_create_video_encoder(dcc, stream, initial_bit_rate, &video_cbs);
     red_channel_client_pipe_add(RED_CHANNEL_CLIENT(dcc), video_stream_create_item_new(agent));
 
     if (red_channel_client_test_remote_cap(RED_CHANNEL_CLIENT(dcc), SPICE_DISPLAY_CAP_STREAM_REPORT)) {
@@ -823,6 +908,7 @@ static void red_upgrade_item_free(RedPipeItem *base)
 
     g_return_if_fail(item->base.refcount == 0);
 
+    dcc_surface_pipe_drawable_released(item->dcc, item->drawable, &item->surface_link);
     drawable_unref(item->drawable);
     g_free(item->rects);
     g_free(item);
@@ -869,8 +955,11 @@ static void dcc_detach_stream_gracefully(DisplayChannelClient *dcc,
         upgrade_item = g_new(RedUpgradeItem, 1);
         red_pipe_item_init_full(&upgrade_item->base, RED_PIPE_ITEM_TYPE_UPGRADE,
                                 red_upgrade_item_free);
+        upgrade_item->dcc = dcc;
         upgrade_item->drawable = stream->current;
         upgrade_item->drawable->refs++;
+        dcc_surface_pipe_drawable_added(dcc, upgrade_item->drawable,
+                                        &upgrade_item->surface_link, &upgrade_item->base);
         n_rects = pixman_region32_n_rects(&upgrade_item->drawable->tree_item.base.rgn);
         upgrade_item->rects = g_malloc(sizeof(SpiceClipRects) + n_rects * sizeof(SpiceRect));
         upgrade_item->rects->num_rects = n_rects;
@@ -49,8 +49,10 @@ typedef struct VideoStream VideoStream;
  * This to avoid the artifacts due to the lossy compression. */
 typedef struct RedUpgradeItem {
     RedPipeItem base;
+    DisplayChannelClient *dcc;
     Drawable *drawable;
     SpiceClipRects *rects;
+    DccSurfacePipeLink surface_link;
 } RedUpgradeItem;
 
 typedef struct RedStreamActivateReportItem {
@@ -134,6 +136,9 @@ struct VideoStream {
     uint32_t num_input_frames;
     uint64_t input_fps_start_time;
     uint32_t input_fps;
+
+    /* the encoders shared by the clients, see video_stream_create_video_encoder() */
+    GList *encoder_tiers;
 };
 
 void display_channel_init_video_streams(DisplayChannel *display);
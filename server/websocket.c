@@ -31,6 +31,13 @@
 #endif
 
 #include <glib.h>
+#include <zlib.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define UNMASK_SIMD
+#include <immintrin.h>
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
 
 #include <common/log.h>
 #include <common/mem.h>
@@ -47,6 +54,7 @@
 
 #define FIN_FLAG        0x80
 #define RSV_MASK        0x70
+#define RSV1_FLAG       0x40
 #define TYPE_MASK       0x0F
 #define CONTROL_FRAME_MASK 0x8
 
@@ -70,6 +78,27 @@
 #define MAX_CONTROL_DATA 125
 #define CONTROL_HDR_LEN 2
 
+/* Frames up to this size are written with their header in a single write
+ * when the stream has no writev, so each frame is a single TLS record */
+#define WRITE_COALESCE_SIZE (16 * 1024)
+
+/* Number of iovec allocated on the stack by websocket_writev */
+#define WRITEV_STACK_IOV 64
+
+/* permessage-deflate, RFC 7692.
+ * Messages smaller than DEFLATE_MIN_SIZE are not compressed. After
+ * DEFLATE_MAX_POOR messages in a row compressed by less than
+ * DEFLATE_MIN_SAVING percent, as for already compressed images, the
+ * compression is skipped for the next messages, doubling the number of
+ * skipped messages each time up to DEFLATE_MAX_SKIP */
+#define DEFLATE_MIN_SIZE 128
+#define DEFLATE_MIN_SAVING 10
+#define DEFLATE_MAX_POOR 4
+#define DEFLATE_MIN_SKIP 16
+#define DEFLATE_MAX_SKIP 1024
+#define DEFLATE_MAX_WINDOW_BITS 15
+#define DEFLATE_READ_BUF_SIZE 4096
+
 typedef struct {
     uint8_t raw_pos;
     union {
@@ -88,11 +117,42 @@ typedef struct {
     int header_pos;
     bool frame_ready:1;
     bool masked:1;
+    /* the frame is part of a compressed message */
+    bool compressed:1;
+    /* the unfinished message is compressed */
+    bool unfinished_compressed:1;
     uint8_t mask[4];
     uint64_t relayed;
     uint64_t expected_len;
 } websocket_frame_t;
 
+typedef struct {
+    bool enabled;
+    /* reset the compression context after each message */
+    bool no_context_takeover;
+    int level;
+    int window_bits;
+
+    z_stream deflate;
+    bool deflate_ready;
+    /* compressed frame being sent, header included, and the number of
+     * bytes of the message it contains */
+    uint8_t *out;
+    size_t out_size, out_pos, out_len;
+    uint64_t out_message_len;
+    unsigned int num_poor;
+    unsigned int num_skip;
+    unsigned int skip_next;
+
+    z_stream inflate;
+    bool inflate_ready;
+    /* the trailing bytes of the message were added */
+    bool inflate_tail_added;
+    /* the output buffer was filled, more data can be produced */
+    bool inflate_pending;
+    uint8_t in[DEFLATE_READ_BUF_SIZE];
+} WebSocketDeflate;
+
 struct RedsWebSocket {
     bool closed;
 
@@ -109,6 +169,8 @@ struct RedsWebSocket {
     websocket_read_cb_t raw_read;
     websocket_write_cb_t raw_write;
     websocket_writev_cb_t raw_writev;
+
+    WebSocketDeflate deflate;
 };
 
 static int websocket_ack_close(RedsWebSocket *ws);
@@ -166,7 +228,7 @@ static uint64_t extract_length(const uint8_t *buf, int *used)
         *used += 8;
         outlen = 0;
         for (i = 56; i >= 0; i -= 8) {
-            outlen |= (*buf++) << i;
+            outlen |= (uint64_t) (*buf++) << i;
         }
         break;
 
@@ -249,16 +311,19 @@ static char *generate_reply_key(char *buf)
 static void websocket_clear_frame(websocket_frame_t *frame)
 {
     uint8_t unfinished = frame->unfinished;
+    bool unfinished_compressed = frame->unfinished_compressed;
     memset(frame, 0, sizeof(*frame));
     frame->unfinished = unfinished;
+    frame->unfinished_compressed = unfinished_compressed;
 }
 
 /* Extract a frame header of data from a set of data transmitted by
     a WebSocket client. Returns success or error */
-static bool websocket_get_frame_header(websocket_frame_t *frame)
+static bool websocket_get_frame_header(websocket_frame_t *frame, bool deflate)
 {
     int fin;
     int used = 0;
+    uint8_t rsv;
 
     if (frame_bytes_needed(frame) > 0) {
         return true;
@@ -266,10 +331,15 @@ static bool websocket_get_frame_header(websocket_frame_t *frame)
 
     fin = frame->fin = frame->header[0] & FIN_FLAG;
     frame->type = frame->header[0] & TYPE_MASK;
+    rsv = frame->header[0] & RSV_MASK;
     used++;
 
-    // reserved bits are not expected
-    if (frame->header[0] & RSV_MASK) {
+    // reserved bits are not expected, RSV1 marks the first frame of a
+    // compressed message
+    if (rsv & ~(deflate ? RSV1_FLAG : 0)) {
+        return false;
+    }
+    if (rsv && ((frame->type & CONTROL_FRAME_MASK) != 0 || frame->type == CONTINUATION_FRAME)) {
         return false;
     }
     // control commands cannot be split
@@ -291,10 +361,14 @@ static bool websocket_get_frame_header(websocket_frame_t *frame)
                 return false;
             }
             frame->type = frame->unfinished;
+            frame->compressed = frame->unfinished_compressed;
         } else if (frame->unfinished) {
             return false;
+        } else {
+            frame->compressed = rsv != 0;
         }
         frame->unfinished = fin ? 0 : frame->type;
+        frame->unfinished_compressed = fin ? false : frame->compressed;
     }
 
     frame->expected_len = extract_length(frame->header + used, &used);
@@ -314,14 +388,199 @@ static bool websocket_get_frame_header(websocket_frame_t *frame)
     return true;
 }
 
+/* not zero, g_once_init_leave() does not accept it */
+typedef enum {
+    WEBSOCKET_UNMASK_IMPL_SCALAR = 1,
+    WEBSOCKET_UNMASK_IMPL_SSE2,
+    WEBSOCKET_UNMASK_IMPL_AVX2,
+} WebsocketUnmaskImpl;
+
+#define UNMASK_WIDE_MASK_SIZE 32
+
+/* The unmask_blocks functions unmask the whole blocks of @size bytes of
+ * @buf, @buf being aligned to 16 bytes, and return the number of bytes
+ * unmasked. @wide_mask is the mask repeated and rotated to the offset of
+ * @buf in the frame */
+static size_t unmask_blocks_scalar(uint8_t *buf, size_t size, const uint8_t *wide_mask)
+{
+    const size_t total = size;
+    uint64_t mask64;
+
+    memcpy(&mask64, wide_mask, sizeof(mask64));
+    for (; size >= 8; size -= 8, buf += 8) {
+        uint64_t data;
+        memcpy(&data, buf, sizeof(data));
+        data ^= mask64;
+        memcpy(buf, &data, sizeof(data));
+    }
+    return total - size;
+}
+
+#ifdef UNMASK_SIMD
+static TARGET_SSE2 size_t unmask_blocks_sse2(uint8_t *buf, size_t size, const uint8_t *wide_mask)
+{
+    const size_t total = size;
+    const __m128i mask128 = _mm_loadu_si128((const __m128i *) wide_mask);
+
+    for (; size >= 16; size -= 16, buf += 16) {
+        __m128i data = _mm_load_si128((const __m128i *) buf);
+        _mm_store_si128((__m128i *) buf, _mm_xor_si128(data, mask128));
+    }
+    return total - size;
+}
+
+static TARGET_AVX2 size_t unmask_blocks_avx2(uint8_t *buf, size_t size, const uint8_t *wide_mask)
+{
+    const size_t total = size;
+    const __m256i mask256 = _mm256_loadu_si256((const __m256i *) wide_mask);
+
+    for (; size >= 32; size -= 32, buf += 32) {
+        __m256i data = _mm256_loadu_si256((const __m256i *) buf);
+        _mm256_storeu_si256((__m256i *) buf, _mm256_xor_si256(data, mask256));
+    }
+    return total - size;
+}
+
+static WebsocketUnmaskImpl websocket_unmask_get_best_impl(void)
+{
+    static gsize best_impl = 0;
+
+    if (g_once_init_enter(&best_impl)) {
+        WebsocketUnmaskImpl impl = WEBSOCKET_UNMASK_IMPL_SCALAR;
+
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            impl = WEBSOCKET_UNMASK_IMPL_AVX2;
+        } else if (__builtin_cpu_supports("sse2")) {
+            impl = WEBSOCKET_UNMASK_IMPL_SSE2;
+        }
+        g_once_init_leave(&best_impl, impl);
+    }
+    return best_impl;
+}
+#endif
+
+/* Unmask @size bytes of @buf, @pos being the offset of the first byte in
+ * the frame payload.
+ * The bytes up to an aligned address are handled one by one, then whole
+ * blocks with the mask rotated to the current offset, then the tail */
+static void websocket_unmask(uint8_t *buf, size_t size, const uint8_t *mask, uint64_t pos)
+{
+    uint8_t wide_mask[UNMASK_WIDE_MASK_SIZE];
+    unsigned int i;
+    size_t done;
+
+    while (size > 0 && ((uintptr_t) buf % 16) != 0) {
+        *buf++ ^= mask[pos++ % 4];
+        size--;
+    }
+
+    if (size >= 8) {
+        /* blocks are multiple of 4 bytes, the offset in the mask does not
+         * change while going through them */
+        for (i = 0; i < sizeof(wide_mask); i++) {
+            wide_mask[i] = mask[(pos + i) % 4];
+        }
+#ifdef UNMASK_SIMD
+        WebsocketUnmaskImpl impl = websocket_unmask_get_best_impl();
+        if (impl == WEBSOCKET_UNMASK_IMPL_AVX2) {
+            done = unmask_blocks_avx2(buf, size, wide_mask);
+            buf += done;
+            size -= done;
+        }
+        if (impl >= WEBSOCKET_UNMASK_IMPL_SSE2) {
+            done = unmask_blocks_sse2(buf, size, wide_mask);
+            buf += done;
+            size -= done;
+        }
+#endif
+        done = unmask_blocks_scalar(buf, size, wide_mask);
+        buf += done;
+        size -= done;
+    }
+
+    while (size > 0) {
+        *buf++ ^= mask[pos++ % 4];
+        size--;
+    }
+}
+
 static void relay_data(uint8_t* buf, size_t size, websocket_frame_t *frame)
 {
     if (frame->masked) {
-        size_t i;
-        for (i = 0; i < size; i++) {
-            *buf++ ^= frame->mask[(frame->relayed + i) % 4];
+        websocket_unmask(buf, size, frame->mask, frame->relayed);
+    }
+}
+
+/* Inflate the payload of the current frame into @buf.
+ * Return the number of bytes produced, @done being set once the payload
+ * has been consumed and all its data produced. If nothing could be
+ * produced the result of the failed read is returned */
+static int inflate_frame_data(RedsWebSocket *ws, uint8_t *buf, size_t size, bool *done)
+{
+    /* removed from the end of the messages by the sender */
+    static const uint8_t tail[] = { 0x00, 0x00, 0xff, 0xff };
+    websocket_frame_t *frame = &ws->read_frame;
+    WebSocketDeflate *deflate = &ws->deflate;
+    z_stream *stream = &deflate->inflate;
+    int ret;
+
+    *done = false;
+    if (!deflate->inflate_ready) {
+        memset(stream, 0, sizeof(*stream));
+        if (inflateInit2(stream, -DEFLATE_MAX_WINDOW_BITS) != Z_OK) {
+            goto error;
         }
+        deflate->inflate_ready = true;
     }
+
+    stream->next_out = buf;
+    stream->avail_out = MIN(size, UINT_MAX);
+    while (stream->avail_out > 0) {
+        if (stream->avail_in == 0) {
+            if (frame->relayed < frame->expected_len) {
+                int rc = ws->raw_read(ws->raw_stream, deflate->in,
+                                      MIN(sizeof(deflate->in),
+                                          frame->expected_len - frame->relayed));
+                if (rc <= 0) {
+                    if (stream->next_out == buf) {
+                        return rc;
+                    }
+                    break;
+                }
+                relay_data(deflate->in, rc, frame);
+                frame->relayed += rc;
+                stream->next_in = deflate->in;
+                stream->avail_in = rc;
+            } else if (frame->fin && !deflate->inflate_tail_added) {
+                stream->next_in = (uint8_t *) tail;
+                stream->avail_in = sizeof(tail);
+                deflate->inflate_tail_added = true;
+            } else if (!deflate->inflate_pending) {
+                /* the output of all the input was produced */
+                *done = true;
+                if (frame->fin) {
+                    deflate->inflate_tail_added = false;
+                }
+                break;
+            }
+        }
+
+        ret = inflate(stream, Z_SYNC_FLUSH);
+        if (ret == Z_STREAM_END) {
+            inflateReset(stream);
+        } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            goto error;
+        }
+        deflate->inflate_pending = stream->avail_out == 0;
+    }
+    return stream->next_out - buf;
+
+error:
+    spice_warning("invalid compressed WebSocket data");
+    ws->closed = true;
+    errno = EIO;
+    return -1;
 }
 
 int websocket_read(RedsWebSocket *ws, uint8_t *buf, size_t size, unsigned *flags)
@@ -350,7 +609,7 @@ int websocket_read(RedsWebSocket *ws, uint8_t *buf, size_t size, unsigned *flags
             }
             frame->header_pos += rc;
 
-            if (!websocket_get_frame_header(frame)) {
+            if (!websocket_get_frame_header(frame, ws->deflate.enabled)) {
                 ws->closed = true;
                 errno = EIO;
                 return -1;
@@ -368,6 +627,26 @@ int websocket_read(RedsWebSocket *ws, uint8_t *buf, size_t size, unsigned *flags
             websocket_clear_frame(frame);
             send_pending_data(ws);
             return 0;
+        } else if ((frame->type == BINARY_FRAME || frame->type == TEXT_FRAME) &&
+                   frame->compressed) {
+            bool done;
+
+            *flags = frame->type;
+            rc = inflate_frame_data(ws, buf, size, &done);
+            if (ws->closed) {
+                return -1;
+            }
+            if (rc <= 0 && !done) {
+                goto read_error;
+            }
+            n += rc;
+            buf += rc;
+            size -= rc;
+            if (!done) {
+                continue;
+            }
+            /* the payload was accounted while inflating */
+            rc = 0;
         } else if (frame->type == BINARY_FRAME || frame->type == TEXT_FRAME) {
             rc = 0;
             if (frame->expected_len > frame->relayed) {
@@ -475,30 +754,6 @@ static int fill_header(uint8_t *header, uint64_t len, uint8_t type)
     return used;
 }
 
-static void constrain_iov(struct iovec *iov, int iovcnt,
-                          struct iovec **iov_out, int *iov_out_cnt,
-                          uint64_t maxlen)
-{
-    int i;
-
-    for (i = 0; i < iovcnt && maxlen > 0; i++) {
-        if (iov[i].iov_len > maxlen) {
-            /* TODO - This code has never triggered afaik... */
-            *iov_out_cnt = ++i;
-            *iov_out = g_memdup(iov, i * sizeof (*iov));
-            (*iov_out)[i-1].iov_len = maxlen;
-            return;
-        }
-        maxlen -= iov[i].iov_len;
-    }
-
-    /* we must trim the iov in case maxlen initially matches some chunks
-     * For instance if initially we had 2 chunks 256 and 128 bytes respectively
-     * and a maxlen of 256 we should just return the first chunk */
-    *iov_out_cnt = i;
-    *iov_out = iov;
-}
-
 static int send_data_header_left(RedsWebSocket *ws)
 {
     /* send the pending header */
@@ -522,12 +777,12 @@ static int send_data_header_left(RedsWebSocket *ws)
     return -1;
 }
 
-static int send_data_header(RedsWebSocket *ws, uint64_t len, uint8_t type)
+/* Fill the header of a new data frame, returning its length */
+static int prepare_data_header(RedsWebSocket *ws, uint64_t len, uint8_t type)
 {
     spice_assert(ws->write_header_pos >= ws->write_header_len);
     spice_assert(ws->write_remainder == 0);
 
-    /* fill a new header */
     ws->write_header_pos = 0;
     if (ws->send_unfinished) {
         type &= FIN_FLAG;
@@ -535,15 +790,211 @@ static int send_data_header(RedsWebSocket *ws, uint64_t len, uint8_t type)
     ws->write_header_len = fill_header(ws->write_header, len, type);
     ws->send_unfinished = (type & FIN_FLAG) == 0;
 
+    return ws->write_header_len;
+}
+
+static int send_data_header(RedsWebSocket *ws, uint64_t len, uint8_t type)
+{
+    prepare_data_header(ws, len, type);
+
     return send_data_header_left(ws);
 }
 
+/* Account @rc bytes written for a new frame of @len bytes including the
+ * header prepared. Return the number of payload bytes written */
+static int frame_written(RedsWebSocket *ws, int rc, uint64_t len)
+{
+    if (rc <= 0) {
+        /* nothing written, the header will be prepared again */
+        ws->write_header_pos = ws->write_header_len = 0;
+        return rc;
+    }
+
+    /* this can happen if we can't write the header */
+    if (SPICE_UNLIKELY(rc < ws->write_header_len)) {
+        ws->write_header_pos = rc;
+        errno = EAGAIN;
+        return -1;
+    }
+    ws->write_header_pos = ws->write_header_len;
+    rc -= ws->write_header_len;
+
+    /* Key point:  if we did not write out all the data, remember how
+       much more data the client is expecting, and write that data without
+       a header of any kind the next time around */
+    ws->write_remainder = len - rc;
+    if (rc == 0 && len > 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    return rc;
+}
+
+static inline bool control_pending(const RedsWebSocket *ws)
+{
+    return ws->close_pending || !control_sent(&ws->pending_pong);
+}
+
+static inline bool deflate_pending(const RedsWebSocket *ws)
+{
+    return ws->deflate.out_pos < ws->deflate.out_len;
+}
+
+/* Compress a message in a frame ready to be sent. Return false if the
+ * message should be sent as is */
+static bool deflate_message(WebSocketDeflate *ctx, const struct iovec *iov, int iovcnt,
+                            uint64_t len, uint8_t type)
+{
+    static const uint8_t tail[] = { 0x00, 0x00, 0xff, 0xff };
+    z_stream *stream = &ctx->deflate;
+    uint8_t header[WEBSOCKET_MAX_HEADER_SIZE];
+    uint64_t compressed_len;
+    size_t needed;
+    int header_len;
+    int i;
+
+    if (!ctx->deflate_ready) {
+        memset(stream, 0, sizeof(*stream));
+        if (deflateInit2(stream, ctx->level, Z_DEFLATED, -ctx->window_bits,
+                         8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            return false;
+        }
+        ctx->deflate_ready = true;
+    }
+
+    /* the bound does not include the sync flush marker */
+    needed = WEBSOCKET_MAX_HEADER_SIZE + deflateBound(stream, len) + 16;
+    if (needed > ctx->out_size) {
+        g_free(ctx->out);
+        ctx->out = g_malloc(needed);
+        ctx->out_size = needed;
+    }
+    stream->next_out = ctx->out + WEBSOCKET_MAX_HEADER_SIZE;
+    stream->avail_out = ctx->out_size - WEBSOCKET_MAX_HEADER_SIZE;
+    for (i = 0; i < iovcnt; i++) {
+        int ret;
+
+        stream->next_in = iov[i].iov_base;
+        stream->avail_in = iov[i].iov_len;
+        ret = deflate(stream, i == iovcnt - 1 ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+        if ((ret != Z_OK && ret != Z_BUF_ERROR) || stream->avail_in != 0) {
+            deflateReset(stream);
+            return false;
+        }
+    }
+    compressed_len = stream->next_out - (ctx->out + WEBSOCKET_MAX_HEADER_SIZE);
+    if (stream->avail_out == 0 || compressed_len < sizeof(tail) ||
+        memcmp(stream->next_out - sizeof(tail), tail, sizeof(tail)) != 0) {
+        deflateReset(stream);
+        return false;
+    }
+    compressed_len -= sizeof(tail);
+    if (ctx->no_context_takeover) {
+        deflateReset(stream);
+    }
+
+    if (compressed_len * 100 > len * (100 - DEFLATE_MIN_SAVING)) {
+        if (++ctx->num_poor >= DEFLATE_MAX_POOR) {
+            ctx->num_poor = 0;
+            ctx->num_skip = ctx->skip_next;
+            ctx->skip_next = MIN(ctx->skip_next * 2, DEFLATE_MAX_SKIP);
+        }
+    } else {
+        ctx->num_poor = 0;
+        ctx->skip_next = DEFLATE_MIN_SKIP;
+    }
+    if (compressed_len >= len) {
+        /* the client will not see this data, it must not be referenced by
+         * the next messages */
+        deflateReset(stream);
+        return false;
+    }
+
+    header_len = fill_header(header, compressed_len, type);
+    header[0] |= RSV1_FLAG;
+    ctx->out_pos = WEBSOCKET_MAX_HEADER_SIZE - header_len;
+    ctx->out_len = WEBSOCKET_MAX_HEADER_SIZE + compressed_len;
+    ctx->out_message_len = len;
+    memcpy(ctx->out + ctx->out_pos, header, header_len);
+    return true;
+}
+
+/* Send the rest of the compressed frame. The caller is told the message
+ * was written only once the whole frame was sent, till then it has to
+ * retry with the same data */
+static int send_deflated_frame(RedsWebSocket *ws)
+{
+    WebSocketDeflate *deflate = &ws->deflate;
+    int rc;
+
+    rc = ws->raw_write(ws->raw_stream, deflate->out + deflate->out_pos,
+                       deflate->out_len - deflate->out_pos);
+    if (rc <= 0) {
+        return rc;
+    }
+    deflate->out_pos += rc;
+    if (deflate_pending(ws)) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return deflate->out_message_len;
+}
+
+/* Compress the message in a frame ready to be sent if possible and worth
+ * it */
+static bool deflate_prepare(RedsWebSocket *ws, const struct iovec *iov, int iovcnt,
+                            uint64_t len, unsigned flags)
+{
+    WebSocketDeflate *deflate = &ws->deflate;
+
+    if (!deflate->enabled || ws->send_unfinished || (flags & FIN_FLAG) == 0) {
+        return false;
+    }
+    if (len < DEFLATE_MIN_SIZE || len > INT_MAX) {
+        return false;
+    }
+    if (deflate->num_skip > 0) {
+        deflate->num_skip--;
+        return false;
+    }
+    return deflate_message(deflate, iov, iovcnt, len, flags);
+}
+
+#define DEFLATE_SKIPPED (-2)
+
+/* Send the data as a compressed message if possible and worth it,
+ * returning DEFLATE_SKIPPED otherwise.
+ * While a frame is partially written the next message is compressed by
+ * websocket_writev() to be sent in the same write */
+static int deflate_writev(RedsWebSocket *ws, const struct iovec *iov, int iovcnt,
+                          unsigned flags)
+{
+    uint64_t len = 0;
+    int i;
+
+    if (ws->write_remainder > 0) {
+        return DEFLATE_SKIPPED;
+    }
+    if (deflate_pending(ws)) {
+        return send_deflated_frame(ws);
+    }
+
+    for (i = 0; i < iovcnt; i++) {
+        len += iov[i].iov_len;
+    }
+    if (!deflate_prepare(ws, iov, iovcnt, len, flags)) {
+        return DEFLATE_SKIPPED;
+    }
+    return send_deflated_frame(ws);
+}
+
 static int send_pending_data(RedsWebSocket *ws)
 {
     int rc;
 
     /* don't send while we are sending a data frame */
-    if (ws->write_remainder) {
+    if (ws->write_remainder || deflate_pending(ws)) {
         return 1;
     }
 
@@ -585,13 +1036,20 @@ static int send_pending_data(RedsWebSocket *ws)
     return 1;
 }
 
-/* Write a WebSocket frame with the enclosed data out. */
+/* Write a WebSocket frame with the enclosed data out.
+ * If a frame was partially written its data is completed first and a new
+ * frame with the rest of the data, compressed if possible, is started in
+ * the same write, unless a control frame is waiting to be sent */
 int websocket_writev(RedsWebSocket *ws, const struct iovec *iov, int iovcnt, unsigned flags)
 {
-    uint64_t len;
+    WebSocketDeflate *deflate = &ws->deflate;
+    struct iovec iov_stack[WRITEV_STACK_IOV];
+    struct iovec *iov_out = iov_stack;
+    int iov_out_cnt = 0;
+    uint64_t len = 0, remainder;
+    bool compressed = false;
+    size_t skip = 0;
     int rc;
-    struct iovec *iov_out;
-    int iov_out_cnt;
     int i;
 
     if (ws->closed) {
@@ -602,53 +1060,85 @@ int websocket_writev(RedsWebSocket *ws, const struct iovec *iov, int iovcnt, uns
     if (rc <= 0) {
         return rc;
     }
-    if (ws->write_remainder > 0) {
-        constrain_iov((struct iovec *) iov, iovcnt, &iov_out, &iov_out_cnt, ws->write_remainder);
-        rc = ws->raw_writev(ws->raw_stream, iov_out, iov_out_cnt);
-        if (iov_out != iov) {
-            g_free(iov_out);
-        }
-        if (rc <= 0) {
-            return rc;
-        }
-        ws->write_remainder -= rc;
+    rc = deflate_writev(ws, iov, iovcnt, flags);
+    if (rc != DEFLATE_SKIPPED) {
         return rc;
     }
 
-    iov_out_cnt = iovcnt + 1;
-    iov_out = g_malloc(iov_out_cnt * sizeof(*iov_out));
-
-    for (i = 0, len = 0; i < iovcnt; i++) {
+    for (i = 0; i < iovcnt; i++) {
         len += iov[i].iov_len;
-        iov_out[i + 1] = iov[i];
+    }
+    /* the current frame is completed first */
+    remainder = MIN(ws->write_remainder, len);
+    ws->write_remainder -= remainder;
+    len -= remainder;
+    if (remainder > 0 && control_pending(ws)) {
+        len = 0;
     }
 
-    ws->write_header_pos = 0;
-    ws->write_header_len = fill_header(ws->write_header, len, flags);
-    iov_out[0].iov_len = ws->write_header_len;
-    iov_out[0].iov_base = ws->write_header;
-    rc = ws->raw_writev(ws->raw_stream, iov_out, iov_out_cnt);
-    g_free(iov_out);
-    if (rc <= 0) {
-        ws->write_header_len = 0;
-        return rc;
+    /* the payload of the current frame, the header of the new one and
+     * its payload, one iovec can be split between the frames */
+    if (iovcnt + 2 > G_N_ELEMENTS(iov_stack)) {
+        iov_out = g_new(struct iovec, iovcnt + 2);
+    }
+    i = 0;
+    for (uint64_t left = remainder; left > 0; ) {
+        size_t chunk = MIN(iov[i].iov_len, left);
+
+        iov_out[iov_out_cnt].iov_base = iov[i].iov_base;
+        iov_out[iov_out_cnt++].iov_len = chunk;
+        left -= chunk;
+        if (chunk == iov[i].iov_len) {
+            i++;
+        } else {
+            skip = chunk;
+        }
     }
+    if (len > 0 || remainder == 0) {
+        struct iovec *payload = &iov_out[iov_out_cnt + 1];
+        int payload_cnt = 0;
 
-    /* this can happen if we can't write the header */
-    if (SPICE_UNLIKELY(rc < ws->write_header_len)) {
-        ws->write_header_pos = ws->write_header_len - rc;
-        errno = EAGAIN;
-        return -1;
+        for (; i < iovcnt; i++, skip = 0) {
+            payload[payload_cnt].iov_base = (uint8_t *) iov[i].iov_base + skip;
+            payload[payload_cnt++].iov_len = iov[i].iov_len - skip;
+        }
+        /* a message compressed after the current frame is kept till
+         * written */
+        if (remainder > 0 &&
+            (deflate_pending(ws) || deflate_prepare(ws, payload, payload_cnt, len, flags))) {
+            iov_out[iov_out_cnt].iov_base = deflate->out + deflate->out_pos;
+            iov_out[iov_out_cnt++].iov_len = deflate->out_len - deflate->out_pos;
+            compressed = true;
+        } else {
+            iov_out[iov_out_cnt].iov_base = ws->write_header;
+            iov_out[iov_out_cnt++].iov_len = prepare_data_header(ws, len, flags);
+            iov_out_cnt += payload_cnt;
+        }
     }
-    ws->write_header_pos = ws->write_header_len;
-    rc -= ws->write_header_len;
 
-    /* Key point:  if we did not write out all the data, remember how
-       much more data the client is expecting, and write that data without
-       a header of any kind the next time around */
-    ws->write_remainder = len - rc;
+    rc = ws->raw_writev(ws->raw_stream, iov_out, iov_out_cnt);
+    if (iov_out != iov_stack) {
+        g_free(iov_out);
+    }
+    if (remainder == 0) {
+        return frame_written(ws, rc, len);
+    }
 
-    return rc;
+    if (rc <= 0 || (uint64_t) rc <= remainder) {
+        if (len > 0 && !compressed) {
+            /* the header of the new frame was not written */
+            ws->write_header_pos = ws->write_header_len = 0;
+        }
+        ws->write_remainder += remainder - MAX(rc, 0);
+        return rc;
+    }
+    if (compressed) {
+        /* the message is written only with the whole compressed frame */
+        deflate->out_pos += rc - remainder;
+        return deflate_pending(ws) ? remainder : remainder + deflate->out_message_len;
+    }
+    rc = frame_written(ws, rc - remainder, len);
+    return remainder + MAX(rc, 0);
 }
 
 int websocket_write(RedsWebSocket *ws, const void *buf, size_t len, unsigned flags)
@@ -664,6 +1154,20 @@ int websocket_write(RedsWebSocket *ws, const void *buf, size_t len, unsigned fla
     if (rc <= 0) {
         return rc;
     }
+    struct iovec iov = { (void *) buf, len };
+    rc = deflate_writev(ws, &iov, 1, flags);
+    if (rc != DEFLATE_SKIPPED) {
+        return rc;
+    }
+    if (ws->write_remainder == 0 && len <= WRITE_COALESCE_SIZE) {
+        uint8_t frame[WEBSOCKET_MAX_HEADER_SIZE + WRITE_COALESCE_SIZE];
+        int header_len = prepare_data_header(ws, len, flags);
+
+        memcpy(frame, ws->write_header, header_len);
+        memcpy(frame + header_len, buf, len);
+        rc = ws->raw_write(ws->raw_stream, frame, header_len + len);
+        return frame_written(ws, rc, len);
+    }
     if (ws->write_remainder == 0) {
         rc = send_data_header(ws, len, flags);
         if (rc <= 0) {
@@ -722,7 +1226,129 @@ static bool websocket_is_start(char *buf, bool *p_has_prototol)
     return true;
 }
 
-static void websocket_create_reply(char *buf, char *outbuf, bool has_protocol)
+/* Parse the value of a permessage-deflate parameter.
+ * Return -1 if invalid, 0 if not present */
+static int deflate_parse_window_bits(const char *value)
+{
+    char *end;
+    long bits;
+
+    if (value == NULL) {
+        return 0;
+    }
+    bits = strtol(value, &end, 10);
+    if (end == value || *end || bits < 8 || bits > DEFLATE_MAX_WINDOW_BITS) {
+        return -1;
+    }
+    return bits;
+}
+
+/* Check a permessage-deflate offer (RFC 7692), filling @deflate and the
+ * response if it can be accepted */
+static bool deflate_accept_offer(WebSocketDeflate *deflate, char *offer, GString *response)
+{
+    gchar **params = g_strsplit(offer, ";", -1);
+    bool server_no_context_takeover = false, client_no_context_takeover = false;
+    bool client_max_window_bits = false;
+    int server_max_window_bits = 0;
+    bool accepted = false;
+    int i;
+
+    if (strcmp(g_strstrip(params[0]), "permessage-deflate") != 0) {
+        goto end;
+    }
+    for (i = 1; params[i]; i++) {
+        gchar *name = g_strstrip(params[i]);
+        gchar *value = strchr(name, '=');
+
+        if (value) {
+            *value++ = 0;
+            g_strchomp(name);
+            value = g_strstrip(value);
+            /* values can be quoted */
+            if (value[0] == '"' && strlen(value) > 1 && g_str_has_suffix(value, "\"")) {
+                value[strlen(value) - 1] = 0;
+                value++;
+            }
+        }
+        if (strcmp(name, "server_no_context_takeover") == 0) {
+            if (server_no_context_takeover || value) {
+                goto end;
+            }
+            server_no_context_takeover = true;
+        } else if (strcmp(name, "client_no_context_takeover") == 0) {
+            if (client_no_context_takeover || value) {
+                goto end;
+            }
+            client_no_context_takeover = true;
+        } else if (strcmp(name, "server_max_window_bits") == 0) {
+            /* zlib does not support raw streams with 8 bits windows */
+            if (server_max_window_bits || (server_max_window_bits =
+                    deflate_parse_window_bits(value)) <= 8) {
+                goto end;
+            }
+        } else if (strcmp(name, "client_max_window_bits") == 0) {
+            if (client_max_window_bits || deflate_parse_window_bits(value) < 0) {
+                goto end;
+            }
+            client_max_window_bits = true;
+        } else {
+            goto end;
+        }
+    }
+
+    /* the client window size is not limited so the maximum is always
+     * accepted for decompression */
+    deflate->enabled = true;
+    deflate->no_context_takeover = server_no_context_takeover;
+    deflate->window_bits = server_max_window_bits ? server_max_window_bits
+                                                  : DEFLATE_MAX_WINDOW_BITS;
+    g_string_append(response, "Sec-WebSocket-Extensions: permessage-deflate");
+    if (server_no_context_takeover) {
+        g_string_append(response, "; server_no_context_takeover");
+    }
+    if (server_max_window_bits) {
+        g_string_append_printf(response, "; server_max_window_bits=%d", server_max_window_bits);
+    }
+    g_string_append(response, "\r\n");
+    accepted = true;
+
+end:
+    g_strfreev(params);
+    return accepted;
+}
+
+/* Negotiate the compression of the messages with the client, return the
+ * header lines to add to the reply. @level 0 disables the compression */
+static char *websocket_negotiate_deflate(WebSocketDeflate *deflate, const char *buf, int level)
+{
+    GString *response = g_string_new(NULL);
+    const char *extensions = buf;
+
+    if (level <= 0) {
+        return g_string_free(response, FALSE);
+    }
+    deflate->level = MIN(level, 9);
+    deflate->skip_next = DEFLATE_MIN_SKIP;
+
+    /* offers can be split in several header lines */
+    while (!deflate->enabled &&
+           (extensions = find_str(extensions, "\nSec-WebSocket-Extensions:")) != NULL) {
+        gchar *line = g_strndup(extensions, strcspn(extensions, "\r\n"));
+        gchar **offers = g_strsplit(line, ",", -1);
+        int i;
+
+        for (i = 0; offers[i] && !deflate_accept_offer(deflate, offers[i], response); i++) {
+            continue;
+        }
+        g_strfreev(offers);
+        g_free(line);
+    }
+    return g_string_free(response, FALSE);
+}
+
+static void websocket_create_reply(char *buf, char *outbuf, bool has_protocol,
+                                   const char *extensions)
 {
     char *key;
 
@@ -730,13 +1356,15 @@ static void websocket_create_reply(char *buf, char *outbuf, bool has_protocol)
     sprintf(outbuf, "HTTP/1.1 101 Switching Protocols\r\n"
                     "Upgrade: WebSocket\r\n"
                     "Connection: Upgrade\r\n"
-                    "Sec-WebSocket-Accept: %s\r\n%s\r\n", key,
-                    has_protocol ? "Sec-WebSocket-Protocol: binary\r\n": "");
+                    "Sec-WebSocket-Accept: %s\r\n%s%s\r\n", key,
+                    has_protocol ? "Sec-WebSocket-Protocol: binary\r\n": "",
+                    extensions);
     g_free(key);
 }
 
-RedsWebSocket *websocket_new(const void *buf, size_t len, void *stream, websocket_read_cb_t read_cb,
-                             websocket_write_cb_t write_cb, websocket_writev_cb_t writev_cb)
+RedsWebSocket *websocket_new(const void *buf, size_t len, void *stream, int compression,
+                             websocket_read_cb_t read_cb, websocket_write_cb_t write_cb,
+                             websocket_writev_cb_t writev_cb)
 {
     char rbuf[4096];
 
@@ -770,8 +1398,11 @@ RedsWebSocket *websocket_new(const void *buf, size_t len, void *stream, websocke
     }
 
     char outbuf[1024];
+    WebSocketDeflate deflate = { 0 };
+    char *extensions = websocket_negotiate_deflate(&deflate, rbuf, compression);
 
-    websocket_create_reply(rbuf, outbuf, has_protocol);
+    websocket_create_reply(rbuf, outbuf, has_protocol, extensions);
+    g_free(extensions);
     rc = write_cb(stream, outbuf, strlen(outbuf));
     if (rc != strlen(outbuf)) {
         return NULL;
@@ -779,6 +1410,7 @@ RedsWebSocket *websocket_new(const void *buf, size_t len, void *stream, websocke
 
     RedsWebSocket *ws = g_new0(RedsWebSocket, 1);
 
+    ws->deflate = deflate;
     ws->raw_stream = stream;
     ws->raw_read = read_cb;
     ws->raw_write = write_cb;
@@ -792,5 +1424,12 @@ RedsWebSocket *websocket_new(const void *buf, size_t len, void *stream, websocke
 
 void websocket_free(RedsWebSocket *ws)
 {
+    if (ws->deflate.deflate_ready) {
+        deflateEnd(&ws->deflate.deflate);
+    }
+    if (ws->deflate.inflate_ready) {
+        inflateEnd(&ws->deflate.inflate);
+    }
+    g_free(ws->deflate.out);
     g_free(ws);
 }
@@ -36,8 +36,19 @@ enum {
     WEBSOCKET_BINARY_FINAL = WEBSOCKET_BINARY | WEBSOCKET_FINAL,
 };
 
-RedsWebSocket *websocket_new(const void *buf, size_t len, void *stream, websocket_read_cb_t read_cb,
-                             websocket_write_cb_t write_cb, websocket_writev_cb_t writev_cb);
+/* Default compression level of the messages sent, when the client supports
+ * the permessage-deflate extension */
+#define WEBSOCKET_DEFAULT_COMPRESSION 1
+
+/**
+ * Handle the WebSocket handshake of @stream, @buf being the start of the
+ * request already read.
+ * @compression is the zlib level of the messages sent, 0 disables the
+ * permessage-deflate extension.
+ */
+RedsWebSocket *websocket_new(const void *buf, size_t len, void *stream, int compression,
+                             websocket_read_cb_t read_cb, websocket_write_cb_t write_cb,
+                             websocket_writev_cb_t writev_cb);
 void websocket_free(RedsWebSocket *ws);
 
 /**